@@ -0,0 +1,39 @@
+#include <string.h>
+
+#include "dt_type.h"
+#include "binary_file.h"
+
+
+
+/* Fill in the tag for a file written by this build */
+void __dt_InitBinaryFileTag(
+    __dt_BinaryFileTag *tag, const char *magic, uint32_t version,
+    uint32_t flags)
+{
+    memcpy(tag->magic, magic, sizeof(tag->magic));
+    tag->version      = version;
+    tag->byte_order   = __DT_BYTE_ORDER_MARK;
+    tag->flags        = flags;
+    tag->sizeof_real  = (uint16_t)sizeof(dt_real_type);
+    tag->sizeof_index = (uint16_t)sizeof(dt_index_type);
+}
+
+/* Check a tag read from a file against the format and this build */
+int __dt_CheckBinaryFileTag(
+    const __dt_BinaryFileTag *tag, const char *magic, uint32_t version)
+{
+    return
+        memcmp(tag->magic, magic, sizeof(tag->magic)) == 0 &&
+        tag->version      == version                &&
+        tag->byte_order   == __DT_BYTE_ORDER_MARK   &&
+        tag->sizeof_real  == sizeof(dt_real_type)   &&
+        tag->sizeof_index == sizeof(dt_index_type);
+}
+
+
+/* Tell if the file name ends with the extension ext */
+int __dt_HasFileExtension(const char *filename, const char *ext)
+{
+    const char *dot = strrchr(filename, '.');
+    return (dot != NULL && strcmp(dot, ext) == 0);
+}
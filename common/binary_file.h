@@ -0,0 +1,44 @@
+#ifndef __DT_BINARY_FILE_HEADER__
+#define __DT_BINARY_FILE_HEADER__
+
+
+#include <stdint.h>
+
+
+/* Every binary file of ours (.dtm models, .dts pose sequences and .tricorrs
+   triangle correspondences) starts its header with this tag, which tells
+   what the file is and whether its arrays could be used as they are by this
+   build: the byte order mark and the type sizes have to match those of the
+   reader, as arrays are never converted.
+*/
+typedef struct __dt_BinaryFileTag_struct
+{
+    char     magic[4];        /* "DTM\x1a", "DTS\x1a", ... */
+    uint32_t version;         /* version of the file format */
+    uint32_t byte_order;      /* __DT_BYTE_ORDER_MARK in writer byte order */
+    uint32_t flags;           /* defined by each file format */
+
+    uint16_t sizeof_real;     /* sizeof(dt_real_type) of the writer */
+    uint16_t sizeof_index;    /* sizeof(dt_index_type) of the writer */
+
+} __dt_BinaryFileTag;
+
+#define __DT_BYTE_ORDER_MARK  0x01020304u
+
+
+/* Fill in the tag for a file written by this build */
+void __dt_InitBinaryFileTag(
+    __dt_BinaryFileTag *tag, const char *magic, uint32_t version,
+    uint32_t flags);
+
+/* Check a tag read from a file against the magic and version of the format
+   and this build, it returns 1 if the file could be read, 0 otherwise. */
+int __dt_CheckBinaryFileTag(
+    const __dt_BinaryFileTag *tag, const char *magic, uint32_t version);
+
+/* Tell if the file name ends with the extension ext (".dtm" for example) */
+int __dt_HasFileExtension(const char *filename, const char *ext);
+
+
+
+#endif /* __DT_BINARY_FILE_HEADER__ */
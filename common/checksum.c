@@ -0,0 +1,119 @@
+#include <string.h>
+
+#include "checksum.h"
+#include "file_map.h"
+
+
+
+/* Primes of XXH64 */
+#define __P1 11400714785074694791ULL
+#define __P2 14029467366897019727ULL
+#define __P3  1609587929392839161ULL
+#define __P4  9650029242287828579ULL
+#define __P5  2870177450012600261ULL
+
+
+static __dt_Hash64 __rotl(__dt_Hash64 x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+/* unaligned loads, memcpy compiles to a single mov on every sane target */
+static __dt_Hash64 __read64(const unsigned char *p) {
+    __dt_Hash64 v;  memcpy(&v, p, sizeof(v));  return v;
+}
+
+static __dt_Hash64 __read32(const unsigned char *p) {
+    unsigned int v;  memcpy(&v, p, sizeof(v));  return v;
+}
+
+static __dt_Hash64 __round(__dt_Hash64 acc, __dt_Hash64 input)
+{
+    acc += input * __P2;
+    acc  = __rotl(acc, 31);
+    return acc * __P1;
+}
+
+static __dt_Hash64 __merge_round(__dt_Hash64 acc, __dt_Hash64 val)
+{
+    acc ^= __round(0, val);
+    return acc * __P1 + __P4;
+}
+
+
+/* Calculate a 64-bit hash value of specified block of memory with the XXH64
+   algorithm, 4 independent accumulators consume 32 bytes per iteration so the
+   multiplications are pipelined nicely, the tail is folded in afterwards. */
+__dt_Hash64 __dt_Checksum64(const void *data, size_t size, __dt_Hash64 seed)
+{
+    const unsigned char *p = (const unsigned char*)data, *end = p + size;
+    __dt_Hash64 h, v1, v2, v3, v4;
+
+    if (size >= 32)
+    {
+        v1 = seed + __P1 + __P2;  v2 = seed + __P2;
+        v3 = seed;                v4 = seed - __P1;
+
+        for ( ; end - p >= 32; p += 32)
+        {
+            v1 = __round(v1, __read64(p));
+            v2 = __round(v2, __read64(p + 8));
+            v3 = __round(v3, __read64(p + 16));
+            v4 = __round(v4, __read64(p + 24));
+        }
+
+        h = __rotl(v1, 1) + __rotl(v2, 7) + __rotl(v3, 12) + __rotl(v4, 18);
+        h = __merge_round(h, v1);  h = __merge_round(h, v2);
+        h = __merge_round(h, v3);  h = __merge_round(h, v4);
+    }
+    else {
+        h = seed + __P5;
+    }
+
+    h += (__dt_Hash64)size;
+
+    for ( ; end - p >= 8; p += 8) {
+        h ^= __round(0, __read64(p));
+        h  = __rotl(h, 27) * __P1 + __P4;
+    }
+    if (end - p >= 4) {
+        h ^= __read32(p) * __P1;
+        h  = __rotl(h, 23) * __P2 + __P3;
+        p += 4;
+    }
+    for ( ; p < end; p++) {
+        h ^= (*p) * __P5;
+        h  = __rotl(h, 11) * __P1;
+    }
+
+    /* avalanche */
+    h ^= h >> 33;  h *= __P2;
+    h ^= h >> 29;  h *= __P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+
+/* Calculate the hash value of the content of specified file. It returns 0 on
+   success, or -1 to indicate an open()/mmap() error. */
+int __dt_ChecksumFile(
+    const char *filename, __dt_Hash64 seed, __dt_Hash64 *hash)
+{
+    __dt_FileMapping map;
+
+    if (__dt_MapFile(filename, &map) != 0) {
+        return -1;
+    }
+
+    *hash = __dt_Checksum64(map.base, map.size, seed);
+    __dt_UnmapFile(&map);
+
+    return 0;
+}
+
+
+#undef __P1
+#undef __P2
+#undef __P3
+#undef __P4
+#undef __P5
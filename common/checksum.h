@@ -0,0 +1,30 @@
+#ifndef __DT_CHECKSUM_HEADER__
+#define __DT_CHECKSUM_HEADER__
+
+
+#include <stddef.h>
+
+
+typedef unsigned long long __dt_Hash64;
+
+
+/* Calculate a 64-bit hash value of specified block of memory with the XXH64
+   algorithm. Hash values of several blocks can be chained together by passing
+   the hash value of the previous block as the seed of the next one, start
+   the chain with a seed of 0.
+
+   Words are read in native byte order, hash values are meant to be compared
+   on the machine they were calculated on or against files carrying the same
+   byte order mark.
+*/
+__dt_Hash64 __dt_Checksum64(const void *data, size_t size, __dt_Hash64 seed);
+
+/* Calculate the hash value of the content of specified file, seed works in
+   the same way as in __dt_Checksum64. It returns 0 on success, or -1 to
+   indicate an open()/mmap() error. */
+int __dt_ChecksumFile(
+    const char *filename, __dt_Hash64 seed, __dt_Hash64 *hash);
+
+
+
+#endif /* __DT_CHECKSUM_HEADER__ */
@@ -1,10 +1,14 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "cholmod_wrapper.h"
+#include "checksum.h"
+#include "pcg.h"
 #include "umfpack.h"
 
 
-static cholmod_common __dt_common, *cm = NULL;
+/* every thread has a workspace of its own, see __dt_CHOLMOD_start */
+static __thread cholmod_common __dt_common, *cm = NULL;
 
 
 /* Halt if an error occurs */
@@ -52,6 +56,16 @@ cholmod_triplet* __dt_CHOLMOD_allocate_triplet(
             cm);
 }
 
+/* A wrapper for cholmod_allocate_sparse, creating a packed real sparse matrix
+   with sorted columns */
+cholmod_sparse* __dt_CHOLMOD_allocate_sparse(
+    size_t nrow, size_t ncol, size_t nzmax, int stype)
+{
+    return cholmod_allocate_sparse(
+        nrow, ncol, nzmax, 1 /* sorted */, 1 /* packed */, stype,
+        CHOLMOD_REAL, cm);
+}
+
 /* Append triplet entry (i,j,x) to specified cholmod_triplet matrix object */
 int __dt_CHOLMOD_entry(cholmod_triplet *T, int i, int j, double x)
 {
@@ -111,6 +125,17 @@ cholmod_dense* __dt_CHOLMOD_dense_zeros(size_t nrow, size_t ncol)
     return cholmod_zeros(nrow, ncol, CHOLMOD_REAL, cm);
 }
 
+/* Fill view with a header referring to columns j..j+n-1 of dense matrix X */
+void __dt_CHOLMOD_dense_columns(
+    cholmod_dense *X, size_t j, size_t n, cholmod_dense *view)
+{
+    *view = *X;
+    view->ncol  = n;
+    view->nzmax = X->d * n;
+    view->x     = (X->dtype == 0)?
+        (void*)((double*)X->x + j * X->d): (void*)((float*)X->x + j * X->d);
+}
+
 /* A wrapper for cholmod_free_sparse, it free the memory of specified sparse 
    matrix object */
 int __dt_CHOLMOD_free_sparse(cholmod_sparse **A)
@@ -147,13 +172,17 @@ cholmod_sparse *__dt_CHOLMOD_AxAt(cholmod_sparse *A)
 /* calculate A*At and return a symmetric matrix storing only upper elements */
 cholmod_sparse *__dt_CHOLMOD_AxAt_symm(cholmod_sparse *A)
 {
-    cholmod_sparse *AAt = cholmod_aat(A, NULL, 0, 1, cm);
-    AAt->stype = 1;         /* symmetric */
-    cholmod_sort(AAt, cm);
-    return AAt;
+    cholmod_sparse *AAt = cholmod_aat(A, NULL, 0, 1, cm), *U;
+
+    /* keep the upper triangular part, marked as symmetric */
+    U = cholmod_copy(AAt, 1, 1, cm);
+    cholmod_free_sparse(&AAt, cm);
+    cholmod_sort(U, cm);
+    return U;
 }
 
-/* calculate b = A*c, where A is sparse and c is dense */
+/* calculate b = A*c, where A is sparse and c is dense, c and b could have
+   several columns */
 void __dt_CHOLMOD_Axc(cholmod_sparse *A, cholmod_dense *c, cholmod_dense *b)
 {
     double alpha[2] = {1,0};
@@ -162,40 +191,183 @@ void __dt_CHOLMOD_Axc(cholmod_sparse *A, cholmod_dense *c, cholmod_dense *b)
     cholmod_sdmult(A, 0, alpha, beta, c, b, cm); /* b = A*c */
 }
 
-/* Solve least square problem: min||c - A*x||^2 */
+/* Analyze symmetric matrix A (upper part stored) for a supernodal Cholesky
+   factorization, with the fill-reducing ordering of CHOLMOD's choice or the
+   given permutation if perm is not NULL. */
+cholmod_factor* __dt_CHOLMOD_analyze(cholmod_sparse *A, int *perm)
+{
+    cholmod_factor *L;
+
+    /* parameters changed here are restored before we leave */
+    int supernodal = cm->supernodal, nmethods = cm->nmethods;
+    int postorder  = cm->postorder,  ordering = cm->method[0].ordering;
+
+    cm->supernodal = CHOLMOD_SUPERNODAL;
+    if (perm != NULL)
+    {
+        /* the permutation of a previous analysis is final, it has been
+           postordered already */
+        cm->nmethods = 1;
+        cm->method[0].ordering = CHOLMOD_GIVEN;
+        cm->postorder = 0;
+    }
+
+    L = cholmod_analyze_p(A, perm, NULL, 0, cm);
+
+    cm->supernodal = supernodal;  cm->nmethods = nmethods;
+    cm->postorder  = postorder;   cm->method[0].ordering = ordering;
+
+    return L;
+}
+
+/* Numerical factorization of A, L is the result of __dt_CHOLMOD_analyze */
+int __dt_CHOLMOD_factorize(cholmod_sparse *A, cholmod_factor *L)
+{
+    return cholmod_factorize(A, L, cm);
+}
+
+/* Solve A*x = b with the factorization of A, x is a newly created dense
+   matrix */
+cholmod_dense* __dt_CHOLMOD_solve(cholmod_factor *L, cholmod_dense *b)
+{
+    return cholmod_solve(CHOLMOD_A, L, b, cm);
+}
+
+/* Free factor object */
+int __dt_CHOLMOD_free_factor(cholmod_factor **L)
+{
+    return cholmod_free_factor(L, cm);
+}
+
+/* Solve A*x = b for a single column with the factorization L */
+void __dt_CHOLMOD_solve_column(cholmod_factor *L, const double *b, double *x)
+{
+    cholmod_dense b_col, *x_col;
+
+    /* a header around b, cholmod_solve won't write to it */
+    b_col.nrow  = b_col.d = b_col.nzmax = L->n;
+    b_col.ncol  = 1;
+    b_col.x     = (void*)b;
+    b_col.z     = NULL;
+    b_col.xtype = CHOLMOD_REAL;
+    b_col.dtype = CHOLMOD_DOUBLE;
+
+    x_col = cholmod_solve(CHOLMOD_A, L, &b_col, cm);
+    memcpy(x, x_col->x, L->n * sizeof(double));
+    cholmod_free_dense(&x_col, cm);
+}
+
+
+/* Symbolic analysis of A for __dt_UMFPACK_factorize */
+void __dt_UMFPACK_analyze(cholmod_sparse *A, __dt_UMFPACK_factor *F)
+{
+    umfpack_di_symbolic(
+        (int)A->nrow, (int)A->ncol, 
+        (const int*)A->p, (const int*)A->i, (const double*)A->x, 
+        &(F->symbolic_obj), NULL, NULL);
+
+    F->numeric_obj = NULL;
+}
+
+/* Numerical factorization of A, replacing the one F had */
+int __dt_UMFPACK_factorize(cholmod_sparse *A, __dt_UMFPACK_factor *F)
+{
+    if (F->numeric_obj != NULL) {
+        umfpack_di_free_numeric(&(F->numeric_obj));
+    }
+
+    return umfpack_di_numeric(
+        (const int*)A->p, (const int*)A->i, (const double*)A->x, 
+        F->symbolic_obj, &(F->numeric_obj), NULL, NULL);
+}
+
+/* Solve A*x = b with the factorization of A, one column of b at a time */
+cholmod_dense* __dt_UMFPACK_solve(
+    cholmod_sparse *A, __dt_UMFPACK_factor *F, cholmod_dense *b)
+{
+    cholmod_dense *x = cholmod_allocate_dense(
+        A->ncol, b->ncol, A->ncol, CHOLMOD_REAL, cm);
+    size_t j;
+
+    /* solve problem with back-substitution, column by column */
+    for (j = 0; j < b->ncol; j++)
+    {
+        umfpack_di_solve(UMFPACK_A, 
+            (const int*)A->p, (const int*)A->i, (const double*)A->x, 
+            (double*)x->x + j * x->d, (const double*)b->x + j * b->d, 
+            F->numeric_obj, NULL, NULL);
+    }
+
+    return x;
+}
+
+/* Solve for a single column without iterative refinement */
+void __dt_UMFPACK_solve_column(
+    __dt_UMFPACK_factor *F, const double *b, double *x)
+{
+    double control[UMFPACK_CONTROL];
+
+    umfpack_di_defaults(control);
+    control[UMFPACK_IRSTEP] = 0;   /* A is not referenced then */
+
+    umfpack_di_solve(UMFPACK_A, NULL, NULL, NULL, x, b,
+        F->numeric_obj, control, NULL);
+}
+
+/* Free the symbolic and numeric objects of F */
+void __dt_UMFPACK_free_factor(__dt_UMFPACK_factor *F)
+{
+    if (F->numeric_obj != NULL) umfpack_di_free_numeric(&(F->numeric_obj));
+    umfpack_di_free_symbolic(&(F->symbolic_obj));
+}
+
+
+/* Solve normal equation AtA*x = b with UMFPACK, AtA is stored in full */
+cholmod_dense* __dt_UMFPACK_normal_solve(cholmod_sparse *AtA, cholmod_dense *b)
+{
+    __dt_UMFPACK_factor F;
+    cholmod_dense *x;
+
+    /* preordering and factorization */
+    __dt_UMFPACK_analyze(AtA, &F);
+    __dt_UMFPACK_factorize(AtA, &F);
+
+    x = __dt_UMFPACK_solve(AtA, &F, b);
+
+    __dt_UMFPACK_free_factor(&F);
+    return x;
+}
+
+/* Solve normal equation AtA*x = b with CHOLMOD, AtA is symmetric with its
+   upper part stored */
+cholmod_dense* __dt_CHOLMOD_normal_solve(cholmod_sparse *AtA, cholmod_dense *b)
+{
+    cholmod_factor *L;
+    cholmod_dense  *x;
+
+    L = cholmod_analyze(AtA, cm);
+    cholmod_factorize(AtA, L, cm);
+    x = cholmod_solve(CHOLMOD_A, L, b, cm);  /* we got the solution here */
+
+    cholmod_free_factor(&L, cm);
+    return x;
+}
+
+
+/* Solve least square problem: min||c - A*x||^2, one column of c at a time */
 cholmod_dense* __dt_UMFPACK_least_square(cholmod_sparse *A, cholmod_dense *c)
 {
-    void *symbolic_obj, *numeric_obj;
     cholmod_sparse *A_trans, *AtA;
-    cholmod_dense  *x, *b = __dt_CHOLMOD_dense_zeros(A->ncol, 1);
+    cholmod_dense  *x, *b = __dt_CHOLMOD_dense_zeros(A->ncol, c->ncol);
 
     A_trans = __dt_CHOLMOD_transpose(A);       /* A_trans = A' */
     __dt_CHOLMOD_Axc(A_trans, c, b);           /* b = A'*c */
     AtA = __dt_CHOLMOD_AxAt(A_trans);          /* AtA = A'*A */
-
     __dt_CHOLMOD_free_sparse(&A_trans);
 
-    /* preordering and factorization */
-    umfpack_di_symbolic(
-        (int)AtA->nrow, (int)AtA->ncol, 
-        (const int*)AtA->p, (const int*)AtA->i, (const double*)AtA->x, 
-        &symbolic_obj, NULL, NULL);
-
-    umfpack_di_numeric(
-        (const int*)AtA->p, (const int*)AtA->i, (const double*)AtA->x, 
-        symbolic_obj, &numeric_obj, NULL, NULL);
-
-    umfpack_di_free_symbolic(&symbolic_obj);
-    x = cholmod_allocate_dense(AtA->ncol, 1, AtA->ncol, CHOLMOD_REAL, cm);
-
-    /* solve problem with back-substitution */
-    umfpack_di_solve(UMFPACK_A, 
-        (const int*)AtA->p, (const int*)AtA->i, (const double*)AtA->x, 
-        (double*)x->x, (const double*)b->x, 
-        numeric_obj, NULL, NULL);
+    x = __dt_UMFPACK_normal_solve(AtA, b);
 
     /* free intermediates */
-    umfpack_di_free_numeric(&numeric_obj);
     __dt_CHOLMOD_free_sparse(&AtA);
     __dt_CHOLMOD_free_dense(&b);
 
@@ -205,9 +377,8 @@ cholmod_dense* __dt_UMFPACK_least_square(cholmod_sparse *A, cholmod_dense *c)
 /* Solve least square problem using CHOLMOD */
 cholmod_dense* __dt_CHOLMOD_least_square(cholmod_sparse *A, cholmod_dense *c)
 {
-    cholmod_factor *L;
     cholmod_sparse *A_trans, *AtA;
-    cholmod_dense  *x, *b = __dt_CHOLMOD_dense_zeros(A->ncol, 1);
+    cholmod_dense  *x, *b = __dt_CHOLMOD_dense_zeros(A->ncol, c->ncol);
 
     A_trans = __dt_CHOLMOD_transpose(A);            /* A_trans = A' */
     __dt_CHOLMOD_Axc(A_trans, c, b);                /* b = A'*c */
@@ -215,12 +386,9 @@ cholmod_dense* __dt_CHOLMOD_least_square(cholmod_sparse *A, cholmod_dense *c)
     __dt_CHOLMOD_free_sparse(&A_trans);
 
     /* solve AtA * x = b, AKA A'*A*x = A'*c */
-    L = cholmod_analyze(AtA, cm);
-    cholmod_factorize(AtA, L, cm);
-    x = cholmod_solve(CHOLMOD_A, L, b, cm);  /* we got the solution here */
+    x = __dt_CHOLMOD_normal_solve(AtA, b);
 
     /* free intermediates */
-    cholmod_free_factor(&L, cm);
     __dt_CHOLMOD_free_sparse(&AtA);
     __dt_CHOLMOD_free_dense(&b);
 
@@ -228,6 +396,47 @@ cholmod_dense* __dt_CHOLMOD_least_square(cholmod_sparse *A, cholmod_dense *c)
 }
 
 
+/* Solve normal equation AtA*x = b with preconditioned conjugate gradient,
+   starting from x */
+int __dt_PCG_normal_solve(
+    cholmod_sparse *AtA, cholmod_dense *b, cholmod_dense *x,
+    int precond, double tol, int max_iter)
+{
+    __dt_Preconditioner M;
+    int n_iter;
+
+    __dt_CreatePreconditioner(AtA, precond, &M);
+    n_iter = __dt_PCG_solve_dense(
+        AtA, b, x, __dt_ApplyPreconditioner, &M, tol, max_iter);
+
+    __dt_DestroyPreconditioner(&M);
+    return n_iter;
+}
+
+/* Solve least square problem with preconditioned conjugate gradient */
+int __dt_PCG_least_square(
+    cholmod_sparse *A, cholmod_dense *c, cholmod_dense *x,
+    int precond, double tol, int max_iter)
+{
+    cholmod_sparse *A_trans, *AtA;
+    cholmod_dense  *b = __dt_CHOLMOD_dense_zeros(A->ncol, c->ncol);
+    int n_iter;
+
+    A_trans = __dt_CHOLMOD_transpose(A);            /* A_trans = A' */
+    __dt_CHOLMOD_Axc(A_trans, c, b);                /* b = A'*c */
+    AtA = __dt_CHOLMOD_AxAt_symm(A_trans);          /* AtA = A'*A */
+    __dt_CHOLMOD_free_sparse(&A_trans);
+
+    n_iter = __dt_PCG_normal_solve(AtA, b, x, precond, tol, max_iter);
+
+    /* free intermediates */
+    __dt_CHOLMOD_free_sparse(&AtA);
+    __dt_CHOLMOD_free_dense(&b);
+
+    return n_iter;
+}
+
+
 /* Read a sparse matrix from file in MatrixMarket format. */
 cholmod_sparse* __dt_CHOLMOD_read_sparse(const char *filename)
 {
@@ -248,6 +457,80 @@ cholmod_dense* __dt_CHOLMOD_read_dense(const char *filename)
     return dmat;
 }
 
+/* Header of a binary sparse matrix, followed by p[ncol+1], i[nnz], x[nnz]
+   and the checksum of these arrays */
+typedef struct __dt_binary_sparse_header_struct
+{
+    int nrow, ncol, nnz;
+    int stype, sorted;
+
+} __dt_binary_sparse_header;
+
+/* checksum of the arrays of a sparse matrix */
+static __dt_Hash64 __sparse_checksum(cholmod_sparse *A, size_t nnz)
+{
+    __dt_Hash64 h = __dt_Checksum64(A->p, (A->ncol + 1) * sizeof(int), 0);
+    h = __dt_Checksum64(A->i, nnz * sizeof(int), h);
+    return __dt_Checksum64(A->x, nnz * sizeof(double), h);
+}
+
+/* Write a sparse matrix to a binary stream. It returns 0 on success or -1 to
+   indicate fwrite() failed. */
+int __dt_CHOLMOD_write_sparse_binary(FILE *fp, cholmod_sparse *A)
+{
+    __dt_binary_sparse_header header;
+    __dt_Hash64 checksum;
+    size_t nnz = (size_t)((int*)A->p)[A->ncol];
+
+    header.nrow   = (int)A->nrow;
+    header.ncol   = (int)A->ncol;
+    header.nnz    = (int)nnz;
+    header.stype  = A->stype;
+    header.sorted = A->sorted;
+
+    checksum = __sparse_checksum(A, nnz);
+
+    return (
+        fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(A->p, sizeof(int), A->ncol + 1, fp) == A->ncol + 1 &&
+        fwrite(A->i, sizeof(int), nnz, fp) == nnz &&
+        fwrite(A->x, sizeof(double), nnz, fp) == nnz &&
+        fwrite(&checksum, sizeof(checksum), 1, fp) == 1)? 0: -1;
+}
+
+/* Read a sparse matrix written by __dt_CHOLMOD_write_sparse_binary, it
+   returns NULL if the stream is truncated or fails the checksum. */
+cholmod_sparse* __dt_CHOLMOD_read_sparse_binary(FILE *fp)
+{
+    __dt_binary_sparse_header header;
+    __dt_Hash64 checksum;
+    cholmod_sparse *A;
+    size_t nnz;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.nrow < 0 || header.ncol < 0 || header.nnz < 0) {
+        return NULL;
+    }
+
+    nnz = (size_t)header.nnz;
+    A = cholmod_allocate_sparse(
+        (size_t)header.nrow, (size_t)header.ncol, nnz,
+        header.sorted, 1 /* packed */, header.stype, CHOLMOD_REAL, cm);
+
+    if (fread(A->p, sizeof(int), A->ncol + 1, fp) != A->ncol + 1 ||
+        fread(A->i, sizeof(int), nnz, fp) != nnz ||
+        fread(A->x, sizeof(double), nnz, fp) != nnz ||
+        fread(&checksum, sizeof(checksum), 1, fp) != 1 ||
+        checksum != __sparse_checksum(A, nnz))
+    {
+        cholmod_free_sparse(&A, cm);
+        return NULL;
+    }
+
+    return A;
+}
+
+
 /* Dumpa sparse matrix to stdout in MatrixMarket triplet form */
 void __dt_CHOLMOD_dump_sparse(cholmod_sparse *mat)
 {
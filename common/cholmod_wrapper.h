@@ -2,6 +2,7 @@
 #define __DT_CHOLMOD_WRAPPER_HEADER__
 
 
+#include <stdio.h>
 #include "cholmod.h"
 
 
@@ -29,7 +30,19 @@
         (((float*)((vec)->x))[i] = (float)(val)))
 
 
-/* Start CHOLMOD and set working parameters */
+/* Element (i,j) of a dense matrix, which is stored in column-major order with
+   leading dimension mat->d */
+#define __dt_CHOLMOD_REFMAT(mat,i,j)                            \
+    __dt_CHOLMOD_REFVEC(mat, (i) + (j)*(mat)->d)
+
+#define __dt_CHOLMOD_MODIFYMAT(mat,i,j, val)                    \
+    __dt_CHOLMOD_MODIFYVEC(mat, (i) + (j)*(mat)->d, val)
+
+
+/* Start CHOLMOD and set working parameters. The CHOLMOD workspace used by
+   these wrappers is thread-local, every thread calling them should start
+   (and finish) CHOLMOD for itself. Matrices and factors could be shared by
+   threads as long as they are only read. */
 void __dt_CHOLMOD_start(void);
 
 /* Terminate CHOLMOD */
@@ -42,6 +55,13 @@ cholmod_triplet* __dt_CHOLMOD_allocate_triplet(
     size_t nrow, size_t ncol, size_t nzmax);
 
 
+/* A wrapper for cholmod_allocate_sparse, creating a packed real sparse matrix
+   with sorted columns, stype tells if it's symmetric with only the upper (1)
+   part stored or unsymmetric (0). Column pointers and row indices are left
+   for the caller to fill in. */
+cholmod_sparse* __dt_CHOLMOD_allocate_sparse(
+    size_t nrow, size_t ncol, size_t nzmax, int stype);
+
 /* Append triplet entry (i,j,x) to specified cholmod_triplet matrix object */
 int __dt_CHOLMOD_entry(cholmod_triplet *T, int i, int j, double x);
 
@@ -58,6 +78,12 @@ cholmod_dense*  __dt_CHOLMOD_sparse_to_dense(cholmod_sparse *A_sparse);
    it with zero. */
 cholmod_dense* __dt_CHOLMOD_dense_zeros(size_t nrow, size_t ncol);
 
+/* Fill view with a header referring to columns j..j+n-1 of dense matrix X,
+   nothing is copied, the view must not be freed and is only valid as long
+   as X is */
+void __dt_CHOLMOD_dense_columns(
+    cholmod_dense *X, size_t j, size_t n, cholmod_dense *view);
+
 /* A wrapper for cholmod_free_sparse, it free the memory of specified sparse 
    matrix object */
 int __dt_CHOLMOD_free_sparse(cholmod_sparse **A);
@@ -75,21 +101,117 @@ cholmod_sparse *__dt_CHOLMOD_transpose(cholmod_sparse *A);
 /* calculate A * At */
 cholmod_sparse *__dt_CHOLMOD_AxAt(cholmod_sparse *A);
 
-/* calculate b = A*c, where A is sparse and c is dense */
+/* calculate A * At and return a symmetric matrix storing only upper elements,
+   which is what CHOLMOD's Cholesky factorization wants */
+cholmod_sparse *__dt_CHOLMOD_AxAt_symm(cholmod_sparse *A);
+
+/* calculate b = A*c, where A is sparse and c is dense, c and b could have
+   several columns */
 void __dt_CHOLMOD_Axc(cholmod_sparse *A, cholmod_dense *c, cholmod_dense *b);
 
 
-/* Solve least square problem: min||c - A*x||^2 */
+/* Analyze symmetric matrix A (upper part stored) for a supernodal Cholesky
+   factorization, with the fill-reducing ordering of CHOLMOD's choice or the
+   given permutation if perm is not NULL. Passing the permutation (L->Perm)
+   of an earlier analysis of the same matrix skips the ordering phase. */
+cholmod_factor* __dt_CHOLMOD_analyze(cholmod_sparse *A, int *perm);
+
+/* Numerical factorization of A, L is the result of __dt_CHOLMOD_analyze, the
+   symbolic analysis could be reused for matrices of the same pattern */
+int __dt_CHOLMOD_factorize(cholmod_sparse *A, cholmod_factor *L);
+
+/* Solve A*x = b with the factorization of A, x is a newly created dense
+   matrix */
+cholmod_dense* __dt_CHOLMOD_solve(cholmod_factor *L, cholmod_dense *b);
+
+/* Free factor object */
+int __dt_CHOLMOD_free_factor(cholmod_factor **L);
+
+/* Solve A*x = b for a single column with the factorization L, b and x are
+   arrays of L->n. It's handy to apply a factor as a preconditioner. */
+void __dt_CHOLMOD_solve_column(cholmod_factor *L, const double *b, double *x);
+
+
+/* UMFPACK counterpart of a CHOLMOD factor, the symbolic analysis could be
+   reused to factorize matrices of the same pattern */
+typedef struct __dt_UMFPACK_factor_struct
+{
+    void *symbolic_obj, *numeric_obj;
+
+} __dt_UMFPACK_factor;
+
+/* Symbolic analysis of A for __dt_UMFPACK_factorize */
+void __dt_UMFPACK_analyze(cholmod_sparse *A, __dt_UMFPACK_factor *F);
+
+/* Numerical factorization of A, replacing the one F had */
+int __dt_UMFPACK_factorize(cholmod_sparse *A, __dt_UMFPACK_factor *F);
+
+/* Solve A*x = b with the factorization of A, one column of b at a time, x is
+   a newly created dense matrix */
+cholmod_dense* __dt_UMFPACK_solve(
+    cholmod_sparse *A, __dt_UMFPACK_factor *F, cholmod_dense *b);
+
+/* Solve for a single column like __dt_CHOLMOD_solve_column, without any
+   iterative refinement the factor could be applied to a matrix other than
+   the one factorized, e.g. as a preconditioner */
+void __dt_UMFPACK_solve_column(
+    __dt_UMFPACK_factor *F, const double *b, double *x);
+
+/* Free the symbolic and numeric objects of F */
+void __dt_UMFPACK_free_factor(__dt_UMFPACK_factor *F);
+
+
+/* Solve normal equation AtA*x = b of a least square problem, AtA is stored
+   in full for UMFPACK, or only its upper part for CHOLMOD. x is a newly
+   created dense matrix with as many columns as b. */
+cholmod_dense* __dt_CHOLMOD_normal_solve(cholmod_sparse *AtA, cholmod_dense *b);
+cholmod_dense* __dt_UMFPACK_normal_solve(cholmod_sparse *AtA, cholmod_dense *b);
+
+/* Solve least square problem: min||c - A*x||^2, each column of c is solved
+   for with the same factorization, x has as many columns as c */
 cholmod_dense* __dt_CHOLMOD_least_square(cholmod_sparse *A, cholmod_dense *c);
 cholmod_dense* __dt_UMFPACK_least_square(cholmod_sparse *A, cholmod_dense *c);
 
 
+/* Iterative counterpart of the solvers above: preconditioned conjugate
+   gradient on AtA, nothing but AtA and a preconditioner of the same size is
+   kept in memory. precond is one of the following, see pcg.h for details: */
+#define __DT_PRECOND_NONE    0
+#define __DT_PRECOND_JACOBI  1   /* inverse of the diagonal of AtA */
+#define __DT_PRECOND_IC0     2   /* incomplete Cholesky, no fill-in */
+
+/* x holds the initial guess on entry and the solution on return, a good
+   one (e.g. the solution to a nearby problem) saves most of the iterations.
+   Each column stops once ||b - AtA*x|| <= tol * ||b||. It returns the
+   maximum number of iterations taken by a column, or -1 if some column
+   doesn't converge in max_iter iterations. */
+int __dt_PCG_normal_solve(
+    cholmod_sparse *AtA, cholmod_dense *b, cholmod_dense *x,
+    int precond, double tol, int max_iter);
+
+/* min||c - A*x||^2 by __dt_PCG_normal_solve on At*A * x = At*c */
+int __dt_PCG_least_square(
+    cholmod_sparse *A, cholmod_dense *c, cholmod_dense *x,
+    int precond, double tol, int max_iter);
+
+
 /* Read a sparse matrix from file in MatrixMarket format. */
 cholmod_sparse* __dt_CHOLMOD_read_sparse(const char *filename);
 
 /* Read a dense matrix from file in MatrixMarket format. */
 cholmod_dense* __dt_CHOLMOD_read_dense(const char *filename);
 
+/* Write a sparse matrix to a binary stream, which is way faster to load than
+   MatrixMarket text. Only packed real matrices with int indexes (everything
+   CHOLMOD creates for us) are supported. It returns 0 on success or -1 to
+   indicate fwrite() failed. */
+int __dt_CHOLMOD_write_sparse_binary(FILE *fp, cholmod_sparse *A);
+
+/* Read a sparse matrix written by __dt_CHOLMOD_write_sparse_binary, it
+   returns NULL if the stream is truncated or fails the checksum. */
+cholmod_sparse* __dt_CHOLMOD_read_sparse_binary(FILE *fp);
+
+
 /* Dumpa sparse matrix to stdout in MatrixMarket triplet form */
 void __dt_CHOLMOD_dump_sparse(cholmod_sparse *mat);
 
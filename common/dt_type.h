@@ -58,6 +58,12 @@ typedef struct __dtMeshModel_struct
     dt_size_type n_normvec;
     dt_size_type n_triangle;
 
+    /* Storage of the arrays above: NULL if they were allocated as a single
+       block by CreateMeshModel, otherwise the private mapping of a .dtm file
+       they live in (see ReadDtmFile), which is unmapped on destruction. */
+    void  *mapped_base;
+    size_t mapped_size;
+
 } dtMeshModel;
 
 
@@ -67,12 +73,16 @@ typedef struct __dtMeshModel_struct
 
 /* The story about elementary matrices of triangle units and the overall large
    sparse linear system can be found in corres_resolve/correseqn_elementary.c 
+
+   x, y and z coordinates never couple in these equations, the 3 rows of the
+   elementary matrix are shared by all three dimensions while the elementary
+   vector still has 9 elements: c[3*i_dim + i_eqn].
 */
 
-typedef dt_real_type __dt_Matrix9x4[9][4];
+typedef dt_real_type __dt_Matrix3x4[3][4];
 typedef dt_real_type __dt_Vector9D [9];
 
-typedef __dt_Matrix9x4 __dt_ElementaryMatrix;
+typedef __dt_Matrix3x4 __dt_ElementaryMatrix;
 typedef __dt_Vector9D  __dt_ElementaryVector;
 
 
@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mesh_model.h"
+#include "file_map.h"
+#include "checksum.h"
+#include "binary_file.h"
+
+
+
+/* .dtm binary model file layout:
+
+   [header (64 bytes)]=>[---vertex---|---norm_vector---|------triangle------]
+
+   The payload is exactly the memory block CreateMeshModel allocates, so a
+   model could be used right where the file is mapped. A file with the shared
+   topology flag set only contains the vertex array, the rest is borrowed from
+   a reference model with the same triangles.
+*/
+
+#define __DTM_VERSION          1
+
+#define __DTM_SHARED_TOPOLOGY  0x1u    /* only vertices are stored */
+
+static const char __dtm_magic[4] = { 'D', 'T', 'M', '\x1a' };
+
+
+typedef struct __dtm_Header_struct
+{
+    /* "DTM\x1a", __DTM_VERSION, flags: __DTM_SHARED_TOPOLOGY or 0 */
+    __dt_BinaryFileTag tag;
+
+    int32_t  n_vertex;
+    int32_t  n_normvec;
+    int32_t  n_triangle;
+
+    uint64_t topology_hash;   /* hash of the triangle array */
+    uint64_t checksum;        /* hash of all arrays stored in this file */
+
+    uint64_t reserved[2];     /* pads the header to 64 bytes */
+
+} __dtm_Header;
+
+/* the payload has to be aligned for dt_real_type */
+typedef char __dtm_header_size_check[sizeof(__dtm_Header) == 64? 1: -1];
+
+
+/* Hash of model topology: vertices are connected by the same triangles */
+static __dt_Hash64 __topology_hash(
+    const dtTriangle *triangle, dt_size_type n_triangle)
+{
+    return __dt_Checksum64(
+        triangle, (size_t)n_triangle * sizeof(dtTriangle), 0);
+}
+
+/* Checksum of the payload, arrays are chained in the order of storage */
+static __dt_Hash64 __payload_checksum(const dtMeshModel *model, int shared)
+{
+    __dt_Hash64 h = __dt_Checksum64(
+        model->vertex, (size_t)model->n_vertex * sizeof(dtVertex), 0);
+
+    if (!shared)
+    {
+        h = __dt_Checksum64(
+            model->normvec, (size_t)model->n_normvec * sizeof(dtVector), h);
+        h = __dt_Checksum64(
+            model->triangle, (size_t)model->n_triangle * sizeof(dtTriangle), h);
+    }
+    return h;
+}
+
+
+/* Check the header against this build and the size of the mapped file */
+static int __header_is_valid(const __dtm_Header *header, size_t file_size)
+{
+    size_t payload_size;
+
+    if (!__dt_CheckBinaryFileTag(&(header->tag), __dtm_magic, __DTM_VERSION) ||
+        header->n_vertex < 0 || header->n_normvec < 0 || header->n_triangle < 0)
+    {
+        return 0;
+    }
+
+    payload_size = (size_t)header->n_vertex * sizeof(dtVertex);
+    if (!(header->tag.flags & __DTM_SHARED_TOPOLOGY))
+    {
+        payload_size +=
+            (size_t)header->n_normvec  * sizeof(dtVector) +
+            (size_t)header->n_triangle * sizeof(dtTriangle);
+    }
+
+    return (file_size == sizeof(__dtm_Header) + payload_size);
+}
+
+
+/* Map the file and set up the model in place, reference is NULL if shared
+   topology is not acceptable. */
+static int __read_dtm_file(
+    const char *filename, const dtMeshModel *reference, dtMeshModel *model)
+{
+    __dt_FileMapping map;
+    __dtm_Header header;
+    char *payload;
+    int shared;
+
+    if (__dt_MapFileCopyOnWrite(filename, &map) != 0) {
+        return -1;   /* could not open file */
+    }
+
+    if (map.size < sizeof(__dtm_Header)) goto bad_format;
+    memcpy(&header, map.base, sizeof(__dtm_Header));
+    if (!__header_is_valid(&header, map.size)) goto bad_format;
+
+    shared  = (header.tag.flags & __DTM_SHARED_TOPOLOGY) != 0;
+    payload = map.base + sizeof(__dtm_Header);
+
+    model->n_vertex = header.n_vertex;
+    model->vertex   = (dtVertex*)payload;
+
+    if (shared)
+    {
+        /* vertices only, borrow the rest from the reference model */
+        if (reference == NULL ||
+            reference->n_vertex   != header.n_vertex   ||
+            reference->n_triangle != header.n_triangle ||
+            __topology_hash(reference->triangle, reference->n_triangle) !=
+                header.topology_hash)
+        {
+            goto bad_format;
+        }
+
+        model->n_normvec  = reference->n_normvec;
+        model->n_triangle = reference->n_triangle;
+        model->normvec    = reference->normvec;
+        model->triangle   = reference->triangle;
+    }
+    else
+    {
+        model->n_normvec  = header.n_normvec;
+        model->n_triangle = header.n_triangle;
+        model->normvec    = (dtVector*)(
+            payload + (size_t)header.n_vertex * sizeof(dtVertex));
+        model->triangle   = (dtTriangle*)(
+            (char*)model->normvec + (size_t)header.n_normvec * sizeof(dtVector));
+    }
+
+    if (__payload_checksum(model, shared) != header.checksum) goto bad_format;
+
+    model->mapped_base = map.base;
+    model->mapped_size = map.size;
+    return 0;
+
+bad_format:
+    __dt_UnmapFile(&map);
+    return -2;
+}
+
+
+/* ReadDtmFile loads a binary .dtm model file written by SaveDtmFile. The file
+   is mapped into memory and the arrays are used in place.
+
+   This function returns 0 on success, -1 to indicate an open()/mmap() error,
+   or -2 to indicate a corrupted or incompatible file.
+*/
+int ReadDtmFile(const char *filename, dtMeshModel *model)
+{
+    return __read_dtm_file(filename, NULL, model);
+}
+
+/* Load a .dtm file which may share topology with the reference model */
+int ReadDtmFile_SharedTopology(
+    const char *filename, const dtMeshModel *reference, dtMeshModel *model)
+{
+    return __read_dtm_file(filename, reference, model);
+}
+
+
+/* Write header and payload of a .dtm file */
+static int __save_dtm_file(
+    const char *filename, const dtMeshModel *model, int shared)
+{
+    __dtm_Header header;
+    FILE *fp;
+    int ok;
+
+    memset(&header, 0, sizeof(header));
+    __dt_InitBinaryFileTag(&(header.tag), __dtm_magic, __DTM_VERSION,
+        shared? __DTM_SHARED_TOPOLOGY: 0);
+    header.n_vertex     = model->n_vertex;
+    header.n_normvec    = model->n_normvec;
+    header.n_triangle   = model->n_triangle;
+
+    header.topology_hash =
+        __topology_hash(model->triangle, model->n_triangle);
+    header.checksum = __payload_checksum(model, shared);
+
+    if ((fp = fopen(filename, "wb")) == NULL) {
+        return -1;
+    }
+
+    /* arrays of a model may not be contiguous, write them one by one */
+    ok =
+        fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(model->vertex, sizeof(dtVertex),
+               (size_t)model->n_vertex, fp) == (size_t)model->n_vertex;
+
+    if (ok && !shared)
+    {
+        ok =
+            fwrite(model->normvec, sizeof(dtVector),
+                   (size_t)model->n_normvec, fp) == (size_t)model->n_normvec &&
+            fwrite(model->triangle, sizeof(dtTriangle),
+                   (size_t)model->n_triangle, fp) == (size_t)model->n_triangle;
+    }
+
+    if (fclose(fp) != 0) ok = 0;
+    return ok? 0: -1;
+}
+
+
+/* SaveDtmFile saves specified mesh model to a .dtm file, it would return 0 on
+   success, otherwise it would return -1 to indicate fopen()/fwrite() failed.
+*/
+int SaveDtmFile(const char *filename, const dtMeshModel *model)
+{
+    return __save_dtm_file(filename, model, 0);
+}
+
+/* Save the vertices of specified model to a .dtm file marked as having shared
+   topology */
+int SaveDtmFile_SharedTopology(const char *filename, const dtMeshModel *model)
+{
+    return __save_dtm_file(filename, model, 1);
+}
@@ -0,0 +1,78 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "file_map.h"
+
+
+
+/* Map the whole file with specified protection, the mapping is always private
+   to this process, pages are populated in advance since we are going to touch
+   every one of them anyway. */
+static int __map_file(const char *filename, int prot, __dt_FileMapping *map)
+{
+    struct stat st;
+    void *addr;
+    int flags = MAP_PRIVATE;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1) {
+        return -1;   /* could not open file */
+    }
+
+    if (fstat(fd, &st) == -1) {
+        close(fd);  return -1;
+    }
+
+    map->base = NULL;
+    map->size = (size_t)st.st_size;
+
+    /* mmap() refuses to map zero bytes, an empty file is simply represented
+       by an empty view. */
+    if (map->size > 0)
+    {
+#ifdef MAP_POPULATE
+        flags |= MAP_POPULATE;
+#endif
+        addr = mmap(NULL, map->size, prot, flags, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);  return -1;
+        }
+
+        madvise(addr, map->size, MADV_SEQUENTIAL);
+        map->base = (char*)addr;
+    }
+
+    close(fd);   /* the mapping keeps its own reference to the file */
+    return 0;
+}
+
+
+/* Map specified file into memory. This function returns 0 on success, or it
+   would return -1 to indicate an open()/mmap() error, check system variable
+   errno for further investigation.
+*/
+int __dt_MapFile(const char *filename, __dt_FileMapping *map)
+{
+    return __map_file(filename, PROT_READ, map);
+}
+
+/* Map specified file as private copy-on-write memory, the view is writable
+   but modifications are never carried through to the file. */
+int __dt_MapFileCopyOnWrite(const char *filename, __dt_FileMapping *map)
+{
+    return __map_file(filename, PROT_READ | PROT_WRITE, map);
+}
+
+/* Unmap a file mapped by __dt_MapFile() or __dt_MapFileCopyOnWrite() */
+void __dt_UnmapFile(__dt_FileMapping *map)
+{
+    if (map->base != NULL) {
+        munmap((void*)map->base, map->size);
+    }
+
+    map->base = NULL;
+    map->size = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef __DT_FILE_MAP_HEADER__
+#define __DT_FILE_MAP_HEADER__
+
+
+#include <stddef.h>
+
+
+/* A view of an entire file mapped into the address space of the process.
+   Model files are scanned from the first byte to the last one, so handing the
+   whole file to the parser as a single block of memory saves us all the
+   buffering and per-character function call overhead of stdio.
+*/
+typedef struct __dt_FileMapping_struct
+{
+    char  *base;   /* first byte of the file, NULL for an empty file */
+    size_t size;   /* length of the file in bytes */
+
+} __dt_FileMapping;
+
+
+/* Map specified file into memory. This function returns 0 on success, or it
+   would return -1 to indicate an open()/mmap() error, check system variable
+   errno for further investigation.
+*/
+int __dt_MapFile(const char *filename, __dt_FileMapping *map);
+
+/* Map specified file as private copy-on-write memory, the view is writable
+   but modifications are never carried through to the file. Binary model files
+   are loaded this way so their arrays could be used in place. */
+int __dt_MapFileCopyOnWrite(const char *filename, __dt_FileMapping *map);
+
+/* Unmap a file mapped by __dt_MapFile() or __dt_MapFileCopyOnWrite() */
+void __dt_UnmapFile(__dt_FileMapping *map);
+
+
+
+#endif /* __DT_FILE_MAP_HEADER__ */
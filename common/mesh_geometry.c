@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "mesh_geometry.h"
+
+
+/* coordinate arrays start at multiples of this many bytes */
+#define __DT_GEOMETRY_ALIGN  64
+
+
+/* size of a coordinate array rounded up to the alignment, so the next one
+   is aligned as well */
+static size_t __aligned_array_size(dt_size_type n, size_t elem_size)
+{
+    size_t size = (size_t)n * elem_size;
+    return (size + __DT_GEOMETRY_ALIGN - 1) /
+        __DT_GEOMETRY_ALIGN * __DT_GEOMETRY_ALIGN;
+}
+
+/* first aligned byte in mem */
+static char* __align(void *mem)
+{
+    uintptr_t addr = (uintptr_t)mem;
+    return (char*)mem +
+        ((__DT_GEOMETRY_ALIGN - addr % __DT_GEOMETRY_ALIGN) %
+            __DT_GEOMETRY_ALIGN);
+}
+
+
+/* Start of the x, y and z arrays owned by a geometry, they're laid out
+   one after another in its memory block */
+static void __owned_arrays(const dtMeshGeometry *geom, char **array)
+{
+    size_t array_size = __aligned_array_size(geom->n_vertex,
+        geom->use_float? sizeof(float): sizeof(dt_real_type));
+    int i_dim;
+
+    for (i_dim = 0; i_dim < 3; i_dim++) {
+        array[i_dim] = __align(geom->mem) + i_dim * array_size;
+    }
+}
+
+
+/* Copy the vertices of model into separate coordinate arrays */
+void CreateMeshGeometry(
+    const dtMeshModel *model, int use_float, dtMeshGeometry *geom)
+{
+    size_t array_size = __aligned_array_size(model->n_vertex,
+        use_float? sizeof(float): sizeof(dt_real_type));
+    char *array[3];
+    int i_dim;
+
+    geom->stride     = 1;
+    geom->use_float  = use_float;
+    geom->n_vertex   = model->n_vertex;
+    geom->triangle   = model->triangle;
+    geom->n_triangle = model->n_triangle;
+
+    /* x, y and z arrays in a single block, with room for the alignment */
+    geom->mem = __dt_malloc(3 * array_size + __DT_GEOMETRY_ALIGN);
+    __owned_arrays(geom, array);
+
+    for (i_dim = 0; i_dim < 3; i_dim++)
+    {
+        geom->coord [i_dim] = NULL;
+        geom->coordf[i_dim] = NULL;
+
+        if (use_float) {
+            geom->coordf[i_dim] = (const float*)array[i_dim];
+        }
+        else {
+            geom->coord[i_dim] = (const dt_real_type*)array[i_dim];
+        }
+    }
+
+    LoadMeshGeometryVertex(geom, model->vertex);
+}
+
+/* View the vertices of model in place */
+void ViewMeshGeometry(const dtMeshModel *model, dtMeshGeometry *geom)
+{
+    geom->coord[0] = &(model->vertex[0].x);
+    geom->coord[1] = &(model->vertex[0].y);
+    geom->coord[2] = &(model->vertex[0].z);
+    geom->coordf[0] = geom->coordf[1] = geom->coordf[2] = NULL;
+
+    geom->stride     = 3;   /* sizeof(dtVertex) / sizeof(dt_real_type) */
+    geom->use_float  = 0;
+    geom->n_vertex   = model->n_vertex;
+    geom->triangle   = model->triangle;
+    geom->n_triangle = model->n_triangle;
+    geom->mem        = NULL;
+}
+
+/* Free the coordinate arrays, views have nothing to free */
+void DestroyMeshGeometry(dtMeshGeometry *geom)
+{
+    free(geom->mem);
+    geom->mem = NULL;
+}
+
+
+/* Load n_vertex vertices into a geometry made by CreateMeshGeometry */
+void LoadMeshGeometryVertex(dtMeshGeometry *geom, const dtVertex *vertex)
+{
+    dt_real_type *x, *y, *z;
+    float *xf, *yf, *zf;
+    char *array[3];
+    dt_index_type i;
+
+    /* write through the arrays the geometry owns, rather than its read-only
+       view of them */
+    __owned_arrays(geom, array);
+
+    if (geom->use_float)
+    {
+        xf = (float*)array[0];
+        yf = (float*)array[1];
+        zf = (float*)array[2];
+
+        for (i = 0; i < geom->n_vertex; i++)
+        {
+            xf[i] = (float)vertex[i].x;
+            yf[i] = (float)vertex[i].y;
+            zf[i] = (float)vertex[i].z;
+        }
+    }
+    else
+    {
+        x = (dt_real_type*)array[0];
+        y = (dt_real_type*)array[1];
+        z = (dt_real_type*)array[2];
+
+        for (i = 0; i < geom->n_vertex; i++)
+        {
+            x[i] = vertex[i].x;
+            y[i] = vertex[i].y;
+            z[i] = vertex[i].z;
+        }
+    }
+}
+
+/* Store the vertices of a geometry back into n_vertex vertices */
+void StoreMeshGeometryVertex(const dtMeshGeometry *geom, dtVertex *vertex)
+{
+    dt_index_type i;
+
+    for (i = 0; i < geom->n_vertex; i++)
+    {
+        vertex[i].x = __dt_GeometryCoord(geom, 0, i);
+        vertex[i].y = __dt_GeometryCoord(geom, 1, i);
+        vertex[i].z = __dt_GeometryCoord(geom, 2, i);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef __DT_MESH_GEOMETRY_HEADER__
+#define __DT_MESH_GEOMETRY_HEADER__
+
+
+#include "dt_type.h"
+
+
+/* dtMeshModel keeps the coordinates of a vertex together, which is handy for
+   code working on a vertex at a time, but a pass over all vertices has to
+   read every component of them even if it only needs one. A mesh geometry
+   keeps x, y and z coordinates of all vertices in separate arrays (structure
+   of arrays), each of them aligned to 64 bytes, and may store them in
+   float32 to halve the memory traffic of large models. Coordinates are
+   always read as dt_real_type, so everything computed from them, like
+   solver inputs, stays in double precision.
+
+   A geometry may also be a view of the vertex array of a dtMeshModel, no
+   copy is made and its coordinate arrays are interleaved with a stride of 3.
+   Routines taking a geometry work on both, a dtMeshModel is passed to them
+   through a view.
+*/
+typedef struct __dtMeshGeometry_struct
+{
+    /* component i_dim of vertex i is coord[i_dim][i * stride], or
+       coordf[i_dim][i * stride] if use_float is set */
+    const dt_real_type *coord [3];
+    const float        *coordf[3];
+
+    dt_size_type stride;   /* 1 for arrays of its own, 3 for a view */
+    int          use_float;
+
+    dt_size_type n_vertex;
+
+    /* triangles of the model, they're never copied */
+    const dtTriangle *triangle;
+    dt_size_type      n_triangle;
+
+    void *mem;   /* storage of the coordinates, NULL for a view */
+
+} dtMeshGeometry;
+
+
+/* Get component i_dim of vertex i_vertex as dt_real_type */
+#define __dt_GeometryCoord(geom, i_dim, i_vertex)                          \
+    ((geom)->use_float?                                                    \
+        (dt_real_type)(geom)->coordf[i_dim][                               \
+            (size_t)(i_vertex) * (size_t)(geom)->stride]:                  \
+        (geom)->coord[i_dim][(size_t)(i_vertex) * (size_t)(geom)->stride])
+
+
+/* CreateMeshGeometry copies the vertices of model into separate x, y and z
+   arrays, which are stored in float32 if use_float is nonzero. Triangles are
+   borrowed from the model, which has to outlive the geometry. */
+void CreateMeshGeometry(
+    const dtMeshModel *model, int use_float, dtMeshGeometry *geom);
+
+/* ViewMeshGeometry makes a geometry view the vertices of model in place, it
+   allocates nothing, but DestroyMeshGeometry could be called on it all the
+   same. */
+void ViewMeshGeometry(const dtMeshModel *model, dtMeshGeometry *geom);
+
+/* DestroyMeshGeometry frees the coordinate arrays made by CreateMeshGeometry
+ */
+void DestroyMeshGeometry(dtMeshGeometry *geom);
+
+
+/* Load n_vertex vertices into a geometry made by CreateMeshGeometry, such as
+   the vertices of a deformed pose of the model it was made from. */
+void LoadMeshGeometryVertex(dtMeshGeometry *geom, const dtVertex *vertex);
+
+/* Store the vertices of a geometry back into n_vertex vertices, such as the
+   vertex array of a dtMeshModel. */
+void StoreMeshGeometryVertex(const dtMeshGeometry *geom, dtVertex *vertex);
+
+
+
+#endif /* __DT_MESH_GEOMETRY_HEADER__ */
@@ -1,8 +1,11 @@
 #include <stdlib.h>
 #include <memory.h>
+#include <string.h>
 #include <stdio.h>
 
 #include "mesh_model.h"
+#include "file_map.h"
+#include "binary_file.h"
 
 
 /*
@@ -32,31 +35,107 @@ void CreateMeshModel(dtMeshModel *model)
     model->vertex   = (dtVertex*)  (mem);
     model->normvec  = (dtVector*)  (mem + vertex_siz);
     model->triangle = (dtTriangle*)(mem + vertex_siz + normvec_siz);
+
+    model->mapped_base = NULL;   /* heap storage */
+    model->mapped_size = 0;
 }
 
-/* DestroyMeshModel frees all memory space allocated in CreateMeshModel */
+/* DestroyMeshModel frees all memory space allocated in CreateMeshModel, or
+   unmaps the .dtm file the model was loaded from. */
 void DestroyMeshModel(dtMeshModel *model)
 {
-    free(model->vertex);  /* we just need to free once and ONLY once */
+    __dt_FileMapping map;
+
+    if (model->mapped_base != NULL)
+    {
+        map.base = (char*)model->mapped_base;
+        map.size = model->mapped_size;
+        __dt_UnmapFile(&map);
+    }
+    else {
+        free(model->vertex);  /* we just need to free once and ONLY once */
+    }
 }
 
 
+/* Model files with a .dtm extension are binary model files, everything else
+   is treated as a .obj file. */
+static int __is_dtm_filename(const char *filename) {
+    return __dt_HasFileExtension(filename, ".dtm");
+}
+
+/* ReadMeshFile reads a .obj or .dtm model file, depending on the extension
+   of the file name. Return values are the same as ReadObjFile/ReadDtmFile. */
+int ReadMeshFile(const char *filename, dtMeshModel *model)
+{
+    return __is_dtm_filename(filename)?
+        ReadDtmFile(filename, model): ReadObjFile(filename, model);
+}
+
+/* Read a deformed pose of the reference model, a .dtm file sharing topology
+   with the reference model is accepted as well. */
+int ReadPoseFile(
+    const char *filename, const dtMeshModel *reference, dtMeshModel *model)
+{
+    return __is_dtm_filename(filename)?
+        ReadDtmFile_SharedTopology(filename, reference, model):
+        ReadObjFile(filename, model);
+}
+
+/* SaveMeshFile saves the model as a .obj or .dtm file, depending on the
+   extension of the file name. */
+int SaveMeshFile(const char *filename, const dtMeshModel *model)
+{
+    return __is_dtm_filename(filename)?
+        SaveDtmFile(filename, model): SaveObjFile(filename, model);
+}
+
+
+/* Print an error message for the return value of a model reading routine to
+   stderr and crash */
+static void __crash_on_read_error(const char *filename, int ret)
+{
+    fprintf(stderr, "file: %s - ", filename);
+    if (ret == -1) {
+        perror("Reading model file error");
+    }
+    else if (ret == -2) {
+        fprintf(stderr, "Corrupted or incompatible .dtm file\n");
+    }
+    else {
+        fprintf(stderr, "Syntax error on line: %u\n", ret);
+    }
+    exit(-1);
+}
+
 /* Read .obj model file into model object, if reading file failed, it would 
    simply print an error message to stderr and crash. */
 void __dt_ReadObjFile_commit_or_crash(
     const char *filename, dtMeshModel *model)
 {
     int ret;
-    if ((ret = ReadObjFile(filename, model)) != 0)
-    {
-        fprintf(stderr, "file: %s - ", filename);
-        if (ret == -1) {
-            perror("Reading model file error");
-        }
-        else {
-            fprintf(stderr, "Syntax error on line: %u\n", ret);
-        }
-        exit(-1);
+    if ((ret = ReadObjFile(filename, model)) != 0) {
+        __crash_on_read_error(filename, ret);
+    }
+}
+
+/* Read .obj or .dtm model file into model object, crash on failure. */
+void __dt_ReadMeshFile_commit_or_crash(
+    const char *filename, dtMeshModel *model)
+{
+    int ret;
+    if ((ret = ReadMeshFile(filename, model)) != 0) {
+        __crash_on_read_error(filename, ret);
+    }
+}
+
+/* Read a deformed pose of the reference model, crash on failure. */
+void __dt_ReadPoseFile_commit_or_crash(
+    const char *filename, const dtMeshModel *reference, dtMeshModel *model)
+{
+    int ret;
+    if ((ret = ReadPoseFile(filename, reference, model)) != 0) {
+        __crash_on_read_error(filename, ret);
     }
 }
 
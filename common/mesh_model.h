@@ -15,16 +15,20 @@
  */
 void CreateMeshModel(dtMeshModel *model);
 
-/* DestroyMeshModel frees all memory space allocated in CreateMeshModel.
+/* DestroyMeshModel frees all memory space allocated in CreateMeshModel, or
+   unmaps the .dtm file the model was loaded from.
  */
 void DestroyMeshModel(dtMeshModel *model);
 
 
 /* ReadObjFile parse specified .obj model description file and read vertex, 
-   normal vector and triangular surface information into *model
+   normal vector and triangular surface information into *model. The file is
+   mapped into memory and parsed in a single pass.
 
    This function returns 0 on success, otherwise it would return an -1 to 
-   indicate an fopen() error (file not exist, privillage or some reason).
+   indicate an open() error (file not exist, privillage or some reason) or
+   running out of memory, or a positive line number where a syntax error was
+   found.
 */
 int ReadObjFile(const char *filename, dtMeshModel *model);
 
@@ -33,12 +37,81 @@ int ReadObjFile(const char *filename, dtMeshModel *model);
 void __dt_ReadObjFile_commit_or_crash(
     const char *filename, dtMeshModel *model);
 
-/* SaveObjFile saves specified mesh model to a file, it would return 0 on 
-   success, otherwise it would return -1 to indicate fopen() was failed.
-   You should check system variable errno for further investigation.
+/* SaveObjFile saves specified mesh model to a file, it would return 0 on
+   success, otherwise it would return -1 to indicate open() or write() was
+   failed. You should check system variable errno for further investigation.
 */
 int SaveObjFile(const char *filename, const dtMeshModel *model);
 
+/* Flags of SaveObjFile_Ex, deformed models usually share normal vectors and
+   triangles with their reference model, there's no need to write them again
+   for every pose. Triangles are written as "f v v v" without normals. */
+#define __DT_OBJ_OMIT_NORMVEC   0x1
+#define __DT_OBJ_OMIT_TRIANGLE  0x2
+
+/* SaveObjFile with some parts of the model left out, flags is a combination
+   of the __DT_OBJ_OMIT_* flags above, SaveObjFile_Ex(filename, model, 0) is
+   the same as SaveObjFile(filename, model). */
+int SaveObjFile_Ex(const char *filename, const dtMeshModel *model, int flags);
+
+
+/* ReadDtmFile loads a binary .dtm model file written by SaveDtmFile. A .dtm
+   file is a small header followed by the vertex, normal vector and triangle
+   arrays in exactly the layout CreateMeshModel uses, so the file is mapped
+   into memory (privately, the arrays are writable) and used in place without
+   any parsing or copying. The mapping is released by DestroyMeshModel.
+
+   This function returns 0 on success, -1 to indicate an open()/mmap() error,
+   or -2 if the file is truncated, fails the checksum, was written on a
+   machine with different byte order or type sizes, or only contains vertices
+   (see ReadDtmFile_SharedTopology).
+*/
+int ReadDtmFile(const char *filename, dtMeshModel *model);
+
+/* Load a .dtm file which may share topology with the reference model. Such
+   files only store vertex coordinates of a deformed pose, normal vectors and
+   triangles of the model are borrowed from the reference model, which must
+   stay alive until the model is destroyed. Triangles of the reference model
+   are checked against the topology hash recorded in the file.
+
+   Self-contained .dtm files are accepted as well, return values are the same
+   as ReadDtmFile.
+*/
+int ReadDtmFile_SharedTopology(
+    const char *filename, const dtMeshModel *reference, dtMeshModel *model);
+
+/* SaveDtmFile saves specified mesh model to a .dtm file, it would return 0 on
+   success, otherwise it would return -1 to indicate fopen()/fwrite() failed.
+*/
+int SaveDtmFile(const char *filename, const dtMeshModel *model);
+
+/* Save the vertices of specified model to a .dtm file marked as having shared
+   topology, normal vectors and triangles are supposed to be identical to
+   those of a reference model and are not written. */
+int SaveDtmFile_SharedTopology(const char *filename, const dtMeshModel *model);
+
+
+/* ReadMeshFile/SaveMeshFile read or save a .dtm model file if the file name
+   ends with ".dtm", or a .obj file otherwise. Return values are the same as
+   the format specific functions above. */
+int ReadMeshFile(const char *filename, dtMeshModel *model);
+int SaveMeshFile(const char *filename, const dtMeshModel *model);
+
+/* Read a deformed pose of the reference model, .dtm pose files sharing
+   topology with the reference model are accepted in addition to ReadMeshFile.
+*/
+int ReadPoseFile(
+    const char *filename, const dtMeshModel *reference, dtMeshModel *model);
+
+/* Read .obj or .dtm model file into model object, if reading file failed, it
+   would simply print an error message to stderr and crash. */
+void __dt_ReadMeshFile_commit_or_crash(
+    const char *filename, dtMeshModel *model);
+
+/* Read a deformed pose of the reference model, crash on failure. */
+void __dt_ReadPoseFile_commit_or_crash(
+    const char *filename, const dtMeshModel *reference, dtMeshModel *model);
+
 
 /* Sort out a list containing the index of normal vectors of each vertex in the
    model, this list might be helpful in closest point iteration. 
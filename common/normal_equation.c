@@ -0,0 +1,332 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "normal_equation.h"
+
+
+
+/* A term with the constants dropped and duplicated variables merged (when
+   two triangle units share vertices), variables are sorted in ascending
+   order so that they can be located in the columns of At*A in one sweep */
+typedef struct __compact_term_struct
+{
+    dt_size_type  n_var;
+    dt_index_type var[__DT_NORMAL_TERM_MAX_VAR];
+    dt_real_type  m[3][__DT_NORMAL_TERM_MAX_VAR];
+
+} __compact_term;
+
+
+static void __compact(const __dt_NormalTerm *term, __compact_term *ct)
+{
+    dt_index_type k, j, i_eqn, v;
+    dt_size_type n = 0;
+
+    for (k = 0; k < term->n_var; k++)
+    {
+        if ((v = term->var[k]) < 0) continue;   /* constant */
+
+        /* find its place, merge it with the same variable if there's one */
+        for (j = n; j > 0 && ct->var[j-1] > v; j--) ;
+
+        if (j > 0 && ct->var[j-1] == v)
+        {
+            for (i_eqn = 0; i_eqn < term->n_eqn; i_eqn++) {
+                ct->m[i_eqn][j-1] += term->m[i_eqn][k];
+            }
+            continue;
+        }
+
+        memmove(ct->var + j + 1, ct->var + j, (n - j) * sizeof(dt_index_type));
+        ct->var[j] = v;
+        for (i_eqn = 0; i_eqn < term->n_eqn; i_eqn++)
+        {
+            memmove(ct->m[i_eqn] + j + 1, ct->m[i_eqn] + j,
+                    (n - j) * sizeof(dt_real_type));
+            ct->m[i_eqn][j] = term->m[i_eqn][k];
+        }
+        n++;
+    }
+
+    ct->n_var = n;
+}
+
+
+/* Create a normal equation of n_var variables, which records the pattern of
+   the terms added to it until __dt_CompleteNormalPattern() is called. */
+void __dt_CreateNormalEquation(
+    dt_size_type n_var, int stype, __dt_NormalEquation *eqn)
+{
+    eqn->n_var = n_var;
+    eqn->stype = stype;
+    eqn->AtA   = NULL;
+    eqn->AtC   = NULL;
+
+    eqn->saved_AtA = eqn->saved_AtC = NULL;
+
+    eqn->n_term_var   = 0;
+    eqn->max_term_var = 4096;
+    eqn->term_var = (dt_index_type*)__dt_malloc(
+        eqn->max_term_var * sizeof(dt_index_type));
+}
+
+/* record the variables of a term: n, var[0..n-1] */
+static void __record_term(__dt_NormalEquation *eqn, const __compact_term *ct)
+{
+    size_t len = 1 + (size_t)ct->n_var;
+
+    if (eqn->n_term_var + len > eqn->max_term_var)
+    {
+        eqn->max_term_var *= 2;
+        eqn->term_var = (dt_index_type*)realloc(eqn->term_var,
+            eqn->max_term_var * sizeof(dt_index_type));
+    }
+
+    eqn->term_var[eqn->n_term_var] = ct->n_var;
+    memcpy(eqn->term_var + eqn->n_term_var + 1, ct->var,
+           ct->n_var * sizeof(dt_index_type));
+    eqn->n_term_var += len;
+}
+
+
+static int __compare_index(const void *a, const void *b)
+{
+    dt_index_type ia = *(const dt_index_type*)a, ib = *(const dt_index_type*)b;
+    return (ia > ib) - (ia < ib);
+}
+
+/* Lay out At*A from the recorded terms, terms added from now on are
+   accumulated into AtA and AtC */
+void __dt_CompleteNormalPattern(__dt_NormalEquation *eqn)
+{
+    dt_index_type *count, *row, *Ap, *Ai;
+    dt_index_type *var, n, q, r, j, nnz;
+    size_t k, n_entry = 0;
+    int upper = (eqn->stype == __DT_NORMAL_UPPER);
+
+    /* count the entries (with duplicates) of each column, a term puts rows
+       var[0..q] to column var[q] of the upper part, or all its rows to the
+       column if At*A is stored in full */
+    count = (dt_index_type*)calloc((size_t)eqn->n_var + 1, sizeof(dt_index_type));
+    for (k = 0; k < eqn->n_term_var; k += 1 + n)
+    {
+        n = eqn->term_var[k];  var = eqn->term_var + k + 1;
+        for (q = 0; q < n; q++) {
+            count[var[q] + 1] += upper? q + 1: n;
+        }
+    }
+    for (j = 0; j < eqn->n_var; j++) count[j + 1] += count[j];
+    n_entry = (size_t)count[eqn->n_var];
+
+    /* scatter rows to their columns */
+    row = (dt_index_type*)__dt_malloc((n_entry + 1) * sizeof(dt_index_type));
+    for (k = 0; k < eqn->n_term_var; k += 1 + n)
+    {
+        n = eqn->term_var[k];  var = eqn->term_var + k + 1;
+        for (q = 0; q < n; q++) {
+            for (r = 0; r < (upper? q + 1: n); r++) {
+                row[count[var[q]]++] = var[r];
+            }
+        }
+    }
+    free(eqn->term_var);
+    eqn->term_var = NULL;
+
+    /* count[] has been shifted to the end of each column, sort every column
+       and squeeze out duplicated rows */
+    for (j = eqn->n_var; j > 0; j--) count[j] = count[j - 1];
+    count[0] = 0;
+
+    for (j = 0, nnz = 0; j < eqn->n_var; j++)
+    {
+        dt_index_type begin = count[j], end = count[j + 1], i;
+
+        qsort(row + begin, (size_t)(end - begin), sizeof(dt_index_type),
+              __compare_index);
+
+        count[j] = nnz;
+        for (i = begin; i < end; i++) {
+            if (i == begin || row[i] != row[i - 1]) row[nnz++] = row[i];
+        }
+    }
+    count[eqn->n_var] = nnz;
+
+    eqn->AtA = __dt_CHOLMOD_allocate_sparse(
+        (size_t)eqn->n_var, (size_t)eqn->n_var, (size_t)nnz, eqn->stype);
+    Ap = (dt_index_type*)eqn->AtA->p;
+    Ai = (dt_index_type*)eqn->AtA->i;
+    memcpy(Ap, count, ((size_t)eqn->n_var + 1) * sizeof(dt_index_type));
+    memcpy(Ai, row, (size_t)nnz * sizeof(dt_index_type));
+    free(count);
+    free(row);
+
+    eqn->AtC = __dt_CHOLMOD_dense_zeros((size_t)eqn->n_var, 3);
+    __dt_ClearNormalEquation(eqn);
+}
+
+/* Reset the values of AtA and AtC to zero, keeping the pattern */
+void __dt_ClearNormalEquation(__dt_NormalEquation *eqn)
+{
+    memset(eqn->AtA->x, 0,
+           (size_t)((dt_index_type*)eqn->AtA->p)[eqn->n_var] * sizeof(double));
+    memset(eqn->AtC->x, 0, eqn->AtC->nzmax * sizeof(double));
+}
+
+/* Keep a copy of the current values of AtA and AtC */
+void __dt_SaveNormalEquation(__dt_NormalEquation *eqn)
+{
+    size_t nnz = (size_t)((dt_index_type*)eqn->AtA->p)[eqn->n_var];
+
+    if (eqn->saved_AtA == NULL)
+    {
+        eqn->saved_AtA = (double*)__dt_malloc(nnz * sizeof(double));
+        eqn->saved_AtC = (double*)__dt_malloc(
+            eqn->AtC->nzmax * sizeof(double));
+    }
+
+    memcpy(eqn->saved_AtA, eqn->AtA->x, nnz * sizeof(double));
+    memcpy(eqn->saved_AtC, eqn->AtC->x, eqn->AtC->nzmax * sizeof(double));
+}
+
+/* Bring back the values kept by __dt_SaveNormalEquation */
+void __dt_RestoreNormalEquation(__dt_NormalEquation *eqn)
+{
+    size_t nnz = (size_t)((dt_index_type*)eqn->AtA->p)[eqn->n_var];
+
+    memcpy(eqn->AtA->x, eqn->saved_AtA, nnz * sizeof(double));
+    memcpy(eqn->AtC->x, eqn->saved_AtC, eqn->AtC->nzmax * sizeof(double));
+}
+
+/* Release the equation, set AtA or AtC to NULL beforehand to keep them */
+void __dt_DestroyNormalEquation(__dt_NormalEquation *eqn)
+{
+    free(eqn->term_var);
+    free(eqn->saved_AtA);
+    free(eqn->saved_AtC);
+    if (eqn->AtA != NULL) __dt_CHOLMOD_free_sparse(&(eqn->AtA));
+    if (eqn->AtC != NULL) __dt_CHOLMOD_free_dense(&(eqn->AtC));
+}
+
+
+static void __accumulate_rhs(
+    cholmod_dense *AtC, dt_index_type i_col,
+    const __dt_NormalTerm *term, const __compact_term *ct)
+{
+    double *x = (double*)AtC->x;
+    dt_real_type s;
+    dt_index_type q, i_dim, i_eqn;
+
+    for (q = 0; q < ct->n_var; q++)
+    {
+        for (i_dim = 0; i_dim < 3; i_dim++)
+        {
+            for (i_eqn = 0, s = 0; i_eqn < term->n_eqn; i_eqn++) {
+                s += ct->m[i_eqn][q] * term->c[3*i_dim + i_eqn];
+            }
+            x[ct->var[q] + (i_col + i_dim) * AtC->d] += term->weight * s;
+        }
+    }
+}
+
+/* accumulate m'*m of a term into AtA, rows of each column are sorted and so
+   are the variables of the term, the entries are found in a single sweep */
+static void __accumulate_matrix(
+    __dt_NormalEquation *eqn,
+    const __dt_NormalTerm *term, const __compact_term *ct)
+{
+    const dt_index_type *Ap = (const dt_index_type*)eqn->AtA->p;
+    const dt_index_type *Ai = (const dt_index_type*)eqn->AtA->i;
+    double *Ax = (double*)eqn->AtA->x;
+
+    dt_index_type q, r, pos, n_row, i_eqn;
+    dt_real_type s;
+
+    for (q = 0; q < ct->n_var; q++)
+    {
+        pos   = Ap[ct->var[q]];
+        n_row = (eqn->stype == __DT_NORMAL_UPPER)? q + 1: ct->n_var;
+
+        for (r = 0; r < n_row; r++)
+        {
+            while (Ai[pos] != ct->var[r]) pos++;
+
+            for (i_eqn = 0, s = 0; i_eqn < term->n_eqn; i_eqn++) {
+                s += ct->m[i_eqn][r] * ct->m[i_eqn][q];
+            }
+            Ax[pos] += term->weight * s;
+        }
+    }
+}
+
+/* Add an elementary term to the normal equation: record its variables, or
+   accumulate its contribution once the pattern is complete */
+void __dt_AddNormalTerm(__dt_NormalEquation *eqn, const __dt_NormalTerm *term)
+{
+    __compact_term ct;
+    __compact(term, &ct);
+
+    if (eqn->AtA == NULL) {
+        __record_term(eqn, &ct);
+    }
+    else {
+        __accumulate_matrix(eqn, term, &ct);
+        __accumulate_rhs(eqn->AtC, 0, term, &ct);
+    }
+}
+
+/* Only accumulate the contribution of a term to the right hand side */
+void __dt_AddNormalTermRhs(
+    cholmod_dense *AtC, dt_index_type i_col, const __dt_NormalTerm *term)
+{
+    __compact_term ct;
+    __compact(term, &ct);
+    __accumulate_rhs(AtC, i_col, term, &ct);
+}
+
+
+/* Set term to the 3 equations of an elementary matrix on the vertices of a
+   triangle unit, var[3] is the phantom vertex */
+void __dt_SetNormalTerm(
+    __dt_NormalTerm *term, const dt_index_type var[4],
+    __dt_ElementaryMatrix m, const __dt_ElementaryVector c,
+    dt_real_type weight)
+{
+    dt_index_type i_eqn, k;
+
+    term->n_eqn = 3;
+    term->n_var = 4;
+    for (k = 0; k < 4; k++)
+    {
+        term->var[k] = var[k];
+        for (i_eqn = 0; i_eqn < 3; i_eqn++) term->m[i_eqn][k] = m[i_eqn][k];
+    }
+
+    if (c != NULL) memcpy(term->c, c, sizeof(__dt_Vector9D));
+    else memset(term->c, 0, sizeof(__dt_Vector9D));
+
+    term->weight = weight;
+}
+
+/* Append the variables of another term with equations of the same number
+   to term, making it weight * ||(m - m_other) * v - (c - c_other)||^2 */
+void __dt_SubtractNormalTerm(
+    __dt_NormalTerm *term, const __dt_NormalTerm *other)
+{
+    dt_index_type i_eqn, k, n = term->n_var;
+
+    __DT_ASSERT(term->n_eqn == other->n_eqn &&
+                n + other->n_var <= __DT_NORMAL_TERM_MAX_VAR,
+                "Terms can't be combined in __dt_SubtractNormalTerm");
+
+    for (k = 0; k < other->n_var; k++)
+    {
+        term->var[n + k] = other->var[k];
+        for (i_eqn = 0; i_eqn < term->n_eqn; i_eqn++) {
+            term->m[i_eqn][n + k] = -other->m[i_eqn][k];
+        }
+    }
+    term->n_var += other->n_var;
+
+    for (k = 0; k < 9; k++) term->c[k] -= other->c[k];
+}
@@ -0,0 +1,117 @@
+#ifndef __DT_NORMAL_EQUATION_HEADER__
+#define __DT_NORMAL_EQUATION_HEADER__
+
+
+#include "dt_type.h"
+
+
+/* Our least squares problems min ||A*x - C||^2 are made up of lots of small
+   elementary terms, each of them is a few rows of A touching a handful of
+   variables. Rather than building A as a triplet matrix, converting and
+   transposing it to get At*A, we accumulate the contribution of each term
+   to the normal equations
+
+       At*A * x = At*C
+
+   straight into a compressed column matrix, which is a small dense block
+   m'*m on the variables of the term, and m'*c for the right hand side.
+
+   The sparsity pattern of At*A has to be known before anything could be
+   accumulated, so the terms are added twice by the same builder code: a
+   newly created normal equation only records the variables of each term,
+   __dt_CompleteNormalPattern() then lays out At*A, after which added terms
+   are accumulated. The pattern could be reused to assemble the equation
+   again with different values after __dt_ClearNormalEquation().
+
+   As everywhere else, the x, y and z coordinates don't couple, a term has
+   one row for each equation and a right hand side for each coordinate.
+*/
+
+
+#define __DT_NORMAL_TERM_MAX_VAR  8   /* at most 2 triangle units per term */
+
+/* At*A is stored in full or its upper triangular part only */
+#define __DT_NORMAL_FULL   0
+#define __DT_NORMAL_UPPER  1
+
+
+/* An elementary term: weight * ||m * v - c||^2, where v are the variables
+   var[0..n_var-1] (-1 marks a constant which has been moved to c), m has
+   n_eqn <= 3 rows and c has a column for x, y and z: c[3*i_dim + i_eqn]. */
+typedef struct __dt_NormalTerm_struct
+{
+    dt_size_type  n_eqn, n_var;
+    dt_index_type var[__DT_NORMAL_TERM_MAX_VAR];
+    dt_real_type  m[3][__DT_NORMAL_TERM_MAX_VAR];
+    __dt_Vector9D c;
+    dt_real_type  weight;
+
+} __dt_NormalTerm;
+
+
+typedef struct __dt_NormalEquation_struct
+{
+    dt_size_type    n_var;  /* number of variables (rows of x) */
+    int             stype;  /* __DT_NORMAL_FULL or __DT_NORMAL_UPPER */
+
+    cholmod_sparse *AtA;    /* NULL until the pattern is complete */
+    cholmod_dense  *AtC;    /* n_var x 3 */
+
+    /* variables of the terms recorded for the pattern: n, var[0..n-1] */
+    dt_index_type  *term_var;
+    size_t          n_term_var, max_term_var;
+
+    /* values kept by __dt_SaveNormalEquation, or NULL */
+    double         *saved_AtA, *saved_AtC;
+
+} __dt_NormalEquation;
+
+
+/* Create a normal equation of n_var variables, which records the pattern of
+   the terms added to it until __dt_CompleteNormalPattern() is called. */
+void __dt_CreateNormalEquation(
+    dt_size_type n_var, int stype, __dt_NormalEquation *eqn);
+
+/* Lay out At*A from the recorded terms, terms added from now on are
+   accumulated into AtA and AtC */
+void __dt_CompleteNormalPattern(__dt_NormalEquation *eqn);
+
+/* Reset the values of AtA and AtC to zero, keeping the pattern */
+void __dt_ClearNormalEquation(__dt_NormalEquation *eqn);
+
+/* Keep a copy of the current values of AtA and AtC, which is brought back
+   by __dt_RestoreNormalEquation(). Terms which never change could be
+   accumulated once and saved, the rest are added to the restored values. */
+void __dt_SaveNormalEquation(__dt_NormalEquation *eqn);
+void __dt_RestoreNormalEquation(__dt_NormalEquation *eqn);
+
+/* Release the equation, set AtA or AtC to NULL beforehand to keep them */
+void __dt_DestroyNormalEquation(__dt_NormalEquation *eqn);
+
+
+/* Add an elementary term to the normal equation: record its variables, or
+   accumulate its contribution once the pattern is complete */
+void __dt_AddNormalTerm(__dt_NormalEquation *eqn, const __dt_NormalTerm *term);
+
+/* Only accumulate the contribution of a term to the right hand side, the
+   x, y and z columns go to columns i_col..i_col+2 of AtC. It comes handy
+   when only the rhs changes, AtC could have more than 3 columns. */
+void __dt_AddNormalTermRhs(
+    cholmod_dense *AtC, dt_index_type i_col, const __dt_NormalTerm *term);
+
+
+/* Set term to the 3 equations of an elementary matrix on the vertices of a
+   triangle unit, var[3] is the phantom vertex */
+void __dt_SetNormalTerm(
+    __dt_NormalTerm *term, const dt_index_type var[4],
+    __dt_ElementaryMatrix m, const __dt_ElementaryVector c,
+    dt_real_type weight);
+
+/* Append the variables of another term with equations of the same number
+   to term, making it weight * ||(m - m_other) * v - (c - c_other)||^2 */
+void __dt_SubtractNormalTerm(
+    __dt_NormalTerm *term, const __dt_NormalTerm *other);
+
+
+
+#endif /* __DT_NORMAL_EQUATION_HEADER__ */
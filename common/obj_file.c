@@ -5,186 +5,376 @@
 #include <stdio.h>
 
 #include "mesh_model.h"
+#include "file_map.h"
 
 
 
+/* The .obj file is mapped into memory and parsed in a single pass, vertices,
+   normal vectors and triangles are appended to growable arrays as they are
+   discovered and finally moved into the model structure. */
+
+/* A sequential list with reserved space, expands like std::vector */
+typedef struct __obj_growable_array_struct
+{
+    char  *data;
+    size_t length;      /* number of elements stored */
+    size_t capacity;    /* number of elements we have reserved space for */
+    size_t elem_size;   /* size of a single element in bytes */
+
+} __obj_growable_array;
+
+static void __array_create(
+    __obj_growable_array *arr, size_t elem_size, size_t capacity)
+{
+    arr->length    = 0;
+    arr->capacity  = capacity;
+    arr->elem_size = elem_size;
+    arr->data      = (char*)__dt_malloc(capacity * elem_size);
+}
+
+/* Reserve space for one more element at the tail of the array and return the
+   address of it, the space grows exponentially. NULL is returned if the array
+   could not grow, its elements are left intact. */
+static void *__array_append(__obj_growable_array *arr)
+{
+    char *data;
+
+    if (arr->length == arr->capacity)
+    {
+        data = (char*)realloc(arr->data, 2 * arr->capacity * arr->elem_size);
+        if (data == NULL) return NULL;
+
+        arr->data = data;
+        arr->capacity *= 2;
+    }
+
+    return arr->data + (arr->length++) * arr->elem_size;
+}
+
+
+/* Characters separating fields in a line, '\n' is not one of them because
+   records never span multiple lines. */
+static int __is_blank(char c) {
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f');
+}
+
+static int __is_digit(char c) {
+    return (c >= '0' && c <= '9');
+}
+
+/* Skip blank characters on current line */
+static const char *__skip_blanks(const char *p, const char *end)
+{
+    while (p < end && __is_blank(*p)) p++;
+    return p;
+}
+
 /* Skip current line / jump to the start of the next line */
-static void __skip_this_line(FILE *fd)
+static const char *__skip_this_line(const char *p, const char *end)
 {
-    /* **skip all characters until encountering an '\n'.**
+    const char *eol = (const char*)memchr(p, '\n', (size_t)(end - p));
+    return (eol != NULL)? eol + 1: end;
+}
+
+/* A number ends with a blank, a line break or the end of file */
+static int __is_token_end(const char *p, const char *end) {
+    return (p == end || __is_blank(*p) || *p == '\n');
+}
+
 
-       It might be **PAINFULLY SLOW**, but using fgets would mess up the code 
-       because you have to make sure that the entire line has been eventually 
-       read into the temporary buffer.
-    */
+/* Numbers we could not convert exactly in __scan_real are handed over to
+   strtod(), which needs a null-terminated copy of the token. */
+static int __scan_real_fallback(
+    const char *begin, const char *end, dt_real_type *val)
+{
+    char  buf[128], *str = buf, *str_end;
+    size_t len;
     int ret;
-    while ((ret = fgetc(fd)) != '\n' && ret != EOF);
+
+    len = (size_t)(end - begin);
+    if (len == 0) return 0;
+    if (len >= sizeof(buf)) {
+        str = (char*)__dt_malloc(len + 1);
+    }
+
+    memcpy(str, begin, len);
+    str[len] = '\0';
+
+    *val = strtod(str, &str_end);
+    ret = (str_end == str + len);   /* the whole token should be consumed */
+
+    if (str != buf) free(str);
+    return ret;
 }
 
-/* Count how many vertices, normal vectors and triangle surfaces were logged in
-   the .obj file. 
+/* Parse a decimal floating point number at *pp, *pp is moved to the end of
+   the number. It returns 1 on success or 0 on a malformed number.
 
-   This function returns the file pointer of the .obj file on success, or it
-   would return NULL to indicate an fopen() error. the user should check errno 
-   to investigate why it failed.
- */
-static FILE *__get_mesh_model_scale(
-    const char *filename, 
-    dt_size_type *n_vertex, dt_size_type *n_normvec, dt_size_type *n_triangle)
+   Numbers with no more than 19 significant digits and a moderate exponent are
+   converted with a single floating point multiplication or division, which is
+   exact as long as both the mantissa (< 2^53) and the power of ten (<= 1e22)
+   are exactly representable, so the result is always identical with what
+   strtod() or fscanf("%lf") would give us. Other numbers fall back to strtod.
+*/
+static int __scan_real(const char **pp, const char *end, dt_real_type *val)
 {
-    char pref[3];  /* we need only 2 characters to identify the prefixes */
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+        1e22
+    };
 
-    FILE *fd = fopen(filename, "r");
-    if (fd)
+    const char *p = __skip_blanks(*pp, end), *begin = p;
+
+    unsigned long long mantissa = 0;
+    int n_digit = 0, n_sigdigit = 0, inexact = 0;
+    int negative = 0, exponent = 0, exp_val = 0, exp_negative = 0;
+    double x;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p++ == '-');
+    }
+
+    /* integral part */
+    for ( ; p < end && __is_digit(*p); p++, n_digit++)
     {
-        *n_vertex = *n_normvec = *n_triangle = 0;
+        if (mantissa == 0 && *p == '0') continue;  /* leading zero */
+        if (n_sigdigit++ < 19) {
+            mantissa = mantissa * 10 + (unsigned)(*p - '0');
+        }
+        else {
+            exponent += 1;  inexact |= (*p != '0');  /* dropped digit */
+        }
+    }
 
-        /* inspect the prefix of each line:
-           #:comment   v:vertex   vn:norm vector   f:triangle */
-        while (fscanf(fd, "%2s", pref) != EOF)
+    /* fractional part */
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && __is_digit(*p); p++, n_digit++)
         {
-            if      (strcmp(pref, "v")  == 0)  *n_vertex   += 1;
-            else if (strcmp(pref, "vn") == 0)  *n_normvec  += 1;
-            else if (strcmp(pref, "f")  == 0)  *n_triangle += 1;
-            /* else if (*pref == '#');  <comment line>       */
-            /* else:                    <unexpected prefix>  */
+            if (mantissa == 0 && *p == '0') {
+                exponent -= 1;  continue;   /* leading zero */
+            }
+            if (n_sigdigit++ < 19) {
+                mantissa = mantissa * 10 + (unsigned)(*p - '0');
+                exponent -= 1;
+            }
+            else {
+                inexact |= (*p != '0');     /* dropped digit */
+            }
+        }
+    }
 
-            __skip_this_line(fd);
+    if (n_digit == 0)   /* inf, nan or something we don't understand */
+    {
+        while (!__is_token_end(p, end)) p++;
+        *pp = p;
+        return __scan_real_fallback(begin, p, val);
+    }
+
+    /* exponent part */
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        if (p < end && (*p == '-' || *p == '+')) {
+            exp_negative = (*p++ == '-');
         }
+        if (p == end || !__is_digit(*p)) return 0;
 
-        /* reset file pointer to the beginning, bcos ReadObjFile() will make a
-           second pass of the file and read the data into model structure. */
-        fseek(fd, SEEK_SET, 0);
+        for ( ; p < end && __is_digit(*p); p++) {
+            if (exp_val < 100000) exp_val = exp_val * 10 + (*p - '0');
+        }
+        exponent += (exp_negative? -exp_val: exp_val);
     }
-    else {
-        return NULL;   /* could not open file */
+
+    if (!__is_token_end(p, end)) return 0;
+    *pp = p;
+
+    if (mantissa == 0 && !inexact) {
+        *val = negative? -0.0: 0.0;
+        return 1;
+    }
+
+    if (!inexact && mantissa <= (1ULL << 53) &&
+        exponent >= -22 && exponent <= 22)
+    {
+        x = (double)mantissa;
+        x = (exponent < 0)? x / pow10[-exponent]: x * pow10[exponent];
+        *val = negative? -x: x;
+        return 1;
     }
 
-    return fd;
+    return __scan_real_fallback(begin, p, val);
 }
 
+/* Parse an one-based index of vertex, texture coordinate or normal vector.
+   It returns 1 on success or 0 if there's no valid index at *pp. */
+static int __scan_index(const char **pp, const char *end, dt_index_type *val)
+{
+    const char *p = *pp;
+    long ind = 0;
 
-/* ReadObjFile parse specified .obj model description file and read vertex, 
-   normal vector and triangular surface information into *model
+    if (p == end || !__is_digit(*p)) return 0;
 
-   This function returns 0 on success, otherwise it would return an -1 to 
-   indicate an fopen() error (file not exist, privillage or some reason).
-*/
-int ReadObjFile(const char *filename, dtMeshModel *model)
-{
-    char pref[3];   /* we need only 2 characters to identify the prefixes */
+    for ( ; p < end && __is_digit(*p); p++)
+    {
+        ind = ind * 10 + (*p - '0');
+        if (ind > INT_MAX) return 0;
+    }
+
+    *pp = p;  *val = (dt_index_type)ind;
+    return (ind > 0);   /* indexes in .obj files are one-based */
+}
 
-    dtVertex *vertex; dtVector *normvec; dtTriangle *triangle;
-    dt_index_type i_lv;
 
-    FILE *fd = __get_mesh_model_scale(
-        filename, &model->n_vertex, &model->n_normvec, &model->n_triangle);
+/* Parse 3 coordinate components of a vertex or a norm vector */
+static int __scan_vector(const char **pp, const char *end, dtVector *v)
+{
+    return
+        __scan_real(pp, end, &(v->x)) &&
+        __scan_real(pp, end, &(v->y)) &&
+        __scan_real(pp, end, &(v->z));
+}
+
+/* Parse a triangle, both "f v//n v//n v//n" and "f v/t/n v/t/n v/t/n" forms
+   are accepted, texture coordinates are ignored. */
+static int __scan_triangle(const char **pp, const char *end, dtTriangle *t)
+{
+    const char *p = *pp;
+    dt_index_type i_lv, i_texture;
 
-    if (fd)
+    for (i_lv = 0; i_lv < 3; i_lv++)
     {
-        /* allocate memory space for mesh model structure */
-        CreateMeshModel(model);
-        vertex   = model->vertex;
-        normvec  = model->normvec;
-        triangle = model->triangle;
-
-        /* parse .obj file */
-        while (fscanf(fd, "%2s", pref) != EOF)
-        {
-            if (strcmp(pref, "v") == 0)        /* vertex */
-            {
-                fscanf(fd, "%lf %lf %lf", 
-                    &(vertex->x), &(vertex->y), &(vertex->z));
-                vertex++;
-            }
-            else if (strcmp(pref, "vn") == 0)  /* norm vector */
-            {
-                fscanf(fd, "%lf %lf %lf",
-                    &(normvec->x), &(normvec->y), &(normvec->z));
-                normvec++;
-            }
-            else if (strcmp(pref, "f") == 0)   /* triangle */
-            {
-                /* vertex/normvec indexes in .obj file are one-based, we have 
-                   to convert them to zero-based array indexes latter */
-
-                /* fscanf(fd, "%d//%d %d//%d %d//%d", */
-                /*     &(triangle->i_vertex[0]), &(triangle->i_norm[0]), */
-                /*     &(triangle->i_vertex[1]), &(triangle->i_norm[1]), */
-                /*     &(triangle->i_vertex[2]), &(triangle->i_norm[2])); */
-                for (i_lv = 0; i_lv < 3; i_lv++)
-                {
-                    fscanf(fd, "%d/", &(triangle->i_vertex[i_lv]));
-                    if ((pref[0] = (char)fgetc(fd)) != '/') {
-                        ungetc(pref[0], fd);  fscanf(fd, "%*d/");
-                    }
-                    fscanf(fd, "%d", &(triangle->i_norm[i_lv]));
-                }
-
-                /* one-based .obj file index => zero-based array index */
-                triangle->i_vertex[0]--, triangle->i_norm[0]--;
-                triangle->i_vertex[1]--, triangle->i_norm[1]--;
-                triangle->i_vertex[2]--, triangle->i_norm[2]--;
-
-                triangle++;
-            }
-            else if (*pref == '#')             /* comment line */
-                __skip_this_line(fd);
+        p = __skip_blanks(p, end);
+
+        /* vertex index */
+        if (!__scan_index(&p, end, &(t->i_vertex[i_lv])))  return 0;
+        if (p == end || *p++ != '/')                      return 0;
 
-            else  __skip_this_line(fd);        /* ignore other informations */
+        /* optional texture coordinate index */
+        if (p < end && *p != '/' && !__scan_index(&p, end, &i_texture)) {
+            return 0;
         }
+        if (p == end || *p++ != '/')                      return 0;
+
+        /* normal vector index */
+        if (!__scan_index(&p, end, &(t->i_norm[i_lv])))    return 0;
+        if (!__is_token_end(p, end))                       return 0;
 
-        fclose(fd);
-        return 0;
+        /* one-based .obj file index => zero-based array index */
+        t->i_vertex[i_lv]--;  t->i_norm[i_lv]--;
     }
-    else {
-        return -1; /* fopen() error propagated from __get_mesh_model_scale() */
+
+    *pp = p;
+    return 1;
+}
+
+
+/* Move parsed elements into a newly created model structure */
+static int __build_mesh_model(
+    __obj_growable_array *vertex, __obj_growable_array *normvec,
+    __obj_growable_array *triangle, dtMeshModel *model)
+{
+    model->n_vertex   = (dt_size_type)vertex->length;
+    model->n_normvec  = (dt_size_type)normvec->length;
+    model->n_triangle = (dt_size_type)triangle->length;
+
+    CreateMeshModel(model);
+    if (model->vertex == NULL) {
+        return -1;   /* out of memory */
     }
+
+    memcpy(model->vertex,   vertex->data,   vertex->length * sizeof(dtVertex));
+    memcpy(model->normvec,  normvec->data,  normvec->length * sizeof(dtVector));
+    memcpy(model->triangle, triangle->data,
+           triangle->length * sizeof(dtTriangle));
+    return 0;
 }
 
 
-/* SaveObjFile saves specified mesh model to a file, it would return 0 on 
-   success, otherwise it would return -1 to indicate fopen() was failed.
-   You should check system variable errno for further investigation.
+/* ReadObjFile parse specified .obj model description file and read vertex,
+   normal vector and triangular surface information into *model
+
+   This function returns 0 on success, -1 to indicate an open() error (file
+   not exist, privillage or some reason) or running out of memory, or a
+   positive line number where a syntax error was found.
 */
-int SaveObjFile(const char *filename, const dtMeshModel *model)
+int ReadObjFile(const char *filename, dtMeshModel *model)
 {
-    const  dtVertex   *vertex   = model->vertex;
-    const  dtVector   *normvec  = model->normvec;
-    const  dtTriangle *triangle = model->triangle;
-    dt_index_type ind;
+    __dt_FileMapping map;
+    __obj_growable_array vertex, normvec, triangle;
+
+    const char *p, *end;
+    void *elem;
+    int i_line = 1, ret = 0;
+    size_t reserve;
+
+    if (__dt_MapFile(filename, &map) != 0) {
+        return -1;   /* could not open file */
+    }
+
+    /* an initial guess of model scale, lines are rarely shorter than this */
+    reserve = map.size / 128 + 16;
+    __array_create(&vertex,   sizeof(dtVertex),   reserve);
+    __array_create(&normvec,  sizeof(dtVector),   reserve);
+    __array_create(&triangle, sizeof(dtTriangle), reserve);
+
+    /* out of memory, reported as -1 with errno set by malloc() */
+    if (vertex.data == NULL || normvec.data == NULL || triangle.data == NULL) {
+        ret = -1;
+    }
 
-    FILE *fd = fopen(filename, "w");
-    if (fd != NULL)
+    /* inspect the prefix of each line:
+       #:comment   v:vertex   vn:norm vector   f:triangle */
+    for (p = map.base, end = p + map.size; ret == 0 && p < end; i_line++)
     {
-        /* save vertex information */
-        for (ind = 0; ind < model->n_vertex; ind++, vertex++) {
-            fprintf(fd, "v   %12.9f   %12.9f   %12.9f\n", 
-                vertex->x, vertex->y, vertex->z);
+        p = __skip_blanks(p, end);
+
+        if (end - p >= 2 && p[0] == 'v' && __is_blank(p[1]))  /* vertex */
+        {
+            p += 1;
+            if ((elem = __array_append(&vertex)) == NULL) {
+                ret = -1;  break;
+            }
+            if (!__scan_vector(&p, end, (dtVertex*)elem)) {
+                ret = i_line;  break;
+            }
         }
-    
-        /* save normal vector information */
-        for (ind = 0; ind < model->n_normvec; ind++, normvec++) {
-            fprintf(fd, "vn   %12.9f   %12.9f   %12.9f\n", 
-                normvec->x, normvec->y, normvec->z);
+        else if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' &&   /* normal */
+                 __is_blank(p[2]))
+        {
+            p += 2;
+            if ((elem = __array_append(&normvec)) == NULL) {
+                ret = -1;  break;
+            }
+            if (!__scan_vector(&p, end, (dtVector*)elem)) {
+                ret = i_line;  break;
+            }
         }
-
-        /* save triangular unit information 
-           
-           Notice that vertex/normvec indexes in .obj file are one-based, so
-           they need a incrementation before being written to filestream. */
-        for (ind = 0; ind < model->n_triangle; ind++, triangle++)
+        else if (end - p >= 2 && p[0] == 'f' && __is_blank(p[1]))  /* face */
         {
-            fprintf(fd, "f %d//%d %d//%d %d//%d\n",
-                triangle->i_vertex[0] + 1, triangle->i_norm[0] + 1,
-                triangle->i_vertex[1] + 1, triangle->i_norm[1] + 1,
-                triangle->i_vertex[2] + 1, triangle->i_norm[2] + 1);
+            p += 1;
+            if ((elem = __array_append(&triangle)) == NULL) {
+                ret = -1;  break;
+            }
+            if (!__scan_triangle(&p, end, (dtTriangle*)elem)) {
+                ret = i_line;  break;
+            }
         }
+        /* else if (*p == '#');  <comment line>
+           else:                 <unexpected prefix, ignore this line> */
 
-        fclose(fd);
-        return 0;
+        p = __skip_this_line(p, end);
     }
-    else {
-        return -1;
+
+    /* ret is the line number where parsing stopped at a syntax error, or -1
+       if we ran out of memory */
+    if (ret == 0) {
+        ret = __build_mesh_model(&vertex, &normvec, &triangle, model);
     }
+
+    free(vertex.data);  free(normvec.data);  free(triangle.data);
+    __dt_UnmapFile(&map);
+
+    return ret;
 }
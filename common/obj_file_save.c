@@ -0,0 +1,239 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+
+#include "mesh_model.h"
+
+
+
+/* .obj files are formatted into a large buffer which is handed over to the
+   kernel with a single write() whenever it is about to fill up. Numbers are
+   converted by hand, the output is byte for byte identical with what
+   fprintf("%12.9f") and fprintf("%d") used to produce. */
+
+#define __OBJ_WRITE_BUFSIZ  (1 << 20)
+
+/* No line we write is longer than this: a "%12.9f" field of the largest
+   double is about 320 characters long. */
+#define __OBJ_MAX_LINE      1024
+
+
+typedef struct __obj_writer_struct
+{
+    int    fd;
+    char  *buf;
+    size_t len;     /* number of bytes buffered */
+    int    error;   /* a write() failed, errno tells why */
+
+} __obj_writer;
+
+
+/* Write all buffered bytes to the file */
+static void __writer_flush(__obj_writer *w)
+{
+    const char *p = w->buf;
+    ssize_t n;
+
+    while (w->len > 0 && !w->error)
+    {
+        n = write(w->fd, p, w->len);
+        if (n < 0) {
+            if (errno != EINTR) w->error = 1;
+            continue;
+        }
+        p += n;  w->len -= (size_t)n;
+    }
+    w->len = 0;
+}
+
+/* Make sure there's room for another line and return the end of buffer */
+static char *__writer_reserve_line(__obj_writer *w)
+{
+    if (w->len + __OBJ_MAX_LINE > __OBJ_WRITE_BUFSIZ) {
+        __writer_flush(w);
+    }
+    return w->buf + w->len;
+}
+
+/* Commit the line which has been written to the buffer up to p */
+static void __writer_commit(__obj_writer *w, char *p) {
+    w->len = (size_t)(p - w->buf);
+}
+
+
+/* Append decimal digits of an unsigned number to p, return the end */
+static char *__format_uint(char *p, unsigned long long n)
+{
+    char digits[24];
+    int  n_digit = 0;
+
+    do {
+        digits[n_digit++] = (char)('0' + n % 10);  n /= 10;
+    } while (n != 0);
+
+    while (n_digit > 0) *p++ = digits[--n_digit];
+    return p;
+}
+
+/* Same as sprintf(p, "%d", n) */
+static char *__format_int(char *p, int n)
+{
+    if (n < 0) {
+        *p++ = '-';
+        return __format_uint(p, (unsigned long long)(-(long long)n));
+    }
+    return __format_uint(p, (unsigned long long)n);
+}
+
+/* Same as sprintf(p, "%12.9f", x)
+
+   x*1e9 is rounded to an integer which is then printed as a fixed point
+   number with 9 decimals. 1e9 is exact, so the product differs from the
+   exact value by half an ulp at most, which is less than 2^-11 as long as
+   the product is below 2^42. The rounding direction of the product is then
+   the same as that of the exact value unless it lies within 2^-9 of a tie,
+   those rare numbers (and the really large ones, inf and nan) are left to
+   snprintf.
+*/
+static char *__format_real(char *p, double x)
+{
+    double a = fabs(x) * 1e9, r;
+    unsigned long long n, int_part;
+    char digits[24];
+    int  n_digit = 0, len;
+
+    if (!(a < 4398046511104.0) ||     /* 2^42, nan fails this test as well */
+        fabs((a - floor(a)) - 0.5) < 1.0 / 512)
+    {
+        return p + snprintf(p, __OBJ_MAX_LINE / 3, "%12.9f", x);
+    }
+
+    r = floor(a);
+    n = (unsigned long long)r + ((a - r) > 0.5);
+    int_part = n / 1000000000ULL;
+
+    do {
+        digits[n_digit++] = (char)('0' + int_part % 10);  int_part /= 10;
+    } while (int_part != 0);
+
+    /* right justified in a field of 12 characters, negative zero keeps its
+       sign as it does in printf */
+    len = n_digit + 10 + (signbit(x)? 1: 0);
+    for ( ; len < 12; len++) *p++ = ' ';
+    if (signbit(x)) *p++ = '-';
+
+    while (n_digit > 0) *p++ = digits[--n_digit];
+    *p++ = '.';
+
+    n %= 1000000000ULL;
+    for (n_digit = 8; n_digit >= 0; n_digit--, n /= 10) {
+        p[n_digit] = (char)('0' + n % 10);
+    }
+    return p + 9;
+}
+
+/* Append a line of "<prefix>   %12.9f   %12.9f   %12.9f\n" */
+static void __write_vector(
+    __obj_writer *w, const char *prefix, size_t prefix_len,
+    const dtVector *v)
+{
+    char *p = __writer_reserve_line(w);
+
+    memcpy(p, prefix, prefix_len);  p += prefix_len;
+    memcpy(p, "   ", 3);  p = __format_real(p + 3, v->x);
+    memcpy(p, "   ", 3);  p = __format_real(p + 3, v->y);
+    memcpy(p, "   ", 3);  p = __format_real(p + 3, v->z);
+    *p++ = '\n';
+
+    __writer_commit(w, p);
+}
+
+/* Append a line of "f %d//%d %d//%d %d//%d\n", or "f %d %d %d\n" if normal
+   vectors are not written */
+static void __write_triangle(
+    __obj_writer *w, const dtTriangle *triangle, int with_normvec)
+{
+    char *p = __writer_reserve_line(w);
+    int iv;
+
+    *p++ = 'f';
+    for (iv = 0; iv < 3; iv++)
+    {
+        *p++ = ' ';
+        p = __format_int(p, triangle->i_vertex[iv] + 1);
+        if (with_normvec) {
+            *p++ = '/';  *p++ = '/';
+            p = __format_int(p, triangle->i_norm[iv] + 1);
+        }
+    }
+    *p++ = '\n';
+
+    __writer_commit(w, p);
+}
+
+
+/* SaveObjFile_Ex saves specified mesh model to a file, flags is a combination
+   of __DT_OBJ_OMIT_NORMVEC and __DT_OBJ_OMIT_TRIANGLE or 0. It would return 0
+   on success, otherwise it would return -1 to indicate open() or write() was
+   failed. You should check system variable errno for further investigation.
+*/
+int SaveObjFile_Ex(const char *filename, const dtMeshModel *model, int flags)
+{
+    const  dtVertex   *vertex   = model->vertex;
+    const  dtVector   *normvec  = model->normvec;
+    const  dtTriangle *triangle = model->triangle;
+    dt_index_type ind;
+
+    int with_normvec = !(flags & __DT_OBJ_OMIT_NORMVEC);
+    __obj_writer w;
+
+    w.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (w.fd == -1) {
+        return -1;
+    }
+
+    w.buf   = (char*)__dt_malloc(__OBJ_WRITE_BUFSIZ);
+    w.len   = 0;
+    w.error = 0;
+
+    /* save vertex information */
+    for (ind = 0; ind < model->n_vertex; ind++, vertex++) {
+        __write_vector(&w, "v", 1, vertex);
+    }
+
+    /* save normal vector information */
+    for (ind = 0; with_normvec && ind < model->n_normvec; ind++, normvec++) {
+        __write_vector(&w, "vn", 2, normvec);
+    }
+
+    /* save triangular unit information
+
+       Notice that vertex/normvec indexes in .obj file are one-based, so
+       they need a incrementation before being written to filestream. */
+    for (ind = 0; !(flags & __DT_OBJ_OMIT_TRIANGLE) &&
+                  ind < model->n_triangle; ind++, triangle++)
+    {
+        __write_triangle(&w, triangle, with_normvec);
+    }
+
+    __writer_flush(&w);
+    free(w.buf);
+
+    if (close(w.fd) != 0) w.error = 1;
+    return w.error? -1: 0;
+}
+
+/* SaveObjFile saves specified mesh model to a file, it would return 0 on
+   success, otherwise it would return -1 to indicate open() or write() was
+   failed. You should check system variable errno for further investigation.
+*/
+int SaveObjFile(const char *filename, const dtMeshModel *model)
+{
+    return SaveObjFile_Ex(filename, model, 0);
+}
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <unistd.h>    /* for sysconf */
+#include <pthread.h>
+
+#include "parallel_for.h"
+
+
+
+/* what a thread of __dt_ParallelFor runs */
+typedef struct __dt_ParallelTask_struct
+{
+    __dt_ParallelBody body;
+    void *data;
+    int i_thread;
+    dt_index_type begin, end;
+
+} __dt_ParallelTask;
+
+static void* __parallel_task_routine(void *arg)
+{
+    __dt_ParallelTask *task = (__dt_ParallelTask*)arg;
+    task->body(task->data, task->i_thread, task->begin, task->end);
+    return NULL;
+}
+
+
+/* Number of processors online, or 1 if it can't be told */
+int __dt_DefaultThreadCount(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 1)? (int)n: 1;
+}
+
+/* Run iterations [0, n) of body with n_thread threads */
+void __dt_ParallelFor(
+    dt_index_type n, int n_thread, __dt_ParallelBody body, void *data)
+{
+    __dt_ParallelTask *task;
+    pthread_t *thread;
+    int i, *started;
+
+    if (n_thread > n) n_thread = (int)n;
+    if (n_thread <= 1)
+    {
+        body(data, 0, 0, n);
+        return;
+    }
+
+    task    = (__dt_ParallelTask*)__dt_malloc(
+        (size_t)n_thread * sizeof(__dt_ParallelTask));
+    thread  = (pthread_t*)__dt_malloc((size_t)n_thread * sizeof(pthread_t));
+    started = (int*)__dt_malloc((size_t)n_thread * sizeof(int));
+
+    for (i = 0; i < n_thread; i++)
+    {
+        task[i].body     = body;
+        task[i].data     = data;
+        task[i].i_thread = i;
+        task[i].begin    = (dt_index_type)((long long)n * i / n_thread);
+        task[i].end      = (dt_index_type)((long long)n * (i + 1) / n_thread);
+    }
+
+    /* the calling thread takes the first range, a range whose thread can't
+       be created is run here as well */
+    for (i = 1; i < n_thread; i++) {
+        started[i] = (pthread_create(
+            thread + i, NULL, __parallel_task_routine, task + i) == 0);
+    }
+
+    __parallel_task_routine(task);
+    for (i = 1; i < n_thread; i++)
+    {
+        if (started[i]) pthread_join(thread[i], NULL);
+        else __parallel_task_routine(task + i);
+    }
+
+    free(task);
+    free(thread);
+    free(started);
+}
+
+
+/* chunks of __dt_ParallelFor_Dynamic not taken yet */
+typedef struct __dt_ChunkQueue_struct
+{
+    pthread_mutex_t lock;
+    dt_index_type next, n, chunk_size;
+
+    __dt_ParallelBody body;
+    void *data;
+
+} __dt_ChunkQueue;
+
+/* each thread takes chunks until there's none left */
+static void __chunk_worker(
+    void *data, int i_thread, dt_index_type begin, dt_index_type end)
+{
+    __dt_ChunkQueue *queue = (__dt_ChunkQueue*)data;
+    dt_index_type chunk_begin, chunk_end;
+
+    /* [begin, end) is just the slot of this thread, chunks come from the
+       queue */
+    (void)begin;  (void)end;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&(queue->lock));
+        chunk_begin  = queue->next;
+        queue->next += (chunk_begin < queue->n)? queue->chunk_size: 0;
+        pthread_mutex_unlock(&(queue->lock));
+
+        if (chunk_begin >= queue->n) break;
+        chunk_end = (queue->n - chunk_begin > queue->chunk_size)?
+            chunk_begin + queue->chunk_size: queue->n;
+
+        queue->body(queue->data, i_thread, chunk_begin, chunk_end);
+    }
+}
+
+/* Run iterations [0, n) of body chunk by chunk with n_thread threads */
+void __dt_ParallelFor_Dynamic(
+    dt_index_type n, dt_index_type chunk_size, int n_thread,
+    __dt_ParallelBody body, void *data)
+{
+    __dt_ChunkQueue queue;
+    dt_index_type n_chunk;
+
+    if (chunk_size < 1) chunk_size = 1;
+    n_chunk = (n + chunk_size - 1) / chunk_size;
+    if (n_thread > n_chunk) n_thread = (int)n_chunk;
+
+    pthread_mutex_init(&(queue.lock), NULL);
+    queue.next       = 0;
+    queue.n          = n;
+    queue.chunk_size = chunk_size;
+    queue.body       = body;
+    queue.data       = data;
+
+    /* a worker for each thread, iteration i of this loop is thread i */
+    __dt_ParallelFor(n_thread, n_thread, __chunk_worker, &queue);
+
+    pthread_mutex_destroy(&(queue.lock));
+}
@@ -0,0 +1,38 @@
+#ifndef __DT_PARALLEL_FOR_HEADER__
+#define __DT_PARALLEL_FOR_HEADER__
+
+
+#include "dt_type.h"
+
+
+/* Loops with independent iterations, like querying a 3d tree for every
+   vertex of a model, are split into n_thread contiguous ranges of about the
+   same size, each of them run by a thread of its own. Thread i_thread runs
+   body(data, i_thread, begin, end) for iterations [begin, end), and ranges
+   of smaller i_thread come first, so results collected per thread could be
+   merged back in the order of the serial loop.
+*/
+typedef void (*__dt_ParallelBody)(
+    void *data, int i_thread, dt_index_type begin, dt_index_type end);
+
+/* Number of processors online, or 1 if it can't be told */
+int __dt_DefaultThreadCount(void);
+
+/* Run iterations [0, n) of body with n_thread threads and wait for them to
+   finish, n_thread <= 1 runs the whole loop on the calling thread. */
+void __dt_ParallelFor(
+    dt_index_type n, int n_thread, __dt_ParallelBody body, void *data);
+
+/* The same as __dt_ParallelFor for loops whose iterations take very
+   different time: iterations are cut into chunks of chunk_size, which
+   threads take one after another as they finish the last one. Chunk k is
+   [k*chunk_size, (k+1)*chunk_size), so results collected per chunk could
+   still be merged in order, and i_thread tells which thread runs it, for
+   buffers of its own. */
+void __dt_ParallelFor_Dynamic(
+    dt_index_type n, dt_index_type chunk_size, int n_thread,
+    __dt_ParallelBody body, void *data);
+
+
+
+#endif /* __DT_PARALLEL_FOR_HEADER__ */
@@ -0,0 +1,302 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "dt_type.h"
+#include "pcg.h"
+
+
+
+/* y = A*x, A is stored in full or only its upper part */
+void __dt_SymmetricMatVec(cholmod_sparse *A, const double *x, double *y)
+{
+    const int    *Ap = (const int*)A->p, *Ai = (const int*)A->i;
+    const double *Ax = (const double*)A->x;
+    int i, j, k, n = (int)A->ncol;
+
+    memset(y, 0, (size_t)n * sizeof(double));
+
+    for (j = 0; j < n; j++)
+    {
+        for (k = Ap[j]; k < Ap[j+1]; k++)
+        {
+            i = Ai[k];
+            y[i] += Ax[k] * x[j];
+
+            /* mirror the upper part to the lower one */
+            if (A->stype > 0 && i != j) y[j] += Ax[k] * x[i];
+        }
+    }
+}
+
+static double __dot(const double *a, const double *b, int n)
+{
+    double s = 0;
+    int i;
+    for (i = 0; i < n; i++) s += a[i] * b[i];
+    return s;
+}
+
+
+/* Solve A*x = b for a single column b with preconditioned CG */
+int __dt_PCG_solve(
+    cholmod_sparse *A, const double *b, double *x,
+    __dt_PCG_Preconditioner precond, void *data,
+    double tol, int max_iter)
+{
+    int n = (int)A->nrow, i, iter = 0;
+    double *work, *r, *z, *p, *q;
+    double rz, rz_next, alpha, b_norm, r_norm;
+
+    /* the relative tolerance can't be met for b = 0, whose solution is 0 */
+    b_norm = sqrt(__dot(b, b, n));
+    if (b_norm == 0)
+    {
+        memset(x, 0, (size_t)n * sizeof(double));
+        return 0;
+    }
+
+    work = (double*)__dt_malloc(4 * (size_t)n * sizeof(double));
+    r = work;  z = work + n;  p = work + 2*n;  q = work + 3*n;
+
+    /* r = b - A*x */
+    __dt_SymmetricMatVec(A, x, q);
+    for (i = 0; i < n; i++) r[i] = b[i] - q[i];
+
+    r_norm = sqrt(__dot(r, r, n));
+
+    if (precond != NULL) precond(data, r, z);
+    else memcpy(z, r, (size_t)n * sizeof(double));
+
+    memcpy(p, z, (size_t)n * sizeof(double));
+    rz = __dot(r, z, n);
+
+    while (r_norm > tol * b_norm && iter < max_iter)
+    {
+        /* step along p */
+        __dt_SymmetricMatVec(A, p, q);
+        alpha = rz / __dot(p, q, n);
+        for (i = 0; i < n; i++)
+        {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+        }
+        r_norm = sqrt(__dot(r, r, n));
+        iter++;
+
+        if (r_norm <= tol * b_norm) break;
+
+        /* next search direction, A-conjugate to the previous ones */
+        if (precond != NULL) precond(data, r, z);
+        else memcpy(z, r, (size_t)n * sizeof(double));
+
+        rz_next = __dot(r, z, n);
+        for (i = 0; i < n; i++) p[i] = z[i] + (rz_next / rz) * p[i];
+        rz = rz_next;
+    }
+
+    free(work);
+    return (r_norm <= tol * b_norm)? iter: -1;
+}
+
+/* Solve A*X = B column by column, every column is solved even if some of
+   them fail to converge */
+int __dt_PCG_solve_dense(
+    cholmod_sparse *A, cholmod_dense *B, cholmod_dense *X,
+    __dt_PCG_Preconditioner precond, void *data,
+    double tol, int max_iter)
+{
+    int n_iter, max_n_iter = 0, failed = 0;
+    size_t j;
+
+    for (j = 0; j < B->ncol; j++)
+    {
+        n_iter = __dt_PCG_solve(A,
+            (const double*)B->x + j * B->d, (double*)X->x + j * X->d,
+            precond, data, tol, max_iter);
+
+        if (n_iter < 0) failed = 1;
+        else if (n_iter > max_n_iter) max_n_iter = n_iter;
+    }
+
+    return failed? -1: max_n_iter;
+}
+
+
+
+/* copy the upper part of A (diagonal included) to Rp, Ri, Rx */
+static void __copy_upper_part(cholmod_sparse *A, __dt_Preconditioner *M)
+{
+    const int    *Ap = (const int*)A->p, *Ai = (const int*)A->i;
+    const double *Ax = (const double*)A->x;
+    int j, k, nnz = 0, n = (int)A->ncol;
+
+    M->Rp = (int*)__dt_malloc(((size_t)n + 1) * sizeof(int));
+    for (j = 0; j < n; j++)
+    {
+        M->Rp[j] = nnz;
+        for (k = Ap[j]; k < Ap[j+1]; k++) nnz += (Ai[k] <= j);
+    }
+    M->Rp[n] = nnz;
+
+    M->Ri = (int*)__dt_malloc(((size_t)nnz + 1) * sizeof(int));
+    M->Rx = (double*)__dt_malloc(((size_t)nnz + 1) * sizeof(double));
+    for (j = 0, nnz = 0; j < n; j++)
+    {
+        for (k = Ap[j]; k < Ap[j+1]; k++)
+        {
+            if (Ai[k] <= j) {
+                M->Ri[nnz] = Ai[k];  M->Rx[nnz] = Ax[k];  nnz++;
+            }
+        }
+    }
+}
+
+/* IC(0) in place on the upper part of A with its diagonal scaled by
+   1 + shift, row by row of L = R': row j of L is column j of R, whose rows
+   are sorted and end with the diagonal. It returns -1 on a breakdown. */
+static int __incomplete_cholesky(__dt_Preconditioner *M, double shift)
+{
+    int *Rp = M->Rp, *Ri = M->Ri, n = (int)M->n;
+    double *Rx = M->Rx, s, d;
+    int j, k, p, q, p_end, q_end, i;
+
+    for (j = 0; j < n; j++)
+    {
+        p_end = Rp[j+1] - 1;  /* the diagonal, if the column has one */
+        if (p_end < Rp[j] || Ri[p_end] != j) return -1;
+
+        /* R(i,j) = (A(i,j) - sum_m R(m,i)*R(m,j)) / R(i,i), i < j */
+        for (k = Rp[j]; k < p_end; k++)
+        {
+            i = Ri[k];
+            q_end = Rp[i+1] - 1;
+
+            /* merge column i (rows < i) with column j (rows < i) */
+            for (s = 0, p = Rp[j], q = Rp[i]; p < k && q < q_end; )
+            {
+                if      (Ri[p] < Ri[q]) p++;
+                else if (Ri[p] > Ri[q]) q++;
+                else    s += Rx[p++] * Rx[q++];
+            }
+
+            Rx[k] = (Rx[k] - s) / Rx[q_end];
+        }
+
+        /* R(j,j) = sqrt(A(j,j) - sum_m R(m,j)^2) */
+        for (s = 0, p = Rp[j]; p < p_end; p++) s += Rx[p] * Rx[p];
+        d = Rx[p_end] * (1 + shift) - s;
+        if (!(d > 0)) return -1;
+        Rx[p_end] = sqrt(d);
+    }
+
+    return 0;
+}
+
+/* inverse of the diagonal of A, 1 where it's missing or zero */
+static void __jacobi(cholmod_sparse *A, __dt_Preconditioner *M)
+{
+    const int    *Ap = (const int*)A->p, *Ai = (const int*)A->i;
+    const double *Ax = (const double*)A->x;
+    size_t j;
+    int k;
+
+    M->type = __DT_PRECOND_JACOBI;
+    M->inv_diag = (double*)__dt_malloc(M->n * sizeof(double));
+    for (j = 0; j < M->n; j++)
+    {
+        M->inv_diag[j] = 1.0;
+        for (k = Ap[j]; k < Ap[j+1]; k++) {
+            if (Ai[k] == (int)j && Ax[k] != 0) M->inv_diag[j] = 1.0 / Ax[k];
+        }
+    }
+}
+
+/* IC(0) breaks down on some SPD matrices, we then factorize A with its
+   diagonal scaled by 1 + shift instead, doubling the shift from
+   __DT_IC0_SHIFT until it succeeds, or settle for Jacobi after
+   __DT_IC0_MAX_SHIFT attempts */
+#define __DT_IC0_SHIFT      1e-3
+#define __DT_IC0_MAX_SHIFT  10
+
+void __dt_CreatePreconditioner(
+    cholmod_sparse *A, int type, __dt_Preconditioner *M)
+{
+    double shift, *Ax;
+    int i_shift;
+
+    M->type = type;
+    M->n    = A->ncol;
+    M->inv_diag = NULL;
+    M->Rp = M->Ri = NULL;  M->Rx = NULL;
+
+    if (type == __DT_PRECOND_JACOBI) {
+        __jacobi(A, M);
+    }
+    else if (type == __DT_PRECOND_IC0)
+    {
+        __copy_upper_part(A, M);
+
+        /* keep the values of A for another attempt */
+        Ax = (double*)__dt_malloc(((size_t)M->Rp[M->n] + 1) * sizeof(double));
+        memcpy(Ax, M->Rx, (size_t)M->Rp[M->n] * sizeof(double));
+
+        for (i_shift = 0, shift = 0;
+             __incomplete_cholesky(M, shift) != 0;
+             i_shift++, shift = (shift == 0)? __DT_IC0_SHIFT: 2 * shift)
+        {
+            if (i_shift == __DT_IC0_MAX_SHIFT)
+            {
+                free(M->Rp);  free(M->Ri);  free(M->Rx);
+                M->Rp = M->Ri = NULL;  M->Rx = NULL;
+                __jacobi(A, M);
+                break;
+            }
+            memcpy(M->Rx, Ax, (size_t)M->Rp[M->n] * sizeof(double));
+        }
+
+        free(Ax);
+    }
+}
+
+void __dt_DestroyPreconditioner(__dt_Preconditioner *M)
+{
+    free(M->inv_diag);
+    free(M->Rp);  free(M->Ri);  free(M->Rx);
+}
+
+/* z = inv(M) * r */
+void __dt_ApplyPreconditioner(void *data, const double *r, double *z)
+{
+    const __dt_Preconditioner *M = (const __dt_Preconditioner*)data;
+    const int *Rp = M->Rp, *Ri = M->Ri;
+    const double *Rx = M->Rx;
+    int j, k, n = (int)M->n;
+    double s;
+
+    switch (M->type)
+    {
+    case __DT_PRECOND_JACOBI:
+        for (j = 0; j < n; j++) z[j] = M->inv_diag[j] * r[j];
+        break;
+
+    case __DT_PRECOND_IC0:
+        /* R' * y = r, column j of R is row j of R' */
+        for (j = 0; j < n; j++)
+        {
+            for (s = r[j], k = Rp[j]; k < Rp[j+1] - 1; k++) s -= Rx[k] * z[Ri[k]];
+            z[j] = s / Rx[Rp[j+1] - 1];
+        }
+
+        /* R * z = y */
+        for (j = n - 1; j >= 0; j--)
+        {
+            z[j] /= Rx[Rp[j+1] - 1];
+            for (k = Rp[j]; k < Rp[j+1] - 1; k++) z[Ri[k]] -= Rx[k] * z[j];
+        }
+        break;
+
+    default:
+        memcpy(z, r, (size_t)n * sizeof(double));
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef __DT_PCG_HEADER__
+#define __DT_PCG_HEADER__
+
+
+#include "cholmod_wrapper.h"
+
+
+/* Preconditioned conjugate gradient for the symmetric positive definite
+   normal equations At*A * x = b. It takes a handful of sparse matrix-vector
+   products and preconditioner applications instead of a factorization, so
+   it pays off when a good preconditioner is at hand, e.g. the factor of a
+   closely related matrix.
+*/
+
+
+/* Apply the preconditioner: z = inv(M) * r, both of length n */
+typedef void (*__dt_PCG_Preconditioner)(
+    void *data, const double *r, double *z);
+
+
+/* Solve A*x = b for a single column b, A is stored in full or only its upper
+   part (A->stype > 0), b and x are arrays of A->nrow and x holds the initial
+   guess on entry. precond could be NULL for plain conjugate gradient.
+
+   It stops as soon as ||b - A*x|| <= tol * ||b||, returning the number of
+   iterations taken, or -1 if it doesn't converge in max_iter iterations, in
+   which case x is the last iterate. x is set to 0 right away if b is 0. */
+int __dt_PCG_solve(
+    cholmod_sparse *A, const double *b, double *x,
+    __dt_PCG_Preconditioner precond, void *data,
+    double tol, int max_iter);
+
+/* Solve A*X = B column by column, X holds the initial guess on entry. It
+   returns the maximum number of iterations taken by a column, or -1 if any
+   of them doesn't converge. The other columns are solved all the same. */
+int __dt_PCG_solve_dense(
+    cholmod_sparse *A, cholmod_dense *B, cholmod_dense *X,
+    __dt_PCG_Preconditioner precond, void *data,
+    double tol, int max_iter);
+
+/* y = A*x, A is stored in full or only its upper part */
+void __dt_SymmetricMatVec(cholmod_sparse *A, const double *x, double *y);
+
+
+/* Preconditioners built from A itself, type is one of __DT_PRECOND_NONE,
+   __DT_PRECOND_JACOBI or __DT_PRECOND_IC0 (see cholmod_wrapper.h). Both of
+   them take memory linear in nnz(A):
+
+       Jacobi   the inverse of the diagonal of A
+       IC(0)    incomplete Cholesky factorization A ~ R'*R, R is upper
+                triangular with the pattern of the upper part of A. If it
+                breaks down, the diagonal of A is shifted up a bit, M->type
+                turns to Jacobi if even that doesn't help.
+*/
+typedef struct __dt_Preconditioner_struct
+{
+    int     type;
+    size_t  n;
+    double *inv_diag;             /* Jacobi */
+    int    *Rp, *Ri;  double *Rx; /* IC(0): R in compressed column form */
+
+} __dt_Preconditioner;
+
+void __dt_CreatePreconditioner(
+    cholmod_sparse *A, int type, __dt_Preconditioner *M);
+
+void __dt_DestroyPreconditioner(__dt_Preconditioner *M);
+
+/* z = inv(M) * r, data points to a __dt_Preconditioner, which could be
+   passed to __dt_PCG_solve as it is */
+void __dt_ApplyPreconditioner(void *data, const double *r, double *z);
+
+
+
+#endif /* __DT_PCG_HEADER__ */
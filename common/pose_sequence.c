@@ -0,0 +1,283 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mesh_model.h"
+#include "checksum.h"
+#include "binary_file.h"
+#include "pose_sequence.h"
+
+
+
+/* .dts pose sequence file layout:
+
+   [header (64 bytes)]=>[vertex|norm_vector|triangle]=>[frame 0][frame 1]...
+
+   The reference model is stored in the same layout as in a .dtm file, each
+   frame is an array of n_vertex*3 coordinates in dt_real_type or float32.
+   The number of frames in the header is updated when the sequence is closed.
+*/
+
+#define __DTS_VERSION          1
+
+#define __DTS_FLOAT32          0x1u    /* frames are encoded in float32 */
+
+static const char __dts_magic[4] = { 'D', 'T', 'S', '\x1a' };
+
+
+typedef struct __dts_Header_struct
+{
+    /* "DTS\x1a", __DTS_VERSION, flags: __DTS_FLOAT32 or 0 */
+    __dt_BinaryFileTag tag;
+
+    int32_t  n_vertex;        /* reference model */
+    int32_t  n_normvec;
+    int32_t  n_triangle;
+    int32_t  n_frame;         /* number of frames following the reference */
+
+    uint32_t reserved0;
+    uint64_t checksum;        /* hash of the reference model arrays */
+    uint64_t reserved[2];     /* pads the header to 64 bytes */
+
+} __dts_Header;
+
+typedef char __dts_header_size_check[sizeof(__dts_Header) == 64? 1: -1];
+
+
+/* Pose sequence files are named with a .dts extension */
+int __dt_IsPoseSequenceFilename(const char *filename)
+{
+    return __dt_HasFileExtension(filename, ".dts");
+}
+
+
+/* size of the arrays of the reference model in bytes */
+static size_t __reference_size(const dtMeshModel *model)
+{
+    return
+        (size_t)model->n_vertex   * sizeof(dtVertex) +
+        (size_t)model->n_normvec  * sizeof(dtVector) +
+        (size_t)model->n_triangle * sizeof(dtTriangle);
+}
+
+/* size of a single frame in bytes */
+static size_t __frame_size(const dtPoseSequence *seq)
+{
+    return (size_t)seq->reference.n_vertex * 3 *
+        (seq->use_float? sizeof(float): sizeof(dt_real_type));
+}
+
+/* Checksum of the reference model, arrays are chained in storage order */
+static __dt_Hash64 __reference_checksum(const dtMeshModel *model)
+{
+    __dt_Hash64 h = __dt_Checksum64(
+        model->vertex, (size_t)model->n_vertex * sizeof(dtVertex), 0);
+    h = __dt_Checksum64(
+        model->normvec, (size_t)model->n_normvec * sizeof(dtVector), h);
+    return __dt_Checksum64(
+        model->triangle, (size_t)model->n_triangle * sizeof(dtTriangle), h);
+}
+
+
+/* Allocate the float32 conversion buffer if it is needed */
+static void __alloc_buffer(dtPoseSequence *seq)
+{
+    seq->buffer = seq->use_float?
+        __dt_malloc((size_t)seq->reference.n_vertex * 3 * sizeof(float)):
+        NULL;
+}
+
+
+/* Open a pose sequence file for reading, the reference model is loaded into
+   seq->reference. It returns 0 on success, -1 to indicate an open()/read()
+   error or -2 to indicate a corrupted or incompatible file.
+*/
+int OpenPoseSequence(const char *filename, dtPoseSequence *seq)
+{
+    __dts_Header header;
+    struct stat st;
+    size_t ref_size;
+
+    if ((seq->fp = fopen(filename, "rb")) == NULL) {
+        return -1;
+    }
+
+    if (fstat(fileno(seq->fp), &st) == -1) {
+        fclose(seq->fp);  return -1;
+    }
+
+    if (fread(&header, sizeof(header), 1, seq->fp) != 1 ||
+        !__dt_CheckBinaryFileTag(&(header.tag), __dts_magic, __DTS_VERSION) ||
+        header.n_vertex < 0 || header.n_normvec < 0 ||
+        header.n_triangle < 0 || header.n_frame < 0)
+    {
+        fclose(seq->fp);  return -2;
+    }
+
+    seq->reference.n_vertex   = header.n_vertex;
+    seq->reference.n_normvec  = header.n_normvec;
+    seq->reference.n_triangle = header.n_triangle;
+
+    seq->n_frame   = header.n_frame;
+    seq->i_frame   = 0;
+    seq->use_float = (header.tag.flags & __DTS_FLOAT32) != 0;
+    seq->writing   = 0;
+
+    /* the file should be exactly as long as the header claims */
+    ref_size = __reference_size(&(seq->reference));
+    if ((size_t)st.st_size != sizeof(header) + ref_size +
+            (size_t)seq->n_frame * __frame_size(seq))
+    {
+        fclose(seq->fp);  return -2;
+    }
+
+    /* arrays of the reference model are contiguous in both file and memory */
+    CreateMeshModel(&(seq->reference));
+    if (fread(seq->reference.vertex, 1, ref_size, seq->fp) != ref_size ||
+        __reference_checksum(&(seq->reference)) != header.checksum)
+    {
+        DestroyMeshModel(&(seq->reference));
+        fclose(seq->fp);  return -2;
+    }
+
+    __alloc_buffer(seq);
+    return 0;
+}
+
+/* Read the next frame into specified vertex array. It returns 0 on success,
+   -1 on read error or 1 if there's no more frames. */
+int ReadPoseSequenceFrame(dtPoseSequence *seq, dtVertex *vertex)
+{
+    size_t n_real = (size_t)seq->reference.n_vertex * 3, i;
+    dt_real_type *dst = (dt_real_type*)vertex;
+    const float  *src = (const float*)seq->buffer;
+
+    if (seq->i_frame == seq->n_frame) {
+        return 1;   /* end of sequence */
+    }
+
+    if (seq->use_float)
+    {
+        if (fread(seq->buffer, sizeof(float), n_real, seq->fp) != n_real)
+            return -1;
+        for (i = 0; i < n_real; i++) {
+            dst[i] = (dt_real_type)src[i];
+        }
+    }
+    else if (fread(dst, sizeof(dt_real_type), n_real, seq->fp) != n_real) {
+        return -1;
+    }
+
+    seq->i_frame++;
+    return 0;
+}
+
+
+/* Write the header of a new sequence */
+static int __write_header(dtPoseSequence *seq)
+{
+    __dts_Header header;
+
+    memset(&header, 0, sizeof(header));
+    __dt_InitBinaryFileTag(&(header.tag), __dts_magic, __DTS_VERSION,
+        seq->use_float? __DTS_FLOAT32: 0);
+    header.n_vertex     = seq->reference.n_vertex;
+    header.n_normvec    = seq->reference.n_normvec;
+    header.n_triangle   = seq->reference.n_triangle;
+    header.n_frame      = 0;
+    header.checksum     = __reference_checksum(&(seq->reference));
+
+    return (fwrite(&header, sizeof(header), 1, seq->fp) == 1)? 0: -1;
+}
+
+/* Create a pose sequence file with specified reference model. It returns 0
+   on success, or -1 to indicate fopen()/fwrite() failed. */
+int CreatePoseSequence(
+    const char *filename, const dtMeshModel *reference, int use_float,
+    dtPoseSequence *seq)
+{
+    const dtMeshModel *ref = reference;
+    int ok;
+
+    if ((seq->fp = fopen(filename, "wb")) == NULL) {
+        return -1;
+    }
+
+    seq->reference = *reference;
+    seq->n_frame   = 0;
+    seq->i_frame   = 0;
+    seq->use_float = use_float;
+    seq->writing   = 1;
+
+    /* arrays of the reference model may not be contiguous */
+    ok =
+        __write_header(seq) == 0 &&
+        fwrite(ref->vertex, sizeof(dtVertex),
+               (size_t)ref->n_vertex, seq->fp) == (size_t)ref->n_vertex &&
+        fwrite(ref->normvec, sizeof(dtVector),
+               (size_t)ref->n_normvec, seq->fp) == (size_t)ref->n_normvec &&
+        fwrite(ref->triangle, sizeof(dtTriangle),
+               (size_t)ref->n_triangle, seq->fp) == (size_t)ref->n_triangle;
+
+    if (!ok) {
+        fclose(seq->fp);  return -1;
+    }
+
+    __alloc_buffer(seq);
+    return 0;
+}
+
+/* Append a frame to the sequence. It returns 0 on success, or -1 to indicate
+   fwrite() failed. */
+int AppendPoseSequenceFrame(dtPoseSequence *seq, const dtVertex *vertex)
+{
+    size_t n_real = (size_t)seq->reference.n_vertex * 3, i;
+    const dt_real_type *src = (const dt_real_type*)vertex;
+    float *dst = (float*)seq->buffer;
+
+    if (seq->use_float)
+    {
+        for (i = 0; i < n_real; i++) {
+            dst[i] = (float)src[i];
+        }
+        if (fwrite(dst, sizeof(float), n_real, seq->fp) != n_real)
+            return -1;
+    }
+    else if (fwrite(src, sizeof(dt_real_type), n_real, seq->fp) != n_real) {
+        return -1;
+    }
+
+    seq->n_frame++;  seq->i_frame++;
+    return 0;
+}
+
+/* Close a pose sequence, the number of frames is written back to the file
+   header if it was opened for writing. The reference model might have been
+   modified by the caller since then, so the rest of the header is left as
+   it is. */
+int ClosePoseSequence(dtPoseSequence *seq)
+{
+    int32_t n_frame = seq->n_frame;
+    int ret = 0;
+
+    if (seq->writing)
+    {
+        if (fseek(seq->fp, offsetof(__dts_Header, n_frame), SEEK_SET) != 0 ||
+            fwrite(&n_frame, sizeof(n_frame), 1, seq->fp) != 1)
+        {
+            ret = -1;
+        }
+    }
+    else {
+        DestroyMeshModel(&(seq->reference));
+    }
+
+    if (fclose(seq->fp) != 0) ret = -1;
+    free(seq->buffer);
+
+    return ret;
+}
@@ -0,0 +1,71 @@
+#ifndef __DT_POSE_SEQUENCE_HEADER__
+#define __DT_POSE_SEQUENCE_HEADER__
+
+
+#include <stdio.h>
+#include "dt_type.h"
+
+
+/* A pose sequence (.dts file) stores a reference model once, followed by any
+   number of frames made up with nothing but the n_vertex*3 coordinates of a
+   deformed pose. All frames share the normal vectors and triangles of the
+   reference model. Frame coordinates are encoded either in dt_real_type or
+   in float32 to halve the size of long animation batches.
+
+   A sequence is opened either for reading (OpenPoseSequence) or for writing
+   (CreatePoseSequence), frames are read or appended one at a time so the
+   sequence never has to fit in memory.
+*/
+typedef struct __dt_PoseSequence_struct
+{
+    dtMeshModel reference;    /* reference model stored in the sequence, it
+                                 is a shallow copy of the caller's model
+                                 when writing */
+    dt_size_type n_frame;     /* number of frames in the sequence */
+    dt_index_type i_frame;    /* index of the next frame to read/append */
+
+    int   use_float;          /* frames are encoded in float32 */
+    int   writing;            /* opened by CreatePoseSequence */
+    FILE *fp;
+
+    void *buffer;             /* conversion buffer for float32 frames */
+
+} dtPoseSequence;
+
+
+/* Open a pose sequence file for reading, the reference model is loaded into
+   seq->reference. It returns 0 on success, -1 to indicate an open()/read()
+   error or -2 if the file is truncated, fails the checksum or was written on
+   a machine with different byte order or type sizes.
+*/
+int OpenPoseSequence(const char *filename, dtPoseSequence *seq);
+
+/* Read the next frame into specified vertex array, which should be large
+   enough to hold seq->reference.n_vertex vertices. It returns 0 on success,
+   -1 on read error or 1 if there's no more frames. */
+int ReadPoseSequenceFrame(dtPoseSequence *seq, dtVertex *vertex);
+
+/* Create a pose sequence file with specified reference model, frames would
+   be encoded in float32 if use_float is nonzero. It returns 0 on success, or
+   -1 to indicate fopen()/fwrite() failed. */
+int CreatePoseSequence(
+    const char *filename, const dtMeshModel *reference, int use_float,
+    dtPoseSequence *seq);
+
+/* Append a frame to the sequence, vertex is an array of
+   seq->reference.n_vertex vertices. It returns 0 on success, or -1 to
+   indicate fwrite() failed. */
+int AppendPoseSequenceFrame(dtPoseSequence *seq, const dtVertex *vertex);
+
+/* Close a pose sequence, the number of frames is written back to the file
+   header if it was opened for writing. It returns 0 on success, or -1 to
+   indicate the file could not be completed. */
+int ClosePoseSequence(dtPoseSequence *seq);
+
+
+/* Pose sequence files are named with a .dts extension */
+int __dt_IsPoseSequenceFilename(const char *filename);
+
+
+
+#endif /* __DT_POSE_SEQUENCE_HEADER__ */
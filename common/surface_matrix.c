@@ -33,26 +33,60 @@ static void __calculate_phantom_vertex(
     __3dvector_sqrt_norm(v3);    /* replace v3 with v4 = sqrtnorm(v3) */
 }
 
+/* edges of specified triangle unit: u = v2 - v1 and v = v3 - v1 */
+static __inline__ void __triangle_edges(
+    const dtMeshGeometry *geom, dt_index_type i_triangle,
+    dt_real_type *u, dt_real_type *v)
+{
+    const dtTriangle *surf = geom->triangle + i_triangle;
+    const dt_real_type *c;
+    const float *cf;
+
+    size_t stride = (size_t)geom->stride;
+    size_t i1 = (size_t)surf->i_vertex[0] * stride;
+    size_t i2 = (size_t)surf->i_vertex[1] * stride;
+    size_t i3 = (size_t)surf->i_vertex[2] * stride;
+    int i_dim;
+
+    /* precision is checked once for all coordinates */
+    if (geom->use_float)
+    {
+        for (i_dim = 0; i_dim < 3; i_dim++)
+        {
+            cf = geom->coordf[i_dim];
+            u[i_dim] = (dt_real_type)cf[i2] - (dt_real_type)cf[i1];
+            v[i_dim] = (dt_real_type)cf[i3] - (dt_real_type)cf[i1];
+        }
+    }
+    else
+    {
+        for (i_dim = 0; i_dim < 3; i_dim++)
+        {
+            c = geom->coord[i_dim];
+            u[i_dim] = c[i2] - c[i1];
+            v[i_dim] = c[i3] - c[i1];
+        }
+    }
+}
+
 /* Calculate unnormalized normal vector of specified triangle unit */
 dtVector __dt_CalculateTriangleUnitNorm(
     const dtMeshModel *model, dt_index_type i_triangle)
 {
-    dtVector   ret;
-    dtTriangle *surf = model->triangle + i_triangle;
-    dtVertex   *v_l, *v_r = model->vertex + surf->i_vertex[0];
+    dtMeshGeometry geom;
 
-    dt_real_type u[3], v[3];  /* u = v1 - v0, v = v2 - v0 */
-
-    v_l = model->vertex + surf->i_vertex[1];
-    u[0] = v_l->x - v_r->x;
-    u[1] = v_l->y - v_r->y;
-    u[2] = v_l->z - v_r->z;
+    ViewMeshGeometry(model, &geom);
+    return __dt_CalculateTriangleUnitNorm_Geometry(&geom, i_triangle);
+}
 
-    v_l = model->vertex + surf->i_vertex[2];
-    v[0] = v_l->x - v_r->x;
-    v[1] = v_l->y - v_r->y;
-    v[2] = v_l->z - v_r->z;
+/* The same as __dt_CalculateTriangleUnitNorm, on a mesh geometry */
+dtVector __dt_CalculateTriangleUnitNorm_Geometry(
+    const dtMeshGeometry *geom, dt_index_type i_triangle)
+{
+    dtVector ret;
+    dt_real_type u[3], v[3];  /* u = v1 - v0, v = v2 - v0 */
 
+    __triangle_edges(geom, i_triangle, u, v);
     __3dvector_cross_product(u, v, &(ret.x) /* a bad hack */);
     return ret;
 }
@@ -70,28 +104,37 @@ dtVector __dt_CalculateTriangleUnitNorm(
 void __dt_CalculateTriangleUnitMatrix(
     const dtMeshModel *model, dt_index_type i_triangle, dtMatrix3x3 V)
 {
-    dtTriangle *surf = model->triangle + i_triangle;
+    dtMeshGeometry geom;
+
+    ViewMeshGeometry(model, &geom);
+    __dt_CalculateTriangleUnitMatrix_Geometry(&geom, i_triangle, V);
+}
+
+/* surface matrix of a triangle of a mesh geometry, it's inlined into the
+   loop over all triangles */
+static __inline__ void __triangle_unit_matrix(
+    const dtMeshGeometry *geom, dt_index_type i_triangle, dtMatrix3x3 V)
+{
     dt_real_type v2_1[3], v3_1[3], v4[3];   /* v2 - v1, v3 - v1, v4 */
-    dtVertex *v_l, *v_r;
-
-    /* first column: v2 - v1 */
-    v_l = model->vertex + surf->i_vertex[1];
-    v_r = model->vertex + surf->i_vertex[0];
-    V[0][0] = v2_1[0] = v_l->x - v_r->x;
-    V[1][0] = v2_1[1] = v_l->y - v_r->y;
-    V[2][0] = v2_1[2] = v_l->z - v_r->z;
-
-    /* second column: v3 - v1 */
-    v_l = model->vertex + surf->i_vertex[2];
-    V[0][1] = v3_1[0] = v_l->x - v_r->x;
-    V[1][1] = v3_1[1] = v_l->y - v_r->y;
-    V[2][1] = v3_1[2] = v_l->z - v_r->z;
-
-    /* third column: v4 */
+    int i_dim;
+
+    __triangle_edges(geom, i_triangle, v2_1, v3_1);
     __calculate_phantom_vertex(v2_1, v3_1, v4);
-    V[0][2] = v4[0];
-    V[1][2] = v4[1];
-    V[2][2] = v4[2];
+
+    /* columns: v2 - v1, v3 - v1, v4 */
+    for (i_dim = 0; i_dim < 3; i_dim++)
+    {
+        V[i_dim][0] = v2_1[i_dim];
+        V[i_dim][1] = v3_1[i_dim];
+        V[i_dim][2] = v4[i_dim];
+    }
+}
+
+/* The same as __dt_CalculateTriangleUnitMatrix, on a mesh geometry */
+void __dt_CalculateTriangleUnitMatrix_Geometry(
+    const dtMeshGeometry *geom, dt_index_type i_triangle, dtMatrix3x3 V)
+{
+    __triangle_unit_matrix(geom, i_triangle, V);
 }
 
 
@@ -99,19 +142,29 @@ void __dt_CalculateTriangleUnitMatrix(
    units in the specified model */
 void __dt_InitializeSurfaceInvVList(
     const dtMeshModel *model, __dt_SurfaceInvVList *sinvlist)
+{
+    dtMeshGeometry geom;
+
+    ViewMeshGeometry(model, &geom);
+    __dt_InitializeSurfaceInvVList_Geometry(&geom, sinvlist);
+}
+
+/* The same as __dt_InitializeSurfaceInvVList, on a mesh geometry */
+void __dt_InitializeSurfaceInvVList_Geometry(
+    const dtMeshGeometry *geom, __dt_SurfaceInvVList *sinvlist)
 {
     dt_index_type i_surf = 0;  /* looping index for triangle units */
 
     /* initialize sinvlist and allocate memory space for it */
-    sinvlist->list_length = model->n_triangle;
+    sinvlist->list_length = geom->n_triangle;
     sinvlist->inV = (dtMatrix3x3*)__dt_malloc(
         (size_t)sinvlist->list_length * sizeof(dtMatrix3x3));
 
     /* calculate the surface matrix and its inverse of each triangle unit 
        in the model and save them into sinvlist. */
-    for ( ; i_surf < model->n_triangle; i_surf++)
+    for ( ; i_surf < geom->n_triangle; i_surf++)
     {
-        __dt_CalculateTriangleUnitMatrix(model, i_surf, sinvlist->inV[i_surf]);
+        __triangle_unit_matrix(geom, i_surf, sinvlist->inV[i_surf]);
         __dt_InverseMatrix3x3(sinvlist->inV[i_surf]);
     }
 }
@@ -3,6 +3,7 @@
 
 
 #include "matrix3x3.h"
+#include "mesh_geometry.h"
 
 
 /* Each triangle unit has a unique corresponding matrix: assume that the 
@@ -21,12 +22,20 @@
 dtVector __dt_CalculateTriangleUnitNorm(
     const dtMeshModel *model, dt_index_type i_triangle);
 
+/* The same as __dt_CalculateTriangleUnitNorm, on a mesh geometry */
+dtVector __dt_CalculateTriangleUnitNorm_Geometry(
+    const dtMeshGeometry *geom, dt_index_type i_triangle);
+
 
 /* Calculate the surface matrix of triangle unit indexed i_triangle in model,
    the result is written to parameter V. */
 void __dt_CalculateTriangleUnitMatrix(
     const dtMeshModel *model, dt_index_type i_triangle, dtMatrix3x3 V);
 
+/* The same as __dt_CalculateTriangleUnitMatrix, on a mesh geometry */
+void __dt_CalculateTriangleUnitMatrix_Geometry(
+    const dtMeshGeometry *geom, dt_index_type i_triangle, dtMatrix3x3 V);
+
 
 /* A list containing INVERSE of surface matrices of all triangle units in a 
    mesh model. Precalculating these matrices all at once would eliminate lots 
@@ -47,6 +56,10 @@ typedef struct __dt_SurfaceInvVList_struct
 void __dt_InitializeSurfaceInvVList(
     const dtMeshModel *model, __dt_SurfaceInvVList *sinvlist);
 
+/* The same as __dt_InitializeSurfaceInvVList, on a mesh geometry */
+void __dt_InitializeSurfaceInvVList_Geometry(
+    const dtMeshGeometry *geom, __dt_SurfaceInvVList *sinvlist);
+
 /* Release memory spaces allocated for sinvlist */
 void __dt_DestroySurfaceInvVList(__dt_SurfaceInvVList *sinvlist);
 
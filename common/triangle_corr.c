@@ -1,7 +1,9 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "triangle_corr.h"
+#include "file_map.h"
 
 
 /* Create an triangle correspondence list containing no entries, but has some
@@ -10,6 +12,10 @@ void __dt_CreateEmptyTriangleCorrsList(__dt_TriangleCorrsList *tclist)
 {
     tclist->list_length   = 0;
     tclist->list_capacity = 8;   /* reserve space for coming entries */
+    tclist->sorted        = 0;
+    tclist->n_maxcorrs    = 0;
+    tclist->mapped_base   = NULL;
+    tclist->mapped_size   = 0;
 
     /* allocate for reserved space (capacity) */
     tclist->corr = (__dt_TriangleCorrsEntry*)__dt_malloc(
@@ -29,15 +35,62 @@ void __dt_CreateTriangleCorrsList(
     {
         tclist->list_length   = length;
         tclist->list_capacity = length;  /* no additional space reserved */
+        tclist->sorted        = 0;
+        tclist->n_maxcorrs    = 0;
+        tclist->mapped_base   = NULL;
+        tclist->mapped_size   = 0;
         tclist->corr = (__dt_TriangleCorrsEntry*)
             __dt_malloc((size_t)length * sizeof(__dt_TriangleCorrsEntry));
     }
 }
 
+/* Release the storage of entries, either heap memory or a file mapping */
+static void __tricorrs_release(__dt_TriangleCorrsList *tclist)
+{
+    __dt_FileMapping map;
+
+    if (tclist->mapped_base != NULL)
+    {
+        map.base = (char*)tclist->mapped_base;
+        map.size = tclist->mapped_size;
+        __dt_UnmapFile(&map);
+    }
+    else {
+        free(tclist->corr);
+    }
+
+    tclist->mapped_base = NULL;
+    tclist->mapped_size = 0;
+}
+
+/* Resize the storage to list_capacity entries, entries living in a mapped
+   file are moved to the heap */
+static void __tricorrs_reserve(__dt_TriangleCorrsList *tclist)
+{
+    __dt_TriangleCorrsEntry *corr;
+
+    if (tclist->mapped_base != NULL)
+    {
+        corr = (__dt_TriangleCorrsEntry*)__dt_malloc(
+            (size_t)tclist->list_capacity * sizeof(__dt_TriangleCorrsEntry));
+        memcpy(corr, tclist->corr, 
+            (size_t)tclist->list_length * sizeof(__dt_TriangleCorrsEntry));
+
+        __tricorrs_release(tclist);
+        tclist->corr = corr;
+    }
+    else
+    {
+        tclist->corr = (__dt_TriangleCorrsEntry*)
+            realloc(tclist->corr, (size_t)tclist->list_capacity * 
+                sizeof(__dt_TriangleCorrsEntry));
+    }
+}
+
 /* Free up the triangle correspondence list */
 void __dt_DestroyTriangleCorrsList(__dt_TriangleCorrsList *tclist)
 {
-    free(tclist->corr);
+    __tricorrs_release(tclist);
 }
 
 /* Append a triangle correspondence entry to the tail of the list */
@@ -48,12 +101,33 @@ void __dt_AppendTriangleCorrsEntry(
     if ((tclist->list_length) == tclist->list_capacity)
     {
         tclist->list_capacity *= 2;  /* space grow exponentially */
-        tclist->corr = (__dt_TriangleCorrsEntry*)
-            realloc(tclist->corr, (size_t)tclist->list_capacity * 
-                sizeof(__dt_TriangleCorrsEntry));
+        __tricorrs_reserve(tclist);
     }
 
     tclist->corr[tclist->list_length++] = *entry;
+    tclist->sorted     = 0;
+    tclist->n_maxcorrs = 0;
+}
+
+/* Append all entries of another list to the tail of the list at once */
+void __dt_AppendTriangleCorrsList(
+    __dt_TriangleCorrsList *tclist, const __dt_TriangleCorrsList *other)
+{
+    dt_size_type length = tclist->list_length + other->list_length;
+
+    /* expand space just like appending the entries one by one */
+    if (length > tclist->list_capacity)
+    {
+        tclist->list_capacity = (2 * tclist->list_capacity > length)?
+            2 * tclist->list_capacity: length;
+        __tricorrs_reserve(tclist);
+    }
+
+    memcpy(tclist->corr + tclist->list_length, other->corr,
+        (size_t)other->list_length * sizeof(__dt_TriangleCorrsEntry));
+    tclist->list_length = length;
+    tclist->sorted      = 0;
+    tclist->n_maxcorrs  = 0;
 }
 
 /* Routine for qsort to compare 2 triangle correspondence entries. We want to 
@@ -78,15 +152,97 @@ static int __tricorrs_entry_compare(const void *_e0, const void *_e1)
     }
 }
 
+/* Groups of entries of the same target triangle no larger than this are
+   sorted by insertion, larger ones go to qsort */
+#define __DT_TRICORRS_INSERTION_SORT  32
+
+/* sort n entries of the same target triangle by distance */
+static void __tricorrs_sort_group(
+    __dt_TriangleCorrsEntry *corr, dt_size_type n)
+{
+    __dt_TriangleCorrsEntry entry;
+    dt_index_type i, j;
+
+    if (n > __DT_TRICORRS_INSERTION_SORT)
+    {
+        qsort(corr, (size_t)n, 
+            sizeof(__dt_TriangleCorrsEntry), __tricorrs_entry_compare);
+        return;
+    }
+
+    for (i = 1; i < n; i++)
+    {
+        entry = corr[i];
+        for (j = i; j > 0 && 
+             __tricorrs_entry_compare(&corr[j-1], &entry) > 0; j--) {
+            corr[j] = corr[j-1];
+        }
+        corr[j] = entry;
+    }
+}
+
 /* Sort the list to ascending order of i_tgt_triangle then strip out duplicated
    entries */
 void __dt_SortUniqueTriangleCorrsList(__dt_TriangleCorrsList *tclist)
 {
-    int i_load, i_store = 0;
+    __dt_TriangleCorrsEntry *grouped;
+    dt_index_type *group_end;   /* end of the entries of each target triangle */
+    dt_index_type  i_load, i_store = 0, i_tgt, n_tgt = 0, begin;
+    int in_order = 1;
+
+    if (tclist->sorted || tclist->list_length == 0) {
+        tclist->sorted = 1;
+        return;
+    }
 
-    /* sort */
-    qsort(tclist->corr, (size_t)tclist->list_length, 
-        sizeof(__dt_TriangleCorrsEntry), __tricorrs_entry_compare);
+    /* range of target triangles, lists stripped before they're saved are
+       usually in order already */
+    for (i_load = 0; i_load < tclist->list_length; i_load++)
+    {
+        i_tgt = tclist->corr[i_load].i_tgt_triangle;
+        if (i_tgt >= n_tgt) n_tgt = i_tgt + 1;
+
+        if (i_load > 0 && __tricorrs_entry_compare(
+                &tclist->corr[i_load - 1], &tclist->corr[i_load]) >= 0) {
+            in_order = 0;
+        }
+    }
+
+    if (in_order) {
+        tclist->sorted = 1;
+        return;
+    }
+
+    /* counting sort on i_tgt_triangle, which keeps the entries of a target
+       triangle in their original order */
+    group_end = (dt_index_type*)__dt_malloc(
+        ((size_t)n_tgt + 1) * sizeof(dt_index_type));
+    grouped   = (__dt_TriangleCorrsEntry*)__dt_malloc(
+        (size_t)tclist->list_length * sizeof(__dt_TriangleCorrsEntry));
+
+    memset(group_end, 0, ((size_t)n_tgt + 1) * sizeof(dt_index_type));
+    for (i_load = 0; i_load < tclist->list_length; i_load++) {
+        group_end[tclist->corr[i_load].i_tgt_triangle + 1]++;
+    }
+    for (i_tgt = 1; i_tgt <= n_tgt; i_tgt++) {
+        group_end[i_tgt] += group_end[i_tgt - 1];
+    }
+    for (i_load = 0; i_load < tclist->list_length; i_load++) {
+        grouped[group_end[tclist->corr[i_load].i_tgt_triangle]++] = 
+            tclist->corr[i_load];
+    }
+
+    /* groups are short, especially when n_maxcorrs was used in the search */
+    for (begin = 0, i_tgt = 0; i_tgt < n_tgt; i_tgt++)
+    {
+        __tricorrs_sort_group(grouped + begin, group_end[i_tgt] - begin);
+        begin = group_end[i_tgt];
+    }
+
+    free(group_end);
+    __tricorrs_release(tclist);
+    tclist->corr = grouped;
+    tclist->list_capacity = tclist->list_length;
 
     /* uniq */
     for (i_load = 1; i_load < tclist->list_length; i_load++)
@@ -101,6 +257,7 @@ void __dt_SortUniqueTriangleCorrsList(__dt_TriangleCorrsList *tclist)
 
     /* uniqued list length: where we stored the last item */
     tclist->list_length = i_store + 1;
+    tclist->sorted = 1;
 }
 
 /* Our automatic optimal region selector in corres_resolve picked up a 
@@ -119,6 +276,10 @@ void __dt_StripTriangleCorrsList(
     /* tclist is sorted and uniqued to make the coming step easier */
     __dt_SortUniqueTriangleCorrsList(tclist);
 
+    /* nothing to strip if it's empty or stripped to no more entries */
+    if (tclist->list_length == 0 ||
+        (tclist->n_maxcorrs != 0 && tclist->n_maxcorrs <= n_maxcorrs)) return;
+
     /* strip out redundant entries with just a linear scan (O(n)). */
     for ( ; i_load < tclist->list_length; i_load++)
     {
@@ -141,6 +302,7 @@ void __dt_StripTriangleCorrsList(
     }
 
     tclist->list_length = i_store + 1;
+    tclist->n_maxcorrs  = n_maxcorrs;
 }
 
 
@@ -185,7 +347,14 @@ int __dt_LoadTriangleCorrsList(
     const char *filename, __dt_TriangleCorrsList *tclist)
 {
     int i_entry = 0, n_entry = 0;
-    FILE *fd = fopen(filename, "r");
+    FILE *fd;
+
+    /* binary files are mapped rather than parsed */
+    if (__dt_IsBinaryTriangleCorrsFile(filename)) {
+        return __dt_LoadTriangleCorrsList_Binary(filename, NULL, NULL, tclist);
+    }
+
+    fd = fopen(filename, "r");
 
     if (fd != NULL)
     {
@@ -2,6 +2,7 @@
 #define __DT_TRIANGLE_CORRESPONDENCE_HEADER__
 
 #include "dt_type.h"
+#include "mesh_geometry.h"
 
 
 /* Once the source model has been properly deformed into the target model, we
@@ -26,6 +27,12 @@ typedef struct __dt_TriangleCorrsEntry_struct
                                  triangle units */
 } __dt_TriangleCorrsEntry;
 
+/* Only the nearest few source triangles of a target triangle are kept in
+   the correspondence, this is how many. corres_resolve searches no more
+   than this many of them and dtrans strips any extra ones loaded. */
+#define __DT_N_MAXCORRS  3
+
+
 /* List of triangle correspondences: a bunch of source-target index pairs
    src0  tgt0
    src1  tgt1
@@ -39,6 +46,22 @@ typedef struct __dt_TriangleCorrsList_struct
     /* list of triangle correspondences */
     __dt_TriangleCorrsEntry *corr;
 
+    /* non-zero if the entries are known to be sorted and uniqued, as
+       __dt_SortUniqueTriangleCorrsList leaves them, appending to the list
+       clears it */
+    int sorted;
+
+    /* if not 0, no target triangle has more entries than this, as left by
+       __dt_StripTriangleCorrsList. Appending to the list clears it too. */
+    dt_size_type n_maxcorrs;
+
+    /* Storage of corr: NULL if it's allocated on the heap, otherwise the
+       private mapping of a binary .tricorrs file it lives in, which is
+       unmapped on destruction. The entries are copied to the heap before
+       the list grows. */
+    void  *mapped_base;
+    size_t mapped_size;
+
 } __dt_TriangleCorrsList;
 
 
@@ -60,8 +83,13 @@ void __dt_DestroyTriangleCorrsList(__dt_TriangleCorrsList *tclist);
 void __dt_AppendTriangleCorrsEntry(
     __dt_TriangleCorrsList *tclist, const __dt_TriangleCorrsEntry *entry);
 
+/* Append all entries of another list to the tail of the list at once */
+void __dt_AppendTriangleCorrsList(
+    __dt_TriangleCorrsList *tclist, const __dt_TriangleCorrsList *other);
+
 /* Sort the list to ascending order of i_tgt_triangle then strip out duplicated
-   entries */
+   entries. Entries are grouped by target triangle in linear time, then each
+   group is sorted by distance. Lists flagged as sorted are left untouched. */
 void __dt_SortUniqueTriangleCorrsList(__dt_TriangleCorrsList *tclist);
 
 
@@ -69,6 +97,10 @@ void __dt_SortUniqueTriangleCorrsList(__dt_TriangleCorrsList *tclist);
    This function would create a new triangle correspondence list object so you
    do not need to call __dt_CreateTriangleCorrsList() before calling this 
    function, or you'll suffer from a memory leak.
+
+   Both the text format and the binary format are accepted, they're told
+   apart by the first bytes of the file. -2 is returned for a corrupted or
+   incompatible binary file.
 */
 int __dt_LoadTriangleCorrsList(
     const char *filename, __dt_TriangleCorrsList *tclist);
@@ -86,6 +118,41 @@ int __dt_SaveTriangleCorrsList(
     const char *filename, const __dt_TriangleCorrsList *tclist);
 
 
+/* Binary .tricorrs files store the entries sorted and grouped by target
+   triangle, followed by the offset of each group, which is exactly how a
+   __dt_TriangleCorrsDict lays them out. The header records the number of
+   triangles and a hash of the triangles of both models, and whether the
+   entries were stripped. These routines are implemented in
+   tricorrs_file.c.
+*/
+
+/* Tell if a file is a binary .tricorrs file by its first bytes */
+int __dt_IsBinaryTriangleCorrsFile(const char *filename);
+
+/* Load a binary .tricorrs file, the file is mapped into memory and the
+   entries are used in place. If source or target is not NULL, the file has
+   to be made for a model with the same triangles. Either way every entry
+   has to refer to triangles within the counts recorded in the file.
+
+   This function returns 0 on success, -1 to indicate an open()/mmap() error,
+   or -2 to indicate a corrupted or incompatible file.
+*/
+int __dt_LoadTriangleCorrsList_Binary(
+    const char *filename,
+    const dtMeshModel *source, const dtMeshModel *target,
+    __dt_TriangleCorrsList *tclist);
+
+/* Save the triangle correspondences between source and target model to a
+   binary .tricorrs file, the entries are sorted first if they're not. It
+   returns 0 on success, -1 to indicate an fopen()/fwrite() error, or -2 if
+   an entry is out of the range of source or target triangles.
+*/
+int __dt_SaveTriangleCorrsList_Binary(
+    const char *filename,
+    const dtMeshModel *source, const dtMeshModel *target,
+    const __dt_TriangleCorrsList *tclist);
+
+
 /* Resolving triangle correspondence by comparing the centroids of the deformed
    source and target triangles. Two triangles are compatible if their centroids
    are within a certain threshold of each other and the angle between their 
@@ -97,12 +164,41 @@ void __dt_ResolveTriangleCorres(
     const dtMeshModel *deformed_source, const dtMeshModel *target, 
     dt_real_type threshold, __dt_TriangleCorrsList *tclist);
 
+/* The same as __dt_ResolveTriangleCorres, chunks of target triangles are
+   taken by n_thread threads as they go. Entries are appended in the same
+   order either way.
+
+   If n_maxcorrs is not 0, only the nearest n_maxcorrs compatible source
+   triangles of each target triangle are searched for, which is much faster
+   than finding all of them in range. Their entries come in the order of
+   target triangles, then distance, then source triangles, just like a list
+   of all of them after __dt_StripTriangleCorrsList(tclist, n_maxcorrs).
+*/
+void __dt_ResolveTriangleCorres_Parallel(
+    const dtMeshModel *deformed_source, const dtMeshModel *target, 
+    dt_real_type threshold, dt_size_type n_maxcorrs,
+    __dt_TriangleCorrsList *tclist, int n_thread);
+
+/* The same as __dt_ResolveTriangleCorres_Parallel, on mesh geometries of the
+   models, which may have coordinates of their own in float32 */
+void __dt_ResolveTriangleCorres_Geometry(
+    const dtMeshGeometry *deformed_source, const dtMeshGeometry *target, 
+    dt_real_type threshold, dt_size_type n_maxcorrs,
+    __dt_TriangleCorrsList *tclist, int n_thread);
+
 /* Easy to use version of __dt_ResolveTriangleCorres, users don't need to pick
    a threshold by hand, the threshold is estimated by a higher level process.
+   Target triangles are split among n_thread threads, and no more than
+   n_maxcorrs entries are made for each of them unless it's 0.
 */
 void __dt_ResolveTriangleCorres_e(
     const dtMeshModel *deformed_source, const dtMeshModel *target, 
-    __dt_TriangleCorrsList *tclist);
+    dt_size_type n_maxcorrs, __dt_TriangleCorrsList *tclist, int n_thread);
+
+/* The same as __dt_ResolveTriangleCorres_e, on mesh geometries */
+void __dt_ResolveTriangleCorres_Geometry_e(
+    const dtMeshGeometry *deformed_source, const dtMeshGeometry *target, 
+    dt_size_type n_maxcorrs, __dt_TriangleCorrsList *tclist, int n_thread);
 
 
 
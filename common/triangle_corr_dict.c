@@ -30,6 +30,10 @@ void __dt_CreateEmptyTriangleCorrsDict(
     tcdict->tclist.list_capacity = 0;
     tcdict->tclist.list_length   = 0;
     tcdict->tclist.corr          = NULL;
+    tcdict->tclist.sorted        = 1;
+    tcdict->tclist.n_maxcorrs    = 0;
+    tcdict->tclist.mapped_base   = NULL;
+    tcdict->tclist.mapped_size   = 0;
 }
 
 
@@ -45,7 +49,8 @@ void __dt_CreateTriangleCorrsDict(
     /* create the corrs dictionary and allocate for the lookup table */
     __dt_CreateEmptyTriangleCorrsDict(target_model, tcdict);
 
-    /* migrate tclist to tcdict */
+    /* migrate tclist to tcdict, it's not sorted again if it's been stripped
+       or sorted already */
     __dt_SortUniqueTriangleCorrsList(tclist);
     tcdict->tclist = *tclist;
 
@@ -69,6 +69,22 @@ void __dt_CreateTriangleCorrsDict(
     const dtMeshModel *target_model,
     __dt_TriangleCorrsList *tclist, __dt_TriangleCorrsDict *tcdict);
 
+/* Load triangle correspondences of the target model from a text or binary
+   .tricorrs file into a dictionary, with no more than n_maxcorrs entries for
+   each target triangle. Binary files stripped to no more than n_maxcorrs
+   entries are used in place, both the entries and the lookup table come
+   right from the mapped file. Binary files made for models with other
+   triangles are refused, source may be NULL to skip the check.
+
+   This function returns 0 on success, -1 to indicate an open()/mmap() error,
+   or -2 to indicate a corrupted or incompatible binary file. It's
+   implemented in tricorrs_file.c.
+*/
+int __dt_LoadTriangleCorrsDict(
+    const char *filename,
+    const dtMeshModel *source, const dtMeshModel *target,
+    dt_size_type n_maxcorrs, __dt_TriangleCorrsDict *tcdict);
+
 /* Destroy specified dictionary object and free its memory */
 void __dt_DestroyTriangleCorrsDict(__dt_TriangleCorrsDict *tcdict);
 
@@ -0,0 +1,344 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "triangle_corr_dict.h"
+#include "file_map.h"
+#include "checksum.h"
+#include "binary_file.h"
+
+
+
+/* binary .tricorrs file layout:
+
+   [header (64 bytes)]=>[------entries------|---group offsets---]
+
+   Entries are sorted and uniqued, so the entries of target triangle i are
+   entries [group[i], group[i+1]) where group is the array of n_tgt_triangle
+   + 1 offsets following them. Entries of a file mapped into memory are
+   used as the storage of a __dt_TriangleCorrsList, and group offsets wire
+   up the lookup table of a __dt_TriangleCorrsDict right away.
+*/
+
+#define __TRICORRS_VERSION   1
+
+#define __TRICORRS_SORTED    0x1u    /* always set, entries are grouped */
+#define __TRICORRS_STRIPPED  0x2u    /* n_maxcorrs entries at most per group */
+
+static const char __tricorrs_magic[4] = { 'D', 'T', 'C', '\x1a' };
+
+
+typedef struct __tricorrs_Header_struct
+{
+    /* "DTC\x1a", __TRICORRS_VERSION,
+       flags: __TRICORRS_SORTED | __TRICORRS_STRIPPED */
+    __dt_BinaryFileTag tag;
+
+    int32_t  n_entry;
+    int32_t  n_src_triangle;
+    int32_t  n_tgt_triangle;
+    int32_t  n_maxcorrs;      /* bound of group size if stripped, or 0 */
+    uint32_t reserved;        /* aligns the hashes */
+
+    uint64_t src_hash;        /* hash of the triangle array of both models */
+    uint64_t tgt_hash;
+    uint64_t checksum;        /* hash of entries and group offsets */
+
+} __tricorrs_Header;
+
+/* the payload has to be aligned for dt_real_type */
+typedef char __tricorrs_header_size_check[
+    sizeof(__tricorrs_Header) == 64? 1: -1];
+
+
+/* Hash of the triangles of a model, the same as the topology hash of .dtm
+   files */
+static __dt_Hash64 __triangle_hash(const dtMeshModel *model)
+{
+    return __dt_Checksum64(model->triangle,
+        (size_t)model->n_triangle * sizeof(dtTriangle), 0);
+}
+
+/* Checksum of the payload, arrays are chained in the order of storage */
+static __dt_Hash64 __payload_checksum(
+    const __dt_TriangleCorrsEntry *corr, dt_size_type n_entry,
+    const dt_index_type *group, dt_size_type n_tgt_triangle)
+{
+    __dt_Hash64 h = __dt_Checksum64(
+        corr, (size_t)n_entry * sizeof(__dt_TriangleCorrsEntry), 0);
+
+    return __dt_Checksum64(
+        group, ((size_t)n_tgt_triangle + 1) * sizeof(dt_index_type), h);
+}
+
+
+/* Check the header against this build and the size of the mapped file */
+static int __header_is_valid(const __tricorrs_Header *header, size_t file_size)
+{
+    if (!__dt_CheckBinaryFileTag(
+            &(header->tag), __tricorrs_magic, __TRICORRS_VERSION) ||
+        !(header->tag.flags & __TRICORRS_SORTED)                 ||
+        header->n_entry < 0 || header->n_src_triangle < 0        ||
+        header->n_tgt_triangle < 0 || header->n_maxcorrs < 0)
+    {
+        return 0;
+    }
+
+    return (file_size == sizeof(__tricorrs_Header) +
+        (size_t)header->n_entry * sizeof(__dt_TriangleCorrsEntry) +
+        ((size_t)header->n_tgt_triangle + 1) * sizeof(dt_index_type));
+}
+
+/* Group offsets have to cover all entries in order */
+static int __group_is_valid(
+    const dt_index_type *group, dt_size_type n_tgt_triangle,
+    dt_size_type n_entry)
+{
+    dt_index_type i_tgt;
+
+    if (group[0] != 0 || group[n_tgt_triangle] != n_entry) return 0;
+    for (i_tgt = 0; i_tgt < n_tgt_triangle; i_tgt++) {
+        if (group[i_tgt] > group[i_tgt + 1]) return 0;
+    }
+    return 1;
+}
+
+/* Entries of group i have to be made for target triangle i, and refer to
+   a source triangle of the header, so that a file checked against no model
+   never indexes out of bounds */
+static int __entries_are_valid(
+    const __dt_TriangleCorrsEntry *corr, const dt_index_type *group,
+    dt_size_type n_src_triangle, dt_size_type n_tgt_triangle)
+{
+    dt_index_type i_tgt, i_entry;
+
+    for (i_tgt = 0; i_tgt < n_tgt_triangle; i_tgt++)
+    {
+        for (i_entry = group[i_tgt]; i_entry < group[i_tgt + 1]; i_entry++)
+        {
+            if (corr[i_entry].i_tgt_triangle != i_tgt ||
+                corr[i_entry].i_src_triangle < 0 ||
+                corr[i_entry].i_src_triangle >= n_src_triangle)
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+/* Map the file and set up the list in place, source and target are checked
+   if they're not NULL. Group offsets are returned through group if it's not
+   NULL. */
+static int __read_tricorrs_file(
+    const char *filename,
+    const dtMeshModel *source, const dtMeshModel *target,
+    __dt_TriangleCorrsList *tclist, const dt_index_type **group)
+{
+    __dt_FileMapping map;
+    __tricorrs_Header header;
+    __dt_TriangleCorrsEntry *corr;
+    const dt_index_type *offset;
+
+    /* copy-on-write, so the list could be stripped in place */
+    if (__dt_MapFileCopyOnWrite(filename, &map) != 0) {
+        return -1;   /* could not open file */
+    }
+
+    if (map.size < sizeof(__tricorrs_Header)) goto bad_format;
+    memcpy(&header, map.base, sizeof(__tricorrs_Header));
+    if (!__header_is_valid(&header, map.size)) goto bad_format;
+
+    /* made for other models? */
+    if (source != NULL &&
+        (source->n_triangle != header.n_src_triangle ||
+         __triangle_hash(source) != header.src_hash)) goto bad_format;
+    if (target != NULL &&
+        (target->n_triangle != header.n_tgt_triangle ||
+         __triangle_hash(target) != header.tgt_hash)) goto bad_format;
+
+    corr   = (__dt_TriangleCorrsEntry*)(map.base + sizeof(__tricorrs_Header));
+    offset = (const dt_index_type*)(corr + header.n_entry);
+
+    if (__payload_checksum(corr, header.n_entry,
+            offset, header.n_tgt_triangle) != header.checksum ||
+        !__group_is_valid(offset, header.n_tgt_triangle, header.n_entry) ||
+        !__entries_are_valid(corr, offset,
+            header.n_src_triangle, header.n_tgt_triangle))
+    {
+        goto bad_format;
+    }
+
+    tclist->list_length   = header.n_entry;
+    tclist->list_capacity = header.n_entry;
+    tclist->corr          = corr;
+    tclist->sorted        = 1;
+    tclist->n_maxcorrs    = (header.tag.flags & __TRICORRS_STRIPPED)?
+        (dt_size_type)header.n_maxcorrs: 0;
+    tclist->mapped_base   = map.base;
+    tclist->mapped_size   = map.size;
+
+    if (group != NULL) *group = offset;
+    return 0;
+
+bad_format:
+    __dt_UnmapFile(&map);
+    return -2;
+}
+
+
+/* Tell if a file is a binary .tricorrs file by its first bytes */
+int __dt_IsBinaryTriangleCorrsFile(const char *filename)
+{
+    char magic[sizeof(__tricorrs_magic)];
+    FILE *fp = fopen(filename, "rb");
+    int is_binary;
+
+    if (fp == NULL) {
+        return 0;
+    }
+
+    is_binary = fread(magic, sizeof(magic), 1, fp) == 1 &&
+        memcmp(magic, __tricorrs_magic, sizeof(magic)) == 0;
+
+    fclose(fp);
+    return is_binary;
+}
+
+/* Load a binary .tricorrs file, entries are used in place */
+int __dt_LoadTriangleCorrsList_Binary(
+    const char *filename,
+    const dtMeshModel *source, const dtMeshModel *target,
+    __dt_TriangleCorrsList *tclist)
+{
+    return __read_tricorrs_file(filename, source, target, tclist, NULL);
+}
+
+
+/* Save the triangle correspondences to a binary .tricorrs file */
+int __dt_SaveTriangleCorrsList_Binary(
+    const char *filename,
+    const dtMeshModel *source, const dtMeshModel *target,
+    const __dt_TriangleCorrsList *tclist)
+{
+    __tricorrs_Header header;
+    __dt_TriangleCorrsList sorted;
+    dt_index_type *group, i_entry, i_tgt;
+    FILE *fp;
+    int ok = 1, in_range = 1;
+
+    dt_size_type n_tgt = target->n_triangle;
+
+    /* entries have to be grouped by target triangle */
+    sorted = *tclist;
+    if (!tclist->sorted)
+    {
+        __dt_CreateTriangleCorrsList(&sorted, tclist->list_length);
+        memcpy(sorted.corr, tclist->corr,
+            (size_t)tclist->list_length * sizeof(__dt_TriangleCorrsEntry));
+        __dt_SortUniqueTriangleCorrsList(&sorted);
+        sorted.n_maxcorrs = 0;
+    }
+
+    /* offsets of groups, by counting entries of each target triangle */
+    group = (dt_index_type*)__dt_malloc(
+        ((size_t)n_tgt + 1) * sizeof(dt_index_type));
+    memset(group, 0, ((size_t)n_tgt + 1) * sizeof(dt_index_type));
+
+    for (i_entry = 0; i_entry < sorted.list_length; i_entry++)
+    {
+        i_tgt = sorted.corr[i_entry].i_tgt_triangle;
+        if (i_tgt < 0 || i_tgt >= n_tgt ||
+            sorted.corr[i_entry].i_src_triangle < 0 ||
+            sorted.corr[i_entry].i_src_triangle >= source->n_triangle)
+        {
+            in_range = 0;  break;
+        }
+        group[i_tgt + 1]++;
+    }
+    for (i_tgt = 1; i_tgt <= n_tgt; i_tgt++) {
+        group[i_tgt] += group[i_tgt - 1];
+    }
+
+    memset(&header, 0, sizeof(header));
+    __dt_InitBinaryFileTag(&(header.tag), __tricorrs_magic,
+        __TRICORRS_VERSION, __TRICORRS_SORTED |
+        (sorted.n_maxcorrs != 0? __TRICORRS_STRIPPED: 0));
+    header.n_entry        = sorted.list_length;
+    header.n_src_triangle = source->n_triangle;
+    header.n_tgt_triangle = n_tgt;
+    header.n_maxcorrs     = sorted.n_maxcorrs;
+
+    header.src_hash = __triangle_hash(source);
+    header.tgt_hash = __triangle_hash(target);
+    header.checksum = __payload_checksum(
+        sorted.corr, sorted.list_length, group, n_tgt);
+
+    if (in_range && (fp = fopen(filename, "wb")) != NULL)
+    {
+        ok =
+            fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(sorted.corr, sizeof(__dt_TriangleCorrsEntry),
+                (size_t)sorted.list_length, fp) ==
+                (size_t)sorted.list_length &&
+            fwrite(group, sizeof(dt_index_type),
+                (size_t)n_tgt + 1, fp) == (size_t)n_tgt + 1;
+
+        if (fclose(fp) != 0) ok = 0;
+    }
+    else {
+        ok = 0;
+    }
+
+    if (sorted.corr != tclist->corr) __dt_DestroyTriangleCorrsList(&sorted);
+    free(group);
+    if (!in_range) return -2;
+    return ok? 0: -1;
+}
+
+
+/* Load triangle correspondences of the target model into a dictionary */
+int __dt_LoadTriangleCorrsDict(
+    const char *filename,
+    const dtMeshModel *source, const dtMeshModel *target,
+    dt_size_type n_maxcorrs, __dt_TriangleCorrsDict *tcdict)
+{
+    __dt_TriangleCorrsList tclist;
+    const dt_index_type *group = NULL;
+    dt_index_type i_tgt;
+    int ret;
+
+    if (__dt_IsBinaryTriangleCorrsFile(filename)) {
+        ret = __read_tricorrs_file(filename, source, target, &tclist, &group);
+    }
+    else {
+        ret = __dt_LoadTriangleCorrsList(filename, &tclist);
+    }
+
+    if (ret != 0) return ret;
+
+    /* text files, and binary files with more entries than we want */
+    if (group == NULL || tclist.n_maxcorrs == 0 ||
+        tclist.n_maxcorrs > n_maxcorrs)
+    {
+        __dt_StripTriangleCorrsList(&tclist, n_maxcorrs);
+        __dt_CreateTriangleCorrsDict(target, &tclist, tcdict);
+        return 0;
+    }
+
+    /* the lookup table is right there in the file */
+    __dt_CreateEmptyTriangleCorrsDict(target, tcdict);
+    tcdict->tclist = tclist;
+
+    for (i_tgt = 0; i_tgt < tcdict->corrsv_size; i_tgt++)
+    {
+        tcdict->corrsv[i_tgt].n_corrstriangle = group[i_tgt+1] - group[i_tgt];
+        if (tcdict->corrsv[i_tgt].n_corrstriangle > 0) {
+            tcdict->corrsv[i_tgt].corrs = tclist.corr + group[i_tgt];
+        }
+    }
+
+    return 0;
+}
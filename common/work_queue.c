@@ -0,0 +1,79 @@
+#include <stdlib.h>
+
+#include "dt_type.h"
+#include "work_queue.h"
+
+
+
+/* Create an empty queue holding at most capacity items */
+void __dt_CreateWorkQueue(size_t capacity, __dt_WorkQueue *queue)
+{
+    pthread_mutex_init(&(queue->lock), NULL);
+    pthread_cond_init(&(queue->not_empty), NULL);
+    pthread_cond_init(&(queue->not_full), NULL);
+
+    queue->item     = (void**)__dt_malloc(capacity * sizeof(void*));
+    queue->capacity = capacity;
+    queue->head     = 0;
+    queue->n_item   = 0;
+    queue->closed   = 0;
+}
+
+/* Release the queue, items still in it are not touched */
+void __dt_DestroyWorkQueue(__dt_WorkQueue *queue)
+{
+    pthread_mutex_destroy(&(queue->lock));
+    pthread_cond_destroy(&(queue->not_empty));
+    pthread_cond_destroy(&(queue->not_full));
+    free(queue->item);
+}
+
+
+/* Append item to the tail of the queue, wait if the queue is full */
+void __dt_WorkQueuePush(__dt_WorkQueue *queue, void *item)
+{
+    pthread_mutex_lock(&(queue->lock));
+
+    while (queue->n_item == queue->capacity) {
+        pthread_cond_wait(&(queue->not_full), &(queue->lock));
+    }
+
+    queue->item[(queue->head + queue->n_item) % queue->capacity] = item;
+    queue->n_item++;
+
+    pthread_cond_signal(&(queue->not_empty));
+    pthread_mutex_unlock(&(queue->lock));
+}
+
+/* Remove the item at the head of the queue and return it, wait if the queue
+   is empty. It returns NULL once the queue is closed and drained. */
+void* __dt_WorkQueuePop(__dt_WorkQueue *queue)
+{
+    void *item = NULL;
+
+    pthread_mutex_lock(&(queue->lock));
+
+    while (queue->n_item == 0 && !queue->closed) {
+        pthread_cond_wait(&(queue->not_empty), &(queue->lock));
+    }
+
+    if (queue->n_item > 0)
+    {
+        item = queue->item[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->n_item--;
+        pthread_cond_signal(&(queue->not_full));
+    }
+
+    pthread_mutex_unlock(&(queue->lock));
+    return item;
+}
+
+/* Tell the consumers that nothing would be pushed any more */
+void __dt_CloseWorkQueue(__dt_WorkQueue *queue)
+{
+    pthread_mutex_lock(&(queue->lock));
+    queue->closed = 1;
+    pthread_cond_broadcast(&(queue->not_empty));
+    pthread_mutex_unlock(&(queue->lock));
+}
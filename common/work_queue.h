@@ -0,0 +1,47 @@
+#ifndef __DT_WORK_QUEUE_HEADER__
+#define __DT_WORK_QUEUE_HEADER__
+
+
+#include <stddef.h>
+#include <pthread.h>
+
+
+/* A bounded FIFO queue of pointers shared by threads of a pipeline. Push
+   blocks while the queue is full and pop blocks while it's empty, so a fast
+   stage can't run arbitrarily far ahead of a slow one. The producing side
+   closes the queue when it's done, after which pop drains the remaining
+   items and returns NULL.
+*/
+typedef struct __dt_WorkQueue_struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty, not_full;
+
+    void  **item;         /* ring buffer of capacity items */
+    size_t  capacity;
+    size_t  head;         /* index of the oldest item */
+    size_t  n_item;       /* number of queued items */
+    int     closed;       /* no more items would be pushed */
+
+} __dt_WorkQueue;
+
+
+/* Create an empty queue holding at most capacity items */
+void __dt_CreateWorkQueue(size_t capacity, __dt_WorkQueue *queue);
+
+/* Release the queue, items still in it are not touched */
+void __dt_DestroyWorkQueue(__dt_WorkQueue *queue);
+
+/* Append item to the tail of the queue, wait if the queue is full */
+void __dt_WorkQueuePush(__dt_WorkQueue *queue, void *item);
+
+/* Remove the item at the head of the queue and return it, wait if the queue
+   is empty. It returns NULL once the queue is closed and drained. */
+void* __dt_WorkQueuePop(__dt_WorkQueue *queue);
+
+/* Tell the consumers that nothing would be pushed any more */
+void __dt_CloseWorkQueue(__dt_WorkQueue *queue);
+
+
+
+#endif /* __DT_WORK_QUEUE_HEADER__ */
@@ -1,113 +1,296 @@
 #include <stdlib.h>
+#include <string.h>
 #include "3dtree.h"
+#include "parallel_for.h"
 
 
-/* select split dimension and split the exemplar set into 2 partitions */
-static void __3dtree_split(
-    __3dtree_Exemplar *ex_begin, __3dtree_Exemplar *ex_end, 
-    int *pi_split, __3dtree_Exemplar **ex_pivot)
+/* Exemplars are sorted by each coordinate once, before the tree is built,
+   and every cell keeps its exemplars in the 3 orders: ord[i_dim][begin..
+   end) are the exemplars of a cell sorted by coordinate i_dim. The bounding
+   box of a cell is read off the ends of these ranges, and a cell is split
+   at the median of one order by partitioning the other two stably, so that
+   each level of the tree takes linear time, rather than a selection and a
+   variance scan per cell. */
+typedef struct __3dtree_SortKey_struct
 {
-    int size = (int)(ex_end - ex_begin);
-    int k = size / 2;   /* find the median */
+    unsigned long long key;
+    int index;
 
-    *pi_split = __3dtree_select_split_dimension(ex_begin, ex_end);
-    __3dtree_kth_split(ex_begin, size, k, *pi_split);
-    *ex_pivot = ex_begin + k;
-}
+} __3dtree_SortKey;
 
-/* Build a 3d tree using the exemplars in the specified array */
-void __3dtree_Create3DTree(
-    __3dtree_Exemplar *ex_begin, __3dtree_Exemplar *ex_end, __3dTree *tree)
+/* bits of a double which compare as unsigned integers in the same order as
+   the doubles do */
+static unsigned long long __3dtree_radix_key(double d)
 {
-    int i_split;
-    __3dtree_Exemplar 
-        *ex_lbeg = ex_begin, *ex_lend, 
-        *ex_rbeg, *ex_rend = ex_end, 
-        *ex_pivot;
+    unsigned long long u;
 
-    __3dtree_Node *newnode;
+    memcpy(&u, &d, sizeof(u));
+    return (u >> 63)? ~u: (u | (1ULL << 63));
+}
+
+/* Stable LSD radix sort of n keys a byte at a time, using b as the buffer.
+   Bytes which are the same for all keys are skipped, coordinates of a
+   model usually share their exponents. It returns the sorted array, a or
+   b. */
+static __3dtree_SortKey *__3dtree_radix_sort(
+    __3dtree_SortKey *a, __3dtree_SortKey *b, int n)
+{
+    __3dtree_SortKey *temp;
+    int count[256], offset, shift, i, c;
 
-    if (ex_begin != ex_end)  /* exemplar range is not empty */
+    for (shift = 0; shift < 64; shift += 8)
     {
-        __3dtree_split(ex_begin, ex_end, &i_split, &ex_pivot);
-     
-        newnode = __3dtree_CreateNode(ex_pivot->pt, ex_pivot->id, i_split);
-        *tree = newnode;
+        memset(count, 0, sizeof(count));
+        for (i = 0; i < n; i++) count[(a[i].key >> shift) & 0xff]++;
+        if (n == 0 || count[(a[0].key >> shift) & 0xff] == n) continue;
 
-        ex_lend = ex_pivot;
-        __3dtree_Create3DTree(ex_lbeg, ex_lend, &(newnode->_left));
+        for (offset = 0, c = 0; c < 256; c++) {
+            i = count[c];  count[c] = offset;  offset += i;
+        }
+        for (i = 0; i < n; i++) b[count[(a[i].key >> shift) & 0xff]++] = a[i];
 
-        ex_rbeg = ex_pivot + 1;
-        __3dtree_Create3DTree(ex_rbeg, ex_rend, &(newnode->_right));
+        temp = a;  a = b;  b = temp;
     }
+
+    return a;
 }
 
-/* Destroy a 3d tree */
-void __3dtree_Destroy3DTree(__3dTree tree)
+/* state of a build shared by threads, cells of a level are split by
+   different threads, which touch disjoint ranges of ord and temp */
+typedef struct __3dtree_build_struct
 {
-    if (tree->_left)  __3dtree_Destroy3DTree(tree->_left);
-    if (tree->_right) __3dtree_Destroy3DTree(tree->_right);
-    free(tree);
-}
+    const __3dtree_Exemplar *exset;
+    int n;
 
+    int *ord[3];           /* exemplars sorted by x, y and z in each cell */
+    int *temp;             /* room for partitioning ord */
+    unsigned char *side;   /* side[i] is 1 if exemplar i goes to the right */
 
-/* Allocate a 3d tree node and initialize with specified parameters,
-   this newly created node has no children so _left and _right are
-   initialized as NULL */
-__3dtree_Node* __3dtree_CreateNode(
-    const dt_real_type *x0, int id, int i_split)
+    __3dtree_Tree *tree;
+    int level_begin;       /* first cell of the level being split */
+
+} __3dtree_build;
+
+/* sort exemplars by coordinates [begin, end), exemplars come in the order
+   of their indexes, which breaks ties as the sort is stable */
+static void __3dtree_sort_dimension(
+    void *data, int i_thread, dt_index_type begin, dt_index_type end)
 {
-    __3dtree_Node *node = (__3dtree_Node*)__dt_malloc(sizeof(__3dtree_Node));
-    node->i_split = i_split;
-    node->id = id;
+    const __3dtree_build *build = (const __3dtree_build*)data;
+    __3dtree_SortKey *key, *sorted;
+    int i_dim, i;
+
+    (void)i_thread;   /* each dimension has its own order array */
+
+    key = (__3dtree_SortKey*)__dt_malloc(
+        (2 * (size_t)build->n + 1) * sizeof(__3dtree_SortKey));
 
-    node->pt[0] = x0[0];
-    node->pt[1] = x0[1];
-    node->pt[2] = x0[2];
+    for (i_dim = begin; i_dim < end; i_dim++)
+    {
+        for (i = 0; i < build->n; i++)
+        {
+            key[i].key   = __3dtree_radix_key(build->exset[i].pt[i_dim]);
+            key[i].index = i;
+        }
+
+        sorted = __3dtree_radix_sort(key, key + build->n, build->n);
+        for (i = 0; i < build->n; i++) build->ord[i_dim][i] = sorted[i].index;
+    }
+
+    free(key);
+}
+
+/* split ord[i_dim][cell->begin..cell->end) at mid, keeping the order */
+static void __3dtree_partition_order(
+    const __3dtree_build *build, const __3dtree_Cell *cell, int i_dim,
+    int mid)
+{
+    int *ord = build->ord[i_dim], *temp = build->temp;
+    int i, i_left = cell->begin, i_right = mid;
 
-    node->_left   = NULL;
-    node->_right  = NULL;
+    for (i = cell->begin; i < cell->end; i++)
+    {
+        if (build->side[ord[i]]) temp[i_right++] = ord[i];
+        else                     temp[i_left++]  = ord[i];
+    }
 
-    return node;
+    for (i = cell->begin; i < cell->end; i++) ord[i] = temp[i];
 }
 
-__3dtree_Node* __3dtree_FindParent(
-    const dt_real_type *x0, __3dtree_Node *tree)
+/* Set the bounding box of cells [begin, end) of the current level and
+   split those which aren't leaves along their longest extent, the median
+   goes to the right child */
+static void __3dtree_split_level(
+    void *data, int i_thread, dt_index_type begin, dt_index_type end)
 {
-    __3dtree_Node *parent;
-    __3dtree_Node *next = tree;
-    int i_split;
+    const __3dtree_build *build = (const __3dtree_build*)data;
+    const __3dtree_Exemplar *exset = build->exset;
+    __3dtree_Cell *cell;
+    int i_cell, i_dim, i_split, mid, i;
+
+    (void)i_thread;   /* cells of a level cover disjoint ranges */
 
-    while (next)
+    for (i_cell = build->level_begin + begin;
+         i_cell < build->level_begin + end; i_cell++)
     {
-        i_split = next->i_split;
-        parent = next;
+        cell = build->tree->cell + i_cell;
+        for (i_split = 0, i_dim = 0; i_dim < 3; i_dim++)
+        {
+            cell->min[i_dim] = exset[build->ord[i_dim][cell->begin]].pt[i_dim];
+            cell->max[i_dim] = exset[build->ord[i_dim][cell->end-1]].pt[i_dim];
+
+            if (cell->max[i_dim] - cell->min[i_dim] >
+                cell->max[i_split] - cell->min[i_split]) i_split = i_dim;
+        }
+
+        if (cell->i_child < 0) continue;   /* leaf */
 
-        if (x0[i_split] > next->pt[i_split])
-            next = next->_right;
-        else
-            next = next->_left;
+        mid = cell->begin + (cell->end - cell->begin) / 2;
+        cell->i_split = i_split;
+        cell->split   = exset[build->ord[i_split][mid]].pt[i_split];
+
+        for (i = cell->begin; i < cell->end; i++) {
+            build->side[build->ord[i_split][i]] = (i >= mid);
+        }
+        for (i_dim = 0; i_dim < 3; i_dim++) {
+            if (i_dim != i_split) {
+                __3dtree_partition_order(build, cell, i_dim, mid);
+            }
+        }
     }
+}
 
-    return parent;
+
+/* Build a 3d tree using the exemplars in the specified array */
+void __3dtree_Create3DTree(
+    __3dtree_Exemplar *ex_begin, __3dtree_Exemplar *ex_end, __3dTree *tree)
+{
+    __3dtree_Create3DTree_Parallel(ex_begin, ex_end, tree, 1);
 }
 
-__3dtree_Node* __3dtree_Insert(
-    const dt_real_type *x0, int id, 
-    __3dtree_Node *tree)
+/* The same as __3dtree_Create3DTree, with n_thread threads */
+void __3dtree_Create3DTree_Parallel(
+    __3dtree_Exemplar *ex_begin, __3dtree_Exemplar *ex_end, __3dTree *tree,
+    int n_thread)
 {
-    __3dtree_Node *parent = __3dtree_FindParent(x0, tree);
-    int i_split = parent->i_split;
+    __3dtree_Tree *t = (__3dtree_Tree*)__dt_malloc(sizeof(__3dtree_Tree));
+    __3dtree_Cell *cell, *child;
+    __3dtree_build build;
+    int n = (int)(ex_end - ex_begin), i_cell, level_end, i;
+
+    /* leaves are split from cells of more than __3DTREE_LEAF_SIZE points, so
+       they have at least half of that many, which bounds the number of
+       leaves and therefore cells */
+    int max_cell = 2 * (2 * n / __3DTREE_LEAF_SIZE + 1);
+
+    t->cell    = (__3dtree_Cell*)__dt_malloc(
+        (size_t)max_cell * sizeof(__3dtree_Cell));
+    t->n_point = n;
+    t->n_cell  = (n > 0)? 1: 0;
+
+    t->cell[0].begin = 0;
+    t->cell[0].end   = n;
+
+    build.exset  = ex_begin;
+    build.n      = n;
+    build.ord[0] = (int*)__dt_malloc((size_t)(4 * n + 1) * sizeof(int));
+    build.ord[1] = build.ord[0] + n;
+    build.ord[2] = build.ord[1] + n;
+    build.temp   = build.ord[2] + n;
+    build.side   = (unsigned char*)__dt_malloc((size_t)n + 1);
+    build.tree   = t;
+
+    __dt_ParallelFor(3, n_thread, __3dtree_sort_dimension, &build);
 
-    __3dtree_Node *newnode = 
-        __3dtree_CreateNode(x0, id, (i_split + 1) % 3);
+    /* cells are split level by level in the order they're created, which
+       lays out the tree in breadth-first order, siblings next to each
+       other. Children are laid out before the cells of a level are split
+       by the threads. */
+    for (build.level_begin = 0; build.level_begin < t->n_cell;
+         build.level_begin = level_end)
+    {
+        level_end = t->n_cell;
+        for (i_cell = build.level_begin; i_cell < level_end; i_cell++)
+        {
+            cell = t->cell + i_cell;
+            if (cell->end - cell->begin <= __3DTREE_LEAF_SIZE)
+            {
+                cell->i_split = -1;   /* leaf */
+                cell->i_child = -1;
+                cell->split   = 0;
+                continue;
+            }
+
+            cell->i_child = t->n_cell;
 
-    if (x0[i_split] > parent->pt[i_split]) {
-        parent->_right = newnode;
+            /* the median starts the right child */
+            child = t->cell + t->n_cell;
+            child[0].begin = cell->begin;
+            child[0].end   = cell->begin + (cell->end - cell->begin) / 2;
+            child[1].begin = child[0].end;
+            child[1].end   = cell->end;
+            t->n_cell += 2;
+        }
+
+        __dt_ParallelFor(level_end - build.level_begin, n_thread,
+            __3dtree_split_level, &build);
     }
-    else {
-        parent->_left = newnode;
+
+    /* points of each cell are contiguous after all the splits */
+    t->x    = (dt_real_type*)__dt_malloc(
+        (size_t)(3 * n + 1) * sizeof(dt_real_type));
+    t->y    = t->x + n;
+    t->z    = t->y + n;
+    t->node = (__3dtree_Node*)__dt_malloc(
+        (size_t)(n + 1) * sizeof(__3dtree_Node));
+
+    for (i = 0; i < n; i++)
+    {
+        t->x[i] = ex_begin[build.ord[0][i]].pt[0];
+        t->y[i] = ex_begin[build.ord[0][i]].pt[1];
+        t->z[i] = ex_begin[build.ord[0][i]].pt[2];
+        t->node[i].id = ex_begin[build.ord[0][i]].id;
     }
 
-    return newnode;
+    free(build.ord[0]);
+    free(build.side);
+
+    t->nx = t->ny = t->nz = NULL;
+    *tree = t;
+}
+
+/* Destroy a 3d tree */
+void __3dtree_Destroy3DTree(__3dTree tree)
+{
+    free(tree->cell);
+    free(tree->x);
+    free(tree->node);
+    free(tree->nx);
+    free(tree);
+}
+
+/* Set the normal of each point for oriented queries */
+void __3dtree_SetNormals(
+    __3dTree tree, const dtVector *normvec, const dt_index_type *i_norm)
+{
+    const dtVector *norm;
+    int i, n = tree->n_point, id;
+
+    if (tree->nx == NULL)
+    {
+        tree->nx = (dt_real_type*)__dt_malloc(
+            (size_t)(3 * n + 1) * sizeof(dt_real_type));
+        tree->ny = tree->nx + n;
+        tree->nz = tree->ny + n;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        id   = tree->node[i].id;
+        norm = normvec + ((i_norm != NULL)? i_norm[id]: id);
+
+        tree->nx[i] = norm->x;
+        tree->ny[i] = norm->y;
+        tree->nz[i] = norm->z;
+    }
 }
@@ -15,43 +15,127 @@ typedef struct __3dtree_Exemplar_struct
 } __3dtree_Exemplar;
 
 
-/* 3d tree is a BST-like data structure for accelerating closest neighbour
-   search. */
+/* An exemplar as stored in a 3d tree, queries hand out pointers to these,
+   which stay valid as long as the tree does. */
 typedef struct __3dtree_Node_struct
 {
-    int i_split;        /* split dimension of this layer */
+    int id;              /* ID */
+
+} __3dtree_Node;
+
+
+/* Points of the tree are kept in small buckets, cells of the tree are boxes
+   which split their buckets in halves until there's no more than
+   __3DTREE_LEAF_SIZE points in a cell */
+#define __3DTREE_LEAF_SIZE  32
+
+typedef struct __3dtree_Cell_struct
+{
+    dt_real_type min[3], max[3];  /* bounding box of points in the cell */
+    dt_real_type split;           /* coordinate of the split plane */
+    int i_split;                  /* split dimension, or -1 for a leaf */
+    int i_child;                  /* left child, the right one follows it */
+    int begin, end;               /* points of the cell: [begin, end) */
+
+} __3dtree_Cell;
+
+
+/* 3d tree is a BST-like data structure for accelerating closest neighbour
+   search. Rather than allocating nodes one by one, cells are laid out in
+   breadth-first order in a single array with cell[0] the root, and points
+   are stored bucket by bucket in separate coordinate arrays, so that a
+   query touches a few contiguous blocks of memory instead of chasing
+   pointers all over the heap. */
+typedef struct __3dtree_Tree_struct
+{
+    __3dtree_Cell *cell;
+    int n_cell;
 
-    /* exemplar */
-    dt_real_type pt[3]; /* coordinate of this point */
-    int id;
+    /* coordinates and IDs of the points, points of a cell are contiguous */
+    dt_real_type *x, *y, *z;
+    __3dtree_Node *node;
+    int n_point;
 
-    /* child nodes */
-    struct __3dtree_Node_struct *_left;
-    struct __3dtree_Node_struct *_right;
+    /* normals of the points for oriented queries, NULL until they're set
+       by __3dtree_SetNormals */
+    dt_real_type *nx, *ny, *nz;
 
-} __3dtree_Node, *__3dTree;
+} __3dtree_Tree, *__3dTree;
 
 
-/* Build a 3d tree using the exemplars in the specified array */
+/* Build a 3d tree using the exemplars in the specified array. Exemplars are
+   sorted by x, y and z once, and each level of the tree is split in linear
+   time from these orders, which makes the build O(n log n). */
 void __3dtree_Create3DTree(
     __3dtree_Exemplar *ex_begin, __3dtree_Exemplar *ex_end, __3dTree *tree);
 
+/* The same as __3dtree_Create3DTree, the 3 sorts and the cells of each
+   level are split among n_thread threads */
+void __3dtree_Create3DTree_Parallel(
+    __3dtree_Exemplar *ex_begin, __3dtree_Exemplar *ex_end, __3dTree *tree,
+    int n_thread);
+
 /* Destroy a 3d tree */
 void __3dtree_Destroy3DTree(__3dTree tree);
 
+/* Set the normal of each point for oriented queries, the normal of the point
+   with ID id is normvec[i_norm[id]], or normvec[id] if i_norm is NULL */
+void __3dtree_SetNormals(
+    __3dTree tree, const dtVector *normvec, const dt_index_type *i_norm);
+
 
 /* Find the nearest neighbour of x0 in the tree, the pointer to the nearest
    neighbour node and the squared distance is returned through the 2 last
-   parameters */
+   parameters, the node is NULL if there's no point in the tree */
 void __3dtree_NearestPoint(
     __3dTree tree, const dt_real_type *x0, 
     __3dtree_Node **nearest_node, dt_real_type *nearest_dist_sq);
 
+/* A condition on the points a query could return, cond_data is passed to it
+   as is. Any state of the condition goes through cond_data, so the tree
+   could be queried by several threads at once. */
+typedef int (*__3dtree_Condition)(__3dtree_Node *node, void *cond_data);
+
 /* Find closest neighbour which satisfying specified condition */
 void __3dtree_NearestPoint_Cond(
     __3dTree tree, const dt_real_type *x0, 
     __3dtree_Node **nearest_node, dt_real_type *nearest_dist_sq, 
-    int(*cond)(__3dtree_Node *node));
+    __3dtree_Condition cond, void *cond_data);
+
+
+/* Scan points [begin, end) for the nearest one closer than nearest_dist_sq
+   whose normal has a positive dot product with n0, it returns the index of
+   the point and updates nearest_dist_sq, or returns -1 if there's none */
+typedef int (*__3dtree_OrientedScan)(
+    const __3dtree_Tree *tree, int begin, int end,
+    const dt_real_type *x0, const dt_real_type *n0,
+    dt_real_type *nearest_dist_sq);
+
+/* Find the nearest point to each of n_query points x0[3*i..3*i+2] whose
+   normal is less than 90-deg away from that of the query (their dot product
+   is positive), which is __3dtree_NearestPoint_Cond with an orientation
+   condition, answered for a whole batch at once. The normal of query i is
+   normvec[i_norm[i]], or normvec[i] if i_norm is NULL. Normals of the tree
+   have to be set beforehand.
+
+   Queries are answered in the order of a space-filling (Morton) curve, so
+   that consecutive queries walk down the same cells while they're still in
+   cache, and each of them starts with the answer to the last one as its
+   best guess, which rules out most of the tree right away. Buckets are
+   scanned by scan, or with the fastest kernel the processor supports
+   (AVX-512, AVX2 or scalar) if it's NULL. nearest_node[i] is NULL if no
+   point satisfies the condition.
+*/
+void __3dtree_NearestOrientedPoint_Batch(
+    __3dTree tree, dt_size_type n_query,
+    const dt_real_type *x0,
+    const dtVector *normvec, const dt_index_type *i_norm,
+    __3dtree_Node **nearest_node, dt_real_type *nearest_dist_sq,
+    __3dtree_OrientedScan scan);
+
+/* The bucket kernel named scalar, avx2 or avx512, or NULL if there's no
+   such kernel or the processor doesn't support it */
+__3dtree_OrientedScan __3dtree_FindOrientedScan(const char *name);
 
 
 /* Find all points lying on the disk centered at x0 with radius range, all 
@@ -67,21 +151,20 @@ int __3dtree_RangeSearch(
 int __3dtree_RangeSearch_Cond(
     __3dTree tree, const dt_real_type *x0, dt_real_type range,
     __3dtree_Node **res_node, dt_real_type *res_dist_sq,
-    int(*cond)(__3dtree_Node *node));
-
+    __3dtree_Condition cond, void *cond_data);
 
-/* routines not intended to be used */
-
-__3dtree_Node* __3dtree_CreateNode(
-    const dt_real_type *x0, int id, int i_split);
-
-__3dtree_Node* __3dtree_FindParent(
-    const dt_real_type *x0, __3dtree_Node *tree);
-
-__3dtree_Node* __3dtree_Insert(
-    const dt_real_type *x0, int id, 
-    __3dtree_Node *tree);
 
+/* Find the k nearest points to x0 within the range that satisfy cond, which
+   is __3dtree_RangeSearch_Cond keeping only the k nearest results. Points
+   found are kept in a max-heap of k entries in res_node and res_dist_sq,
+   and once it's full the search radius shrinks to its farthest entry, so
+   most of the cells in range are never visited. The number of points
+   found (at most k) is returned, they're sorted by distance, ties by ID.
+*/
+int __3dtree_KNearestInRange_Cond(
+    __3dTree tree, const dt_real_type *x0, dt_real_type range, int k,
+    __3dtree_Node **res_node, dt_real_type *res_dist_sq,
+    __3dtree_Condition cond, void *cond_data);
 
 
 /* private functions, do not touch. */
@@ -92,6 +175,9 @@ int __3dtree_select_split_dimension(
 void __3dtree_kth_split(
     __3dtree_Exemplar *a, int size, int k, int i_split);
 
+/* the fastest scan the processor supports, picked once */
+__3dtree_OrientedScan __3dtree_select_oriented_scan(void);
+
 
 
 #endif /* __3DTREE_HEADER__ */
@@ -1,48 +1,26 @@
 #include <stdlib.h>
-#include <math.h>
 #include <float.h>
 #include "3dtree.h"
 
 
-/* calculate squared distance between v1 and v2 */
-static dt_real_type __squared_distance(
-    const dt_real_type *v1, const dt_real_type *v2)
-{
-    dt_real_type  dx = (v1[0] - v2[0]);
-    dt_real_type  dy = (v1[1] - v2[1]);
-    dt_real_type  dz = (v1[2] - v2[2]);
-
-    return dx*dx + dy*dy + dz*dz;
-}
-
+/* cells waiting to be visited by a query, the tree is balanced so it's
+   never deeper than this */
+#define __3DTREE_MAX_DEPTH  64
 
-/* This structure is to represent the bounds of hyperspace dominated by the 
-   nodes in 3d tree */
-typedef struct __3dtree_Hyperrect_struct
-{
-    dt_real_type min[3];   /* the lower left corner  */
-    dt_real_type max[3];   /* the upper right corner */
-
-} __3dtree_Hyperrect;
-
-/* calculate squared distance from x0 to the hyperrect */
-static dt_real_type __squared_hyperrect_distance(
-    const __3dtree_Hyperrect *rect, const dt_real_type *x0)
+/* calculate squared distance from x0 to the bounding box of a cell */
+static dt_real_type __squared_cell_distance(
+    const __3dtree_Cell *cell, const dt_real_type *x0)
 {
     int i_dim;
-    dt_real_type dist_sq = 0;
+    dt_real_type d, dist_sq = 0;
 
     for (i_dim = 0; i_dim < 3; i_dim++)
     {
-        if (x0[i_dim] < rect->min[i_dim]) {
-            dist_sq += 
-                (rect->min[i_dim] - x0[i_dim]) *
-                (rect->min[i_dim] - x0[i_dim]);
+        if ((d = cell->min[i_dim] - x0[i_dim]) > 0) {
+            dist_sq += d * d;
         }
-        else if (x0[i_dim] > rect->max[i_dim]) {
-            dist_sq +=
-                (rect->max[i_dim] - x0[i_dim]) *
-                (rect->max[i_dim] - x0[i_dim]);
+        else if ((d = x0[i_dim] - cell->max[i_dim]) > 0) {
+            dist_sq += d * d;
         }
     }
 
@@ -50,79 +28,92 @@ static dt_real_type __squared_hyperrect_distance(
 }
 
 
-static void __3dtree_nearest(
-    __3dtree_Node *node, const dt_real_type *x0, 
-    __3dtree_Node **nearest_node, dt_real_type *nearest_dist_sq, 
-    __3dtree_Hyperrect *rect, int(*cond)(__3dtree_Node *node))
+/* the child of a cell whose bounding box is nearer to x0, and the squared
+   distances to both children */
+static int __3dtree_nearer_child(
+    const __3dtree_Tree *tree, const __3dtree_Cell *cell,
+    const dt_real_type *x0,
+    dt_real_type *near_dist_sq, dt_real_type *far_dist_sq)
 {
-    int i_dim = node->i_split;
+    dt_real_type d0, d1;
 
-    dt_real_type tmp, dist_sq;
-    __3dtree_Node *nearer_part, *further_part;
-    dt_real_type *nearer_hr_coord, *further_hr_coord;
+    d0 = __squared_cell_distance(tree->cell + cell->i_child, x0);
+    d1 = __squared_cell_distance(tree->cell + cell->i_child + 1, x0);
 
-    /* determine whether to go left or right in the tree */
-    if (x0[i_dim] <= node->pt[i_dim])
-    {
-        nearer_part  = node->_left;
-        further_part = node->_right;
-        nearer_hr_coord  = &(rect->max[i_dim]);
-        further_hr_coord = &(rect->min[i_dim]);
-    }
-    else
+    /* ties (x0 in both boxes) are broken by the split plane */
+    if (d0 < d1 || (d0 == d1 && x0[cell->i_split] <= cell->split))
     {
-        nearer_part  = node->_right;
-        further_part = node->_left;
-        nearer_hr_coord  = &(rect->min[i_dim]);
-        further_hr_coord = &(rect->max[i_dim]);
+        *near_dist_sq = d0;  *far_dist_sq = d1;
+        return cell->i_child;
     }
 
-    if (nearer_part)
-    {
-        /* slice the hyperrect to get the hyperrect of the nearer subtree */
-        tmp = *nearer_hr_coord;  /* save current hyperrect coordinate */
-        *nearer_hr_coord = node->pt[i_dim];
+    *near_dist_sq = d1;  *far_dist_sq = d0;
+    return cell->i_child + 1;
+}
 
-        /* recurse down into nearer subtree */
-        __3dtree_nearest(nearer_part, x0, 
-            nearest_node, nearest_dist_sq, rect, cond);
 
-        /* restore the hyperrect */
-        *nearer_hr_coord = tmp;
-    }
+/* Visit the cells nearer to x0 first, skipping those whose bounding box is
+   not closer than the nearest point found so far. i_nearest is -1 if no
+   point satisfies cond. */
+static void __3dtree_nearest(
+    const __3dtree_Tree *tree, const dt_real_type *x0,
+    int *i_nearest, dt_real_type *nearest_dist_sq,
+    __3dtree_Condition cond, void *cond_data)
+{
+    int stack[__3DTREE_MAX_DEPTH], n_stack = 0;
+    dt_real_type stack_dist_sq[__3DTREE_MAX_DEPTH];
 
+    const __3dtree_Cell *cell;
+    const dt_real_type *x = tree->x, *y = tree->y, *z = tree->z;
+    dt_real_type dx, dy, dz, dist_sq, near_dist_sq, far_dist_sq;
+    int i, i_near;
 
-    /* check if custom condition is satisfied */
-    if (cond == NULL || cond(node))
-    {
-        /* check the distance of the point at the current node, compare it with
-           our best so far */
-        dist_sq = __squared_distance(node->pt, x0);
-        if (dist_sq < *nearest_dist_sq) {
-            *nearest_node = node;
-            *nearest_dist_sq = dist_sq;
-        }
-    }
+    *i_nearest = -1;
+    if (tree->n_cell == 0) return;
 
+    stack[0] = 0;
+    stack_dist_sq[n_stack++] = __squared_cell_distance(tree->cell, x0);
 
-    if (further_part)
+    while (n_stack > 0)
     {
-        /* make a slice on the hyperrect */
-        tmp = *further_hr_coord;
-        *further_hr_coord = node->pt[i_dim];
-
-        /* Check if we have to recurse down by calculating the closest point of
-           the hyperrect and see if it's closer than our minimum distance in 
-           nearest_dist_sq. */
-        if (__squared_hyperrect_distance(rect, x0) < *nearest_dist_sq)
+        /* the cell might have been outdone since it was pushed */
+        n_stack--;
+        if (stack_dist_sq[n_stack] >= *nearest_dist_sq) continue;
+        cell = tree->cell + stack[n_stack];
+
+        if (cell->i_split < 0)
         {
-            /* recurse down into further subtree */
-            __3dtree_nearest(further_part, x0, 
-                nearest_node, nearest_dist_sq, rect, cond);
+            /* scan the bucket, testing cond only on closer points */
+            for (i = cell->begin; i < cell->end; i++)
+            {
+                dx = x[i] - x0[0];  dy = y[i] - x0[1];  dz = z[i] - x0[2];
+                dist_sq = dx*dx + dy*dy + dz*dz;
+
+                if (dist_sq < *nearest_dist_sq &&
+                    (cond == NULL || cond(tree->node + i, cond_data)))
+                {
+                    *i_nearest = i;
+                    *nearest_dist_sq = dist_sq;
+                }
+            }
+            continue;
         }
 
-        /* undo the slice on the hyperrect */
-        *further_hr_coord = tmp;
+        /* push the further child first so that the nearer one goes first,
+           the distances to their boxes tell which one is nearer */
+        i_near = __3dtree_nearer_child(tree, cell, x0,
+            &near_dist_sq, &far_dist_sq);
+
+        if (far_dist_sq < *nearest_dist_sq)
+        {
+            stack[n_stack] = 2 * cell->i_child + 1 - i_near;
+            stack_dist_sq[n_stack++] = far_dist_sq;
+        }
+        if (near_dist_sq < *nearest_dist_sq)
+        {
+            stack[n_stack] = i_near;
+            stack_dist_sq[n_stack++] = near_dist_sq;
+        }
     }
 }
 
@@ -134,71 +125,220 @@ void __3dtree_NearestPoint(
     __3dTree tree, const dt_real_type *x0, 
     __3dtree_Node **nearest_node, dt_real_type *nearest_dist_sq)
 {
-    __3dtree_NearestPoint_Cond(tree, x0, nearest_node, nearest_dist_sq, NULL);
+    __3dtree_NearestPoint_Cond(
+        tree, x0, nearest_node, nearest_dist_sq, NULL, NULL);
 }
 
 /* Find closest neighbour which satisfying specified condition */
 void __3dtree_NearestPoint_Cond(
     __3dTree tree, const dt_real_type *x0, 
     __3dtree_Node **nearest_node, dt_real_type *nearest_dist_sq, 
-    int(*cond)(__3dtree_Node *node))
+    __3dtree_Condition cond, void *cond_data)
 {
-    __3dtree_Hyperrect rect = {
-        {-DBL_MAX, -DBL_MAX, -DBL_MAX},
-        { DBL_MAX,  DBL_MAX,  DBL_MAX}
-    };
+    int i_nearest;
+
     *nearest_dist_sq = DBL_MAX;
-    __3dtree_nearest(tree, x0, nearest_node, nearest_dist_sq, &rect, cond);
+    __3dtree_nearest(
+        tree, x0, &i_nearest, nearest_dist_sq, cond, cond_data);
+    *nearest_node = (i_nearest >= 0)? tree->node + i_nearest: NULL;
 }
 
 
+/* Visit every cell whose bounding box intersects the ball, points are
+   appended to the results in the order of the buckets */
 static int __3dtree_range(
-    __3dtree_Node *node, const dt_real_type *x0, dt_real_type range,
+    const __3dtree_Tree *tree, const dt_real_type *x0, dt_real_type range,
     __3dtree_Node **res_node, dt_real_type *res_dist_sq,
-    int *i_res,
-    int(*cond)(__3dtree_Node *node))
+    __3dtree_Condition cond, void *cond_data)
 {
-    __3dtree_Node *nearer, *further;
-    dt_real_type dist_sq, dx;
-    int ret, in_bound = 0;
+    int stack[__3DTREE_MAX_DEPTH], n_stack = 0, n_res = 0, i;
 
-    if (!node) return 0;
-    dist_sq = __squared_distance(node->pt, x0);
+    const __3dtree_Cell *cell;
+    const dt_real_type *x = tree->x, *y = tree->y, *z = tree->z;
+    dt_real_type dx, dy, dz, dist_sq, range_sq = range * range;
 
-    if (dist_sq < range*range)
+    if (tree->n_cell > 0) stack[n_stack++] = 0;
+
+    while (n_stack > 0)
     {
-        in_bound = 1;
-        
-        /* append this exemplar to result list if cond is satisfied */
-        if (cond == NULL || cond(node)) {
-            res_node[*i_res] = node; res_dist_sq[*i_res] = dist_sq;
-            (*i_res) += 1;
+        cell = tree->cell + stack[--n_stack];
+        if (__squared_cell_distance(cell, x0) >= range_sq) continue;
+
+        if (cell->i_split >= 0)
+        {
+            stack[n_stack++] = cell->i_child + 1;
+            stack[n_stack++] = cell->i_child;
+            continue;
+        }
+
+        for (i = cell->begin; i < cell->end; i++)
+        {
+            dx = x[i] - x0[0];  dy = y[i] - x0[1];  dz = z[i] - x0[2];
+            dist_sq = dx*dx + dy*dy + dz*dz;
+
+            /* append this exemplar to result list if cond is satisfied */
+            if (dist_sq < range_sq &&
+                (cond == NULL || cond(tree->node + i, cond_data)))
+            {
+                res_node[n_res] = tree->node + i;
+                res_dist_sq[n_res++] = dist_sq;
+            }
         }
     }
 
-    /* determine which partition is the nearer subspace. */
-    if ((dx = x0[node->i_split] - node->pt[node->i_split]) <= 0) {
-        nearer = node->_left; further = node->_right;
+    return n_res;
+}
+
+
+/* The same walk as __3dtree_nearest with the orientation condition built
+   into the scan of buckets, starting from the best guess in i_nearest and
+   nearest_dist_sq */
+static void __3dtree_nearest_oriented(
+    const __3dtree_Tree *tree, const dt_real_type *x0, const dt_real_type *n0,
+    __3dtree_OrientedScan scan, int *i_nearest, dt_real_type *nearest_dist_sq)
+{
+    int stack[__3DTREE_MAX_DEPTH], n_stack = 0;
+    dt_real_type stack_dist_sq[__3DTREE_MAX_DEPTH];
+
+    const __3dtree_Cell *cell;
+    dt_real_type near_dist_sq, far_dist_sq;
+    int i, i_near;
+
+    stack[0] = 0;
+    stack_dist_sq[n_stack++] = __squared_cell_distance(tree->cell, x0);
+
+    while (n_stack > 0)
+    {
+        n_stack--;
+        if (stack_dist_sq[n_stack] >= *nearest_dist_sq) continue;
+        cell = tree->cell + stack[n_stack];
+
+        if (cell->i_split < 0)
+        {
+            i = scan(tree, cell->begin, cell->end, x0, n0, nearest_dist_sq);
+            if (i >= 0) *i_nearest = i;
+            continue;
+        }
+
+        i_near = __3dtree_nearer_child(tree, cell, x0,
+            &near_dist_sq, &far_dist_sq);
+
+        if (far_dist_sq < *nearest_dist_sq)
+        {
+            stack[n_stack] = 2 * cell->i_child + 1 - i_near;
+            stack_dist_sq[n_stack++] = far_dist_sq;
+        }
+        if (near_dist_sq < *nearest_dist_sq)
+        {
+            stack[n_stack] = i_near;
+            stack_dist_sq[n_stack++] = near_dist_sq;
+        }
     }
-    else {
-        nearer = node->_right; further = node->_left;
+}
+
+
+/* position of a query on the Morton curve */
+typedef struct __3dtree_MortonKey_struct
+{
+    unsigned int code;
+    int i_query;
+
+} __3dtree_MortonKey;
+
+/* Morton code of x0: coordinates are quantized to 10 bits in the bounding
+   box of the tree and their bits are interleaved */
+static unsigned int __morton_code(
+    const __3dtree_Cell *root, const dt_real_type *x0)
+{
+    unsigned int code = 0, q[3];
+    dt_real_type t, extent;
+    int i_dim, bit;
+
+    for (i_dim = 0; i_dim < 3; i_dim++)
+    {
+        extent = root->max[i_dim] - root->min[i_dim];
+        t = (extent > 0)? (x0[i_dim] - root->min[i_dim]) / extent: 0;
+        t = (t < 0)? 0: (t > 1)? 1: t;
+        q[i_dim] = (unsigned int)(t * 1023);
     }
-    
-    /* storm down to the nearer bound */
-    in_bound += (ret = 
-        __3dtree_range(
-            nearer, x0, range, res_node, res_dist_sq, i_res, cond));
-    
-    /* if the nearer down level is in bound, then the further one might be
-       in bounds too. */
-    if (ret >= 0 && fabs(dx) < range)
+
+    for (bit = 9; bit >= 0; bit--)
     {
-        in_bound += 
-            __3dtree_range(further, x0, range, 
-                res_node, res_dist_sq, i_res, cond);
+        for (i_dim = 0; i_dim < 3; i_dim++) {
+            code = (code << 1) | ((q[i_dim] >> bit) & 1);
+        }
+    }
+
+    return code;
+}
+
+static int __morton_key_compare(const void *_k0, const void *_k1)
+{
+    const __3dtree_MortonKey *k0 = (const __3dtree_MortonKey*)_k0;
+    const __3dtree_MortonKey *k1 = (const __3dtree_MortonKey*)_k1;
+
+    if (k0->code != k1->code) return (k0->code < k1->code)? -1: 1;
+    return k0->i_query - k1->i_query;
+}
+
+/* Find the nearest oriented point for a batch of queries */
+void __3dtree_NearestOrientedPoint_Batch(
+    __3dTree tree, dt_size_type n_query,
+    const dt_real_type *x0,
+    const dtVector *normvec, const dt_index_type *i_norm,
+    __3dtree_Node **nearest_node, dt_real_type *nearest_dist_sq,
+    __3dtree_OrientedScan scan)
+{
+    __3dtree_MortonKey *key;
+    const dt_real_type *q, *qn;
+    dt_real_type dx, dy, dz, dist_sq;
+    int k, i, i_nearest, i_last = -1;
+
+    if (scan == NULL) scan = __3dtree_select_oriented_scan();
+
+    key = (__3dtree_MortonKey*)__dt_malloc(
+        ((size_t)n_query + 1) * sizeof(__3dtree_MortonKey));
+
+    for (i = 0; i < n_query; i++)
+    {
+        key[i].code =
+            (tree->n_cell > 0)? __morton_code(tree->cell, x0 + 3*i): 0;
+        key[i].i_query = i;
+    }
+    qsort(key, (size_t)n_query, sizeof(__3dtree_MortonKey),
+        __morton_key_compare);
+
+    for (k = 0; k < n_query; k++)
+    {
+        i  = key[k].i_query;
+        q  = x0 + 3*i;
+        qn = &(normvec[(i_norm != NULL)? i_norm[i]: i].x);
+
+        i_nearest = -1;
+        dist_sq   = DBL_MAX;
+
+        /* the answer to the last query is most likely close to this one */
+        if (i_last >= 0 &&
+            tree->nx[i_last]*qn[0] + tree->ny[i_last]*qn[1] +
+            tree->nz[i_last]*qn[2] > 0)
+        {
+            dx = tree->x[i_last] - q[0];
+            dy = tree->y[i_last] - q[1];
+            dz = tree->z[i_last] - q[2];
+            dist_sq   = dx*dx + dy*dy + dz*dz;
+            i_nearest = i_last;
+        }
+
+        if (tree->n_cell > 0) {
+            __3dtree_nearest_oriented(tree, q, qn, scan, &i_nearest, &dist_sq);
+        }
+
+        nearest_node[i]    = (i_nearest >= 0)? tree->node + i_nearest: NULL;
+        nearest_dist_sq[i] = dist_sq;
+        if (i_nearest >= 0) i_last = i_nearest;
     }
 
-    return in_bound;
+    free(key);
 }
 
 
@@ -213,17 +353,151 @@ int __3dtree_RangeSearch(
 {
     return 
         __3dtree_RangeSearch_Cond(
-            tree, x0, range, res_node, res_dist_sq, NULL);
+            tree, x0, range, res_node, res_dist_sq, NULL, NULL);
 }
 
 /* The conditional version of __3dtree_RangeSearch */
 int __3dtree_RangeSearch_Cond(
     __3dTree tree, const dt_real_type *x0, dt_real_type range,
     __3dtree_Node **res_node, dt_real_type *res_dist_sq,
-    int(*cond)(__3dtree_Node *node))
+    __3dtree_Condition cond, void *cond_data)
+{
+    return __3dtree_range(
+        tree, x0, range, res_node, res_dist_sq, cond, cond_data);
+}
+
+
+/* order of the k nearest points: distance, then ID */
+static int __3dtree_closer(
+    dt_real_type dist_sq0, const __3dtree_Node *node0,
+    dt_real_type dist_sq1, const __3dtree_Node *node1)
+{
+    return (dist_sq0 < dist_sq1) ||
+           (dist_sq0 == dist_sq1 && node0->id < node1->id);
+}
+
+/* move entry i of the max-heap [0, n) down to where it belongs */
+static void __3dtree_heap_sift_down(
+    __3dtree_Node **node, dt_real_type *dist_sq, int n, int i)
+{
+    __3dtree_Node *tmp_node;
+    dt_real_type   tmp_dist_sq;
+    int i_child;
+
+    while ((i_child = 2*i + 1) < n)
+    {
+        /* the farther child */
+        if (i_child + 1 < n && __3dtree_closer(
+                dist_sq[i_child], node[i_child],
+                dist_sq[i_child+1], node[i_child+1])) i_child++;
+
+        if (!__3dtree_closer(dist_sq[i], node[i],
+                dist_sq[i_child], node[i_child])) break;
+
+        tmp_node    = node[i];     node[i]    = node[i_child];
+        tmp_dist_sq = dist_sq[i];  dist_sq[i] = dist_sq[i_child];
+        node[i_child] = tmp_node;  dist_sq[i_child] = tmp_dist_sq;
+        i = i_child;
+    }
+}
+
+/* add a point to the max-heap [0, n), it returns the new size */
+static int __3dtree_heap_push(
+    __3dtree_Node **node, dt_real_type *dist_sq, int n,
+    __3dtree_Node *new_node, dt_real_type new_dist_sq)
+{
+    int i = n++, i_parent;
+
+    for ( ; i > 0; i = i_parent)
+    {
+        i_parent = (i - 1) / 2;
+        if (!__3dtree_closer(dist_sq[i_parent], node[i_parent],
+                new_dist_sq, new_node)) break;
+
+        node[i] = node[i_parent];
+        dist_sq[i] = dist_sq[i_parent];
+    }
+
+    node[i] = new_node;
+    dist_sq[i] = new_dist_sq;
+    return n;
+}
+
+/* The same walk as __3dtree_range visiting the nearer child first, with
+   the search radius shrinking to the farthest of the k nearest points
+   once k of them have been found. A cell as far as that point is still
+   visited, it might hold a point at the same distance with a smaller ID. */
+int __3dtree_KNearestInRange_Cond(
+    __3dTree tree, const dt_real_type *x0, dt_real_type range, int k,
+    __3dtree_Node **res_node, dt_real_type *res_dist_sq,
+    __3dtree_Condition cond, void *cond_data)
 {
-    int n_res = 0;
-    __3dtree_range(tree, x0, range, res_node, res_dist_sq, &n_res, cond);
+    int stack[__3DTREE_MAX_DEPTH], n_stack = 0, n_res = 0, i, i_near;
+    dt_real_type stack_dist_sq[__3DTREE_MAX_DEPTH];
+
+    const __3dtree_Cell *cell;
+    const dt_real_type *x = tree->x, *y = tree->y, *z = tree->z;
+    dt_real_type dx, dy, dz, dist_sq, range_sq = range * range;
+    dt_real_type near_dist_sq, far_dist_sq;
+    __3dtree_Node *node, *tmp_node;
+
+    if (tree->n_cell == 0 || k <= 0) return 0;
+
+    stack[0] = 0;
+    stack_dist_sq[n_stack++] = __squared_cell_distance(tree->cell, x0);
+
+    while (n_stack > 0)
+    {
+        n_stack--;
+        if (stack_dist_sq[n_stack] >= range_sq ||
+            (n_res == k && stack_dist_sq[n_stack] > res_dist_sq[0])) continue;
+        cell = tree->cell + stack[n_stack];
+
+        if (cell->i_split < 0)
+        {
+            for (i = cell->begin; i < cell->end; i++)
+            {
+                dx = x[i] - x0[0];  dy = y[i] - x0[1];  dz = z[i] - x0[2];
+                dist_sq = dx*dx + dy*dy + dz*dz;
+                node = tree->node + i;
+
+                /* closer than the farthest of the heap, if it's full */
+                if (dist_sq >= range_sq || (n_res == k && !__3dtree_closer(
+                        dist_sq, node, res_dist_sq[0], res_node[0]))) continue;
+                if (cond != NULL && !cond(node, cond_data)) continue;
+
+                if (n_res == k)
+                {
+                    res_node[0] = node;
+                    res_dist_sq[0] = dist_sq;
+                    __3dtree_heap_sift_down(res_node, res_dist_sq, n_res, 0);
+                }
+                else {
+                    n_res = __3dtree_heap_push(
+                        res_node, res_dist_sq, n_res, node, dist_sq);
+                }
+            }
+            continue;
+        }
+
+        i_near = __3dtree_nearer_child(tree, cell, x0,
+            &near_dist_sq, &far_dist_sq);
+
+        stack[n_stack] = 2 * cell->i_child + 1 - i_near;
+        stack_dist_sq[n_stack++] = far_dist_sq;
+        stack[n_stack] = i_near;
+        stack_dist_sq[n_stack++] = near_dist_sq;
+    }
+
+    /* heap sort, the farthest goes to the back */
+    for (i = n_res - 1; i > 0; i--)
+    {
+        tmp_node = res_node[0];    res_node[0] = res_node[i];
+        res_node[i] = tmp_node;
+        dist_sq = res_dist_sq[0];  res_dist_sq[0] = res_dist_sq[i];
+        res_dist_sq[i] = dist_sq;
+        __3dtree_heap_sift_down(res_node, res_dist_sq, i, 0);
+    }
 
     return n_res;
 }
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "3dtree.h"
+
+
+/* Buckets of oriented queries are scanned 4 (AVX2) or 8 (AVX-512) points at
+   a time: distances and normal dot products of a vector of points are
+   calculated at once, and only lanes passing both tests are looked at one
+   by one. Each kernel is compiled for its instruction set on its own and
+   picked at run time, the rest of the program doesn't need any special
+   compiler flags. Other processors and compilers get the scalar kernel.
+
+   The kernels multiply and add in the same order as the scalar one and
+   never fuse them (FMA rounds once where the scalar code rounds twice), so
+   every kernel finds the same nearest point on any processor.
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define __3DTREE_X86_SIMD  1
+#include <immintrin.h>
+#endif
+
+/* GCC fuses multiplies and adds wherever the target has FMA, even those
+   written as separate intrinsics, unless it's told otherwise */
+#if defined(__GNUC__) && !defined(__clang__)
+#define __3DTREE_NO_FMA  __attribute__((optimize("fp-contract=off")))
+#else
+#define __3DTREE_NO_FMA
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+
+
+/* portable scalar kernel */
+__3DTREE_NO_FMA
+static int __3dtree_scan_oriented(
+    const __3dtree_Tree *tree, int begin, int end,
+    const dt_real_type *x0, const dt_real_type *n0,
+    dt_real_type *nearest_dist_sq)
+{
+    dt_real_type dx, dy, dz, dist_sq;
+    int i, i_nearest = -1;
+
+    for (i = begin; i < end; i++)
+    {
+        dx = tree->x[i] - x0[0];
+        dy = tree->y[i] - x0[1];
+        dz = tree->z[i] - x0[2];
+        dist_sq = dx*dx + dy*dy + dz*dz;
+
+        if (dist_sq < *nearest_dist_sq &&
+            tree->nx[i]*n0[0] + tree->ny[i]*n0[1] + tree->nz[i]*n0[2] > 0)
+        {
+            *nearest_dist_sq = dist_sq;
+            i_nearest = i;
+        }
+    }
+
+    return i_nearest;
+}
+
+
+#ifdef __3DTREE_X86_SIMD
+
+/* pick the nearest of the lanes set in mask */
+static __inline__ int __3dtree_pick_lanes(
+    const dt_real_type *dist_sq, unsigned int mask, int i_base,
+    int i_nearest, dt_real_type *nearest_dist_sq)
+{
+    int lane;
+
+    for (lane = 0; mask != 0; lane++, mask >>= 1)
+    {
+        if ((mask & 1) && dist_sq[lane] < *nearest_dist_sq)
+        {
+            *nearest_dist_sq = dist_sq[lane];
+            i_nearest = i_base + lane;
+        }
+    }
+
+    return i_nearest;
+}
+
+__attribute__((target("avx2"))) __3DTREE_NO_FMA
+static int __3dtree_scan_oriented_avx2(
+    const __3dtree_Tree *tree, int begin, int end,
+    const dt_real_type *x0, const dt_real_type *n0,
+    dt_real_type *nearest_dist_sq)
+{
+    __m256d qx = _mm256_set1_pd(x0[0]), qnx = _mm256_set1_pd(n0[0]);
+    __m256d qy = _mm256_set1_pd(x0[1]), qny = _mm256_set1_pd(n0[1]);
+    __m256d qz = _mm256_set1_pd(x0[2]), qnz = _mm256_set1_pd(n0[2]);
+    __m256d d, dot, zero = _mm256_setzero_pd(), t;
+    __m256i load;
+    dt_real_type dist_sq[4];
+    int i, i_nearest = -1;
+    unsigned int mask;
+
+    /* the last vector is loaded partially */
+    for (i = begin; i < end; i += 4)
+    {
+        load = _mm256_cmpgt_epi64(_mm256_set1_epi64x(end - i),
+                                  _mm256_set_epi64x(3, 2, 1, 0));
+
+        t = _mm256_sub_pd(_mm256_maskload_pd(tree->x + i, load), qx);
+        d = _mm256_mul_pd(t, t);
+        t = _mm256_sub_pd(_mm256_maskload_pd(tree->y + i, load), qy);
+        d = _mm256_add_pd(d, _mm256_mul_pd(t, t));
+        t = _mm256_sub_pd(_mm256_maskload_pd(tree->z + i, load), qz);
+        d = _mm256_add_pd(d, _mm256_mul_pd(t, t));
+
+        dot = _mm256_mul_pd(_mm256_maskload_pd(tree->nx + i, load), qnx);
+        dot = _mm256_add_pd(dot,
+            _mm256_mul_pd(_mm256_maskload_pd(tree->ny + i, load), qny));
+        dot = _mm256_add_pd(dot,
+            _mm256_mul_pd(_mm256_maskload_pd(tree->nz + i, load), qnz));
+
+        /* masked off lanes have a zero normal and fail the dot test */
+        mask = (unsigned int)_mm256_movemask_pd(_mm256_and_pd(
+            _mm256_cmp_pd(d, _mm256_set1_pd(*nearest_dist_sq), _CMP_LT_OQ),
+            _mm256_cmp_pd(dot, zero, _CMP_GT_OQ)));
+
+        if (mask != 0)
+        {
+            _mm256_storeu_pd(dist_sq, d);
+            i_nearest = __3dtree_pick_lanes(
+                dist_sq, mask, i, i_nearest, nearest_dist_sq);
+        }
+    }
+
+    return i_nearest;
+}
+
+__attribute__((target("avx512f"))) __3DTREE_NO_FMA
+static int __3dtree_scan_oriented_avx512(
+    const __3dtree_Tree *tree, int begin, int end,
+    const dt_real_type *x0, const dt_real_type *n0,
+    dt_real_type *nearest_dist_sq)
+{
+    __m512d qx = _mm512_set1_pd(x0[0]), qnx = _mm512_set1_pd(n0[0]);
+    __m512d qy = _mm512_set1_pd(x0[1]), qny = _mm512_set1_pd(n0[1]);
+    __m512d qz = _mm512_set1_pd(x0[2]), qnz = _mm512_set1_pd(n0[2]);
+    __m512d d, dot, zero = _mm512_setzero_pd(), t;
+    dt_real_type dist_sq[8];
+    __mmask8 load, mask;
+    int i, i_nearest = -1;
+
+    /* the last vector is loaded partially */
+    for (i = begin; i < end; i += 8)
+    {
+        load = (__mmask8)((end - i >= 8)? 0xff: (1u << (end - i)) - 1);
+
+        t = _mm512_sub_pd(_mm512_maskz_loadu_pd(load, tree->x + i), qx);
+        d = _mm512_mul_pd(t, t);
+        t = _mm512_sub_pd(_mm512_maskz_loadu_pd(load, tree->y + i), qy);
+        d = _mm512_add_pd(d, _mm512_mul_pd(t, t));
+        t = _mm512_sub_pd(_mm512_maskz_loadu_pd(load, tree->z + i), qz);
+        d = _mm512_add_pd(d, _mm512_mul_pd(t, t));
+
+        dot = _mm512_mul_pd(_mm512_maskz_loadu_pd(load, tree->nx + i), qnx);
+        dot = _mm512_add_pd(dot,
+            _mm512_mul_pd(_mm512_maskz_loadu_pd(load, tree->ny + i), qny));
+        dot = _mm512_add_pd(dot,
+            _mm512_mul_pd(_mm512_maskz_loadu_pd(load, tree->nz + i), qnz));
+
+        mask = _mm512_mask_cmp_pd_mask(load,
+            d, _mm512_set1_pd(*nearest_dist_sq), _CMP_LT_OQ);
+        mask = _mm512_mask_cmp_pd_mask(mask, dot, zero, _CMP_GT_OQ);
+
+        if (mask != 0)
+        {
+            _mm512_storeu_pd(dist_sq, d);
+            i_nearest = __3dtree_pick_lanes(
+                dist_sq, mask, i, i_nearest, nearest_dist_sq);
+        }
+    }
+
+    return i_nearest;
+}
+
+#endif /* __3DTREE_X86_SIMD */
+
+
+/* The bucket kernel named scalar, avx2 or avx512, or NULL if there's no
+   such kernel or the processor doesn't support it */
+__3dtree_OrientedScan __3dtree_FindOrientedScan(const char *name)
+{
+    if (strcmp(name, "scalar") == 0) {
+        return __3dtree_scan_oriented;
+    }
+
+#ifdef __3DTREE_X86_SIMD
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        return __3dtree_scan_oriented_avx2;
+    }
+    if (strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512f")) {
+        return __3dtree_scan_oriented_avx512;
+    }
+#endif
+    return NULL;
+}
+
+/* the fastest scan the processor supports, the processor never changes so
+   it's picked once for all queries */
+static __3dtree_OrientedScan __3dtree_fastest_scan = NULL;
+static pthread_once_t __3dtree_fastest_scan_once = PTHREAD_ONCE_INIT;
+
+static void __3dtree_pick_fastest_scan(void)
+{
+    if ((__3dtree_fastest_scan = __3dtree_FindOrientedScan("avx512")) == NULL &&
+        (__3dtree_fastest_scan = __3dtree_FindOrientedScan("avx2")) == NULL)
+    {
+        __3dtree_fastest_scan = __3dtree_scan_oriented;
+    }
+}
+
+__3dtree_OrientedScan __3dtree_select_oriented_scan(void)
+{
+    pthread_once(&__3dtree_fastest_scan_once, __3dtree_pick_fastest_scan);
+    return __3dtree_fastest_scan;
+}
@@ -2,6 +2,7 @@
 #include <math.h>
 
 #include "closest_point.h"
+#include "parallel_for.h"
 
 
 
@@ -16,10 +17,13 @@ void __dt_CreateSpatialJoinList(
     spjlist->list_length = source_model->n_vertex;
     spjlist->i_target_vertex = (dt_index_type*)__dt_malloc(
         (size_t)spjlist->list_length * sizeof(dt_index_type));
+    spjlist->target_point = (dtVertex*)__dt_malloc(
+        (size_t)spjlist->list_length * sizeof(dtVertex));
 }
 
 void __dt_DestroySpatialJoinList(__dt_SpatialJoinList *spjlist) {
     free(spjlist->i_target_vertex);
+    free(spjlist->target_point);
 }
 
 
@@ -38,47 +42,129 @@ static dt_real_type __vector_dot(const dtVector *v1, const dtVector *v2)
    search, it is quite handy in correspondence phase 2 - closest point 
    iteration. */
 __3dTree __dt_Build3DTree_Vertex(const dtMeshModel *model)
+{
+    dtMeshGeometry geom;
+
+    ViewMeshGeometry(model, &geom);
+    return __dt_Build3DTree_Geometry(&geom);
+}
+
+/* Build a 3d tree with the vertices of a mesh geometry */
+__3dTree __dt_Build3DTree_Geometry(const dtMeshGeometry *geom)
 {
     __3dTree  tree;
     __3dtree_Exemplar *exset;
 
-    dt_index_type i_vertex = 0;
+    size_t stride = (size_t)geom->stride;
+    const dt_real_type *c;
+    const float *cf;
+    dt_index_type i_vertex;
+    int i_dim;
 
     /* 3d tree works with exemplar set, we need to construct exsets for target 
        model */
     exset = (__3dtree_Exemplar*)__dt_malloc(
-        (size_t)model->n_vertex * sizeof(__3dtree_Exemplar));
+        (size_t)geom->n_vertex * sizeof(__3dtree_Exemplar));
 
-    for ( ; i_vertex < model->n_vertex; i_vertex++)
-    {
-        exset[i_vertex].pt[0] = model->vertex[i_vertex].x;
-        exset[i_vertex].pt[1] = model->vertex[i_vertex].y;
-        exset[i_vertex].pt[2] = model->vertex[i_vertex].z;
+    for (i_vertex = 0; i_vertex < geom->n_vertex; i_vertex++) {
         exset[i_vertex].id = i_vertex;
     }
 
+    /* a coordinate at a time, reading a single array of the geometry */
+    for (i_dim = 0; i_dim < 3; i_dim++)
+    {
+        if (geom->use_float)
+        {
+            cf = geom->coordf[i_dim];
+            for (i_vertex = 0; i_vertex < geom->n_vertex; i_vertex++) {
+                exset[i_vertex].pt[i_dim] =
+                    (dt_real_type)cf[(size_t)i_vertex * stride];
+            }
+        }
+        else
+        {
+            c = geom->coord[i_dim];
+            for (i_vertex = 0; i_vertex < geom->n_vertex; i_vertex++) {
+                exset[i_vertex].pt[i_dim] = c[(size_t)i_vertex * stride];
+            }
+        }
+    }
+
     /* create the 3d tree */
-    __3dtree_Create3DTree(exset, exset + model->n_vertex, &tree);
+    __3dtree_Create3DTree(exset, exset + geom->n_vertex, &tree);
 
     /* free the exset allocated for building the tree */
     free(exset);
     return tree;
 }
 
+/* Build a BVH with triangles of specified model for closest point on
+   surface search */
+__TriBVH __dt_BuildTriangleBVH(const dtMeshModel *model)
+{
+    __TriBVH bvh;
+
+    __tribvh_CreateBVH(model, &bvh);
+    return bvh;
+}
 
-/* variables for currying */
-static const dtVector      *__lambda_src_norm;
-static const dtVector      *__lambda_target_normvec;
-static const dt_index_type *__lambda_tgt_inorm_list;
 
-/* compare source vertex normal with target vertex normal and a difference in 
-   orientation of less than 90-deg indicates a valid point */
-static int __norm_condition(__3dtree_Node *node)
+/* arguments of __dt_ResolveModelSpatialJoin_Parallel shared by threads */
+typedef struct __spatial_join_task_struct
 {
-    const dtVector *tgt_norm = 
-        __lambda_target_normvec + __lambda_tgt_inorm_list[node->id];
+    const dtMeshModel   *source_model, *target_model;
+    const dt_index_type *src_inorm_list;
+    __3dTree             tree_tgt;
+    __dt_SpatialJoinList *spjlist;
 
-    return (__vector_dot(__lambda_src_norm, tgt_norm) > 0);
+} __spatial_join_task;
+
+/* resolve the spatial join of source vertices [begin, end) with a single
+   batch of oriented queries, the tree has the normals of target vertices */
+static void __spatial_join_range(
+    void *data, int i_thread, dt_index_type begin, dt_index_type end)
+{
+    const __spatial_join_task *task = (const __spatial_join_task*)data;
+    const dtMeshModel *source_model = task->source_model;
+
+    dt_size_type n = end - begin;
+    dt_real_type  *dist_sq;
+    __3dtree_Node **res_node;
+    dt_index_type i_vertex;
+
+    (void)i_thread;   /* buffers are allocated for each range */
+
+    dist_sq  = (dt_real_type*)__dt_malloc(
+        (size_t)(n + 1) * sizeof(dt_real_type));
+    res_node = (__3dtree_Node**)__dt_malloc(
+        (size_t)(n + 1) * sizeof(__3dtree_Node*));
+
+    /* search for the nearest valid vertex, vertex normal vectors are for
+       orientation condition */
+    __3dtree_NearestOrientedPoint_Batch(task->tree_tgt, n,
+        &(source_model->vertex[begin].x),
+        source_model->normvec, task->src_inorm_list + begin,
+        res_node, dist_sq, NULL);
+
+    /* append result vertex index to the spatial join list, vertices with no
+       target vertex facing their way are left unjoined */
+    for (i_vertex = begin; i_vertex < end; i_vertex++)
+    {
+        if (res_node[i_vertex - begin] == NULL)
+        {
+            task->spjlist->i_target_vertex[i_vertex] = -1;
+            task->spjlist->target_point[i_vertex] =
+                source_model->vertex[i_vertex];
+            continue;
+        }
+
+        task->spjlist->i_target_vertex[i_vertex] = 
+            res_node[i_vertex - begin]->id;
+        task->spjlist->target_point[i_vertex] = task->target_model->vertex[
+            task->spjlist->i_target_vertex[i_vertex]];
+    }
+
+    free(dist_sq);  free(res_node);
 }
 
 /* Resolve the spatial join between source model and target model using a 
@@ -90,33 +176,121 @@ void __dt_ResolveModelSpatialJoin(
     const dt_index_type *tgt_inorm_list,
     __3dTree tree_tgt, __dt_SpatialJoinList *spjlist)
 {
-    __3dtree_Node *res_node;
-    dt_real_type  x0[3], dist_sq;
-    dt_index_type i_vertex;
+    __dt_ResolveModelSpatialJoin_Parallel(source_model, target_model,
+        src_inorm_list, tgt_inorm_list, tree_tgt, spjlist, 1);
+}
 
-    /* currying */
-    __lambda_target_normvec = target_model->normvec;
-    __lambda_tgt_inorm_list = tgt_inorm_list;
+/* The same as __dt_ResolveModelSpatialJoin, source vertices are split among
+   n_thread threads */
+void __dt_ResolveModelSpatialJoin_Parallel(
+    const dtMeshModel *source_model, const dtMeshModel *target_model,
+    const dt_index_type *src_inorm_list,
+    const dt_index_type *tgt_inorm_list,
+    __3dTree tree_tgt, __dt_SpatialJoinList *spjlist, int n_thread)
+{
+    __spatial_join_task task;
+
+    task.source_model   = source_model;
+    task.target_model   = target_model;
+    task.src_inorm_list = src_inorm_list;
+    task.tree_tgt       = tree_tgt;
+    task.spjlist        = spjlist;
+
+    /* orientation of target vertices, set before any thread reads the tree */
+    __3dtree_SetNormals(tree_tgt, target_model->normvec, tgt_inorm_list);
+
+    __dt_ParallelFor(source_model->n_vertex, n_thread,
+        __spatial_join_range, &task);
+}
+
+
+/* arguments of __dt_ResolveModelSurfaceJoin_Parallel shared by threads */
+typedef struct __surface_join_task_struct
+{
+    const dtMeshModel   *source_model, *target_model;
+    const dt_index_type *src_inorm_list;
+    __TriBVH             bvh_tgt;
+    __dt_SpatialJoinList *spjlist;
+
+} __surface_join_task;
+
+/* resolve the surface join of source vertices [begin, end) with a single
+   batch of oriented queries */
+static void __surface_join_range(
+    void *data, int i_thread, dt_index_type begin, dt_index_type end)
+{
+    const __surface_join_task *task = (const __surface_join_task*)data;
+    const dtMeshModel *target_model = task->target_model;
+    const dtTriangle  *tri;
+    const dtVertex    *p, *v;
+
+    dt_size_type n = end - begin;
+    dt_real_type  *dist_sq, d, min_d;
+    int           *i_triangle;
+    dt_index_type i_vertex, i_corner, i_nearest = -1;
+
+    (void)i_thread;   /* buffers are allocated for each range */
+
+    dist_sq    = (dt_real_type*)__dt_malloc(
+        (size_t)(n + 1) * sizeof(dt_real_type));
+    i_triangle = (int*)__dt_malloc((size_t)(n + 1) * sizeof(int));
+
+    /* closest points go right into the spatial join list */
+    __tribvh_NearestOrientedPoint_Batch(task->bvh_tgt, n,
+        &(task->source_model->vertex[begin].x),
+        task->source_model->normvec, task->src_inorm_list + begin,
+        i_triangle, &(task->spjlist->target_point[begin].x), dist_sq);
 
-    /* nearest point search */
-    for (i_vertex = 0; i_vertex < source_model->n_vertex; i_vertex++)
+    for (i_vertex = begin; i_vertex < end; i_vertex++)
     {
-        /* convert reference point to 3D array form */
-        x0[0] = source_model->vertex[i_vertex].x;
-        x0[1] = source_model->vertex[i_vertex].y;
-        x0[2] = source_model->vertex[i_vertex].z;
-
-        /* currying vertex normal vectors for orientation condition */
-        __lambda_src_norm = 
-            source_model->normvec + src_inorm_list[i_vertex];
-        
-        /* search for the nearest valid vertex */
-        __3dtree_NearestPoint_Cond(
-            tree_tgt, x0, &res_node, &dist_sq, __norm_condition);
-
-        /* append result vertex index to the spatial join list */
-        spjlist->i_target_vertex[i_vertex] = res_node->id;
+        /* no target triangle faces the way of the vertex, it's left
+           unjoined as in the vertex join */
+        if (i_triangle[i_vertex - begin] < 0)
+        {
+            task->spjlist->i_target_vertex[i_vertex] = -1;
+            task->spjlist->target_point[i_vertex] =
+                task->source_model->vertex[i_vertex];
+            continue;
+        }
+
+        /* the corner of the triangle nearest to the closest point */
+        tri = target_model->triangle + i_triangle[i_vertex - begin];
+        p   = task->spjlist->target_point + i_vertex;
+
+        for (min_d = -1, i_corner = 0; i_corner < 3; i_corner++)
+        {
+            v = target_model->vertex + tri->i_vertex[i_corner];
+            d = (v->x - p->x)*(v->x - p->x) + (v->y - p->y)*(v->y - p->y) +
+                (v->z - p->z)*(v->z - p->z);
+
+            if (min_d < 0 || d < min_d) {
+                min_d = d;  i_nearest = tri->i_vertex[i_corner];
+            }
+        }
+
+        task->spjlist->i_target_vertex[i_vertex] = i_nearest;
     }
+
+    free(dist_sq);  free(i_triangle);
+}
+
+/* Join each source vertex to the closest point on the surface of target
+   model, source vertices are split among n_thread threads */
+void __dt_ResolveModelSurfaceJoin_Parallel(
+    const dtMeshModel *source_model, const dtMeshModel *target_model,
+    const dt_index_type *src_inorm_list,
+    __TriBVH bvh_tgt, __dt_SpatialJoinList *spjlist, int n_thread)
+{
+    __surface_join_task task;
+
+    task.source_model   = source_model;
+    task.target_model   = target_model;
+    task.src_inorm_list = src_inorm_list;
+    task.bvh_tgt        = bvh_tgt;
+    task.spjlist        = spjlist;
+
+    __dt_ParallelFor(source_model->n_vertex, n_thread,
+        __surface_join_range, &task);
 }
 
 
@@ -169,6 +343,10 @@ void __dt_ResolveModelSpatialJoin_BruteForce(
             }
         }
 
+        /* vertices with no target vertex facing their way are left
+           unjoined, at their own position */
         spjlist->i_target_vertex[i_src_vertex] = i_tgt_closest;
+        spjlist->target_point[i_src_vertex] = (i_tgt_closest >= 0)?
+            target_model->vertex[i_tgt_closest]: *src_vertex;
     }
 }
@@ -3,16 +3,24 @@
 
 
 #include "mesh_model.h"
+#include "mesh_geometry.h"
 #include "3dtree.h"
+#include "tribvh.h"
 
 
-/* A list of indexes of each source vertex's closest vertex on target mesh */
+/* A list of indexes of each source vertex's closest vertex on target mesh,
+   and the closest point itself, which is that vertex or a point on the
+   surface of target mesh, depending on how the join was resolved */
 typedef struct __dt_SpatialJoinList_struct
 {
     dt_size_type  list_length;
     dt_index_type *i_target_vertex;  /* i_target_vertex[i] is the index of the
                                         closest vertex on target mesh to 
-                                        vertex i on source mesh */
+                                        vertex i on source mesh, or -1 if
+                                        nothing on target mesh faces its
+                                        way, vertex i is then unjoined */
+    dtVertex      *target_point;     /* closest point to vertex i, or vertex
+                                        i itself if it's unjoined */
 } __dt_SpatialJoinList;
 
 
@@ -27,19 +35,48 @@ void __dt_CreateSpatialJoinList(
    iteration. */
 __3dTree __dt_Build3DTree_Vertex(const dtMeshModel *model);
 
+/* The same as __dt_Build3DTree_Vertex, with the vertices of a mesh
+   geometry */
+__3dTree __dt_Build3DTree_Geometry(const dtMeshGeometry *geom);
+
+/* Build a BVH with triangles of specified model for closest point on
+   surface search, normals of the triangles are those of their vertices. */
+__TriBVH __dt_BuildTriangleBVH(const dtMeshModel *model);
+
 void __dt_DestroySpatialJoinList(__dt_SpatialJoinList *spjlist);
 
 
 
 /* Resolve the spatial join between source model and target model using a 
    3d tree of the target model, this routine is way more effiecient than
-   the brute force one. */
+   the brute force one. Source vertices are queried in a batch, see
+   __3dtree_NearestOrientedPoint_Batch. */
 void __dt_ResolveModelSpatialJoin(
     const dtMeshModel *source_model, const dtMeshModel *target_model,
     const dt_index_type *src_inorm_list,
     const dt_index_type *tgt_inorm_list,
     __3dTree tree_tgt, __dt_SpatialJoinList *spjlist);
 
+/* The same as __dt_ResolveModelSpatialJoin, source vertices are split among
+   n_thread threads. Normals of target vertices are set to the tree before
+   the threads start, which then only read it. */
+void __dt_ResolveModelSpatialJoin_Parallel(
+    const dtMeshModel *source_model, const dtMeshModel *target_model,
+    const dt_index_type *src_inorm_list,
+    const dt_index_type *tgt_inorm_list,
+    __3dTree tree_tgt, __dt_SpatialJoinList *spjlist, int n_thread);
+
+/* Join each source vertex to the closest point on the surface of target
+   model rather than its closest vertex, only triangles less than 90-deg
+   away from the normal of the source vertex are considered, as in the
+   vertex join. i_target_vertex is set to the corner of the triangle which
+   is the nearest to that point. Source vertices are split among n_thread
+   threads, the BVH is only read. */
+void __dt_ResolveModelSurfaceJoin_Parallel(
+    const dtMeshModel *source_model, const dtMeshModel *target_model,
+    const dt_index_type *src_inorm_list,
+    __TriBVH bvh_tgt, __dt_SpatialJoinList *spjlist, int n_thread);
+
 /* Resolve the spatial join between source model and target model, this routine
    uses a naive brute force O(m*n) method, which might be slow for even small
    or medium size models. KD tree might be much faster in 3D case. */
@@ -49,6 +86,15 @@ void __dt_ResolveModelSpatialJoin_BruteForce(
     const dt_index_type *tgt_inorm_list,
     __dt_SpatialJoinList *spjlist);
 
+/* Benchmark the nearest oriented vertex queries of the spatial join of
+   source model to target model on a single thread, printing the queries
+   per second of the per-query conditional search and of the batch with
+   each leaf kernel the processor supports, best of n_repeat runs. Batch
+   answers are checked against the per-query ones. */
+void __dt_BenchmarkSpatialJoin(
+    const dtMeshModel *source_model, const dtMeshModel *target_model,
+    int n_repeat);
+
 
 
 #endif /* __DT_CLOSEST_POINT_HEADER__ */
@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>     /* for clock_gettime */
+
+#include "closest_point.h"
+
+
+
+/* orientation condition of the per-query path, the same test the batch
+   kernels make on the normals stored in the tree */
+typedef struct __bench_orientation_struct
+{
+    const dtVector      *normvec;     /* normals of the target model */
+    const dt_index_type *i_norm;      /* normal index of target vertices */
+    const dtVector      *n0;          /* normal of the query */
+
+} __bench_orientation;
+
+static int __bench_oriented(__3dtree_Node *node, void *cond_data)
+{
+    const __bench_orientation *o = (const __bench_orientation*)cond_data;
+    const dtVector *n = o->normvec + o->i_norm[node->id];
+
+    return n->x * o->n0->x + n->y * o->n0->y + n->z * o->n0->z > 0;
+}
+
+/* wall clock time in seconds */
+static double __bench_seconds(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+}
+
+
+/* Benchmark the nearest oriented vertex queries of the spatial join */
+void __dt_BenchmarkSpatialJoin(
+    const dtMeshModel *source_model, const dtMeshModel *target_model,
+    int n_repeat)
+{
+    static const char *kernel_name[] = { "scalar", "avx2", "avx512" };
+    __3dtree_OrientedScan kernel;
+
+    dt_index_type *src_inorm, *tgt_inorm, i_vertex;
+    __3dTree tree;
+    __3dtree_Node **res_node, **cond_node;
+    dt_real_type *dist_sq, *cond_dist_sq;
+    __bench_orientation o;
+
+    dt_size_type n = source_model->n_vertex, n_mismatch;
+    double t0, seconds;
+    int i_repeat, i_kernel;
+
+    src_inorm = __dt_SortOutVertexNormalList(source_model);
+    tgt_inorm = __dt_SortOutVertexNormalList(target_model);
+    tree = __dt_Build3DTree_Vertex(target_model);
+    __3dtree_SetNormals(tree, target_model->normvec, tgt_inorm);
+
+    res_node     = (__3dtree_Node**)__dt_malloc(
+        ((size_t)n + 1) * sizeof(__3dtree_Node*));
+    cond_node    = (__3dtree_Node**)__dt_malloc(
+        ((size_t)n + 1) * sizeof(__3dtree_Node*));
+    dist_sq      = (dt_real_type*)__dt_malloc(
+        ((size_t)n + 1) * sizeof(dt_real_type));
+    cond_dist_sq = (dt_real_type*)__dt_malloc(
+        ((size_t)n + 1) * sizeof(dt_real_type));
+
+    printf("%d queries, %d target vertices, single thread, best of %d\n",
+        (int)n, (int)target_model->n_vertex, n_repeat);
+
+    /* a query at a time, orientation tested by a condition callback */
+    o.normvec = target_model->normvec;
+    o.i_norm  = tgt_inorm;
+    for (seconds = -1, i_repeat = 0; i_repeat < n_repeat; i_repeat++)
+    {
+        t0 = __bench_seconds();
+        for (i_vertex = 0; i_vertex < n; i_vertex++)
+        {
+            o.n0 = source_model->normvec + src_inorm[i_vertex];
+            __3dtree_NearestPoint_Cond(tree,
+                &(source_model->vertex[i_vertex].x),
+                cond_node + i_vertex, cond_dist_sq + i_vertex,
+                __bench_oriented, &o);
+        }
+        t0 = __bench_seconds() - t0;
+        if (seconds < 0 || t0 < seconds) seconds = t0;
+    }
+    printf("  cond query     %8.3f M queries/s\n", 1e-6 * n / seconds);
+
+    /* batches, with each kernel the processor supports */
+    for (i_kernel = 0; i_kernel < 3; i_kernel++)
+    {
+        kernel = __3dtree_FindOrientedScan(kernel_name[i_kernel]);
+        if (kernel == NULL) continue;   /* the processor doesn't support it */
+
+        for (seconds = -1, i_repeat = 0; i_repeat < n_repeat; i_repeat++)
+        {
+            t0 = __bench_seconds();
+            __3dtree_NearestOrientedPoint_Batch(tree, n,
+                &(source_model->vertex[0].x),
+                source_model->normvec, src_inorm, res_node, dist_sq, kernel);
+            t0 = __bench_seconds() - t0;
+            if (seconds < 0 || t0 < seconds) seconds = t0;
+        }
+
+        /* both paths have to find points at the same distance */
+        for (n_mismatch = 0, i_vertex = 0; i_vertex < n; i_vertex++)
+        {
+            if ((res_node[i_vertex] == NULL) !=
+                (cond_node[i_vertex] == NULL) ||
+                (res_node[i_vertex] != NULL &&
+                 dist_sq[i_vertex] != cond_dist_sq[i_vertex]))
+            {
+                n_mismatch++;
+            }
+        }
+
+        printf("  batch %-8s %8.3f M queries/s, %d mismatches\n",
+            kernel_name[i_kernel], 1e-6 * n / seconds, (int)n_mismatch);
+    }
+
+    free(res_node);  free(cond_node);
+    free(dist_sq);   free(cond_dist_sq);
+    __3dtree_Destroy3DTree(tree);
+    free(src_inorm);  free(tgt_inorm);
+}
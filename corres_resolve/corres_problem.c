@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include "corres_problem.h"
+#include "parallel_for.h"
 
 
 
@@ -12,8 +13,10 @@ void CreateCorrespondenceProblem(
     const char *vertex_constraint_name, 
     const char *source_adjacency_name)
 {
-    __dt_ReadObjFile_commit_or_crash(source_mesh_name, &(problem->source_model));
-    __dt_ReadObjFile_commit_or_crash(target_mesh_name, &(problem->target_model));
+    __dt_ReadMeshFile_commit_or_crash(
+        source_mesh_name, &(problem->source_model));
+    __dt_ReadMeshFile_commit_or_crash(
+        target_mesh_name, &(problem->target_model));
 
     if (__dt_LoadConstraints(
             vertex_constraint_name, &(problem->conslist)) != 0)
@@ -42,7 +45,20 @@ void CreateCorrespondenceProblem(
     __dt_CreateVertexInfoList(
         &(problem->source_model), &(problem->conslist), &(problem->vtilist));
 
+    /* elementary terms only depend on the undeformed source model */
+    __dt_InitializeSurfaceInvVList(
+        &(problem->source_model), &(problem->sinvlist));
+    __dt_CreateElementaryTermList(
+        &(problem->source_model), &(problem->target_model),
+        &(problem->conslist), &(problem->vtilist), &(problem->sinvlist),
+        &(problem->elemtermlist));
+
     __dt_CreateEmptyTriangleCorrsList(&(problem->result_tclist));
+    problem->n_thread = __dt_DefaultThreadCount();
+    problem->closest_surface   = 0;
+    problem->adaptive_schedule = 0;
+    problem->use_float         = 0;
+    problem->use_cholmod       = 0;
 }
 
 
@@ -52,6 +68,8 @@ void DestroyCorrespondenceProblem(dtCorrespondenceProblem *problem)
     __dt_ReleaseAdjacencies        (&(problem->adjlist));
     __dt_ReleaseConstraints        (&(problem->conslist));
     __dt_DestroyVertexInfoList     (&(problem->vtilist));
+    __dt_DestroySurfaceInvVList    (&(problem->sinvlist));
+    __dt_DestroyElementaryTermList (&(problem->elemtermlist));
     __dt_DestroyTriangleCorrsList  (&(problem->result_tclist));
     DestroyMeshModel               (&(problem->source_model));
     DestroyMeshModel               (&(problem->target_model));
@@ -15,13 +15,42 @@ typedef struct __dt_CorrespondenceProblem_struct
     __dt_VertexConstraintList conslist;      /* marker points constraints */
     __dt_VertexInfoList       vtilist;       /* varvector/conslist index */
 
+    /* inverse surface matrices and elementary terms of the undeformed 
+       source model, shared by both phases */
+    __dt_SurfaceInvVList      sinvlist;
+    __dt_ElementaryTermList   elemtermlist;
+
     dt_real_type   weight_smooth;      /* weight for smoothness term */
     dt_real_type   weight_identity;    /* weight for identity term */
 
-    /* weight for closest point iteration: [start: step: end) */
+    /* weight for closest point iteration: [start: step: end), step must be
+       positive */
     dt_real_type   weight_closest_start, weight_closest_end;
     dt_real_type   weight_closest_step;
 
+    /* adapt the step of closest point iteration to the changes of spatial
+       join, or take every step of the schedule if it's 0 (the default) */
+    int            adaptive_schedule;
+
+    /* join free vertices to the closest point on the surface of target
+       model, or to its closest vertex if it's 0 (the default) */
+    int            closest_surface;
+
+    /* copy the vertices into float32 arrays of their own before resolving
+       triangle correspondences, centroids and normals of triangles are
+       calculated from these rounded coordinates, or read the vertices from
+       the models in place if it's 0 (the default) */
+    int            use_float;
+
+    /* solve the normal equations with the Cholesky factorization of
+       CHOLMOD, or with the LU factorization of UMFPACK if it's 0 (the
+       default) */
+    int            use_cholmod;
+
+    /* threads resolving spatial joins and triangle correspondences, all
+       processors online by default */
+    int            n_thread;
+
     /* result: triangle units correspondences */
     __dt_TriangleCorrsList result_tclist;
 
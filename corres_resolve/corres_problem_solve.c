@@ -1,14 +1,100 @@
 #include <math.h>
 #include "corres_problem.h"
 #include "triangle_corr.h"
+#include "pcg.h"
 
 
-#define __dt_SOLVER_least_square __dt_UMFPACK_least_square
+/* the storage of At*A the solver wants: UMFPACK wants it in full, CHOLMOD
+   only needs its upper part */
+static int __solver_stype(const dtCorrespondenceProblem *problem) {
+    return problem->use_cholmod? __DT_NORMAL_UPPER: __DT_NORMAL_FULL;
+}
+
+
+/* Factorization of At*A. The pattern of At*A stays the same through all 
+   closest point iterations of phase 2, so the ordering and the symbolic
+   analysis are done once and each iteration only factorizes numerically. */
+typedef struct __corres_factor_struct
+{
+    int                  use_cholmod;   /* which one of these is used */
+    cholmod_factor      *L;             /* CHOLMOD */
+    __dt_UMFPACK_factor  F;             /* UMFPACK */
+
+} __corres_factor;
+
+static void __analyze(
+    cholmod_sparse *AtA, int use_cholmod, __corres_factor *fac)
+{
+    fac->use_cholmod = use_cholmod;
+    if (use_cholmod) {
+        fac->L = __dt_CHOLMOD_analyze(AtA, NULL);
+    }
+    else {
+        __dt_UMFPACK_analyze(AtA, &(fac->F));
+    }
+}
+
+/* factorize At*A with its current values and solve for x */
+static cholmod_dense* __factorize_and_solve(
+    __dt_NormalEquation *eqn, __corres_factor *fac)
+{
+    if (fac->use_cholmod)
+    {
+        __dt_CHOLMOD_factorize(eqn->AtA, fac->L);
+        return __dt_CHOLMOD_solve(fac->L, eqn->AtC);
+    }
+
+    __dt_UMFPACK_factorize(eqn->AtA, &(fac->F));
+    return __dt_UMFPACK_solve(eqn->AtA, &(fac->F), eqn->AtC);
+}
+
+static void __free_factor(__corres_factor *fac)
+{
+    if (fac->use_cholmod) {
+        __dt_CHOLMOD_free_factor(&(fac->L));
+    }
+    else {
+        __dt_UMFPACK_free_factor(&(fac->F));
+    }
+}
+
+
+/* Between closest point iterations only the closest point diagonal of At*A
+   changes, the factor of an earlier iteration makes an excellent 
+   preconditioner for the current one.
+   Later iterations are solved with PCG, warm started from the solution of
+   the last iteration, the numeric factorization is only redone when PCG
+   fails to converge in __DT_PCG_MAX_ITER iterations. */
+#define __DT_PCG_TOL       1e-8
+#define __DT_PCG_MAX_ITER  50
+
+static void __factor_preconditioner(void *data, const double *r, double *z)
+{
+    __corres_factor *fac = (__corres_factor*)data;
+
+    if (fac->use_cholmod) {
+        __dt_CHOLMOD_solve_column(fac->L, r, z);
+    }
+    else {
+        __dt_UMFPACK_solve_column(&(fac->F), r, z);
+    }
+}
+
+/* Solve for x, y and z with a stale factor as preconditioner, x holds the
+   initial guess. It returns the maximum number of PCG iterations of these
+   columns, or -1 if any of them didn't converge. */
+static int __solve_with_stale_factor(
+    __dt_NormalEquation *eqn, __corres_factor *fac, cholmod_dense *x)
+{
+    return __dt_PCG_solve_dense(eqn->AtA, eqn->AtC, x,
+        __factor_preconditioner, fac, __DT_PCG_TOL, __DT_PCG_MAX_ITER);
+}
 
 
 /* Apply the solution vector of the correspondence equation to the vertices of
-   the source model, make the source model deform into the target model. */
-static void __apply_deformation_to_source_model(
+   the source model, make the source model deform into the target model. It
+   returns how far the free vertices moved at most. */
+static dt_real_type __apply_deformation_to_source_model(
     dtMeshModel *source_model, const dtMeshModel *target_model,
     const __dt_VertexInfoList *vtilist, 
     const __dt_VertexConstraintList *conslist,
@@ -30,26 +116,24 @@ static void __solve_correspondence_problem_Launch(
 static void __solve_correspondence_problem_Phase1(
     dtCorrespondenceProblem *problem)
 {
-    cholmod_triplet *M;
-    cholmod_dense   *C, *x;
-    cholmod_sparse  *A;
+    __dt_NormalEquation eqn;
+    __corres_factor fac;
+    cholmod_dense *x;
 
     /* building linear system */
     __dt_CorresEqn_Phase1(
-        &(problem->source_model), &(problem->target_model), 
-        &(problem->adjlist), &(problem->conslist), &(problem->vtilist), 
-        &M, &C,
+        &(problem->source_model), &(problem->adjlist), &(problem->vtilist), 
+        &(problem->elemtermlist), __solver_stype(problem), &eqn,
         sqrt(problem->weight_smooth), 
         sqrt(problem->weight_identity));
 
     /* solve the least square problem */
     printf("solving linear system...\n");
-    A = __dt_CHOLMOD_triplet_to_sparse(M);
-    __dt_CHOLMOD_free_triplet(&M);
-    x = __dt_SOLVER_least_square(A, C);
+    __analyze(eqn.AtA, problem->use_cholmod, &fac);
+    x = __factorize_and_solve(&eqn, &fac);
 
-    __dt_CHOLMOD_free_sparse(&A);
-    __dt_CHOLMOD_free_dense(&C);
+    __free_factor(&fac);
+    __dt_DestroyNormalEquation(&eqn);
 
     /* deform the source mesh according to the solution we got */
     printf("applying deformation...\n");
@@ -61,88 +145,272 @@ static void __solve_correspondence_problem_Phase1(
 }
 
 
+/* The adaptive schedule of closest point iteration watches how many spatial
+   join assignments changed and how far the free vertices moved in each
+   iteration: the step is doubled while the join is stable, and halved (down
+   to __DT_MIN_STEP_RATIO of the given step) when a lot of assignments keep
+   changing. Once the join has been stable for 2 iterations in a row, the
+   remaining weights would only pull the vertices closer to the same points,
+   so we jump straight to the last weight of the schedule. */
+#define __DT_STABLE_JOIN     0.001   /* fraction of changed assignments */
+#define __DT_STABLE_MOVE     0.001   /* max move / target model size */
+#define __DT_UNSTABLE_JOIN   0.05
+#define __DT_MIN_STEP_RATIO  0.125
+
+
+/* length of the bounding box diagonal of a model */
+static dt_real_type __model_size(const dtMeshModel *model)
+{
+    dtVertex lo = model->vertex[0], hi = model->vertex[0], *v;
+    dt_index_type i;
+
+    for (i = 1; i < model->n_vertex; i++)
+    {
+        v = model->vertex + i;
+        lo.x = (v->x < lo.x)? v->x: lo.x;   hi.x = (v->x > hi.x)? v->x: hi.x;
+        lo.y = (v->y < lo.y)? v->y: lo.y;   hi.y = (v->y > hi.y)? v->y: hi.y;
+        lo.z = (v->z < lo.z)? v->z: lo.z;   hi.z = (v->z > hi.z)? v->z: hi.z;
+    }
+
+    return sqrt((hi.x - lo.x)*(hi.x - lo.x) + (hi.y - lo.y)*(hi.y - lo.y) +
+                (hi.z - lo.z)*(hi.z - lo.z));
+}
+
+/* number of free vertices joined to another target vertex than last time */
+static dt_size_type __count_join_changes(
+    const __dt_VertexInfoList *vtilist,
+    const __dt_SpatialJoinList *last, const __dt_SpatialJoinList *spjlist)
+{
+    dt_size_type n_changed = 0;
+    dt_index_type i;
+
+    for (i = 0; i < vtilist->list_length; i++)
+    {
+        if (vtilist->vertex_type[i] == __DT_FREE_VERTEX &&
+            last->i_target_vertex[i] != spjlist->i_target_vertex[i]) {
+            n_changed++;
+        }
+    }
+
+    return n_changed;
+}
+
+/* residual of the closest point term: RMS distance between joined free
+   vertices and the closest points they're joined to */
+static dt_real_type __closest_point_residual(
+    const dtMeshModel *source_model,
+    const __dt_VertexInfoList *vtilist, const __dt_SpatialJoinList *spjlist)
+{
+    const dtVertex *v, *c;
+    dt_real_type sum = 0;
+    dt_index_type i, n_joined = 0;
+
+    for (i = 0; i < vtilist->list_length; i++)
+    {
+        if (vtilist->vertex_type[i] == __DT_FREE_VERTEX &&
+            spjlist->i_target_vertex[i] >= 0)
+        {
+            n_joined++;
+            v = source_model->vertex + i;
+            c = spjlist->target_point + i;
+            sum += (v->x - c->x)*(v->x - c->x) + (v->y - c->y)*(v->y - c->y) +
+                   (v->z - c->z)*(v->z - c->z);
+        }
+    }
+
+    return (n_joined > 0)? sqrt(sum / n_joined): 0;
+}
+
+
 static void __solve_correspondence_problem_Phase2(
     dtCorrespondenceProblem *problem)
 {
-    cholmod_triplet *M;
-    cholmod_dense   *C, *x;
-    cholmod_sparse  *A;
+    __dt_NormalEquation eqn;
+    __corres_factor fac;
+    cholmod_dense *x = NULL;   /* solution of the last iteration */
+    int analyzed = 0;          /* eqn, fac and x are ready */
+    int n_iter;
 
     dt_index_type *i_src_norm_list, *i_tgt_norm_list;
-    __dt_SpatialJoinList spjlist;
-    __3dTree tree_tgt;
-
-    dt_real_type weight_closest;
-
-    /* build 3d tree for target model for fast closest point iteration */
-    tree_tgt = __dt_Build3DTree_Vertex(&(problem->target_model));
+    __dt_SpatialJoinList spjlist, last_spjlist, temp;
+    __3dTree tree_tgt = NULL;
+    __TriBVH bvh_tgt  = NULL;
+
+    dt_real_type weight_closest, weight_last, step, max_move, size;
+    dt_size_type n_changed;
+    int n_stable = 0, stable;
+
+    /* build 3d tree for target model for fast closest point iteration, or a
+       BVH of its triangles to join free vertices to its surface */
+    if (problem->closest_surface) {
+        bvh_tgt = __dt_BuildTriangleBVH(&(problem->target_model));
+    }
+    else {
+        tree_tgt = __dt_Build3DTree_Vertex(&(problem->target_model));
+    }
 
     /* sort out vertex normals */
     i_src_norm_list = __dt_SortOutVertexNormalList(&(problem->source_model));
     i_tgt_norm_list = __dt_SortOutVertexNormalList(&(problem->target_model));
 
+    __dt_CreateSpatialJoinList(&(problem->source_model), &spjlist);
+    __dt_CreateSpatialJoinList(&(problem->source_model), &last_spjlist);
+    size = __model_size(&(problem->target_model));
+
+    /* the last weight of the fixed schedule [start: step: end) */
+    step = problem->weight_closest_step;
+    for (weight_last = problem->weight_closest_start;
+         weight_last + step < problem->weight_closest_end;
+         weight_last += step) ;
+
     /* closest point iteration */
     for (weight_closest = problem->weight_closest_start;
-         weight_closest < problem->weight_closest_end;
-         weight_closest += problem->weight_closest_step)
+         weight_closest < problem->weight_closest_end; )
     {
         printf("current weight: %f\n", weight_closest);
 
         /* Resolving spatial join */
         printf("resolving spatial join...\n");
-        __dt_CreateSpatialJoinList(&(problem->source_model), &spjlist);
-        __dt_ResolveModelSpatialJoin(
-            &(problem->source_model), &(problem->target_model),
-            i_src_norm_list, i_tgt_norm_list, tree_tgt, &spjlist);
+        if (problem->closest_surface)
+        {
+            __dt_ResolveModelSurfaceJoin_Parallel(
+                &(problem->source_model), &(problem->target_model),
+                i_src_norm_list, bvh_tgt, &spjlist, problem->n_thread);
+        }
+        else
+        {
+            __dt_ResolveModelSpatialJoin_Parallel(
+                &(problem->source_model), &(problem->target_model),
+                i_src_norm_list, i_tgt_norm_list, tree_tgt, &spjlist,
+                problem->n_thread);
+        }
 
-        /* build linear system */
+        /* build linear system, or refill the one of the last iteration */
         printf("building linear system...\n");
-        __dt_CorresEqn_Phase2(
-            &(problem->source_model), &(problem->target_model), 
-            &(problem->adjlist), &(problem->conslist), &(problem->vtilist), 
-            &spjlist, 
-            &M, &C, 
-            sqrt(problem->weight_smooth), 
-            sqrt(problem->weight_identity), 
-            /* sqrt(weight_closest)); */
-            weight_closest);
-
-        __dt_DestroySpatialJoinList(&spjlist);
-
-
-        /* solve the least square problem */
-        printf("solving linear system...\n");
-        A = __dt_CHOLMOD_triplet_to_sparse(M);
-        __dt_CHOLMOD_free_triplet(&M);
-        x = __dt_SOLVER_least_square(A, C);
-
-        __dt_CHOLMOD_free_sparse(&A);
-        __dt_CHOLMOD_free_dense(&C);
+        if (!analyzed)
+        {
+            __dt_CorresEqn_Phase2(
+                &(problem->source_model),
+                &(problem->adjlist), &(problem->vtilist), 
+                &(problem->elemtermlist), &spjlist, 
+                __solver_stype(problem), &eqn, 
+                sqrt(problem->weight_smooth), 
+                sqrt(problem->weight_identity), 
+                /* sqrt(weight_closest)); */
+                weight_closest);
+
+            printf("solving linear system...\n");
+            __analyze(eqn.AtA, problem->use_cholmod, &fac);
+            x = __factorize_and_solve(&eqn, &fac);
+            n_changed = problem->vtilist.n_free;   /* everything's new */
+        }
+        else
+        {
+            __dt_UpdateCorresEqn_Phase2(
+                &(problem->source_model),
+                &(problem->vtilist), &spjlist, &eqn, weight_closest);
+
+            /* solve the least square problem */
+            printf("solving linear system...\n");
+            if ((n_iter = __solve_with_stale_factor(&eqn, &fac, x)) >= 0) {
+                printf("PCG converged in %d iterations\n", n_iter);
+            }
+            else
+            {
+                printf("refactorizing...\n");
+                __dt_CHOLMOD_free_dense(&x);
+                x = __factorize_and_solve(&eqn, &fac);
+            }
+
+            n_changed = __count_join_changes(
+                &(problem->vtilist), &last_spjlist, &spjlist);
+        }
 
         /* deform the source mesh according to the solution we got */
         printf("applying deformation...\n");
-        __apply_deformation_to_source_model(
+        max_move = __apply_deformation_to_source_model(
             &(problem->source_model), &(problem->target_model),
             &(problem->vtilist), &(problem->conslist), x);
 
+        printf("%d joins changed, max move: %g, residual: %g\n",
+            (int)n_changed, max_move, 
+            __closest_point_residual(&(problem->source_model),
+                &(problem->vtilist), &spjlist));
+
+        /* keep this spatial join to compare with the next one */
+        temp = last_spjlist;  last_spjlist = spjlist;  spjlist = temp;
+
+        /* next weight */
+        if (!problem->adaptive_schedule) {
+            weight_closest += problem->weight_closest_step;
+        }
+        else if (weight_closest >= weight_last) {
+            break;
+        }
+        else
+        {
+            stable = analyzed &&
+                n_changed <= __DT_STABLE_JOIN * problem->vtilist.n_free &&
+                max_move  <= __DT_STABLE_MOVE * size;
+            n_stable = stable? n_stable + 1: 0;
+
+            if (n_stable >= 2) {
+                step = weight_last - weight_closest;
+            }
+            else if (stable) {
+                step *= 2;
+            }
+            else if (n_changed > __DT_UNSTABLE_JOIN * problem->vtilist.n_free &&
+                     step > __DT_MIN_STEP_RATIO * problem->weight_closest_step) {
+                step /= 2;
+            }
+
+            weight_closest = (weight_closest + step < weight_last)?
+                weight_closest + step: weight_last;
+        }
+
+        analyzed = 1;
+    }
+
+    if (analyzed)
+    {
         __dt_CHOLMOD_free_dense(&x);
+        __free_factor(&fac);
+        __dt_DestroyNormalEquation(&eqn);
     }
 
+    __dt_DestroySpatialJoinList(&spjlist);
+    __dt_DestroySpatialJoinList(&last_spjlist);
     free(i_src_norm_list);
     free(i_tgt_norm_list);
-    __3dtree_Destroy3DTree(tree_tgt);
+    if (tree_tgt != NULL) __3dtree_Destroy3DTree(tree_tgt);
+    if (bvh_tgt  != NULL) __tribvh_DestroyBVH(bvh_tgt);
 }
 
 
 static void __solve_correspondence_problem_Finalize(
     dtCorrespondenceProblem *problem)
 {
+    dtMeshGeometry geom_src, geom_tgt;
+
     __dt_CHOLMOD_finish();  /* stop the CHOLMOD module */
     /* __port_normal_vectors(&(problem->source_model), &(problem->target_model)); */
 
-    __dt_ResolveTriangleCorres_e(
-        &(problem->source_model), &(problem->target_model), 
-        &(problem->result_tclist));
+    if (problem->use_float)
+    {
+        CreateMeshGeometry(&(problem->source_model), 1, &geom_src);
+        CreateMeshGeometry(&(problem->target_model), 1, &geom_tgt);
+        __dt_ResolveTriangleCorres_Geometry_e(&geom_src, &geom_tgt,
+            __DT_N_MAXCORRS, &(problem->result_tclist), problem->n_thread);
+        DestroyMeshGeometry(&geom_src);
+        DestroyMeshGeometry(&geom_tgt);
+    }
+    else
+    {
+        __dt_ResolveTriangleCorres_e(
+            &(problem->source_model), &(problem->target_model), 
+            __DT_N_MAXCORRS, &(problem->result_tclist), problem->n_thread);
+    }
 }
 
 
@@ -158,31 +426,35 @@ void SolveCorrespondenceProblem(dtCorrespondenceProblem *problem)
 
 
 /* Apply the solution vector of the correspondence equation to the vertices of
-   the source model, make the source model deform into the target model. */
-static void __apply_deformation_to_source_model(
+   the source model, make the source model deform into the target model. It
+   returns how far the free vertices moved at most. */
+static dt_real_type __apply_deformation_to_source_model(
     dtMeshModel *source_model, const dtMeshModel *target_model,
     const __dt_VertexInfoList *vtilist, 
     const __dt_VertexConstraintList *conslist,
     const __dt_DenseVector vec)
 {
-    dt_index_type cons_ind, vertex_ind;
+    dt_index_type cons_ind, vertex_ind, i_var;
     dt_index_type i_v = 0;
+    dtVertex v, *u;
+    dt_real_type move_sq, max_move_sq = 0;
 
     for ( ; i_v < vtilist->list_length; i_v++)
     {
         if (vtilist->vertex_type[i_v] == __DT_FREE_VERTEX)
         {
-            source_model->vertex[i_v].x = 
-                __dt_CHOLMOD_REFVEC(
-                    vec, __dt_GetFreeCoordVarIndex(vtilist, i_v, 0));
-
-            source_model->vertex[i_v].y = 
-                __dt_CHOLMOD_REFVEC(
-                    vec, __dt_GetFreeCoordVarIndex(vtilist, i_v, 1));
-
-            source_model->vertex[i_v].z = 
-                __dt_CHOLMOD_REFVEC(
-                    vec, __dt_GetFreeCoordVarIndex(vtilist, i_v, 2));
+            /* x, y and z are in the 3 columns of the solution */
+            i_var = __dt_GetFreeVertexVarIndex(vtilist, i_v);
+            v.x = __dt_CHOLMOD_REFMAT(vec, i_var, 0);
+            v.y = __dt_CHOLMOD_REFMAT(vec, i_var, 1);
+            v.z = __dt_CHOLMOD_REFMAT(vec, i_var, 2);
+
+            u = source_model->vertex + i_v;
+            move_sq = (v.x - u->x)*(v.x - u->x) + (v.y - u->y)*(v.y - u->y) +
+                      (v.z - u->z)*(v.z - u->z);
+            if (move_sq > max_move_sq) max_move_sq = move_sq;
+
+            u->x = v.x,  u->y = v.y,  u->z = v.z;
         }
         else
         {
@@ -194,6 +466,7 @@ static void __apply_deformation_to_source_model(
 
     /* FIXME: saving the deformed model in each iteration might be painful */
     SaveObjFile("out.obj", source_model);
+    return sqrt(max_move_sq);
 }
 
 
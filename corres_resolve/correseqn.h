@@ -12,12 +12,13 @@
 #include "vertex_info.h"
 #include "surface_matrix.h"
 #include "closest_point.h"
+#include "normal_equation.h"
 
 
-/* Elementary term is a 9x4 matrix and a 9d vector to represent an equation on 
+/* Elementary term is a 3x4 matrix and a 9d vector to represent an equation on 
    a single triangle unit, elementary term can be intergrated to the overall
-   large linear system with __dt_AppendElementaryTermToLinearSystem() to make
-   the equation to make contribution to the shape of the entire deformed model.
+   large linear system with __dt_GetElementaryNormalTerm() to make the
+   equation to make contribution to the shape of the entire deformed model.
 */
 void __dt_CalculateElementaryTerm(
     const dtMeshModel *source_model, const dtMeshModel *target_model,
@@ -51,84 +52,102 @@ void __dt_DestroyElementaryTermList(__dt_ElementaryTermList *termlist);
 
 
 
-/* Append the elementary matrix/vector of triangle i to the linear system. */
-void __dt_AppendElementaryTermToLinearSystem(
+/* Make the elementary term of triangle i a term of the normal equation on
+   the variables of that triangle unit, weighted by weight^2 */
+void __dt_GetElementaryNormalTerm(
     const dtMeshModel *source_model,
     const __dt_VertexInfoList *vtilist, 
     dt_index_type i_triangle,
-    __dt_ElementaryMatrix m, __dt_ElementaryVector c,
-    __dt_SparseMatrix M,     __dt_DenseVector C,
+    __dt_ElementaryMatrix m, const __dt_ElementaryVector c,
     dt_real_type weight,
-    dt_index_type i_row);
+    __dt_NormalTerm *term);
 
 
+/* The correspondence system is never built as a whole, each phase assembles
+   the normal equation At*A*x = At*C of it directly, with At*A stored in
+   full or its upper part only as stype tells (see normal_equation.h). Rows
+   of each term are weighted by the given weights, just as if they were rows
+   of A. Release the equation with __dt_DestroyNormalEquation().
+
+   Elementary terms are computed for the undeformed source model once, by
+   the caller, and shared by both phases and all closest point iterations.
+*/
+
 /* Build phase1 equation: Es + Ei, closest point term Ec is not involved */
-dt_index_type __dt_CorresEqn_Phase1(
-    const dtMeshModel *source_model, const dtMeshModel *target_model,
+void __dt_CorresEqn_Phase1(
+    const dtMeshModel *source_model,
     const __dt_AdjacentTriangleList *adjlist,
-    const __dt_VertexConstraintList *conslist,
     const __dt_VertexInfoList *vtilist,
-    __dt_SparseMatrix *M, __dt_DenseVector *C,  /* output param */
+    const __dt_ElementaryTermList *elemtermlist,
+    int stype,
+    __dt_NormalEquation *eqn,   /* output param */
     dt_real_type weight_smooth,
     dt_real_type weight_identity);
 
-/* Build phase2 equation: Es + Ei + Ec */
-dt_index_type __dt_CorresEqn_Phase2(
-    const dtMeshModel *source_model, const dtMeshModel *target_model,
+/* Build phase2 equation: Es + Ei + Ec, closest points are taken from the
+   spatial join */
+void __dt_CorresEqn_Phase2(
+    const dtMeshModel *source_model,
     const __dt_AdjacentTriangleList *adjlist,
-    const __dt_VertexConstraintList *conslist,
     const __dt_VertexInfoList *vtilist,
+    const __dt_ElementaryTermList *elemtermlist,
     const __dt_SpatialJoinList *spjlist,
-    __dt_SparseMatrix *M, __dt_DenseVector *C,  /* output param */
+    int stype,
+    __dt_NormalEquation *eqn,   /* output param */
     dt_real_type weight_smooth,
     dt_real_type weight_identity,
     dt_real_type weight_closest);
 
+/* Rebuild phase2 equation created by __dt_CorresEqn_Phase2 in place for a
+   new spatial join and closest point weight. Es + Ei and the pattern of 
+   At*A never change between closest point iterations, the saved Es + Ei
+   part is restored and only the closest point terms are added again. */
+void __dt_UpdateCorresEqn_Phase2(
+    const dtMeshModel *source_model,
+    const __dt_VertexInfoList *vtilist,
+    const __dt_SpatialJoinList *spjlist,
+    __dt_NormalEquation *eqn,
+    dt_real_type weight_closest);
+
 
 
-/* Integrate all elementary smoothness equations of source_model to the overall
-   linear system M*x = C.
+/* Integrate all elementary smoothness equations of source_model to the normal
+   equation of the overall linear system M*x = C.
 
-   Elementary terms were integrated one by another, the first one is integrated
-   at the i_row-th row of M and C, and all following up terms are going downward
-   until all terms has been integrated into the large linear system. The row 
-   index of the next comming term is returned on success, with the help of this
-   index, you can integrate more terms to the tail of currently integrated terms
-   until the whole system is blown up.
+   Terms are added one by another with __dt_AddNormalTerm(), so the same call
+   records the pattern of them or accumulates them, depending on whether
+   the pattern of eqn has been completed.
 */
-dt_index_type __dt_AppendSmoothnessEqn2LinearSystem(
+void __dt_AppendSmoothnessEqn2NormalEquation(
     const dtMeshModel *source_model,
     const __dt_AdjacentTriangleList *adjlist,
     const __dt_VertexInfoList *vtilist,
     const __dt_ElementaryTermList *elemtermlist,
-    __dt_SparseMatrix M, __dt_DenseVector C,
-    dt_real_type smooth_term_weight, 
-    dt_index_type i_row);
+    __dt_NormalEquation *eqn,
+    dt_real_type smooth_term_weight);
 
 
-/* Integrate all elementary identity equations of source_model to the overall
-   linear system M*x = C.
+/* Integrate all elementary identity equations of source_model to the normal
+   equation of the overall linear system M*x = C.
 
-   Very similar to __dt_AppendSmoothnessEqn2LinearSystem(), I won't repeat
+   Very similar to __dt_AppendSmoothnessEqn2NormalEquation(), I won't repeat
    the usage again because I think I've already made my point there.
 */
-dt_index_type __dt_AppendIdentityEqn2LinearSystem(
+void __dt_AppendIdentityEqn2NormalEquation(
     const dtMeshModel *source_model,
     const __dt_VertexInfoList *vtilist,
     const __dt_ElementaryTermList *elemtermlist,
-    __dt_SparseMatrix M, __dt_DenseVector C,
-    dt_real_type identity_term_weight, 
-    dt_index_type i_row);
+    __dt_NormalEquation *eqn,
+    dt_real_type identity_term_weight);
 
 
-/* Integrate closest point terms: ||v - c||^2 to the overall linear system */
-dt_index_type __dt_AppendSpatialJoinEqn2LinearSystem(
-    const dtMeshModel *source_model, const dtMeshModel *target_model,
+/* Integrate closest point terms: ||v - c||^2 to the normal equation */
+void __dt_AppendSpatialJoinEqn2NormalEquation(
+    const dtMeshModel *source_model,
     const __dt_VertexInfoList *vtilist,
     const __dt_SpatialJoinList *spjlist,
-    __dt_SparseMatrix M, __dt_DenseVector C,
-    dt_real_type closest_term_weight, 
-    dt_index_type i_row);
+    __dt_NormalEquation *eqn,
+    dt_real_type closest_term_weight);
 
 
 
@@ -4,46 +4,42 @@
 #include "correseqn.h"
 
 
-/* Integrate closest point terms: ||v - c||^2 to the overall linear system: 
-       vx = cx
-       vy = cy
-       vz = cz
+/* Integrate closest point terms: ||v - c||^2 to the normal equation of the
+   overall linear system, one equation for each free vertex with the closest
+   point [cx, cy, cz] it's joined to on the right hand side:
+       v = c
+   Vertices left unjoined get no closest point term.
 */
-dt_index_type __dt_AppendSpatialJoinEqn2LinearSystem(
-    const dtMeshModel *source_model, const dtMeshModel *target_model,
+void __dt_AppendSpatialJoinEqn2NormalEquation(
+    const dtMeshModel *source_model,
     const __dt_VertexInfoList *vtilist,
     const __dt_SpatialJoinList *spjlist,
-    __dt_SparseMatrix M, __dt_DenseVector C,
-    dt_real_type closest_term_weight, 
-    dt_index_type i_row)
+    __dt_NormalEquation *eqn,
+    dt_real_type closest_term_weight)
 {
-    dtVertex *tgt_vertex;
-    dt_index_type i_x, i_y, i_z;
+    __dt_NormalTerm term;
+    const dtVertex *tgt_point;
     dt_index_type i_vertex = 0;
 
+    memset(&term, 0, sizeof(term));
+    term.n_eqn   = 1;
+    term.n_var   = 1;
+    term.m[0][0] = 1;
+    term.weight  = closest_term_weight * closest_term_weight;
+
     for ( ; i_vertex < source_model->n_vertex; i_vertex++)
     {
-        if (vtilist->vertex_type[i_vertex] == __DT_FREE_VERTEX)
+        if (vtilist->vertex_type[i_vertex] == __DT_FREE_VERTEX &&
+            spjlist->i_target_vertex[i_vertex] >= 0)
         {
-            i_x = __dt_GetFreeCoordVarIndex(vtilist, i_vertex, 0);
-            i_y = __dt_GetFreeCoordVarIndex(vtilist, i_vertex, 1);
-            i_z = __dt_GetFreeCoordVarIndex(vtilist, i_vertex, 2);
-
-            tgt_vertex = target_model->vertex + spjlist->i_target_vertex[i_vertex];
+            term.var[0] = __dt_GetFreeVertexVarIndex(vtilist, i_vertex);
 
-            __dt_CHOLMOD_entry(M, i_row, i_x, closest_term_weight);
-            __dt_CHOLMOD_MODIFYVEC(C, i_row, closest_term_weight * tgt_vertex->x);
-            i_row++;
+            tgt_point = spjlist->target_point + i_vertex;
 
-            __dt_CHOLMOD_entry(M, i_row, i_y, closest_term_weight);
-            __dt_CHOLMOD_MODIFYVEC(C, i_row, closest_term_weight * tgt_vertex->y);
-            i_row++;
-
-            __dt_CHOLMOD_entry(M, i_row, i_z, closest_term_weight);
-            __dt_CHOLMOD_MODIFYVEC(C, i_row, closest_term_weight * tgt_vertex->z);
-            i_row++;
+            term.c[0] = tgt_point->x;
+            term.c[3] = tgt_point->y;
+            term.c[6] = tgt_point->z;
+            __dt_AddNormalTerm(eqn, &term);
         }
     }
-
-    return i_row;
 }
@@ -52,9 +52,11 @@
                                                                               [-(v13 + v23 + v33), v13, v23, v33]       [u3z]
                                                                                                                         [u4z]
     However, rather than representing the 9x9 coefficient matrix "as is" in a
-  dt_real_type[9][9], we align all meaningful element of the matrix to the
-  left side, so that we can shrink this matrix and stuff it into a smaller 9x4
-  matrix. That's what these code are all about.
+  dt_real_type[9][9], we notice that the three diagonal blocks are identical
+  and x, y, z never couple, so we stuff a single block into a 3x4 matrix. The
+  overall linear system is built the same way: it's a n x n system with the 
+  x, y and z coordinates of n vertices as the 3 columns of its unknowns and 
+  its right hand side. That's what these code are all about.
 */
 
 
@@ -75,10 +77,10 @@ static void __calculate_v1_coefficients(
 }
 
 
-/* Elementary term is a 9x4 matrix and a 9d vector to represent an equation on 
+/* Elementary term is a 3x4 matrix and a 9d vector to represent an equation on 
    a single triangle unit, elementary term can be intergrated to the overall
-   large linear system with __dt_AppendElementaryTermToLinearSystem() to make
-   the equation to make contribution to the shape of the entire deformed model.
+   large linear system with __dt_GetElementaryNormalTerm() to make the
+   equation to make contribution to the shape of the entire deformed model.
 */
 void __dt_CalculateElementaryTerm(
     const dtMeshModel *source_model, const dtMeshModel *target_model,
@@ -109,29 +111,29 @@ void __dt_CalculateElementaryTerm(
             /* coefficient of v1: -(a[0,i] + a[1,i] + a[2,i]) */
             coef = coefv1[j];
             (vinfo[0].vertex_type == __DT_FREE_VERTEX)?
-                (m[row][0] = coef):
-                (c[row]   -= coef *
+                (m[j][0] = coef):
+                (c[row] -= coef *
                     __dt_GetMappedVertexCoord(
                         target_model, conslist, vinfo[0].vertex_index, i));
 
             /* coefficient of v2: a[0,i]*/
             coef = (*inV)[0][j];
             (vinfo[1].vertex_type == __DT_FREE_VERTEX)?
-                (m[row][1] = coef): 
-                (c[row]   -= coef *
+                (m[j][1] = coef): 
+                (c[row] -= coef *
                     __dt_GetMappedVertexCoord(
                         target_model, conslist, vinfo[1].vertex_index, i));
 
             /* coefficient of v3: a[1,i] */
             coef = (*inV)[1][j];
             (vinfo[2].vertex_type == __DT_FREE_VERTEX)?
-                (m[row][2] = coef):
-                (c[row]   -= coef *
+                (m[j][2] = coef):
+                (c[row] -= coef *
                     __dt_GetMappedVertexCoord(
                         target_model, conslist, vinfo[2].vertex_index, i));
 
             /* coefficient of v4: a[2,i] */
-            m[row][3] = (*inV)[2][j];
+            m[j][3] = (*inV)[2][j];
         }
     }
 }
@@ -176,48 +178,22 @@ void __dt_DestroyElementaryTermList(__dt_ElementaryTermList *termlist)
 
 
 
-/* Append the elementary matrix/vector of triangle i to the linear system. */
-void __dt_AppendElementaryTermToLinearSystem(
+/* Make the elementary term of triangle i a term of the normal equation on
+   the variables of that triangle unit, weighted by weight^2 */
+void __dt_GetElementaryNormalTerm(
     const dtMeshModel *source_model,
     const __dt_VertexInfoList *vtilist, 
     dt_index_type i_triangle,
-    __dt_ElementaryMatrix m, __dt_ElementaryVector c,
-    __dt_SparseMatrix M,  __dt_DenseVector C,
+    __dt_ElementaryMatrix m, const __dt_ElementaryVector c,
     dt_real_type weight,
-    dt_index_type i_row)
+    __dt_NormalTerm *term)
 {
     __dt_TriangleVarIndexTable var_ind;  /* var index table for triangle i */
 
-    dt_index_type i_var;  /* index on variable vector */
-    dt_index_type i_dim, i_vlocal, i_eqn; /* loop variable */
-
-    dt_index_type j_row = 0;  /* loop index for row number of 
-                                 elementary matrix/vector */
-
+    /* constrained vertices are marked with -1 in the table, their
+       contribution has been moved to c already */
     __dt_GetTriangleVerticesVarIndex(
         source_model, vtilist, i_triangle, var_ind);
 
-    /* construct 9 lines of equations */
-    for (i_dim = 0; i_dim < 3; i_dim++)
-    {
-        for (i_eqn = 0; i_eqn < 3; i_eqn++, i_row++, j_row++)
-        {
-            /* fill in line i_row of coefficient matrix */
-            for (i_vlocal = 0; i_vlocal < 4; i_vlocal++)
-            {
-                /* get the variable vector index of this vertex, -1 indicates
-                   that specified vertex is not a free vertex. */
-                i_var = __dt_GetVarIndexFromTable(var_ind, i_vlocal, i_dim);
-
-                /* append this term if it is a free vertex */
-                if (i_var != -1) {
-                    __dt_CHOLMOD_entry(M, i_row, i_var, weight * m[j_row][i_vlocal]);
-                }
-            }
-            /* element of right hand side vector */
-            __dt_CHOLMOD_MODIFYVEC(C, i_row, 
-                __dt_CHOLMOD_REFVEC(C, i_row) + weight * c[j_row]);
-        }
-    }
+    __dt_SetNormalTerm(term, var_ind, m, c, weight * weight);
 }
-
@@ -12,14 +12,14 @@
    where T[i] is the deformation matrix of triangle i in the source model.
 */
 
-static dt_index_type __dt_append_identity_term_to_linear_system(
+static void __dt_append_identity_term_to_normal_equation(
     const dtMeshModel *model, const __dt_VertexInfoList *vtilist,
     dt_index_type i_triangle, 
     __dt_ElementaryMatrix m, __dt_ElementaryVector c,    
-    __dt_SparseMatrix M,     __dt_DenseVector C,
-    dt_real_type identity_term_weight, 
-    dt_index_type i_row)
+    __dt_NormalEquation *eqn,
+    dt_real_type identity_term_weight)
 {
+    __dt_NormalTerm term;
     __dt_Vector9D c_identity = {1, 0, 0, 
                                 0, 1, 0,
                                 0, 0, 1};
@@ -30,24 +30,23 @@ static dt_index_type __dt_append_identity_term_to_linear_system(
 
     /* I didn't modify c because I don't want to hurt those elementary terms */
 
-    __dt_AppendElementaryTermToLinearSystem(
+    __dt_GetElementaryNormalTerm(
         model, vtilist, i_triangle,
-        m, c_identity, M, C, identity_term_weight, i_row);
+        m, c_identity, identity_term_weight, &term);
 
-    return i_row + 9;
+    __dt_AddNormalTerm(eqn, &term);
 }
 
 
-/* Integrate all elementary identity equations of source_model to the overall
-   linear system M*x = C.
+/* Integrate all elementary identity equations of source_model to the normal
+   equation of the overall linear system M*x = C.
 */
-dt_index_type __dt_AppendIdentityEqn2LinearSystem(
+void __dt_AppendIdentityEqn2NormalEquation(
     const dtMeshModel *source_model,
     const __dt_VertexInfoList *vtilist,
     const __dt_ElementaryTermList *elemtermlist,
-    __dt_SparseMatrix M, __dt_DenseVector C,
-    dt_real_type identity_term_weight, 
-    dt_index_type i_row)
+    __dt_NormalEquation *eqn,
+    dt_real_type identity_term_weight)
 {
     dt_index_type i_triangle;
 
@@ -57,12 +56,10 @@ dt_index_type __dt_AppendIdentityEqn2LinearSystem(
     /* append all identity terms to the linear system */
     for (i_triangle = 0; i_triangle < source_model->n_triangle; i_triangle++)
     {
-        i_row = __dt_append_identity_term_to_linear_system(
+        __dt_append_identity_term_to_normal_equation(
             source_model, vtilist,
             i_triangle, m_list[i_triangle], c_list[i_triangle],
-            M, C, identity_term_weight, i_row);
+            eqn, identity_term_weight);
     }
-
-    return i_row;
 }
 
@@ -16,44 +16,40 @@
   should be minimized.
 */
 
-static dt_index_type __dt_append_smoothness_term_to_linear_system(
+static void __dt_append_smoothness_term_to_normal_equation(
     const dtMeshModel *source_model,
     const __dt_VertexInfoList *vtilist, 
     dt_index_type i_triangle, dt_index_type i_adjtriangle, 
     __dt_ElementaryMatrix m,     __dt_ElementaryVector c,
     __dt_ElementaryMatrix m_adj, __dt_ElementaryVector c_adj,
-    __dt_SparseMatrix M,         __dt_DenseVector C,
-    dt_real_type smooth_term_weight,
-    dt_index_type i_row)
+    __dt_NormalEquation *eqn,
+    dt_real_type smooth_term_weight)
 {
-    __dt_AppendElementaryTermToLinearSystem(source_model, vtilist, 
-        i_triangle, m,c, M,C, smooth_term_weight, i_row);
+    __dt_NormalTerm term, term_adj;
 
-    __dt_AppendElementaryTermToLinearSystem(source_model, vtilist, 
-        i_adjtriangle, m_adj,c_adj, M,C, -smooth_term_weight, i_row);
+    /* T_i - T_adj: 3 equations on the variables of both triangle units */
+    __dt_GetElementaryNormalTerm(source_model, vtilist, 
+        i_triangle, m,c, smooth_term_weight, &term);
 
-    return i_row + 9;
-}
+    __dt_GetElementaryNormalTerm(source_model, vtilist, 
+        i_adjtriangle, m_adj,c_adj, smooth_term_weight, &term_adj);
 
+    __dt_SubtractNormalTerm(&term, &term_adj);
+    __dt_AddNormalTerm(eqn, &term);
+}
 
-/* Integrate all elementary smoothness equations of source_model to the overall
-   linear system M*x = C.
 
-   Elementary terms where integrated one by another, the first one is integrated
-   at the i_row-th row of M and C, and all following up terms are going downward
-   until all terms has been integrated into the large linear system. The row 
-   index of the next comming term is returned on success, with the help of this
-   index, you can integrate more terms to the tail of currently integrated terms
-   until the whole system is blown up.
+/* Integrate all elementary smoothness equations of source_model to the normal
+   equation of the overall linear system M*x = C, each pair of adjacent
+   triangles makes a term T_i - T_adj.
 */
-dt_index_type __dt_AppendSmoothnessEqn2LinearSystem(
+void __dt_AppendSmoothnessEqn2NormalEquation(
     const dtMeshModel *source_model,
     const __dt_AdjacentTriangleList *adjlist,
     const __dt_VertexInfoList *vtilist,
     const __dt_ElementaryTermList *elemtermlist,
-    __dt_SparseMatrix M, __dt_DenseVector C,
-    dt_real_type smooth_term_weight, 
-    dt_index_type i_row)
+    __dt_NormalEquation *eqn,
+    dt_real_type smooth_term_weight)
 {
     dt_index_type i_triangle, i_adjtriangle;
 
@@ -73,19 +69,17 @@ dt_index_type __dt_AppendSmoothnessEqn2LinearSystem(
         adj = __dt_GetAdjacentTriangles(adjlist, i_triangle);
 
         /* iterate through all adjacent triangles of i_triangle, 
-           append T_i - T_adj to overall linear system. */
+           append T_i - T_adj to the normal equation. */
         for (i_adjtriangle = 0; i_adjtriangle < adj.n_adjtriangle; i_adjtriangle++)
         {
             /* grab the elementary term of the adjacent triangle */
             m_adj = m_list + adj.i_adjtriangle[i_adjtriangle];
             c_adj = c_list + adj.i_adjtriangle[i_adjtriangle];
 
-            i_row = __dt_append_smoothness_term_to_linear_system(
+            __dt_append_smoothness_term_to_normal_equation(
                 source_model, vtilist,
                 i_triangle, adj.i_adjtriangle[i_adjtriangle],
-                *m, *c, *m_adj, *c_adj, M, C, smooth_term_weight, i_row);
+                *m, *c, *m_adj, *c_adj, eqn, smooth_term_weight);
         }
     }
-
-    return i_row;
 }
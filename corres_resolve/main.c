@@ -1,11 +1,28 @@
 #include <stdlib.h>
 #include <memory.h>
+#include <string.h>
 #include <stdio.h>
 
 #include "corres_problem.h"
 #include "closest_point.h"
 
 
+/* corres_resolve -b source_ref target_ref [n_repeat] */
+static void __benchmark(int argc, char *argv[])
+{
+    dtMeshModel source, target;
+    int n_repeat = (argc > 4)? atoi(argv[4]): 5;
+
+    __dt_ReadMeshFile_commit_or_crash(argv[2], &source);
+    __dt_ReadMeshFile_commit_or_crash(argv[3], &target);
+
+    __dt_BenchmarkSpatialJoin(&source, &target,
+        (n_repeat > 0)? n_repeat: 1);
+
+    DestroyMeshModel(&source);
+    DestroyMeshModel(&target);
+}
+
 int main(int argc, char *argv[])
 {
     dtCorrespondenceProblem problem;
@@ -17,33 +34,81 @@ int main(int argc, char *argv[])
                                    */
     dt_real_type start, step, end;  /* closest point iteration process -
                                        [start:step:end] */
-    if (argc == 5)
+    int adaptive = 0, closest_surface = 0, use_float = 0, binary_tricorrs = 0;
+    int use_cholmod = 0, i_arg = 5;
+
+    if (argc >= 4 && strcmp(argv[1], "-b") == 0) {
+        __benchmark(argc, argv);
+        return 0;
+    }
+
+    /* options follow the closest point schedule */
+    for ( ; i_arg < argc; i_arg++)
+    {
+        if      (strcmp(argv[i_arg], "-a") == 0) adaptive = 1;
+        else if (strcmp(argv[i_arg], "-s") == 0) closest_surface = 1;
+        else if (strcmp(argv[i_arg], "-f") == 0) use_float = 1;
+        else if (strcmp(argv[i_arg], "-m") == 0) binary_tricorrs = 1;
+        else if (strcmp(argv[i_arg], "-l") == 0) use_cholmod = 1;
+        else break;
+    }
+
+    /* the schedule has to reach its end in a finite number of steps */
+    if (argc >= 5 && i_arg == argc &&
+        sscanf(argv[4], "[%lf:%lf:%lf]", &start, &step, &end) == 3 &&
+        step > 0 && start <= end)
     {
         printf("reading data...\n");
         CreateCorrespondenceProblem(&problem,
             source_model, target_model, markerpoints, NULL);
 
-        sscanf(argv[4], "[%lf:%lf:%lf]", &start, &step, &end);
         problem.weight_smooth        = 1.0;
         problem.weight_identity      = 0.01;
         problem.weight_closest_start = start;
         problem.weight_closest_step  = step;
         problem.weight_closest_end   = end;
+        problem.adaptive_schedule    = adaptive;
+        problem.closest_surface      = closest_surface;
+        problem.use_float            = use_float;
+        problem.use_cholmod          = use_cholmod;
 
         SolveCorrespondenceProblem(&problem);
 
         /* save deformed source model (it should looked like the target 
            reference model) and the correspondece list */
         SaveObjFile("out.obj", &(problem.source_model));
-        __dt_SaveTriangleCorrsList("out.tricorrs", &(problem.result_tclist));
+        if (binary_tricorrs) {
+            __dt_SaveTriangleCorrsList_Binary("out.tricorrs", 
+                &(problem.source_model), &(problem.target_model),
+                &(problem.result_tclist));
+        }
+        else {
+            __dt_SaveTriangleCorrsList(
+                "out.tricorrs", &(problem.result_tclist));
+        }
 
         /* done */
         DestroyCorrespondenceProblem(&problem);
     }
     else {
         printf(
-            "usage: %s source_ref target_ref markerpt [start:step:end]\n",
-            argv[0]);
+            "usage: %s source_ref target_ref markerpt [start:step:end] "
+            "[-a] [-s] [-f] [-m] [-l]\n"
+            "  start <= end and step > 0\n"
+            "  -a  adapt the step to how much the spatial join changes,\n"
+            "      rather than taking every step of the schedule\n"
+            "  -s  join free vertices to the closest point on the surface of\n"
+            "      target model, rather than its closest vertex\n"
+            "  -f  resolve triangle correspondences on float32 copies of the\n"
+            "      vertices, centroids and normals are rounded to float32\n"
+            "  -m  save out.tricorrs in the binary format dtrans maps into\n"
+            "      memory, rather than as text\n"
+            "  -l  solve with Cholesky factorization of CHOLMOD, rather than\n"
+            "      LU factorization of UMFPACK\n"
+            "   or: %s -b source_ref target_ref [n_repeat]\n"
+            "  benchmark the closest vertex queries of source_ref on\n"
+            "  target_ref, with each kernel the processor supports\n",
+            argv[0], argv[0]);
     }
 
     return 0;
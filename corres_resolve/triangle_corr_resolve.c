@@ -4,31 +4,52 @@
 #include "3dtree.h"
 #include "triangle_corr.h"
 #include "surface_matrix.h"
+#include "parallel_for.h"
 
 
 
 /* calculate the coordinate of the centroid of specified triangle */
 static void __calculate_triangle_centroid(
-    const dtMeshModel *model, dt_index_type i_triangle, dt_real_type *centroid)
+    const dtMeshGeometry *geom, dt_index_type i_triangle,
+    dt_real_type *centroid)
 {
-    /* get the coordinates of vertices in the triangle */
-    dtTriangle *triangle = model->triangle + i_triangle;
-    dtVertex 
-        *v0 = model->vertex + triangle->i_vertex[0],
-        *v1 = model->vertex + triangle->i_vertex[1],
-        *v2 = model->vertex + triangle->i_vertex[2];
+    /* get the indices of vertices in the triangle */
+    const dtTriangle *triangle = geom->triangle + i_triangle;
+    size_t
+        stride = (size_t)geom->stride,
+        i0 = (size_t)triangle->i_vertex[0] * stride,
+        i1 = (size_t)triangle->i_vertex[1] * stride,
+        i2 = (size_t)triangle->i_vertex[2] * stride;
+    const dt_real_type *c;
+    const float *cf;
+    int i_dim;
 
     /* cartesian coordinates of centroid are the means of the coordinates of
-       the three vertices */
-    centroid[0] = (v0->x + v1->x + v2->x) / 3;
-    centroid[1] = (v0->y + v1->y + v2->y) / 3;
-    centroid[2] = (v0->z + v1->z + v2->z) / 3;
+       the three vertices, precision is checked once for all of them */
+    if (geom->use_float)
+    {
+        for (i_dim = 0; i_dim < 3; i_dim++)
+        {
+            cf = geom->coordf[i_dim];
+            centroid[i_dim] = ((dt_real_type)cf[i0] + (dt_real_type)cf[i1] +
+                               (dt_real_type)cf[i2]) / 3;
+        }
+    }
+    else
+    {
+        for (i_dim = 0; i_dim < 3; i_dim++)
+        {
+            c = geom->coord[i_dim];
+            centroid[i_dim] = (c[i0] + c[i1] + c[i2]) / 3;
+        }
+    }
 }
 
-static __3dTree __create_centroid_tree(const dtMeshModel *model)
+static __3dTree __create_centroid_tree(
+    const dtMeshGeometry *geom, int n_thread)
 {
     __3dTree centroid_tree;
-    dt_size_type tree_size = model->n_triangle;
+    dt_size_type tree_size = geom->n_triangle;
 
     /* create the exset of the tree, id of each centroid are named with the
        index of corresponded triangle  */
@@ -38,11 +59,12 @@ static __3dTree __create_centroid_tree(const dtMeshModel *model)
     dt_index_type i_tri = 0;
     for ( ; i_tri < tree_size; i_tri++)
     {
-        __calculate_triangle_centroid(model, i_tri, exset[i_tri].pt);
+        __calculate_triangle_centroid(geom, i_tri, exset[i_tri].pt);
         exset[i_tri].id = i_tri;
     }
 
-    __3dtree_Create3DTree(exset, exset + tree_size, &centroid_tree);
+    __3dtree_Create3DTree_Parallel(
+        exset, exset + tree_size, &centroid_tree, n_thread);
 
     free(exset);
     return centroid_tree;
@@ -61,57 +83,107 @@ static dt_real_type __vector_dot(const dtVector *v1, const dtVector *v2)
 }
 
 
-/* variables for currying */
-static const dtMeshModel *__lambda_model;
-static       dtVector     __lambda_norm;
+/* the target triangle the orientation condition compares with */
+typedef struct __triangle_corr_condition_struct
+{
+    const dtVector    *src_norm;  /* normals of deformed source triangles */
+    dtVector           norm;      /* normal of the target triangle */
+
+} __triangle_corr_condition;
 
 /* the angle between the normals of the two triangles should be less than 90-
    deg, this compatibility test prevents two nearby triangles with disparate
    orientation from entering the correspondence. */
-static int __norm_condition(__3dtree_Node *node)
+static int __norm_condition(__3dtree_Node *node, void *data)
 {
-    dtVector norm1 = 
-        __dt_CalculateTriangleUnitNorm(__lambda_model, node->id);
+    const __triangle_corr_condition *cond = 
+        (const __triangle_corr_condition*)data;
 
-    return  (__vector_dot(&__lambda_norm, &norm1) > 0);
+    return  (__vector_dot(&(cond->norm), cond->src_norm + node->id) > 0);
 }
 
 
-/* Resolving triangle correspondence by comparing the centroids of the deformed
-   source and target triangles. Two triangles are compatible if their centroids
-   are within a certain threshold of each other and the angle between their 
-   normals is less than 90-deg.
-*/
-void __dt_ResolveTriangleCorres(
-    const dtMeshModel *deformed_source, const dtMeshModel *target, 
-    dt_real_type threshold,
-    __dt_TriangleCorrsList *tclist)
+/* target triangles are cut into chunks of this many, which are taken by
+   the threads as they go, the cost of a range search varies a lot */
+#define __DT_TRIANGLE_CORR_CHUNK  1024
+
+/* arguments of __dt_ResolveTriangleCorres_Parallel shared by threads. Each
+   thread has range search buffers of its own, and each chunk of target
+   triangles appends its entries to a list of its own. */
+typedef struct __triangle_corr_task_struct
+{
+    const dtMeshGeometry *deformed_source, *target;
+    dt_real_type       threshold;
+    dt_size_type       n_maxcorrs;      /* 0: all in range */
+    __3dTree           centroid_tree;
+    dtVector          *src_norm;
+
+    __3dtree_Node    **thread_result;   /* n_buffer per thread */
+    dt_real_type      *thread_dist_sq;
+    dt_size_type       n_buffer;
+    __dt_TriangleCorrsList *chunk_tclist;
+
+} __triangle_corr_task;
+
+/* normals of deformed source triangles [begin, end) */
+static void __triangle_norm_range(
+    void *data, int i_thread, dt_index_type begin, dt_index_type end)
 {
-    __3dTree centroid_tree = __create_centroid_tree(deformed_source);
+    const __triangle_corr_task *task = (const __triangle_corr_task*)data;
+    dt_index_type i_tri;
 
-    /* n_triangle buffer space is large enough, though it might waste a lot
-       of memory space, at least it would never overflow. */
-    __3dtree_Node **result = (__3dtree_Node**)__dt_malloc(
-        (size_t)deformed_source->n_triangle * sizeof(__3dtree_Node*));
+    (void)i_thread;   /* writes to disjoint elements, no buffer needed */
+
+    for (i_tri = begin; i_tri < end; i_tri++)
+    {
+        task->src_norm[i_tri] = __dt_CalculateTriangleUnitNorm_Geometry(
+            task->deformed_source, i_tri);
+    }
+}
+
+/* resolve the correspondences of target triangles [begin, end), a chunk */
+static void __triangle_corr_range(
+    void *data, int i_thread, dt_index_type begin, dt_index_type end)
+{
+    const __triangle_corr_task *task = (const __triangle_corr_task*)data;
+    const dtMeshGeometry *target = task->target;
+    dt_size_type n_buffer = task->n_buffer;
 
-    dt_real_type *dist_sq = (dt_real_type*)__dt_malloc(
-        (size_t)deformed_source->n_triangle * sizeof(dt_real_type));
-        
+    __dt_TriangleCorrsList *tclist = 
+        task->chunk_tclist + begin / __DT_TRIANGLE_CORR_CHUNK;
+
+    __3dtree_Node **result  = 
+        task->thread_result  + (size_t)i_thread * n_buffer;
+    dt_real_type   *dist_sq = 
+        task->thread_dist_sq + (size_t)i_thread * n_buffer;
 
     dt_real_type  x0[3];  /* centroid of triangle on target model */
     dt_size_type  n_result;
-    dt_index_type i_tri = 0, i_entry;
+    dt_index_type i_tri, i_entry;
 
     __dt_TriangleCorrsEntry entry;
-    __lambda_model = deformed_source;
+    __triangle_corr_condition cond;
+
+    cond.src_norm = task->src_norm;
+    __dt_CreateEmptyTriangleCorrsList(tclist);
 
-    for ( ; i_tri < target->n_triangle; i_tri++)
+    for (i_tri = begin; i_tri < end; i_tri++)
     {
         __calculate_triangle_centroid(target, i_tri, x0);
-        __lambda_norm = __dt_CalculateTriangleUnitNorm(target, i_tri);
+        cond.norm = __dt_CalculateTriangleUnitNorm_Geometry(target, i_tri);
 
-        n_result = __3dtree_RangeSearch_Cond(
-            centroid_tree, x0, threshold, result, dist_sq, __norm_condition);
+        if (task->n_maxcorrs == 0)
+        {
+            n_result = __3dtree_RangeSearch_Cond(task->centroid_tree, 
+                x0, task->threshold, result, dist_sq, 
+                __norm_condition, &cond);
+        }
+        else
+        {
+            n_result = __3dtree_KNearestInRange_Cond(task->centroid_tree, 
+                x0, task->threshold, (int)task->n_maxcorrs, result, dist_sq,
+                __norm_condition, &cond);
+        }
 
         /* append all found entries to the triangle corrs list */
         for (i_entry = 0 ; i_entry < n_result; i_entry++)
@@ -122,9 +194,99 @@ void __dt_ResolveTriangleCorres(
             __dt_AppendTriangleCorrsEntry(tclist, &entry);
         }
     }
+}
+
 
-    __3dtree_Destroy3DTree(centroid_tree);
-    free(result); free(dist_sq);
+/* Resolving triangle correspondence by comparing the centroids of the deformed
+   source and target triangles. Two triangles are compatible if their centroids
+   are within a certain threshold of each other and the angle between their 
+   normals is less than 90-deg.
+*/
+void __dt_ResolveTriangleCorres(
+    const dtMeshModel *deformed_source, const dtMeshModel *target, 
+    dt_real_type threshold,
+    __dt_TriangleCorrsList *tclist)
+{
+    __dt_ResolveTriangleCorres_Parallel(
+        deformed_source, target, threshold, 0, tclist, 1);
+}
+
+/* The same as __dt_ResolveTriangleCorres, chunks of target triangles are
+   taken by n_thread threads, only the nearest n_maxcorrs source triangles
+   of each are searched for unless it's 0 */
+void __dt_ResolveTriangleCorres_Parallel(
+    const dtMeshModel *deformed_source, const dtMeshModel *target, 
+    dt_real_type threshold, dt_size_type n_maxcorrs,
+    __dt_TriangleCorrsList *tclist, int n_thread)
+{
+    dtMeshGeometry geom_src, geom_tgt;
+
+    ViewMeshGeometry(deformed_source, &geom_src);
+    ViewMeshGeometry(target, &geom_tgt);
+    __dt_ResolveTriangleCorres_Geometry(
+        &geom_src, &geom_tgt, threshold, n_maxcorrs, tclist, n_thread);
+}
+
+/* The same as __dt_ResolveTriangleCorres_Parallel, on mesh geometries */
+void __dt_ResolveTriangleCorres_Geometry(
+    const dtMeshGeometry *deformed_source, const dtMeshGeometry *target, 
+    dt_real_type threshold, dt_size_type n_maxcorrs,
+    __dt_TriangleCorrsList *tclist, int n_thread)
+{
+    __triangle_corr_task task;
+    dt_size_type  n_src = deformed_source->n_triangle;
+    dt_size_type  n_entry = tclist->list_length;
+    dt_index_type n_chunk, i_chunk;
+
+    if (n_thread < 1) n_thread = 1;
+    n_chunk = (target->n_triangle + __DT_TRIANGLE_CORR_CHUNK - 1) /
+        __DT_TRIANGLE_CORR_CHUNK;
+
+    task.deformed_source = deformed_source;
+    task.target          = target;
+    task.threshold       = threshold;
+    task.n_maxcorrs      = n_maxcorrs;
+
+    /* n_triangle buffer space is large enough for a range search, though it
+       might waste a lot of memory space, at least it would never overflow.
+       A search of the nearest ones only needs n_maxcorrs. */
+    task.n_buffer = (n_maxcorrs > 0 && n_maxcorrs < n_src)? n_maxcorrs: n_src;
+    task.centroid_tree   = __create_centroid_tree(deformed_source, n_thread);
+
+    task.src_norm       = (dtVector*)__dt_malloc(
+        ((size_t)n_src + 1) * sizeof(dtVector));
+    task.thread_result  = (__3dtree_Node**)__dt_malloc(
+        ((size_t)n_thread * task.n_buffer + 1) * sizeof(__3dtree_Node*));
+    task.thread_dist_sq = (dt_real_type*)__dt_malloc(
+        ((size_t)n_thread * task.n_buffer + 1) * sizeof(dt_real_type));
+    task.chunk_tclist   = (__dt_TriangleCorrsList*)__dt_malloc(
+        ((size_t)n_chunk + 1) * sizeof(__dt_TriangleCorrsList));
+
+    __dt_ParallelFor(n_src, n_thread, __triangle_norm_range, &task);
+    __dt_ParallelFor_Dynamic(target->n_triangle, __DT_TRIANGLE_CORR_CHUNK,
+        n_thread, __triangle_corr_range, &task);
+
+    /* chunks are in the order of target triangles, and so are the lists,
+       which makes the result the same as the serial one */
+    for (i_chunk = 0; i_chunk < n_chunk; i_chunk++)
+    {
+        __dt_AppendTriangleCorrsList(tclist, task.chunk_tclist + i_chunk);
+        __dt_DestroyTriangleCorrsList(task.chunk_tclist + i_chunk);
+    }
+
+    /* the nearest ones of each target triangle are found in order, there's
+       no need to sort or strip them again if they're all the list has */
+    if (n_maxcorrs > 0 && n_entry == 0)
+    {
+        tclist->sorted     = 1;
+        tclist->n_maxcorrs = n_maxcorrs;
+    }
+
+    __3dtree_Destroy3DTree(task.centroid_tree);
+    free(task.src_norm);
+    free(task.thread_result);
+    free(task.thread_dist_sq);
+    free(task.chunk_tclist);
 }
 
 
@@ -133,22 +295,37 @@ void __dt_ResolveTriangleCorres(
 
 
 /* Determine the threshold of triangle correspondence searching */
-static dt_real_type __select_triangle_corrs_threshold(const dtMeshModel *model);
+static dt_real_type __select_triangle_corrs_threshold(
+    const dtMeshGeometry *geom);
 
 /* Easy to use version of __dt_ResolveTriangleCorres, users don't need to pick
    a threshold by hand, the threshold is estimated by a higher level process.
 */
 void __dt_ResolveTriangleCorres_e(
     const dtMeshModel *deformed_source, const dtMeshModel *target, 
-    __dt_TriangleCorrsList *tclist)
+    dt_size_type n_maxcorrs, __dt_TriangleCorrsList *tclist, int n_thread)
 {
-    dt_real_type 
-        threshold_src = __select_triangle_corrs_threshold(deformed_source),
-        threshold_tgt = __select_triangle_corrs_threshold(target);
+    dtMeshGeometry geom_src, geom_tgt;
 
-    dt_real_type threshold = __DT_LARGER(threshold_src, threshold_tgt);
+    ViewMeshGeometry(deformed_source, &geom_src);
+    ViewMeshGeometry(target, &geom_tgt);
+    __dt_ResolveTriangleCorres_Geometry_e(
+        &geom_src, &geom_tgt, n_maxcorrs, tclist, n_thread);
+}
 
-    __dt_ResolveTriangleCorres(deformed_source, target, threshold, tclist);
+/* The same as __dt_ResolveTriangleCorres_e, on mesh geometries */
+void __dt_ResolveTriangleCorres_Geometry_e(
+    const dtMeshGeometry *deformed_source, const dtMeshGeometry *target, 
+    dt_size_type n_maxcorrs, __dt_TriangleCorrsList *tclist, int n_thread)
+{
+    dt_real_type threshold_src, threshold_tgt, threshold;
+
+    threshold_src = __select_triangle_corrs_threshold(deformed_source);
+    threshold_tgt = __select_triangle_corrs_threshold(target);
+    threshold = __DT_LARGER(threshold_src, threshold_tgt);
+
+    __dt_ResolveTriangleCorres_Geometry(
+        deformed_source, target, threshold, n_maxcorrs, tclist, n_thread);
 }
 
 
@@ -157,32 +334,43 @@ void __dt_ResolveTriangleCorres_e(
 
        threshold = sqrt(4*surface_area / n_triangle)
 */
-static dt_real_type __select_triangle_corrs_threshold(const dtMeshModel *model)
+static dt_real_type __select_triangle_corrs_threshold(
+    const dtMeshGeometry *geom)
 {
-    dt_index_type iv = 1;
-    dt_real_type x, y, z, dx, dy, dz,
-        x_max = model->vertex[0].x, x_min = model->vertex[0].x, 
-        y_max = model->vertex[0].y, y_min = model->vertex[0].y, 
-        z_max = model->vertex[0].z, z_min = model->vertex[0].z;
-
-    /* find the bounding box of the model */
-    for ( ; iv < model->n_vertex; iv++)
+    size_t iv, stride = (size_t)geom->stride;
+    size_t end = (size_t)geom->n_vertex * stride;
+    dt_real_type c, size[3], c_max, c_min;
+    const dt_real_type *cd;
+    const float *cf;
+    int i_dim;
+
+    /* find the bounding box of the model, a dimension at a time */
+    for (i_dim = 0; i_dim < 3; i_dim++)
     {
-        x = model->vertex[iv].x;
-        y = model->vertex[iv].y;
-        z = model->vertex[iv].z;
+        c_max = c_min = __dt_GeometryCoord(geom, i_dim, 0);
+        if (geom->use_float)
+        {
+            for (cf = geom->coordf[i_dim], iv = stride; iv < end; iv += stride)
+            {
+                c = (dt_real_type)cf[iv];
+                c_max = __DT_LARGER(c, c_max);  c_min = __DT_SMALLER(c, c_min);
+            }
+        }
+        else
+        {
+            for (cd = geom->coord[i_dim], iv = stride; iv < end; iv += stride)
+            {
+                c = cd[iv];
+                c_max = __DT_LARGER(c, c_max);  c_min = __DT_SMALLER(c, c_min);
+            }
+        }
 
-        x_max = __DT_LARGER(x, x_max);  x_min = __DT_SMALLER(x, x_min);
-        y_max = __DT_LARGER(y, y_max);  y_min = __DT_SMALLER(y, y_min);
-        z_max = __DT_LARGER(z, z_max);  z_min = __DT_SMALLER(z, z_min);
+        /* width, height and depth of model's bounding box */
+        size[i_dim] = c_max - c_min;
     }
 
-    /* width, height and depth of model's bounding box */
-    dx = x_max - x_min;
-    dy = y_max - y_min;
-    dz = z_max - z_min;
-
-    return sqrt(4 * (dx*dy + dy*dz + dx*dz) / model->n_triangle);
+    return sqrt(4 * (size[0]*size[1] + size[1]*size[2] + size[0]*size[2]) /
+        geom->n_triangle);
 }
 
 #undef __DT_LARGER
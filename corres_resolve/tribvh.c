@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <float.h>
+#include "tribvh.h"
+#include "3dtree.h"
+
+
+/* triangles of a node to be split into its children, the centroids of the
+   triangles are split just like the points of a 3d tree */
+typedef struct __tribvh_Range_struct
+{
+    int begin, end;
+
+} __tribvh_Range;
+
+
+/* bounding box of triangles in [ex_begin, ex_end) goes to slot k of node */
+static void __tribvh_bounding_box(
+    const dtMeshModel *model,
+    const __3dtree_Exemplar *ex_begin, const __3dtree_Exemplar *ex_end,
+    __tribvh_Node *node, int k)
+{
+    const __3dtree_Exemplar *ex;
+    const dtVertex *v;
+    int i_corner;
+
+    node->min_x[k] = node->min_y[k] = node->min_z[k] =  DBL_MAX;
+    node->max_x[k] = node->max_y[k] = node->max_z[k] = -DBL_MAX;
+
+    for (ex = ex_begin; ex < ex_end; ex++)
+    {
+        for (i_corner = 0; i_corner < 3; i_corner++)
+        {
+            v = model->vertex + model->triangle[ex->id].i_vertex[i_corner];
+            if (v->x < node->min_x[k]) node->min_x[k] = v->x;
+            if (v->x > node->max_x[k]) node->max_x[k] = v->x;
+            if (v->y < node->min_y[k]) node->min_y[k] = v->y;
+            if (v->y > node->max_y[k]) node->max_y[k] = v->y;
+            if (v->z < node->min_z[k]) node->min_z[k] = v->z;
+            if (v->z > node->max_z[k]) node->max_z[k] = v->z;
+        }
+    }
+}
+
+/* Split the triangles of a node into at most __TRIBVH_WIDTH parts: the
+   largest part is split at the median of its centroids until there're
+   enough parts or all of them fit in a leaf. It returns the number of
+   parts. */
+static int __tribvh_split(
+    __3dtree_Exemplar *exset, __tribvh_Range range,
+    __tribvh_Range part[__TRIBVH_WIDTH])
+{
+    __3dtree_Exemplar *ex_begin;
+    int n_part = 1, k, i_largest, size, i_split;
+
+    part[0] = range;
+    while (n_part < __TRIBVH_WIDTH)
+    {
+        for (i_largest = 0, k = 1; k < n_part; k++)
+        {
+            if (part[k].end - part[k].begin >
+                part[i_largest].end - part[i_largest].begin) i_largest = k;
+        }
+
+        size = part[i_largest].end - part[i_largest].begin;
+        if (size <= __TRIBVH_LEAF_SIZE) break;
+
+        ex_begin = exset + part[i_largest].begin;
+        i_split  = __3dtree_select_split_dimension(ex_begin, ex_begin + size);
+        __3dtree_kth_split(ex_begin, size, size / 2, i_split);
+
+        part[n_part].begin = part[i_largest].begin + size / 2;
+        part[n_part].end   = part[i_largest].end;
+        part[i_largest].end = part[n_part].begin;
+        n_part++;
+    }
+
+    return n_part;
+}
+
+
+/* Allocate a block of the BVH under construction, or grow it to size bytes
+   if it's not NULL. There's no way to build the BVH without it, so it
+   crashes if malloc/realloc fails. */
+static void *__tribvh_grow(void *block, size_t size)
+{
+    void *grown = realloc(block, size);
+
+    if (grown == NULL)
+    {
+        perror("Building triangle BVH failed");
+        exit(-1);
+    }
+    return grown;
+}
+
+
+/* Build a BVH over the triangles of a mesh model */
+void __tribvh_CreateBVH(const dtMeshModel *model, __TriBVH *bvh)
+{
+    __tribvh_Tree *t = (__tribvh_Tree*)__tribvh_grow(
+        NULL, sizeof(__tribvh_Tree));
+    __3dtree_Exemplar *exset;
+    __tribvh_Range *range, part[__TRIBVH_WIDTH];
+    __tribvh_Node *node;
+    __tribvh_Triangle *tri;
+    const dtTriangle *mt;
+    const dtVertex *v;
+    const dtVector *nv;
+    dt_real_type *corner[3];
+
+    int n = (int)model->n_triangle, max_node = 16;
+    int i_node, n_part, k, i, i_corner;
+
+    /* centroids of the triangles */
+    exset = (__3dtree_Exemplar*)__tribvh_grow(NULL,
+        ((size_t)n + 1) * sizeof(__3dtree_Exemplar));
+    for (i = 0; i < n; i++)
+    {
+        exset[i].pt[0] = exset[i].pt[1] = exset[i].pt[2] = 0;
+        for (i_corner = 0; i_corner < 3; i_corner++)
+        {
+            v = model->vertex + model->triangle[i].i_vertex[i_corner];
+            exset[i].pt[0] += v->x / 3;
+            exset[i].pt[1] += v->y / 3;
+            exset[i].pt[2] += v->z / 3;
+        }
+        exset[i].id = i;
+    }
+
+    t->node   = (__tribvh_Node*)__tribvh_grow(NULL,
+        (size_t)max_node * sizeof(__tribvh_Node));
+    range     = (__tribvh_Range*)__tribvh_grow(NULL,
+        (size_t)max_node * sizeof(__tribvh_Range));
+    t->n_node = (n > 0)? 1: 0;
+
+    range[0].begin = 0;
+    range[0].end   = n;
+
+    /* nodes are split in the order they're created, which lays out the
+       hierarchy in breadth-first order */
+    for (i_node = 0; i_node < t->n_node; i_node++)
+    {
+        n_part = __tribvh_split(exset, range[i_node], part);
+
+        /* room for new nodes, node may move */
+        if (t->n_node + n_part > max_node)
+        {
+            max_node = 2 * max_node + n_part;
+            t->node  = (__tribvh_Node*)__tribvh_grow(
+                t->node, (size_t)max_node * sizeof(__tribvh_Node));
+            range    = (__tribvh_Range*)__tribvh_grow(
+                range, (size_t)max_node * sizeof(__tribvh_Range));
+        }
+
+        node = t->node + i_node;
+        for (k = 0; k < __TRIBVH_WIDTH; k++)
+        {
+            node->child[k] = -1;
+            node->begin[k] = node->count[k] = 0;
+
+            if (k >= n_part)
+            {
+                node->min_x[k] = node->min_y[k] = node->min_z[k] =  DBL_MAX;
+                node->max_x[k] = node->max_y[k] = node->max_z[k] = -DBL_MAX;
+                continue;
+            }
+
+            __tribvh_bounding_box(model,
+                exset + part[k].begin, exset + part[k].end, node, k);
+
+            if (part[k].end - part[k].begin <= __TRIBVH_LEAF_SIZE)
+            {
+                node->begin[k] = part[k].begin;
+                node->count[k] = part[k].end - part[k].begin;
+            }
+            else
+            {
+                node->child[k] = t->n_node;
+                range[t->n_node++] = part[k];
+            }
+        }
+    }
+
+    /* triangles of each leaf are contiguous after all the splits */
+    t->triangle   = (__tribvh_Triangle*)__tribvh_grow(NULL,
+        ((size_t)n + 1) * sizeof(__tribvh_Triangle));
+    t->n_triangle = n;
+
+    for (i = 0; i < n; i++)
+    {
+        tri = t->triangle + i;
+        mt  = model->triangle + exset[i].id;
+        tri->id = exset[i].id;
+        tri->n[0] = tri->n[1] = tri->n[2] = 0;
+        corner[0] = tri->a;  corner[1] = tri->b;  corner[2] = tri->c;
+
+        for (i_corner = 0; i_corner < 3; i_corner++)
+        {
+            v  = model->vertex  + mt->i_vertex[i_corner];
+            nv = model->normvec + mt->i_norm[i_corner];
+            corner[i_corner][0] = v->x;
+            corner[i_corner][1] = v->y;
+            corner[i_corner][2] = v->z;
+            tri->n[0] += nv->x;  tri->n[1] += nv->y;  tri->n[2] += nv->z;
+        }
+    }
+
+    free(range);
+    free(exset);
+    *bvh = t;
+}
+
+/* Destroy a BVH */
+void __tribvh_DestroyBVH(__TriBVH bvh)
+{
+    free(bvh->node);
+    free(bvh->triangle);
+    free(bvh);
+}
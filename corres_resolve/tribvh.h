@@ -0,0 +1,89 @@
+#ifndef __TRIBVH_HEADER__
+#define __TRIBVH_HEADER__
+
+
+#include "dt_type.h"
+
+
+/* A triangle as stored in the BVH: its corners, the orientation used to
+   filter queries (sum of the normals of its vertices) and its index in the
+   mesh model. */
+typedef struct __tribvh_Triangle_struct
+{
+    dt_real_type a[3], b[3], c[3];
+    dt_real_type n[3];
+    int id;
+
+} __tribvh_Triangle;
+
+
+/* Each node of the BVH has up to __TRIBVH_WIDTH children, a child is
+   either another node or a leaf of no more than __TRIBVH_LEAF_SIZE
+   triangles. Bounding boxes of the children are stored coordinate by
+   coordinate, so that a query tests its distance to all of them with a
+   single loop over __TRIBVH_WIDTH lanes, which compilers turn into SIMD
+   code. */
+#define __TRIBVH_WIDTH      4
+#define __TRIBVH_LEAF_SIZE  4
+
+typedef struct __tribvh_Node_struct
+{
+    /* bounding boxes of the children, empty slots have min > max */
+    dt_real_type min_x[__TRIBVH_WIDTH], max_x[__TRIBVH_WIDTH];
+    dt_real_type min_y[__TRIBVH_WIDTH], max_y[__TRIBVH_WIDTH];
+    dt_real_type min_z[__TRIBVH_WIDTH], max_z[__TRIBVH_WIDTH];
+
+    /* child >= 0 is the index of a node, otherwise the child is a leaf of
+       triangles [begin, begin + count), count is 0 for empty slots */
+    int child[__TRIBVH_WIDTH];
+    int begin[__TRIBVH_WIDTH], count[__TRIBVH_WIDTH];
+
+} __tribvh_Node;
+
+
+/* Bounding volume hierarchy over the triangles of a mesh model for closest
+   point on surface queries. Like the 3d tree, nodes are laid out in
+   breadth-first order in a single array with node[0] the root, and
+   triangles of a leaf are contiguous. */
+typedef struct __tribvh_Tree_struct
+{
+    __tribvh_Node *node;
+    int n_node;
+
+    __tribvh_Triangle *triangle;
+    int n_triangle;
+
+} __tribvh_Tree, *__TriBVH;
+
+
+/* Build a BVH over the triangles of a mesh model */
+void __tribvh_CreateBVH(const dtMeshModel *model, __TriBVH *bvh);
+
+/* Destroy a BVH */
+void __tribvh_DestroyBVH(__TriBVH bvh);
+
+
+/* Find the closest point to x0 on the triangles whose orientation is less
+   than 90-deg away from n0 (their dot product is positive). The index of
+   the triangle in the mesh model, the closest point on it and its squared
+   distance to x0 are returned through the last 3 parameters, the index is
+   -1 if no triangle satisfies the condition. */
+void __tribvh_NearestOrientedPoint(
+    __TriBVH bvh, const dt_real_type *x0, const dt_real_type *n0,
+    int *i_triangle, dt_real_type *point, dt_real_type *dist_sq);
+
+/* Answer n_query queries x0[3*i..3*i+2] at once, the normal of query i is
+   normvec[i_norm[i]], or normvec[i] if i_norm is NULL. Results of query i
+   go to i_triangle[i], point[3*i..3*i+2] and dist_sq[i]. Each query starts
+   from the closest point on the triangle found for the last one, which is
+   usually nearby when consecutive queries are close to each other, like
+   the vertices of a mesh. */
+void __tribvh_NearestOrientedPoint_Batch(
+    __TriBVH bvh, dt_size_type n_query,
+    const dt_real_type *x0,
+    const dtVector *normvec, const dt_index_type *i_norm,
+    int *i_triangle, dt_real_type *point, dt_real_type *dist_sq);
+
+
+
+#endif /* __TRIBVH_HEADER__ */
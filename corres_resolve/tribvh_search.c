@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <float.h>
+#include "tribvh.h"
+
+
+/* children waiting to be visited by a query, a node pushes no more than
+   __TRIBVH_WIDTH of them and the hierarchy is balanced */
+#define __TRIBVH_MAX_STACK  256
+
+typedef struct __tribvh_StackEntry_struct
+{
+    int child, begin, count;
+    dt_real_type dist_sq;
+
+} __tribvh_StackEntry;
+
+
+static dt_real_type __dot(const dt_real_type *u, const dt_real_type *v) {
+    return u[0]*v[0] + u[1]*v[1] + u[2]*v[2];
+}
+
+/* q = a + s*ab + t*ac, it returns the squared distance from q to p */
+static dt_real_type __barycentric_point(
+    const __tribvh_Triangle *tri, const dt_real_type *p,
+    dt_real_type s, dt_real_type t, dt_real_type *q)
+{
+    dt_real_type d, dist_sq = 0;
+    int i_dim;
+
+    for (i_dim = 0; i_dim < 3; i_dim++)
+    {
+        q[i_dim] = tri->a[i_dim] + s * (tri->b[i_dim] - tri->a[i_dim]) +
+                                   t * (tri->c[i_dim] - tri->a[i_dim]);
+        d = q[i_dim] - p[i_dim];
+        dist_sq += d * d;
+    }
+
+    return dist_sq;
+}
+
+/* Closest point q to p on a triangle, it returns their squared distance.
+   p is projected onto the plane of the triangle and clamped to the Voronoi
+   region of a corner or an edge if it falls outside the triangle. */
+static dt_real_type __closest_point_on_triangle(
+    const __tribvh_Triangle *tri, const dt_real_type *p, dt_real_type *q)
+{
+    dt_real_type ab[3], ac[3], ap[3], bp[3], cp[3];
+    dt_real_type d1, d2, d3, d4, d5, d6, va, vb, vc, s, t, denom;
+    int i_dim;
+
+    for (i_dim = 0; i_dim < 3; i_dim++)
+    {
+        ab[i_dim] = tri->b[i_dim] - tri->a[i_dim];
+        ac[i_dim] = tri->c[i_dim] - tri->a[i_dim];
+        ap[i_dim] = p[i_dim] - tri->a[i_dim];
+        bp[i_dim] = p[i_dim] - tri->b[i_dim];
+        cp[i_dim] = p[i_dim] - tri->c[i_dim];
+    }
+
+    d1 = __dot(ab, ap);  d2 = __dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) return __barycentric_point(tri, p, 0, 0, q);
+
+    d3 = __dot(ab, bp);  d4 = __dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) return __barycentric_point(tri, p, 1, 0, q);
+
+    vc = d1*d4 - d3*d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+        return __barycentric_point(tri, p, d1 / (d1 - d3), 0, q);
+    }
+
+    d5 = __dot(ab, cp);  d6 = __dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) return __barycentric_point(tri, p, 0, 1, q);
+
+    vb = d5*d2 - d1*d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+        return __barycentric_point(tri, p, 0, d2 / (d2 - d6), q);
+    }
+
+    va = d3*d6 - d5*d4;
+    if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+    {
+        t = (d4 - d3) / ((d4 - d3) + (d5 - d6));   /* on edge bc */
+        return __barycentric_point(tri, p, 1 - t, t, q);
+    }
+
+    denom = va + vb + vc;
+    s = (denom != 0)? vb / denom: 0;
+    t = (denom != 0)? vc / denom: 0;
+    return __barycentric_point(tri, p, s, t, q);
+}
+
+
+/* Visit the children nearer to x0 first, skipping those whose bounding box
+   is not closer than the closest point found so far, which comes in as
+   i_nearest, point and dist_sq (i_nearest is -1 and dist_sq DBL_MAX when
+   there's no guess). */
+static void __tribvh_nearest_oriented(
+    const __tribvh_Tree *bvh, const dt_real_type *x0, const dt_real_type *n0,
+    int *i_nearest, dt_real_type *point, dt_real_type *dist_sq)
+{
+    __tribvh_StackEntry stack[__TRIBVH_MAX_STACK], entry;
+    int n_stack = 0, order[__TRIBVH_WIDTH], n_order, k, j, i;
+
+    const __tribvh_Node *node;
+    const __tribvh_Triangle *tri;
+    dt_real_type box_dist_sq[__TRIBVH_WIDTH], dx, dy, dz, t, d, q[3];
+
+    if (bvh->n_node == 0) return;
+
+    stack[0].child   = 0;
+    stack[0].dist_sq = 0;
+    n_stack = 1;
+
+    while (n_stack > 0)
+    {
+        entry = stack[--n_stack];
+        if (entry.dist_sq >= *dist_sq) continue;
+
+        if (entry.child < 0)
+        {
+            /* scan the leaf */
+            for (i = entry.begin; i < entry.begin + entry.count; i++)
+            {
+                tri = bvh->triangle + i;
+                if (__dot(tri->n, n0) <= 0) continue;
+
+                if ((d = __closest_point_on_triangle(tri, x0, q)) < *dist_sq)
+                {
+                    *dist_sq   = d;
+                    *i_nearest = i;
+                    point[0] = q[0];  point[1] = q[1];  point[2] = q[2];
+                }
+            }
+            continue;
+        }
+
+        /* distances to the boxes of all children at once */
+        node = bvh->node + entry.child;
+        for (k = 0; k < __TRIBVH_WIDTH; k++)
+        {
+            dx = node->min_x[k] - x0[0];  t = x0[0] - node->max_x[k];
+            dx = (dx > t)? dx: t;         dx = (dx > 0)? dx: 0;
+            dy = node->min_y[k] - x0[1];  t = x0[1] - node->max_y[k];
+            dy = (dy > t)? dy: t;         dy = (dy > 0)? dy: 0;
+            dz = node->min_z[k] - x0[2];  t = x0[2] - node->max_z[k];
+            dz = (dz > t)? dz: t;         dz = (dz > 0)? dz: 0;
+            box_dist_sq[k] = dx*dx + dy*dy + dz*dz;
+        }
+
+        /* sort children still worth visiting, the farthest first */
+        for (n_order = 0, k = 0; k < __TRIBVH_WIDTH; k++)
+        {
+            if (box_dist_sq[k] >= *dist_sq) continue;
+            if (node->child[k] < 0 && node->count[k] == 0) continue;
+
+            for (j = n_order++;
+                 j > 0 && box_dist_sq[order[j-1]] < box_dist_sq[k]; j--) {
+                order[j] = order[j-1];
+            }
+            order[j] = k;
+        }
+
+        /* so that the nearest one is popped first */
+        for (j = 0; j < n_order; j++)
+        {
+            k = order[j];
+            stack[n_stack].child   = node->child[k];
+            stack[n_stack].begin   = node->begin[k];
+            stack[n_stack].count   = node->count[k];
+            stack[n_stack].dist_sq = box_dist_sq[k];
+            n_stack++;
+        }
+    }
+}
+
+
+/* Find the closest point to x0 on the triangles oriented like n0 */
+void __tribvh_NearestOrientedPoint(
+    __TriBVH bvh, const dt_real_type *x0, const dt_real_type *n0,
+    int *i_triangle, dt_real_type *point, dt_real_type *dist_sq)
+{
+    int i_nearest = -1;
+
+    *dist_sq = DBL_MAX;
+    __tribvh_nearest_oriented(bvh, x0, n0, &i_nearest, point, dist_sq);
+    *i_triangle = (i_nearest >= 0)? bvh->triangle[i_nearest].id: -1;
+}
+
+/* Answer a batch of oriented closest point queries */
+void __tribvh_NearestOrientedPoint_Batch(
+    __TriBVH bvh, dt_size_type n_query,
+    const dt_real_type *x0,
+    const dtVector *normvec, const dt_index_type *i_norm,
+    int *i_triangle, dt_real_type *point, dt_real_type *dist_sq)
+{
+    const dt_real_type *q, *qn;
+    int i, i_nearest, i_last = -1;
+
+    for (i = 0; i < n_query; i++)
+    {
+        q  = x0 + 3*i;
+        qn = &(normvec[(i_norm != NULL)? i_norm[i]: i].x);
+
+        i_nearest  = -1;
+        dist_sq[i] = DBL_MAX;
+
+        /* the triangle of the last query is most likely close to this one */
+        if (i_last >= 0 && __dot(bvh->triangle[i_last].n, qn) > 0)
+        {
+            dist_sq[i] = __closest_point_on_triangle(
+                bvh->triangle + i_last, q, point + 3*i);
+            i_nearest  = i_last;
+        }
+
+        __tribvh_nearest_oriented(
+            bvh, q, qn, &i_nearest, point + 3*i, dist_sq + i);
+
+        i_triangle[i] = (i_nearest >= 0)? bvh->triangle[i_nearest].id: -1;
+        if (i_nearest >= 0) i_last = i_nearest;
+    }
+}
@@ -85,32 +85,27 @@ void __dt_GetTriangleVerticesInfo(
 }
 
 
-/* Get the index of components of free or phantom vertices (v4) in the linear 
-   system of correspondence phase. */
-dt_index_type __dt_GetFreeCoordVarIndex(const __dt_VertexInfoList *vtilist,
-    dt_index_type i_vertex, dt_index_type i_dimension)
+/* Get the index of free or phantom vertices (v4) in the linear system of
+   correspondence phase. */
+dt_index_type __dt_GetFreeVertexVarIndex(const __dt_VertexInfoList *vtilist,
+    dt_index_type i_vertex)
 {
     __DT_ASSERT(
         vtilist->vertex_type[i_vertex] == __DT_FREE_VERTEX, 
         "i_vertex specified is not index of a free vertex.");
 
-    return vtilist->vertex_index[i_vertex] * 3 + i_dimension;
+    return vtilist->vertex_index[i_vertex];
 }
 
-dt_index_type __dt_GetPhantomCoordVarIndex(const __dt_VertexInfoList *vtilist,
-    dt_index_type i_triangle, dt_index_type i_dimension)
+dt_index_type __dt_GetPhantomVertexVarIndex(
+    const __dt_VertexInfoList *vtilist, dt_index_type i_triangle)
 {
-    return (vtilist->n_free + i_triangle) * 3 + i_dimension;
+    return vtilist->n_free + i_triangle;
 }
 
 
-/* An easy way to get the variable vector indexes of coordinate components of 
-   all vertices (including the phantom vertex) in a triangle unit. 
-
-   v_ind is a 2 dimensional array containing all retrieved variable vector 
-   indexes, -1 indicates that the corresponding coordinate component belongs
-   to a constrained vertex. 
-*/
+/* An easy way to get the variable indexes of all vertices (including the 
+   phantom vertex) in a triangle unit, -1 indicates a constrained vertex. */
 void __dt_GetTriangleVerticesVarIndex(
     const dtMeshModel *model, const __dt_VertexInfoList *vtilist, 
     dt_index_type i_triangle,
@@ -118,32 +113,25 @@ void __dt_GetTriangleVerticesVarIndex(
 {
     const dtTriangle *triangle = model->triangle + i_triangle;
     __dt_VertexInfo vinfo;
-    dt_index_type i_dim, i_vlocal;
+    dt_index_type i_vlocal;
 
-    for (i_dim = 0; i_dim < 3; i_dim++)
+    for (i_vlocal = 0; i_vlocal < 3; i_vlocal++)
     {
-        for (i_vlocal = 0; i_vlocal < 3; i_vlocal++)
-        {
-            vinfo = __dt_GetVertexInfo(
-                vtilist, triangle->i_vertex[i_vlocal]);
-
-            /* get the variable vector index of i_dim-th component of this
-               vertex if it is a free vertex, or mark it a component of a 
-               constrained vertex with -1 */
-            v_ind[i_dim][i_vlocal] = (vinfo.vertex_type == __DT_FREE_VERTEX ?
-                __dt_GetFreeCoordVarIndex(
-                    vtilist, triangle->i_vertex[i_vlocal], i_dim):
-                -1);
-        }
-        v_ind[i_dim][3] = __dt_GetPhantomCoordVarIndex(vtilist, i_triangle, i_dim);
+        vinfo = __dt_GetVertexInfo(vtilist, triangle->i_vertex[i_vlocal]);
+
+        /* get the variable index of this vertex if it is a free vertex, or
+           mark it a constrained vertex with -1 */
+        v_ind[i_vlocal] = (vinfo.vertex_type == __DT_FREE_VERTEX ?
+            __dt_GetFreeVertexVarIndex(vtilist, triangle->i_vertex[i_vlocal]):
+            -1);
     }
+    v_ind[3] = __dt_GetPhantomVertexVarIndex(vtilist, i_triangle);
 }
 
 
-/* Get the index of variable vector component from the var index table */
+/* Get the variable index of a vertex from the var index table */
 dt_index_type __dt_GetVarIndexFromTable(
-    __dt_TriangleVarIndexTable var_ind, 
-    dt_index_type i_localvertex, dt_index_type i_dimension)
+    __dt_TriangleVarIndexTable var_ind, dt_index_type i_localvertex)
 {
-    return var_ind[i_dimension][i_localvertex];
+    return var_ind[i_localvertex];
 }
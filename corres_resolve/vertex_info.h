@@ -88,61 +88,57 @@ void __dt_GetTriangleVerticesInfo(
     __dt_VertexInfo *vinfo);
 
 
-/* Get the index of components of free or phantom vertices (v4) in the linear 
-   system of correspondence phase.
+/* Get the index of free or phantom vertices (v4) in the linear system of
+   correspondence phase.
 
-   Layout of variable vector in the linear system:
+   x, y and z coordinates never couple in the equations, so the unknowns of
+   the linear system make up a n x 3 matrix rather than a 3n vector, column
+   i_dim of it holds the i_dim-th coordinate of these vertices:
 
    [
-     # coordinates of free vertices
+     # free vertices
      v[0].x, v[0].y, v[0].z,
      v[1].x, v[1].y, v[1].z, 
-     v[2].x, v[2].y, v[2].z,  
      ......
      v[n_free-1].x, v[n_free-1].y, v[n_free-1].z,
 
-     # coordinates of phantom vertices
+     # phantom vertices
      t[0].x, t[0].y, t[0].z,
      t[1].x, t[1].y, t[1].z, 
      ......
    ]
 
    where v is an array of free vertices, t is an array of phantom vertices, 
-   t[i] is the phantom vertex of triangle i.
+   t[i] is the phantom vertex of triangle i. The variable index is the row
+   index in this matrix.
 */
-dt_index_type __dt_GetFreeCoordVarIndex(const __dt_VertexInfoList *vtilist,
-    dt_index_type i_vertex, dt_index_type i_dimension);
+dt_index_type __dt_GetFreeVertexVarIndex(const __dt_VertexInfoList *vtilist,
+    dt_index_type i_vertex);
 
-dt_index_type __dt_GetPhantomCoordVarIndex(const __dt_VertexInfoList *vtilist,
-    dt_index_type i_triangle, dt_index_type i_dimension);
+dt_index_type __dt_GetPhantomVertexVarIndex(
+    const __dt_VertexInfoList *vtilist, dt_index_type i_triangle);
 
 
 
-/* An easy way to get the variable vector indexes of coordinate components of 
-   all vertices (including the phantom vertex) in a triangle unit. 
+/* An easy way to get the variable indexes of all vertices (including the 
+   phantom vertex) in a triangle unit. 
 
-   v_ind is a 2 dimensional array containing all retrieved variable vector 
-   indexes, -1 indicates that the corresponding coordinate component belongs
-   to a constrained vertex.
+   v_ind = [i_v1, i_v2, i_v3, i_v4]
 
-   v_ind = [i_v1.x, i_v2.x, i_v3.x, i_v4.x]
-           [i_v1.y, i_v2.y, i_v3.y, i_v4.y]
-           [i_v1.z, i_v2.z, i_v3.z, i_v4.z]
-
-           where i_v1, i_v2, i_v3 are indexes of i_triangle-th triangle unit, 
-           i_v4 indicates the index of phantom vertex.
+           where i_v1, i_v2, i_v3 are indexes of vertices of i_triangle-th 
+           triangle unit, -1 indicates a constrained vertex, i_v4 indicates
+           the index of phantom vertex.
 */
-typedef dt_index_type __dt_TriangleVarIndexTable[3][4];
+typedef dt_index_type __dt_TriangleVarIndexTable[4];
 
 void __dt_GetTriangleVerticesVarIndex(
     const dtMeshModel *model, const __dt_VertexInfoList *vtilist, 
     dt_index_type i_triangle,
     __dt_TriangleVarIndexTable var_ind);
 
-/* Get the index of variable vector component from the var index table */
+/* Get the variable index of a vertex from the var index table */
 dt_index_type __dt_GetVarIndexFromTable(
-    __dt_TriangleVarIndexTable var_ind, 
-    dt_index_type i_localvertex, dt_index_type i_dimension);
+    __dt_TriangleVarIndexTable var_ind, dt_index_type i_localvertex);
 
 
 
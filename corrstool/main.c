@@ -17,8 +17,8 @@ int main(int argc, char *argv[])
         if (argc == 4) cons_filename = argv[3];
 
         /* Read source and target model files */
-        __dt_ReadObjFile_commit_or_crash(argv[1], &modelL);
-        __dt_ReadObjFile_commit_or_crash(argv[2], &modelR);
+        __dt_ReadMeshFile_commit_or_crash(argv[1], &modelL);
+        __dt_ReadMeshFile_commit_or_crash(argv[2], &modelR);
 
         __gl_InitLayoutManager(BORDER_SIZE, VIEW_INFO_RATIO);
 
@@ -6,216 +6,160 @@
 
 
 
-/* calculate the size of the equation with the triangle correspondence list,
-   it scans the list and counts the correspondence entries for each target 
-   triangles to obtain the row number and column number of the coefficient 
-   matrix of the deformation equation 
-*/
-static void __calculate_equation_size(
-    const dtMeshModel *target_mesh, const __dt_TriangleCorrsDict *tcdict,
-    /* output param */ dt_size_type *n_row, dt_size_type *n_col)
-{
-    dt_size_type  n_corrs, n_eqn = 0;
-    dt_index_type i_tgt_triangle = 0;
-
-    for ( ; i_tgt_triangle < target_mesh->n_triangle; i_tgt_triangle++)
-    {
-        n_corrs = __dt_GetTriangleCorrsNumber(tcdict, i_tgt_triangle);
-        n_eqn += ((n_corrs > 0)? n_corrs: 1);
-    }
-
-    *n_row = 9 * n_eqn;
-    *n_col = 3 * (target_mesh->n_vertex + target_mesh->n_triangle);
-}
-
-/* Allocate for coefficient matrix and rhs vector with proper size */
-void __dt_AllocDeformationEquation(
-    const dtMeshModel *target_mesh, const __dt_TriangleCorrsDict *tcdict,
-    __dt_SparseMatrix *A_tri, __dt_DenseVector *C)
-{
-    dt_size_type n_row, n_col;
-    __calculate_equation_size(target_mesh, tcdict, &n_row, &n_col);
-
-    /* allocate for coefficient triplet matrix and rhs vector */
-    *A_tri = __dt_CHOLMOD_allocate_triplet((size_t)n_row, (size_t)n_col, 0);
-    *C     = __dt_CHOLMOD_dense_zeros     ((size_t)n_row, (size_t)1);
-}
-
-
 /* Get elementary matrix m from the inverse of surface (triangle unit) matrix,
    it is quite similar with the one in corres_resolve but we don't need to 
    bother with vertex constraints here. */
 static void __calculate_elementary_matrix(
     dtMatrix3x3 inV, __dt_ElementaryMatrix m)
 {
-    dt_index_type i, j, row;  /* looping index: 
-                                 dimension, equation and row index */
-    for (i = 0, row = 0; i < 3; i++)
+    dt_index_type j;  /* looping index: equation */
+    for (j = 0; j < 3; j++)
     {
-        for (j = 0; j < 3; j++, row++)
-        {
-            /* coefficient of v1: -(a[0,i] + a[1,i] + a[2,i]) */
-            m[row][0] = -(inV[0][j] + inV[1][j] + inV[2][j]);
+        /* coefficient of v1: -(a[0,j] + a[1,j] + a[2,j]) */
+        m[j][0] = -(inV[0][j] + inV[1][j] + inV[2][j]);
 
-            /* coefficient of v2..v4 */
-            m[row][1] = inV[0][j];
-            m[row][2] = inV[1][j];
-            m[row][3] = inV[2][j];
-        }
+        /* coefficient of v2..v4 */
+        m[j][1] = inV[0][j];
+        m[j][2] = inV[1][j];
+        m[j][3] = inV[2][j];
     }
 }
 
-/* Get the index of components of free or phantom vertices (v4) in the linear
-   system of deformation transfer phase, similar with the correspondence phase
-   procedure __dt_GetFreeCoordVarIndex(). */
+/* Calculate elementary matrices of all triangle units of target_ref */
+__dt_ElementaryMatrix* __dt_CreateElementaryMatrixList(
+    const dtMeshModel *target_ref)
+{
+    __dt_SurfaceInvVList  sinvlist;
+    __dt_ElementaryMatrix *elem_list = (__dt_ElementaryMatrix*)__dt_malloc(
+        (size_t)target_ref->n_triangle * sizeof(__dt_ElementaryMatrix));
+
+    dt_index_type i_triangle = 0;
+
+    __dt_InitializeSurfaceInvVList(target_ref, &sinvlist);
+    for ( ; i_triangle < target_ref->n_triangle; i_triangle++) {
+        __calculate_elementary_matrix(
+            sinvlist.inV[i_triangle], elem_list[i_triangle]);
+    }
+    __dt_DestroySurfaceInvVList(&sinvlist);
+
+    return elem_list;
+}
+
+
+/* Get the index of real or phantom vertices (v4) in the linear system of 
+   deformation transfer phase, similar with the correspondence phase 
+   procedure __dt_GetFreeVertexVarIndex(). */
 static dt_index_type __get_variable_index(
     const dtMeshModel *model, dt_index_type i_triangle,
-    dt_index_type i_vlocal, dt_index_type i_dim)
+    dt_index_type i_vlocal)
 {
     const dtTriangle *triangle = model->triangle + i_triangle;
-    dt_index_type i_vertex;
 
-    if (i_vlocal < 3)  /* real vertex */
-    {
-        i_vertex = triangle->i_vertex[i_vlocal];
-        return i_vertex * 3 + i_dim;
+    if (i_vlocal < 3) {   /* real vertex */
+        return triangle->i_vertex[i_vlocal];
     }
-    else {             /* phantom vertex */
-        return 3*(model->n_vertex + i_triangle) + i_dim;
+    else {                /* phantom vertex */
+        return model->n_vertex + i_triangle;
     }
 }
 
-
-static dt_index_type __append_elem_matrix_to_linear_system(
+/* Make the term of target triangle i_triangle, c is left zero */
+static void __get_triangle_term(
     const dtMeshModel *model, dt_index_type i_triangle,
-    __dt_ElementaryMatrix m, __dt_SparseMatrix M, dt_index_type i_row)
+    __dt_ElementaryMatrix m, dt_real_type weight, __dt_NormalTerm *term)
 {
-    dt_index_type i_var;  /* index on variable vector */
-    dt_index_type i_dim, i_vlocal, i_eqn; /* loop variable */
-
-    dt_index_type j_row = 0;  /* loop index for row number of 
-                                 elementary matrix/vector */
+    dt_index_type var[4], i_vlocal;
 
-    /* construct 9 lines of equations */
-    for (i_dim = 0; i_dim < 3; i_dim++)
-    {
-        for (i_eqn = 0; i_eqn < 3; i_eqn++, i_row++, j_row++)
-        {
-            /* fill in line i_row of coefficient matrix */
-            for (i_vlocal = 0; i_vlocal < 4; i_vlocal++)
-            {
-                /* get the variable vector index of this vertex then append 
-                   this elementary term */
-                i_var = __get_variable_index(model, i_triangle, i_vlocal, i_dim);
-                __dt_CHOLMOD_entry(M, i_row, i_var, m[j_row][i_vlocal]);
-            }
-        }
+    for (i_vlocal = 0; i_vlocal < 4; i_vlocal++) {
+        var[i_vlocal] = __get_variable_index(model, i_triangle, i_vlocal);
     }
 
-    return i_row;
+    __dt_SetNormalTerm(term, var, m, NULL, weight);
 }
 
 
-/* Build the coefficient matrix of deformation equations from target reference 
-   mesh, the coefficient matrix can be built only once to deform for a lot of 
-   deformed source meshes. 
-*/
-void __dt_BuildCoefficientMatrix(
+/* add the terms of all target triangles to eqn */
+static void __append_triangle_terms(
     const dtMeshModel *target_ref, const __dt_TriangleCorrsDict *tcdict,
-    __dt_SparseMatrix A)
+    __dt_ElementaryMatrix *elem_list, __dt_NormalEquation *eqn)
 {
-    __dt_SurfaceInvVList  sinvlist;
-    __dt_ElementaryMatrix mat;
-
-    dt_index_type 
-        i_triangle = 0, i_entry, i_row = 0;  /* looping index */
-
+    __dt_NormalTerm term;
     dt_size_type n_corrs;
-
-    __dt_InitializeSurfaceInvVList(target_ref, &sinvlist);
-
+    dt_index_type i_triangle = 0;
 
     for ( ; i_triangle < target_ref->n_triangle; i_triangle++)
     {
+        /* a target triangle without correspondence is minimized against an
+           identity matrix, which counts as a single entry */
         n_corrs = __dt_GetTriangleCorrsNumber(tcdict, i_triangle);
 
-        if (n_corrs == 0)  /* i_triangle has no corresponded pieces */
-        {
-            /* Triangle correspondence entry for this target triangle unit is
-               absent, minimize the transformation with an identity matrix */
-            __calculate_elementary_matrix(sinvlist.inV[i_triangle], mat);
-            i_row = __append_elem_matrix_to_linear_system(
-                target_ref, i_triangle, mat, A, i_row);
-        }
-        else
-        {
-            /* Append coefficient elements for minimizing the difference of
-               transformation between corresponded triangle units */
-            for (i_entry = 0; i_entry < n_corrs; i_entry++)
-            {
-                __calculate_elementary_matrix(sinvlist.inV[i_triangle], mat);
-                i_row = __append_elem_matrix_to_linear_system(
-                    target_ref, i_triangle, mat, A, i_row);
-            }
-        }
+        __get_triangle_term(target_ref, i_triangle, elem_list[i_triangle],
+            (dt_real_type)((n_corrs > 0)? n_corrs: 1), &term);
+        __dt_AddNormalTerm(eqn, &term);
     }
-
-    __dt_DestroySurfaceInvVList(&sinvlist);
 }
 
-
-/* It is quite straight forward, just place the elements of the transformation
-   matrix in row-majored sequence */
-static dt_index_type __append_rhs_vector_to_linear_system(
-    dtMatrix3x3 T, __dt_DenseVector C, dt_index_type i_row)
+/* Build the coefficient matrix AtA of the deformation equation from target
+   reference mesh, x, y and z coordinates never couple, the system has one
+   unknown per (real or phantom) vertex. */
+cholmod_sparse* __dt_BuildNormalMatrix(
+    const dtMeshModel *target_ref, const __dt_TriangleCorrsDict *tcdict,
+    __dt_ElementaryMatrix *elem_list, int stype)
 {
-    __dt_CHOLMOD_MODIFYVEC(C, i_row, T[0][0]);  i_row += 1;
-    __dt_CHOLMOD_MODIFYVEC(C, i_row, T[0][1]);  i_row += 1;
-    __dt_CHOLMOD_MODIFYVEC(C, i_row, T[0][2]);  i_row += 1;
-    __dt_CHOLMOD_MODIFYVEC(C, i_row, T[1][0]);  i_row += 1;
-    __dt_CHOLMOD_MODIFYVEC(C, i_row, T[1][1]);  i_row += 1;
-    __dt_CHOLMOD_MODIFYVEC(C, i_row, T[1][2]);  i_row += 1;
-    __dt_CHOLMOD_MODIFYVEC(C, i_row, T[2][0]);  i_row += 1;
-    __dt_CHOLMOD_MODIFYVEC(C, i_row, T[2][1]);  i_row += 1;
-    __dt_CHOLMOD_MODIFYVEC(C, i_row, T[2][2]);  i_row += 1;
-
-    return i_row;
+    __dt_NormalEquation eqn;
+    cholmod_sparse *AtA;
+
+    __dt_CreateNormalEquation(
+        target_ref->n_vertex + target_ref->n_triangle, stype, &eqn);
+
+    /* the first pass lays out AtA, the second one fills it */
+    __append_triangle_terms(target_ref, tcdict, elem_list, &eqn);
+    __dt_CompleteNormalPattern(&eqn);
+    __append_triangle_terms(target_ref, tcdict, elem_list, &eqn);
+
+    AtA = eqn.AtA;  eqn.AtA = NULL;
+    __dt_DestroyNormalEquation(&eqn);
+
+    return AtA;
 }
 
-/* Build rhs vector of the deformation equation for source_ref=>source_deform.
-   You just need to build rhs vector for each deformation while keeping the 
-   coefficient matrix unchanged.
+
+/* Build rhs vector At*C of the deformation equation for source_ref=>
+   source_deform. Row i of the transformation matrix goes to the x, y or z
+   column of the rhs of the term.
  */
 void __dt_BuildRhsConstantVector(
     const dtMeshModel *source_deformed, const dtMeshModel *target_ref,
     const __dt_SurfaceInvVList *sinvlist_ref,
     const __dt_TriangleCorrsDict *tcdict,
-    __dt_DenseVector C)
+    __dt_ElementaryMatrix *elem_list,
+    __dt_DenseVector c, dt_index_type i_col)
 {
+    __dt_NormalTerm term;
     dtMatrix3x3 V, T;
 
     dt_size_type n_corrs;
     dt_index_type 
-        i_triangle = 0, i_entry = 0, i_src_triangle,
-        i_row = 0;
+        i_triangle = 0, i_entry = 0, i_src_triangle, i_dim, i_eqn;
+
+    /* accumulated from scratch */
+    memset((double*)c->x + (size_t)i_col * c->d, 0, 3 * c->d * sizeof(double));
 
     for ( ; i_triangle < target_ref->n_triangle; i_triangle++)
     {
         n_corrs = __dt_GetTriangleCorrsNumber(tcdict, i_triangle);
+        __get_triangle_term(
+            target_ref, i_triangle, elem_list[i_triangle], 1.0, &term);
 
         if (n_corrs == 0)    /* i_triangle absent in tclist */
         {
             /* Triangle correspondence entry for this target triangle unit is
                absent, minimize the transformation with an identity matrix */
-            T[0][0] = 1.0,  T[0][1] = 0.0,  T[0][2] =  0.0;
-            T[1][0] = 0.0,  T[1][1] = 1.0,  T[1][2] =  0.0;
-            T[2][0] = 0.0,  T[2][1] = 0.0,  T[2][2] =  1.0;
-
-            /* append I to C */
-            i_row = __append_rhs_vector_to_linear_system(T, C, i_row);
+            term.c[0] = 1.0,  term.c[4] = 1.0,  term.c[8] = 1.0;
         }
         else 
         {
+            /* the sum of transformations of all corresponded triangles */
             for (i_entry = 0; i_entry < n_corrs; i_entry++)
             {
                 /* get source-target triangle index */
@@ -225,9 +169,14 @@ void __dt_BuildRhsConstantVector(
                 __dt_CalculateTriangleUnitMatrix(source_deformed, i_src_triangle, V);
                 __dt_Matrix3x3_Product(V, sinvlist_ref->inV[i_src_triangle], T);
 
-                /* append T to C */
-                i_row = __append_rhs_vector_to_linear_system(T, C, i_row);
+                for (i_dim = 0; i_dim < 3; i_dim++) {
+                    for (i_eqn = 0; i_eqn < 3; i_eqn++) {
+                        term.c[3*i_dim + i_eqn] += T[i_dim][i_eqn];
+                    }
+                }
             }
         }
+
+        __dt_AddNormalTermRhs(c, i_col, &term);
     }
 }
@@ -5,33 +5,47 @@
 #include "triangle_corr_dict.h"
 #include "mesh_model.h"
 #include "surface_matrix.h"
+#include "normal_equation.h"
 
 
 
-/* Allocate for coefficient matrix and rhs vector with proper size */
-void __dt_AllocDeformationEquation(
-    const dtMeshModel *target_mesh, const __dt_TriangleCorrsDict *tcdict,
-    __dt_SparseMatrix *A_tri, __dt_DenseVector *C);
+/* The deformation equation min ||A*x - C||^2 is never built as it is, we
+   assemble its normal equation AtA * x = At*C directly (see 
+   normal_equation.h). Each target triangle makes a term on its 3 vertices
+   and its phantom vertex, all correspondence entries of a target triangle
+   share the same elementary matrix so the term is weighted by the number of
+   entries, and its rhs is the sum of their deformation gradients.
+*/
+
+
+/* Calculate elementary matrices of all triangle units of target_ref, the
+   list is malloc'ed and should be free'd by the caller */
+__dt_ElementaryMatrix* __dt_CreateElementaryMatrixList(
+    const dtMeshModel *target_ref);
 
 
-/* Build the coefficient matrix of deformation equations from target reference 
-   mesh, the coefficient matrix can be built only once to deform for a lot of 
-   deformed source meshes. 
+/* Build the coefficient matrix AtA of the deformation equation from target
+   reference mesh, the coefficient matrix can be built only once to deform
+   for a lot of deformed source meshes. It's stored in full or only its 
+   upper part as stype tells: __DT_NORMAL_FULL or __DT_NORMAL_UPPER.
 */
-void __dt_BuildCoefficientMatrix(
+cholmod_sparse* __dt_BuildNormalMatrix(
     const dtMeshModel *target_ref, const __dt_TriangleCorrsDict *tcdict,
-    __dt_SparseMatrix A);
+    __dt_ElementaryMatrix *elem_list, int stype);
 
 
-/* Build rhs vector of the deformation equation for source_ref=>source_deform.
-   You just need to build rhs vector for each deformation while keeping the 
-   coefficient matrix unchanged.
+/* Build rhs vector At*C of the deformation equation for source_ref=>
+   source_deform. You just need to build rhs vector for each deformation 
+   while keeping the coefficient matrix unchanged. The x, y and z rhs go to
+   columns i_col, i_col+1 and i_col+2 of c, so several deformations could be
+   solved for at once.
 */
 void __dt_BuildRhsConstantVector(
     const dtMeshModel *source_deformed, const dtMeshModel *target_ref,
     const __dt_SurfaceInvVList *sinvlist_ref,
     const __dt_TriangleCorrsDict *tcdict,
-    __dt_DenseVector C);
+    __dt_ElementaryMatrix *elem_list,
+    __dt_DenseVector c, dt_index_type i_col);
 
 
 
@@ -1,76 +1,144 @@
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include <memory.h>
+#include <unistd.h>   /* for getopt */
 
 #include "transformer.h"
 #include "mesh_seg.h"
 #include "triangle_corr_dict.h"
+#include "pose_sequence.h"
+#include "pipeline.h"
 
 
-#define N_MAXCORRS 3
+#define N_BATCH    16     /* default number of poses solved for at once */
+#define N_WORKER   1      /* default number of solving threads */
 
 
+static void __print_usage(const char *program)
+{
+    printf(
+        "usage: %s [-v] [-u | -l | -p] [-b n] [-j n] [-o out.dts [-f]]"
+        " [-c cache_dir]"
+        " source_ref target_ref tricorres"
+        " <one or more deformed source model>\n"
+        "  deformed source models could be .obj, .dtm or .dts files\n"
+        "  -o  write deformed target meshes to a pose sequence file\n"
+        "      instead of out_##.obj\n"
+        "  -f  encode pose sequence frames in float32\n"
+        "  -v  only write vertices to out_##.obj, normals and triangles\n"
+        "      are the same as those of the target reference model\n"
+        "  -c  load the factorization of the deformation equation from\n"
+        "      cache_dir, or save it there if it's not been cached\n"
+        "  -u  solve with LU factorization of UMFPACK, the default with -c\n"
+        "      since only its factorization could be cached\n"
+        "  -l  solve with Cholesky factorization of CHOLMOD, the default\n"
+        "      without -c, only its ordering is cached with -c\n"
+        "  -p  solve with preconditioned conjugate gradient, which takes\n"
+        "      much less memory than factorizations, each pose starts\n"
+        "      from the solution to the previous one in its batch, the\n"
+        "      first one of a batch from the rest pose\n"
+        "  -b  number of poses to solve for at once (default %d)\n"
+        "  -j  number of solving threads (default %d), poses are read\n"
+        "      and saved by another thread for every 4 of them\n",
+        program, N_BATCH, N_WORKER);
+}
+
 int main(int argc, char *argv[])
 {
     dtTransformer trans;
-    dtMeshModel source_deformed;
+    dtTransferPipelineOptions options;
+    dtPoseSequence output_seq;
 
-    const char 
-        *source_ref = argv[1],  /* filename of source reference model */
-        *target_ref = argv[2],  /* filename of target reference model */
-        *tricorrs   = argv[3];  /* filename of triangle correspondence */
+    const char
+        *source_ref, *target_ref,  /* filename of source/target ref models */
+        *tricorrs,                 /* filename of triangle correspondence */
+        *sequence_name = NULL,     /* pose sequence to write, -o option */
+        *cache_dir     = NULL;     /* factorization cache, -c option */
 
-    char **src_deformed = &argv[4]; /* deformed source mesh filenames */
+    char **src_deformed;  /* deformed source mesh filenames */
+    int use_float = 0, vertex_only = 0, opt;
+    int solver = -1, n_batch = N_BATCH, n_worker = N_WORKER;
 
     /* number of deformed source model files specified in command line */
-    dt_size_type n_deformed_source = argc - 4;
-    dt_index_type i_source = 0;
-
-    char deformed_mesh_name[FILENAME_MAX];  /* deformed target mesh filename */
+    dt_size_type n_deformed_source;
 
-    if (argc > 3)
+    while ((opt = getopt(argc, argv, "o:fvc:ulpb:j:")) != -1)
     {
-        __dt_CHOLMOD_start();
-
-        /* Create a transformer object for deforming the target mesh using 
-           source mesh deformations */
-        printf("reading data...\n");
-        CreateDeformationTransformer(
-            source_ref, target_ref, tricorrs, N_MAXCORRS, &trans);
-
-        /* Transfer the deformation of each deformed source mesh to the target
-           mesh, so that the target mesh would deform like the source mesh  */
-        for ( ; i_source < n_deformed_source; i_source++)
+        switch (opt)
         {
-            /* read deformed source model */
-            printf("loading source deformed meshes...\n");
-            __dt_ReadObjFile_commit_or_crash(
-                src_deformed[i_source], &source_deformed);
-
-            /* deform the target model like source_ref=>source_deformed */
-            printf("deforming...\n");
-            Transform2TargetMeshModel(&source_deformed, &trans);
-
-            /* save deformed target mesh to file: out_##.obj */
-            printf("deformation complete, save deformed mesh to file\n");
-            snprintf(
-                deformed_mesh_name, sizeof(deformed_mesh_name), 
-                "out_%d.obj", i_source);
-            SaveObjFile(deformed_mesh_name, &(trans.target));
-
-            /* complete */
-            DestroyMeshModel(&source_deformed);
+            case 'o': sequence_name = optarg; break;
+            case 'f': use_float = 1;          break;
+            case 'v': vertex_only = 1;        break;
+            case 'c': cache_dir = optarg;     break;
+            case 'u': solver = __DT_SOLVER_UMFPACK; break;
+            case 'l': solver = __DT_SOLVER_CHOLMOD; break;
+            case 'p': solver = __DT_SOLVER_PCG;     break;
+            case 'b': n_batch = atoi(optarg);       break;
+            case 'j': n_worker = atoi(optarg);      break;
+            default:
+                __print_usage(argv[0]);
+                return 0;
         }
+    }
+
+    if (argc - optind < 3 || n_batch < 1 || n_worker < 1) {
+        __print_usage(argv[0]);
+        return 0;
+    }
 
-        DestroyDeformationTransformer(&trans);
-        __dt_CHOLMOD_finish();
+    /* a CHOLMOD factor would be computed again on every cache hit, while
+       UMFPACK loads its numeric factorization as it is */
+    if (solver == -1) {
+        solver = (cache_dir != NULL)?
+            __DT_SOLVER_UMFPACK: __DT_SOLVER_CHOLMOD;
+    }
 
+    source_ref   = argv[optind];
+    target_ref   = argv[optind + 1];
+    tricorrs     = argv[optind + 2];
+    src_deformed = &argv[optind + 3];
+    n_deformed_source = argc - optind - 3;
+
+    __dt_CHOLMOD_start();
+
+    /* Create a transformer object for deforming the target mesh using
+       source mesh deformations */
+    printf("reading data...\n");
+    CreateDeformationTransformer(
+        source_ref, target_ref, tricorrs, __DT_N_MAXCORRS,
+        solver, cache_dir, &trans);
+
+    /* deformed target meshes share the topology of the target reference */
+    if (sequence_name != NULL &&
+        CreatePoseSequence(
+            sequence_name, &(trans.target), use_float, &output_seq) != 0)
+    {
+        fprintf(stderr, "file: %s - ", sequence_name);
+        perror("Creating pose sequence error");
+        exit(-1);
     }
-    else {
-        printf(
-            "usage: %s source_ref target_ref tricorres"
-            " <one or more deformed source model>\n", argv[0]);
+
+    /* Transfer the deformation of each deformed source mesh to the target
+       mesh, so that the target mesh would deform like the source mesh  */
+    options.n_batch  = (dt_size_type)n_batch;
+    options.n_worker = n_worker;
+    options.n_reader = options.n_writer = (n_worker + 3) / 4;
+
+    RunTransferPipeline(
+        &trans, src_deformed, n_deformed_source, &options,
+        (sequence_name != NULL)? &output_seq: NULL,
+        vertex_only? (__DT_OBJ_OMIT_NORMVEC | __DT_OBJ_OMIT_TRIANGLE): 0);
+
+    if (sequence_name != NULL && ClosePoseSequence(&output_seq) != 0)
+    {
+        fprintf(stderr, "file: %s - ", sequence_name);
+        perror("Writing pose sequence error");
+        exit(-1);
     }
 
+    DestroyDeformationTransformer(&trans);
+    __dt_CHOLMOD_finish();
+
     return 0;
 }
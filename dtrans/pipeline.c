@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "work_queue.h"
+
+
+
+/* A batch of poses travelling through the pipeline */
+typedef struct __pipeline_Batch_struct
+{
+    dt_index_type  i_batch;        /* number of the batch in input order */
+    dt_size_type   n_pose;         /* number of poses in the batch */
+
+    dtMeshModel   *source;         /* deformed source models */
+    const char   **filename;       /* file source[k] is to be read from, or
+                                      NULL for a pose sequence frame which
+                                      has been read into frame_vertex[k] */
+    dtVertex     **frame_vertex;   /* vertex buffers for sequence frames */
+    dtVertex     **target_vertex;  /* deformed target vertices */
+
+} __pipeline_Batch;
+
+
+typedef struct __pipeline_struct
+{
+    const dtTransformer *trans;
+    dt_size_type n_batch;
+
+    /* with __DT_SOLVER_PCG, the solution to the rest pose, which the first
+       pose of every batch starts from */
+    dtTransformerWorkspace rest;
+
+    /* input cursor, guarded by input_lock */
+    pthread_mutex_t input_lock;
+    char *const   *filename;
+    dt_size_type   n_file;
+    dt_index_type  i_file;         /* next file to claim */
+    dtPoseSequence seq;            /* pose sequence being read */
+    const char    *seq_name;       /* NULL if no sequence is open */
+    dt_index_type  i_next_batch;   /* number of the next claimed batch */
+
+    /* number of live readers and workers, guarded by count_lock, the last
+       one leaving closes the queue of the next stage */
+    pthread_mutex_t count_lock;
+    int n_reader_left, n_worker_left;
+
+    __dt_WorkQueue free_queue;     /* empty batches */
+    __dt_WorkQueue work_queue;     /* batches of source models to solve */
+
+    /* solved batches, writers take them in input order. There're never more
+       than n_slot batches around, so batch i could always go to done[i %
+       n_slot] */
+    pthread_mutex_t    done_lock;
+    pthread_cond_t     done_cond;
+    __pipeline_Batch **done;
+    dt_size_type       n_slot;
+    dt_index_type      i_next_write;
+    int                done_closed;
+
+    dtPoseSequence *out_seq;
+    int obj_flags;
+
+} __pipeline;
+
+
+static __pipeline_Batch* __create_batch(const __pipeline *pl)
+{
+    __pipeline_Batch *batch =
+        (__pipeline_Batch*)__dt_malloc(sizeof(__pipeline_Batch));
+    dt_size_type n = pl->n_batch;
+    dt_index_type k;
+
+    batch->source   = (dtMeshModel*)__dt_malloc(n * sizeof(dtMeshModel));
+    batch->filename = (const char**)__dt_malloc(n * sizeof(const char*));
+    batch->frame_vertex  = (dtVertex**)__dt_malloc(n * sizeof(dtVertex*));
+    batch->target_vertex = (dtVertex**)__dt_malloc(n * sizeof(dtVertex*));
+
+    for (k = 0; k < n; k++)
+    {
+        batch->frame_vertex[k] = (dtVertex*)__dt_malloc(
+            (size_t)pl->trans->source_ref.n_vertex * sizeof(dtVertex));
+        batch->target_vertex[k] = (dtVertex*)__dt_malloc(
+            (size_t)pl->trans->target.n_vertex * sizeof(dtVertex));
+    }
+
+    return batch;
+}
+
+static void __destroy_batch(const __pipeline *pl, __pipeline_Batch *batch)
+{
+    dt_index_type k;
+
+    for (k = 0; k < pl->n_batch; k++) {
+        free(batch->frame_vertex[k]);
+        free(batch->target_vertex[k]);
+    }
+    free(batch->source);
+    free(batch->filename);
+    free(batch->frame_vertex);
+    free(batch->target_vertex);
+    free(batch);
+}
+
+
+/* Open a pose sequence as the input, its frames should be poses of the
+   source reference model. Called with input_lock held. */
+static void __open_sequence(__pipeline *pl, const char *filename)
+{
+    const dtMeshModel *ref = &(pl->trans->source_ref);
+    int ret;
+
+    if ((ret = OpenPoseSequence(filename, &(pl->seq))) != 0)
+    {
+        fprintf(stderr, "file: %s - ", filename);
+        if (ret == -1) perror("Reading pose sequence error");
+        else fprintf(stderr, "Corrupted or incompatible .dts file\n");
+        exit(-1);
+    }
+
+    if (pl->seq.reference.n_vertex   != ref->n_vertex   ||
+        pl->seq.reference.n_triangle != ref->n_triangle ||
+        memcmp(pl->seq.reference.triangle, ref->triangle,
+               (size_t)ref->n_triangle * sizeof(dtTriangle)) != 0)
+    {
+        fprintf(stderr, "file: %s - topology differs from the source "
+                "reference model\n", filename);
+        exit(-1);
+    }
+
+    pl->seq_name = filename;
+}
+
+/* Claim the next n_batch poses of the input for batch, pose files are only
+   recorded to be parsed later without holding the lock, while sequence
+   frames have to be read right here. It returns the number of claimed
+   poses, 0 if the input is exhausted. */
+static dt_size_type __claim_batch(__pipeline *pl, __pipeline_Batch *batch)
+{
+    const char *name;
+    dt_size_type n = 0;
+    int ret;
+
+    pthread_mutex_lock(&(pl->input_lock));
+
+    while (n < pl->n_batch)
+    {
+        if (pl->seq_name != NULL)   /* in the middle of a pose sequence */
+        {
+            ret = ReadPoseSequenceFrame(&(pl->seq), batch->frame_vertex[n]);
+            if (ret == 0)
+            {
+                batch->source[n] = pl->trans->source_ref;
+                batch->source[n].vertex = batch->frame_vertex[n];
+                batch->filename[n++] = NULL;
+                continue;
+            }
+            if (ret == -1)
+            {
+                fprintf(stderr, "file: %s - ", pl->seq_name);
+                perror("Reading pose sequence error");
+                exit(-1);
+            }
+
+            ClosePoseSequence(&(pl->seq));
+            pl->seq_name = NULL;
+            continue;
+        }
+
+        if (pl->i_file == pl->n_file) break;   /* no more input */
+
+        name = pl->filename[pl->i_file++];
+        if (__dt_IsPoseSequenceFilename(name)) {
+            __open_sequence(pl, name);
+        }
+        else {
+            batch->filename[n++] = name;
+        }
+    }
+
+    batch->n_pose  = n;
+    batch->i_batch = (n > 0)? pl->i_next_batch++: -1;
+
+    pthread_mutex_unlock(&(pl->input_lock));
+    return n;
+}
+
+
+/* Hand a solved batch over to the writers */
+static void __push_done(__pipeline *pl, __pipeline_Batch *batch)
+{
+    pthread_mutex_lock(&(pl->done_lock));
+    pl->done[batch->i_batch % pl->n_slot] = batch;
+    pthread_cond_broadcast(&(pl->done_cond));
+    pthread_mutex_unlock(&(pl->done_lock));
+}
+
+/* Take the next solved batch in input order, it returns NULL when every
+   batch has been taken */
+static __pipeline_Batch* __pop_done(__pipeline *pl)
+{
+    __pipeline_Batch **slot, *batch;
+
+    pthread_mutex_lock(&(pl->done_lock));
+
+    slot = pl->done + pl->i_next_write % pl->n_slot;
+    while (*slot == NULL && !pl->done_closed) {
+        pthread_cond_wait(&(pl->done_cond), &(pl->done_lock));
+    }
+
+    if ((batch = *slot) != NULL) {
+        *slot = NULL;
+        pl->i_next_write++;
+    }
+
+    pthread_mutex_unlock(&(pl->done_lock));
+    return batch;
+}
+
+static void __close_done(__pipeline *pl)
+{
+    pthread_mutex_lock(&(pl->done_lock));
+    pl->done_closed = 1;
+    pthread_cond_broadcast(&(pl->done_cond));
+    pthread_mutex_unlock(&(pl->done_lock));
+}
+
+
+static void* __reader_thread(void *arg)
+{
+    __pipeline *pl = (__pipeline*)arg;
+    __pipeline_Batch *batch;
+    dt_index_type k;
+
+    while ((batch = (__pipeline_Batch*)__dt_WorkQueuePop(
+                &(pl->free_queue))) != NULL)
+    {
+        if (__claim_batch(pl, batch) == 0) {
+            __dt_WorkQueuePush(&(pl->free_queue), batch);
+            break;
+        }
+
+        /* a .dtm pose file may share its topology with the source reference
+           model */
+        for (k = 0; k < batch->n_pose; k++)
+        {
+            if (batch->filename[k] != NULL) {
+                __dt_ReadPoseFile_commit_or_crash(batch->filename[k],
+                    &(pl->trans->source_ref), batch->source + k);
+            }
+        }
+
+        __dt_WorkQueuePush(&(pl->work_queue), batch);
+    }
+
+    pthread_mutex_lock(&(pl->count_lock));
+    if (--pl->n_reader_left == 0) __dt_CloseWorkQueue(&(pl->work_queue));
+    pthread_mutex_unlock(&(pl->count_lock));
+
+    return NULL;
+}
+
+static void* __worker_thread(void *arg)
+{
+    __pipeline *pl = (__pipeline*)arg;
+    __pipeline_Batch *batch;
+    dtTransformerWorkspace work;
+    dt_index_type k;
+
+    __dt_CHOLMOD_start();    /* CHOLMOD workspace of this thread */
+    CreateTransformerWorkspace(pl->trans, &work);
+
+    while ((batch = (__pipeline_Batch*)__dt_WorkQueuePop(
+                &(pl->work_queue))) != NULL)
+    {
+        /* not from the last batch of this worker, which depends on how
+           batches happened to be shared out */
+        if (pl->trans->solver == __DT_SOLVER_PCG) {
+            CopyTransformerWorkspaceGuess(&(pl->rest), &work);
+        }
+
+        printf("deforming %d poses...\n", (int)batch->n_pose);
+        Transform2TargetMeshModel_Batch(batch->source, batch->n_pose,
+            pl->trans, &work, batch->target_vertex);
+
+        for (k = 0; k < batch->n_pose; k++) {
+            if (batch->filename[k] != NULL) DestroyMeshModel(batch->source + k);
+        }
+
+        __push_done(pl, batch);
+    }
+
+    DestroyTransformerWorkspace(&work);
+    __dt_CHOLMOD_finish();
+
+    pthread_mutex_lock(&(pl->count_lock));
+    if (--pl->n_worker_left == 0) __close_done(pl);
+    pthread_mutex_unlock(&(pl->count_lock));
+
+    return NULL;
+}
+
+/* save a deformed target mesh sharing the topology of the target model */
+static void __save_pose(
+    const __pipeline *pl, dt_index_type i_output, dtVertex *vertex)
+{
+    char deformed_mesh_name[FILENAME_MAX];  /* deformed target mesh filename */
+    dtMeshModel deformed = pl->trans->target;
+
+    if (pl->out_seq != NULL)
+    {
+        if (AppendPoseSequenceFrame(pl->out_seq, vertex) != 0) {
+            perror("Writing pose sequence error");
+            exit(-1);
+        }
+    }
+    else
+    {
+        /* save deformed target mesh to file: out_##.obj */
+        snprintf(
+            deformed_mesh_name, sizeof(deformed_mesh_name),
+            "out_%d.obj", i_output);
+        deformed.vertex = vertex;
+        SaveObjFile_Ex(deformed_mesh_name, &deformed, pl->obj_flags);
+    }
+}
+
+static void* __writer_thread(void *arg)
+{
+    __pipeline *pl = (__pipeline*)arg;
+    __pipeline_Batch *batch;
+    dt_index_type k;
+
+    while ((batch = __pop_done(pl)) != NULL)
+    {
+        for (k = 0; k < batch->n_pose; k++) {
+            __save_pose(pl, batch->i_batch * pl->n_batch + k,
+                        batch->target_vertex[k]);
+        }
+
+        __dt_WorkQueuePush(&(pl->free_queue), batch);
+    }
+
+    return NULL;
+}
+
+
+/* Solve for the rest pose of the target model, the deformed source model is
+   the source reference model itself */
+static void __solve_rest_pose(__pipeline *pl)
+{
+    const dtTransformer *trans = pl->trans;
+    dtVertex *vertex = (dtVertex*)__dt_malloc(
+        (size_t)trans->target.n_vertex * sizeof(dtVertex));
+
+    CreateTransformerWorkspace(trans, &(pl->rest));
+    Transform2TargetMeshModel_Batch(
+        &(trans->source_ref), 1, trans, &(pl->rest), &vertex);
+
+    free(vertex);
+}
+
+
+/* Start n threads running routine, abort if any of them can't be created */
+static void __start_threads(
+    pthread_t *thread, int n, void *(*routine)(void*), __pipeline *pl)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        if (pthread_create(thread + i, NULL, routine, pl) != 0) {
+            perror("Creating thread failed");
+            exit(-1);
+        }
+    }
+}
+
+
+/* Deform trans->target like every deformed source model listed in filename
+   and save the deformed target meshes */
+void RunTransferPipeline(
+    const dtTransformer *trans,
+    char *const *filename, dt_size_type n_file,
+    const dtTransferPipelineOptions *options,
+    dtPoseSequence *out_seq, int obj_flags)
+{
+    __pipeline pl;
+    pthread_t *thread;
+    int n_reader = options->n_reader, n_worker = options->n_worker;
+    int n_writer = (out_seq != NULL)? 1: options->n_writer;
+    int n_thread = n_reader + n_worker + n_writer, i;
+    dt_index_type k;
+
+    pl.trans    = trans;
+    pl.n_batch  = options->n_batch;
+    pl.filename = filename;
+    pl.n_file   = n_file;
+    pl.i_file   = 0;
+    pl.seq_name = NULL;
+    pl.i_next_batch  = 0;
+    pl.n_reader_left = n_reader;
+    pl.n_worker_left = n_worker;
+    pl.out_seq   = out_seq;
+    pl.obj_flags = obj_flags;
+
+    pthread_mutex_init(&(pl.input_lock), NULL);
+    pthread_mutex_init(&(pl.count_lock), NULL);
+    pthread_mutex_init(&(pl.done_lock), NULL);
+    pthread_cond_init(&(pl.done_cond), NULL);
+
+    /* one batch in hand for every thread, plus one queued ahead for each
+       worker, that's what bounds the memory used by the pipeline */
+    pl.n_slot = (dt_size_type)(n_thread + n_worker);
+    pl.done = (__pipeline_Batch**)__dt_malloc(
+        pl.n_slot * sizeof(__pipeline_Batch*));
+    pl.i_next_write = 0;
+    pl.done_closed  = 0;
+
+    __dt_CreateWorkQueue(pl.n_slot, &(pl.free_queue));
+    __dt_CreateWorkQueue(pl.n_slot, &(pl.work_queue));
+    for (k = 0; k < pl.n_slot; k++)
+    {
+        pl.done[k] = NULL;
+        __dt_WorkQueuePush(&(pl.free_queue), __create_batch(&pl));
+    }
+
+    /* poses are warm started from the rest pose, so that the deformed
+       meshes are the same with any number of threads */
+    if (trans->solver == __DT_SOLVER_PCG) {
+        __solve_rest_pose(&pl);
+    }
+
+    /* run the pipeline */
+    thread = (pthread_t*)__dt_malloc(n_thread * sizeof(pthread_t));
+    __start_threads(thread, n_reader, __reader_thread, &pl);
+    __start_threads(thread + n_reader, n_worker, __worker_thread, &pl);
+    __start_threads(
+        thread + n_reader + n_worker, n_writer, __writer_thread, &pl);
+
+    for (i = 0; i < n_thread; i++) {
+        pthread_join(thread[i], NULL);
+    }
+
+    /* every batch is back in the free queue */
+    for (k = 0; k < pl.n_slot; k++) {
+        __destroy_batch(&pl,
+            (__pipeline_Batch*)__dt_WorkQueuePop(&(pl.free_queue)));
+    }
+
+    if (trans->solver == __DT_SOLVER_PCG) {
+        DestroyTransformerWorkspace(&(pl.rest));
+    }
+
+    free(thread);
+    free(pl.done);
+    __dt_DestroyWorkQueue(&(pl.free_queue));
+    __dt_DestroyWorkQueue(&(pl.work_queue));
+    pthread_mutex_destroy(&(pl.input_lock));
+    pthread_mutex_destroy(&(pl.count_lock));
+    pthread_mutex_destroy(&(pl.done_lock));
+    pthread_cond_destroy(&(pl.done_cond));
+}
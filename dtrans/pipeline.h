@@ -0,0 +1,48 @@
+#ifndef __DT_TRANSFER_PIPELINE_HEADER__
+#define __DT_TRANSFER_PIPELINE_HEADER__
+
+
+#include "transformer.h"
+#include "pose_sequence.h"
+
+
+/* Deformation transfer of a long list of poses runs as a pipeline of three
+   stages connected by bounded queues:
+
+       readers   parse deformed source models ahead of time, or read frames
+                 of pose sequences
+       workers   build the rhs and solve for a batch of poses with the
+                 shared factorization, which they only read
+       writers   save deformed target meshes
+
+   Poses travel through the pipeline in batches, batches are numbered in the
+   order of the input and are always filled up to n_batch poses (except for
+   the last one), so the k-th pose of batch i is always saved as pose
+   i*n_batch+k no matter which thread handles it.
+*/
+typedef struct __dt_TransferPipelineOptions_struct
+{
+    dt_size_type n_batch;     /* poses solved for at once */
+    int n_reader;             /* number of threads of each stage */
+    int n_worker;
+    int n_writer;
+
+} dtTransferPipelineOptions;
+
+
+/* Deform trans->target like every deformed source model listed in filename
+   (.obj, .dtm pose files or .dts pose sequences), deformed target meshes are
+   appended to out_seq in input order, or saved as out_##.obj with flags of
+   SaveObjFile_Ex if out_seq is NULL. There's only one writer thread when
+   writing to a pose sequence. With __DT_SOLVER_PCG the first pose of each
+   batch starts from the rest pose, so that the result doesn't depend on
+   the number of threads. */
+void RunTransferPipeline(
+    const dtTransformer *trans,
+    char *const *filename, dt_size_type n_file,
+    const dtTransferPipelineOptions *options,
+    dtPoseSequence *out_seq, int obj_flags);
+
+
+
+#endif /* __DT_TRANSFER_PIPELINE_HEADER__ */
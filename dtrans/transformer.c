@@ -1,98 +1,352 @@
+#include <string.h>
+
 #include "transformer.h"
+#include "transformer_cache.h"
 #include "umfpack.h"
 
 
+/* PCG stops once ||c - AtA*x|| <= tol * ||c|| for every column */
+#define __DT_PCG_TOL       1e-10
+#define __DT_PCG_MAX_ITER  1000
+
+
+
+/* Factorize trans->AtA with the solver of the transformer. perm is a fill-
+   reducing permutation for CHOLMOD found by an earlier analysis of the same
+   matrix, or NULL. */
+static void __factorize(dtTransformer *trans, int *perm)
+{
+    void *symbolic_obj;        /* for umfpack's symbolic analysis */
+
+    if (trans->solver == __DT_SOLVER_PCG)
+    {
+        /* nothing but the preconditioner, which is linear in nnz(AtA) */
+        __dt_CreatePreconditioner(trans->AtA, __DT_PRECOND_IC0,
+            &(trans->precond));
+        return;
+    }
+
+    if (trans->solver == __DT_SOLVER_CHOLMOD)
+    {
+        /* supernodal Cholesky factorization of the SPD normal equations */
+        trans->L = __dt_CHOLMOD_analyze(trans->AtA, perm);
+        __dt_CHOLMOD_factorize(trans->AtA, trans->L);
+        return;
+    }
+
+    /* LU factorization with UMFPACK */
+    umfpack_di_symbolic(
+        (int)trans->AtA->nrow, (int)trans->AtA->ncol, 
+        (const int*)trans->AtA->p, (const int*)trans->AtA->i, (const double*)trans->AtA->x, 
+        &symbolic_obj, NULL, NULL);
+
+    umfpack_di_numeric(
+        (const int*)trans->AtA->p, (const int*)trans->AtA->i, (const double*)trans->AtA->x, 
+        symbolic_obj, &(trans->numeric_obj), NULL, NULL);
+
+    umfpack_di_free_symbolic(&symbolic_obj);
+}
+
+/* Build the coefficient matrix AtA and factorize it, only UMFPACK needs AtA
+   to be stored in full */
+static void __build_and_factorize(dtTransformer *trans)
+{
+    printf("building equation...\n");
+    trans->AtA = __dt_BuildNormalMatrix(
+        &(trans->target), &(trans->tcdict), trans->elem_list,
+        (trans->solver == __DT_SOLVER_UMFPACK)?
+            __DT_NORMAL_FULL: __DT_NORMAL_UPPER);
+
+    printf("factorizing...\n");
+    __factorize(trans, NULL);
+}
+
+/* Free the factorization of AtA */
+static void __free_factorization(dtTransformer *trans)
+{
+    if (trans->solver == __DT_SOLVER_CHOLMOD) {
+        __dt_CHOLMOD_free_factor(&(trans->L));
+    }
+    else if (trans->solver == __DT_SOLVER_UMFPACK) {
+        umfpack_di_free_numeric(&(trans->numeric_obj));
+    }
+    else {
+        __dt_DestroyPreconditioner(&(trans->precond));
+    }
+}
+
+/* Load AtA and the factorization from the cache, it returns 0 on a cache
+   hit or -1 if they have to be built. CHOLMOD factors can't be saved, we
+   only cache the fill-reducing permutation and factorize again, which saves
+   the building of matrices and the ordering phase of the analysis. PCG only
+   has AtA cached, its preconditioner is cheap to build again. */
+static int __load_from_cache(
+    const char *cache_dir, __dt_Hash64 key, dtTransformer *trans,
+    size_t n_col)
+{
+    int *perm = NULL;
+
+    if (__dt_LoadTransformerCache(cache_dir, key, trans, &perm) != 0) {
+        return -1;
+    }
+
+    /* the cached system should at least be of the right size */
+    if (trans->AtA->ncol != n_col)
+    {
+        if (trans->solver == __DT_SOLVER_UMFPACK) __free_factorization(trans);
+        __dt_CHOLMOD_free_sparse(&(trans->AtA));
+        free(perm);
+        return -1;
+    }
+
+    if (trans->solver != __DT_SOLVER_UMFPACK)
+    {
+        printf("factorizing...\n");
+        __factorize(trans, perm);
+        free(perm);
+    }
+
+    printf("loaded factorization from cache\n");
+    return 0;
+}
+
 
 /* Create a deformation transfer object, once created, this object can help 
    deforming the target mesh like the source mesh deformation quicky and 
    faithfully. 
+
+   solver is one of __DT_SOLVER_CHOLMOD, UMFPACK and PCG. If cache_dir
+   is not NULL, the coefficient matrices and the factorization are loaded
+   from the cache directory when they have been built for the same target
+   model and triangle correspondence before, and saved to it otherwise.
 */
 void CreateDeformationTransformer(
     const char *source_ref_name, const char *target_ref_name,
     const char *tricorrs_name, dt_size_type n_maxcorrs,
-    dtTransformer *trans)
+    int solver, const char *cache_dir, dtTransformer *trans)
 {
-    __dt_TriangleCorrsList tclist;
+    __dt_Hash64 cache_key;
+    int ret;
+    size_t n_col;
 
-    cholmod_sparse   *A;
-    __dt_SparseMatrix A_tri;
-    void *symbolic_obj;        /* for umfpack's symbolic analysis */
+    trans->solver      = solver;
+    trans->L           = NULL;
+    trans->numeric_obj = NULL;
+    trans->precond.type = __DT_PRECOND_NONE;
 
     /* Load data */
-    __dt_ReadObjFile_commit_or_crash(source_ref_name, &(trans->source_ref));
-    __dt_ReadObjFile_commit_or_crash(target_ref_name, &(trans->target));
+    __dt_ReadMeshFile_commit_or_crash(source_ref_name, &(trans->source_ref));
+    __dt_ReadMeshFile_commit_or_crash(target_ref_name, &(trans->target));
 
-    if (__dt_LoadTriangleCorrsList(
-            tricorrs_name, &tclist) == -1) {
+    /* Load triangle correspondences into the dictionary */
+    ret = __dt_LoadTriangleCorrsDict(tricorrs_name,
+        &(trans->source_ref), &(trans->target), n_maxcorrs, &(trans->tcdict));
+    if (ret == -1) {
         perror("Loading triangle correspondence failed");
         exit(1);
     }
-
-    /* Initialize triangle correspondence dictionary */
-    __dt_StripTriangleCorrsList(&tclist, n_maxcorrs);
-    __dt_CreateTriangleCorrsDict(&(trans->target), &tclist, &(trans->tcdict));
+    else if (ret == -2) {
+        fprintf(stderr, "Corrupted or incompatible .tricorrs file\n");
+        exit(1);
+    }
 
     /* Precalculate inverse of surface matrices of source reference model*/
     __dt_InitializeSurfaceInvVList(&(trans->source_ref), &(trans->sinvlist));
 
-    /* Allocate for linear system */
-    __dt_AllocDeformationEquation(&(trans->target), &(trans->tcdict), &A_tri, &(trans->C));
-    trans->c = __dt_CHOLMOD_dense_zeros(A_tri->ncol, 1);      /* rhs vector: ncol*1 */
-    trans->x = __dt_CHOLMOD_dense_zeros(A_tri->ncol, 1); /* solution vector: ncol*1 */
+    /* Elementary matrices of the target reference model, and the size of
+       the linear system: a real or phantom vertex for each variable */
+    trans->elem_list = __dt_CreateElementaryMatrixList(&(trans->target));
+    n_col = (size_t)(trans->target.n_vertex + trans->target.n_triangle);
 
-    /* Building coefficient matrix: 
-       A_tri(triplet) ==> A(sparse) ==> At ==> AtA */
-    printf("building equation...\n");
-    __dt_BuildCoefficientMatrix(&(trans->target), &(trans->tcdict), A_tri);
-    A = __dt_CHOLMOD_triplet_to_sparse(A_tri); __dt_CHOLMOD_free_triplet(&A_tri);
-    trans->At  = __dt_CHOLMOD_transpose(A);    __dt_CHOLMOD_free_sparse(&A);
-    trans->AtA = __dt_CHOLMOD_AxAt(trans->At);
+    trans->work.c = __dt_CHOLMOD_dense_zeros(n_col, 3);      /* rhs: ncol*3 */
+    trans->work.x = __dt_CHOLMOD_dense_zeros(n_col, 3); /* solution: ncol*3 */
 
-    printf("factorizing...\n");
-    /* factorize AtA */
-    umfpack_di_symbolic(
-        (int)trans->AtA->nrow, (int)trans->AtA->ncol, 
-        (const int*)trans->AtA->p, (const int*)trans->AtA->i, (const double*)trans->AtA->x, 
-        &symbolic_obj, NULL, NULL);
+    /* caching is silently disabled if the key can't be calculated */
+    if (cache_dir != NULL && __dt_TransformerCacheKey(
+            target_ref_name, tricorrs_name, n_maxcorrs, solver,
+            &cache_key) != 0) {
+        cache_dir = NULL;
+    }
 
-    umfpack_di_numeric(
-        (const int*)trans->AtA->p, (const int*)trans->AtA->i, (const double*)trans->AtA->x, 
-        symbolic_obj, &(trans->numeric_obj), NULL, NULL);
+    if (cache_dir != NULL &&
+        __load_from_cache(cache_dir, cache_key, trans, n_col) == 0) {
+        return;
+    }
 
-    umfpack_di_free_symbolic(&symbolic_obj);
+    __build_and_factorize(trans);
+
+    if (cache_dir != NULL &&
+        __dt_SaveTransformerCache(cache_dir, cache_key, trans) != 0) {
+        perror("Saving factorization to cache failed");
+    }
+}
+
+
+static void __apply_deformation(
+    dt_size_type n_vertex, __dt_DenseVector x, dt_index_type i_col,
+    dtVertex *vertex);
+
+
+/* Create a workspace for Transform2TargetMeshModel_Batch */
+void CreateTransformerWorkspace(
+    const dtTransformer *trans, dtTransformerWorkspace *work)
+{
+    work->c = __dt_CHOLMOD_dense_zeros(trans->AtA->nrow, 3);
+    work->x = __dt_CHOLMOD_dense_zeros(trans->AtA->nrow, 3);
+}
+
+void DestroyTransformerWorkspace(dtTransformerWorkspace *work)
+{
+    __dt_CHOLMOD_free_dense(&(work->x));
+    __dt_CHOLMOD_free_dense(&(work->c));
+}
+
+/* Copy the last pose solved for with from to the last pose of to, which is
+   where the next transform with to starts from */
+void CopyTransformerWorkspaceGuess(
+    const dtTransformerWorkspace *from, dtTransformerWorkspace *to)
+{
+    size_t nrow = to->x->nrow;
+
+    memcpy((double*)to->x->x + (to->x->ncol - 3) * to->x->d,
+           (double*)from->x->x + (from->x->ncol - 3) * from->x->d,
+           3 * nrow * sizeof(double));
+}
+
+/* Copy the 3 columns of pose i_from in x to those of pose i_to */
+static void __copy_pose(
+    cholmod_dense *x, dt_index_type i_from, dt_index_type i_to)
+{
+    if (i_from != i_to)
+    {
+        memcpy((double*)x->x + 3 * i_to * x->d,
+               (double*)x->x + 3 * i_from * x->d,
+               3 * x->d * sizeof(double));
+    }
+}
+
+/* Make room in c and x for the rhs and the solution of n_pose poses, the
+   last pose of the old x stays the last one of the new x. n_pose is at
+   least 1. */
+static void __reserve_batch(
+    dtTransformerWorkspace *work, dt_size_type n_pose)
+{
+    size_t ncol = 3 * (size_t)n_pose, nrow = work->c->nrow;
+    cholmod_dense *x = work->x;
+
+    if (work->c->ncol != ncol)
+    {
+        __dt_CHOLMOD_free_dense(&(work->c));
+        work->c = __dt_CHOLMOD_dense_zeros(nrow, ncol);
+        work->x = __dt_CHOLMOD_dense_zeros(nrow, ncol);
+
+        memcpy((double*)work->x->x + (ncol - 3) * work->x->d,
+               (double*)x->x + (x->ncol - 3) * x->d,
+               3 * nrow * sizeof(double));
+        __dt_CHOLMOD_free_dense(&x);
+    }
 }
 
+/* Solve for the poses of a batch one after another with PCG, each of them
+   starts from the solution to the last one */
+static void __solve_batch_pcg(
+    const dtTransformer *trans, dtTransformerWorkspace *work,
+    dt_size_type n_pose)
+{
+    cholmod_dense c_pose, x_pose;
+    dt_index_type k;
 
-static void __apply_deformation_to_model(dtMeshModel *model, __dt_DenseVector x);
+    for (k = 0; k < n_pose; k++)
+    {
+        __copy_pose(work->x, (k == 0)? n_pose - 1: k - 1, k);
 
+        __dt_CHOLMOD_dense_columns(work->c, 3 * (size_t)k, 3, &c_pose);
+        __dt_CHOLMOD_dense_columns(work->x, 3 * (size_t)k, 3, &x_pose);
+
+        if (__dt_PCG_solve_dense(trans->AtA, &c_pose, &x_pose,
+                __dt_ApplyPreconditioner, (void*)&(trans->precond),
+                __DT_PCG_TOL, __DT_PCG_MAX_ITER) < 0)
+        {
+            fprintf(stderr, "PCG did not converge in %d iterations\n",
+                __DT_PCG_MAX_ITER);
+        }
+    }
+}
 
 /* Transform the target model like source_ref==>source_deformed, trans->target
    is modified to deformed model.  */
 void Transform2TargetMeshModel(
     const dtMeshModel *source_deformed, dtTransformer *trans)
 {
-    __dt_BuildRhsConstantVector(source_deformed, &(trans->target), 
-        &(trans->sinvlist), &(trans->tcdict), trans->C);
+    dtVertex *target_vertex = trans->target.vertex;
+    Transform2TargetMeshModel_Batch(
+        source_deformed, 1, trans, &(trans->work), &target_vertex);
+}
+
+/* Transform the target model like source_ref==>source_deformed[k] for n_pose
+   deformed source models at once */
+void Transform2TargetMeshModel_Batch(
+    const dtMeshModel *source_deformed, dt_size_type n_pose,
+    const dtTransformer *trans, dtTransformerWorkspace *work,
+    dtVertex *const *target_vertex)
+{
+    dt_index_type k;
+    size_t j;
+
+    /* there's no last pose to keep in an empty batch */
+    if (n_pose == 0) return;
 
-    __dt_CHOLMOD_Axc(trans->At, trans->C, trans->c);
+    __reserve_batch(work, n_pose);
+
+    /* c = At * C, pose k goes to columns 3k..3k+2 */
+    for (k = 0; k < n_pose; k++)
+    {
+        __dt_BuildRhsConstantVector(source_deformed + k, &(trans->target), 
+            &(trans->sinvlist), &(trans->tcdict), trans->elem_list,
+            work->c, 3 * k);
+    }
 
-    umfpack_di_solve(UMFPACK_A, 
-        (const int*)(trans->AtA->p), (const int*)(trans->AtA->i), (const double*)(trans->AtA->x), 
-        (double*)(trans->x->x), (const double*)(trans->c->x), 
-        trans->numeric_obj, NULL, NULL);
+    if (trans->solver == __DT_SOLVER_PCG)
+    {
+        __solve_batch_pcg(trans, work, n_pose);
+    }
+    else if (trans->solver == __DT_SOLVER_CHOLMOD)
+    {
+        /* cholmod_solve hands us a new solution vector */
+        __dt_CHOLMOD_free_dense(&(work->x));
+        work->x = __dt_CHOLMOD_solve(trans->L, work->c);
+    }
+    else
+    {
+        /* umfpack solves for one column at a time */
+        for (j = 0; j < work->c->ncol; j++)
+        {
+            umfpack_di_solve(UMFPACK_A, 
+                (const int*)(trans->AtA->p), (const int*)(trans->AtA->i), (const double*)(trans->AtA->x), 
+                (double*)(work->x->x) + j * work->x->d,
+                (const double*)(work->c->x) + j * work->c->d, 
+                trans->numeric_obj, NULL, NULL);
+        }
+    }
 
-    __apply_deformation_to_model(&(trans->target), trans->x);
+    for (k = 0; k < n_pose; k++) {
+        __apply_deformation(
+            trans->target.n_vertex, work->x, 3 * k, target_vertex[k]);
+    }
 }
 
-/* Update the coordinates of vertices in specified model with solution vector x */
-static void __apply_deformation_to_model(dtMeshModel *model, __dt_DenseVector x)
+/* Update the coordinates of vertices with solution x, its columns i_col, 
+   i_col+1 and i_col+2 are the x, y and z coordinates */
+static void __apply_deformation(
+    dt_size_type n_vertex, __dt_DenseVector x, dt_index_type i_col,
+    dtVertex *vertex)
 {
-    dt_index_type i = 0, ind = 0;
-    for ( ; i < model->n_vertex; i++)
+    dt_index_type i = 0;
+    for ( ; i < n_vertex; i++)
     {
-        model->vertex[i].x = __dt_CHOLMOD_REFVEC(x, ind); ind++;
-        model->vertex[i].y = __dt_CHOLMOD_REFVEC(x, ind); ind++;
-        model->vertex[i].z = __dt_CHOLMOD_REFVEC(x, ind); ind++;
+        vertex[i].x = __dt_CHOLMOD_REFMAT(x, i, i_col);
+        vertex[i].y = __dt_CHOLMOD_REFMAT(x, i, i_col + 1);
+        vertex[i].z = __dt_CHOLMOD_REFMAT(x, i, i_col + 2);
     }
 }
 
@@ -105,10 +359,8 @@ void DestroyDeformationTransformer(dtTransformer *trans)
     __dt_DestroySurfaceInvVList(&(trans->sinvlist));
     __dt_DestroyTriangleCorrsDict(&(trans->tcdict));
 
-    umfpack_di_free_numeric(&(trans->numeric_obj));
-    __dt_CHOLMOD_free_dense(&(trans->x));
-    __dt_CHOLMOD_free_dense(&(trans->c));
-    __dt_CHOLMOD_free_dense(&(trans->C));
-    __dt_CHOLMOD_free_sparse(&(trans->At));
+    __free_factorization(trans);
+    DestroyTransformerWorkspace(&(trans->work));
     __dt_CHOLMOD_free_sparse(&(trans->AtA));
+    free(trans->elem_list);
 }
@@ -3,24 +3,52 @@
 
 
 #include "dt_equation.h"
+#include "pcg.h"
+
+
+/* Solvers for the deformation equation AtA * x = c */
+#define __DT_SOLVER_CHOLMOD  0   /* supernodal Cholesky factorization */
+#define __DT_SOLVER_UMFPACK  1   /* general LU factorization */
+#define __DT_SOLVER_PCG      2   /* conjugate gradient, IC(0) preconditioned */
+
+
+/* Right hand side and solution of the deformation equation: AtA * x = c,
+   where c = At * C. x, y and z coordinates don't couple, they are the 3 
+   columns of c and x, which have 3 columns for each pose of a batch. c is
+   accumulated triangle by triangle, A and C are never formed.
+
+   They are written by every transform, while the rest of the transformer is
+   only read, threads sharing a transformer need a workspace each. With
+   __DT_SOLVER_PCG the last pose solved for in x is the initial guess of the
+   next transform. */
+typedef struct __dt_TransformerWorkspace_struct
+{
+    cholmod_dense *c, *x;
+
+} dtTransformerWorkspace;
 
 
 typedef struct __dt_Transformer_struct
 {
     dtMeshModel source_ref;   /* source reference model */
-    dtMeshModel target;       /* target reference/deformed model. 
-                                 It represents the reference model when
-                                 initializing the transformer object, 
-                                 and turns into deformed target model in
-                                 deformation transfer solving phase. */
+    dtMeshModel target;       /* target reference model, only its
+                                 triangles are read once the transformer
+                                 is created. Transform2TargetMeshModel
+                                 overwrites its vertices with the deformed
+                                 ones, the batch version leaves it as is. */
 
     __dt_TriangleCorrsDict tcdict;  /* triangle units correspondence */
 
-    /* the deformation equation: AtA * x = c, where c = At * C */
-    cholmod_sparse *At, *AtA;
-    cholmod_dense  *C, *c, *x;
+    /* coefficient matrix of the deformation equation and elementary matrices
+       of the target triangles making up AtA and the rhs */
+    cholmod_sparse *AtA;
+    __dt_ElementaryMatrix *elem_list;
+    dtTransformerWorkspace work;   /* for Transform2TargetMeshModel */
 
-    void *numeric_obj;     /* umfpack factorization result */
+    int solver;                 /* __DT_SOLVER_CHOLMOD/UMFPACK/PCG */
+    cholmod_factor *L;          /* cholmod factorization result */
+    void *numeric_obj;          /* umfpack factorization result */
+    __dt_Preconditioner precond;    /* preconditioner of AtA for PCG */
 
     __dt_SurfaceInvVList sinvlist;   /* inverse surface matrix list for 
                                         source reference model */
@@ -32,17 +60,59 @@ typedef struct __dt_Transformer_struct
    deforming the target mesh like the source mesh deformation quicky and 
    faithfully. There's a lot of initialization process so this procedure might
    take significiant amount of time.
+
+   The coefficient matrix and the factorization only depend on the target
+   reference model and the triangle correspondence, if cache_dir is not NULL
+   they are loaded from the cache directory if they've been built before, or
+   saved to it after being built.
+
+   AtA is symmetric positive definite, solver should be __DT_SOLVER_CHOLMOD
+   unless there's something wrong with the Cholesky factorization, in which
+   case __DT_SOLVER_UMFPACK could be used as a fallback. __DT_SOLVER_PCG
+   keeps no factorization, only AtA and a preconditioner of the same size,
+   for targets too large to be factorized. It takes a few dozen iterations
+   per pose, much fewer when poses are close to each other, like the frames
+   of an animation, each of them starts from the solution to the last one.
 */
 void CreateDeformationTransformer(
     const char *source_ref_name, const char *target_ref_name,
     const char *tricorrs_name, dt_size_type n_maxcorrs,
-    dtTransformer *trans);
+    int solver, const char *cache_dir, dtTransformer *trans);
 
 /* Transform the target model like source_ref==>source_deformed, trans->target
    is modified to deformed model.  */
 void Transform2TargetMeshModel(
     const dtMeshModel *source_deformed, dtTransformer *trans);
 
+/* Transform the target model like source_ref==>source_deformed[k] for n_pose
+   deformed source models at once, the rhs of all poses are solved for with a
+   single multi-column solve. Deformed vertices of the k-th pose are written
+   to target_vertex[k], which has room for trans->target.n_vertex vertices,
+   trans->target is left untouched.
+
+   Memory of the rhs and the solution grows with n_pose, blocks of 16 to 64
+   poses get most of the speedup, n_pose of 0 does nothing. Poses should be
+   passed in animation order when solving with PCG, as they are warm started
+   from each other. The transformer is only read, several threads could
+   transform with it at the same time, each with a workspace of its own.
+*/
+void Transform2TargetMeshModel_Batch(
+    const dtMeshModel *source_deformed, dt_size_type n_pose,
+    const dtTransformer *trans, dtTransformerWorkspace *work,
+    dtVertex *const *target_vertex);
+
+/* Create/destroy a workspace for Transform2TargetMeshModel_Batch */
+void CreateTransformerWorkspace(
+    const dtTransformer *trans, dtTransformerWorkspace *work);
+void DestroyTransformerWorkspace(dtTransformerWorkspace *work);
+
+/* Make the last pose solved for with workspace from the initial guess of
+   the next transform with workspace to, both of them created for the same
+   transformer. With __DT_SOLVER_PCG this decides where a batch starts from
+   no matter which workspace solved for the poses before it. */
+void CopyTransformerWorkspaceGuess(
+    const dtTransformerWorkspace *from, dtTransformerWorkspace *to);
+
 /* Release the memory allocated for the transformer object */
 void DestroyDeformationTransformer(dtTransformer *trans);
 
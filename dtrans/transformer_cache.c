@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>   /* for getpid */
+
+#include "transformer_cache.h"
+#include "umfpack.h"
+
+
+
+/* Bump this whenever the layout of cache files or the way the matrices are
+   built changes, stale entries are then simply never looked up again. */
+#define __DTC_VERSION  4
+
+static const char __dtc_magic[4] = { 'D', 'T', 'C', '\x1a' };
+
+
+typedef struct __dtc_Header_struct
+{
+    char         magic[4];    /* "DTC\x1a" */
+    unsigned int version;     /* __DTC_VERSION */
+    __dt_Hash64  key;         /* cache key of this entry */
+
+} __dtc_Header;
+
+
+/* Calculate the cache key from the content of the input files */
+int __dt_TransformerCacheKey(
+    const char *target_ref_name, const char *tricorrs_name,
+    dt_size_type n_maxcorrs, int solver, __dt_Hash64 *key)
+{
+    int params[5];
+    __dt_Hash64 h;
+
+    /* everything else the matrices depend on */
+    params[0] = __DTC_VERSION;
+    params[1] = n_maxcorrs;
+    params[2] = (int)sizeof(dt_real_type);
+    params[3] = (int)sizeof(dt_index_type);
+    params[4] = solver;
+    h = __dt_Checksum64(params, sizeof(params), 0);
+
+    if (__dt_ChecksumFile(target_ref_name, h, &h) != 0 ||
+        __dt_ChecksumFile(tricorrs_name,   h, &h) != 0)
+    {
+        return -1;
+    }
+
+    *key = h;
+    return 0;
+}
+
+
+/* Name of a file of the cache entry, suffix tells which one. Temporary
+   files are told apart by the id of the process writing them. */
+static void __cache_filename(
+    char *filename, const char *cache_dir, __dt_Hash64 key,
+    const char *suffix, int temp)
+{
+    char tag[32] = "";
+    int len;
+
+    if (temp) snprintf(tag, sizeof(tag), ".%ld.tmp", (long)getpid());
+
+    len = snprintf(filename, FILENAME_MAX,
+                   "%s/%016llx.%s%s", cache_dir, key, suffix, tag);
+    if (len < 0 || len >= FILENAME_MAX) {
+        filename[0] = '\0';   /* too long, fopen() would fail on it */
+    }
+}
+
+
+/* Fill-reducing permutation of a CHOLMOD factor: n, perm[n], checksum */
+static int __write_permutation(FILE *fp, const cholmod_factor *L)
+{
+    int n = (int)L->n;
+    __dt_Hash64 checksum = __dt_Checksum64(L->Perm, n * sizeof(int), 0);
+
+    if (fwrite(&n, sizeof(n), 1, fp) != 1 ||
+        fwrite(L->Perm, sizeof(int), n, fp) != (size_t)n ||
+        fwrite(&checksum, sizeof(checksum), 1, fp) != 1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Read a permutation written by __write_permutation, it returns NULL if it's
+   truncated or corrupted. */
+static int* __read_permutation(FILE *fp)
+{
+    int n, *perm;
+    __dt_Hash64 checksum;
+
+    if (fread(&n, sizeof(n), 1, fp) != 1 || n <= 0) {
+        return NULL;
+    }
+
+    perm = (int*)__dt_malloc(n * sizeof(int));
+    if (fread(perm, sizeof(int), n, fp) != (size_t)n ||
+        fread(&checksum, sizeof(checksum), 1, fp) != 1 ||
+        checksum != __dt_Checksum64(perm, n * sizeof(int), 0))
+    {
+        free(perm);
+        return NULL;
+    }
+
+    return perm;
+}
+
+
+/* Load trans->AtA and the factorization from the cache entry of
+   specified key. It returns 0 on success, or -1 if there's no usable cache
+   entry. */
+int __dt_LoadTransformerCache(
+    const char *cache_dir, __dt_Hash64 key, dtTransformer *trans,
+    int **perm)
+{
+    char dtc_name[FILENAME_MAX], umf_name[FILENAME_MAX];
+    __dtc_Header header;
+    FILE *fp;
+    int ok;
+
+    __cache_filename(dtc_name, cache_dir, key, "dtc", 0);
+    __cache_filename(umf_name, cache_dir, key, "umf", 0);
+
+    if ((fp = fopen(dtc_name, "rb")) == NULL) {
+        return -1;   /* cache miss */
+    }
+
+    trans->AtA = NULL;
+    *perm = NULL;
+    if (fread(&header, sizeof(header), 1, fp) == 1 &&
+        memcmp(header.magic, __dtc_magic, sizeof(__dtc_magic)) == 0 &&
+        header.version == __DTC_VERSION && header.key == key)
+    {
+        trans->AtA = __dt_CHOLMOD_read_sparse_binary(fp);
+        if (trans->AtA != NULL && trans->solver == __DT_SOLVER_CHOLMOD) {
+            *perm = __read_permutation(fp);
+        }
+    }
+    fclose(fp);
+
+    /* the factorization is only useful with the matrices */
+    if (trans->solver == __DT_SOLVER_CHOLMOD) {
+        ok = (*perm != NULL);   /* only read along with AtA */
+    }
+    else if (trans->solver == __DT_SOLVER_PCG) {
+        ok = (trans->AtA != NULL);   /* there's no factorization at all */
+    }
+    else {
+        ok = (trans->AtA != NULL &&
+              umfpack_di_load_numeric(
+                  &(trans->numeric_obj), umf_name) == UMFPACK_OK);
+    }
+
+    if (!ok)
+    {
+        if (trans->AtA != NULL) __dt_CHOLMOD_free_sparse(&(trans->AtA));
+        free(*perm);  *perm = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Save trans->AtA and the factorization to the cache. It returns
+   0 on success, or -1 to indicate that the entry could not be written. */
+int __dt_SaveTransformerCache(
+    const char *cache_dir, __dt_Hash64 key, const dtTransformer *trans)
+{
+    char dtc_name[FILENAME_MAX], umf_name[FILENAME_MAX];
+    char dtc_temp[FILENAME_MAX], umf_temp[FILENAME_MAX];
+    __dtc_Header header;
+    FILE *fp;
+    int ok;
+
+    __cache_filename(dtc_name, cache_dir, key, "dtc", 0);
+    __cache_filename(umf_name, cache_dir, key, "umf", 0);
+    __cache_filename(dtc_temp, cache_dir, key, "dtc", 1);
+    __cache_filename(umf_temp, cache_dir, key, "umf", 1);
+
+    /* UMFPACK factorization goes first, an entry is only complete when its
+       .dtc file shows up */
+    if (trans->solver == __DT_SOLVER_UMFPACK &&
+        (umfpack_di_save_numeric(trans->numeric_obj, umf_temp) != UMFPACK_OK ||
+         rename(umf_temp, umf_name) != 0))
+    {
+        remove(umf_temp);
+        return -1;
+    }
+
+    if ((fp = fopen(dtc_temp, "wb")) == NULL) {
+        return -1;
+    }
+
+    memcpy(header.magic, __dtc_magic, sizeof(__dtc_magic));
+    header.version = __DTC_VERSION;
+    header.key     = key;
+
+    ok =
+        fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        __dt_CHOLMOD_write_sparse_binary(fp, trans->AtA) == 0;
+
+    if (ok && trans->solver == __DT_SOLVER_CHOLMOD) {
+        ok = (__write_permutation(fp, trans->L) == 0);
+    }
+
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok || rename(dtc_temp, dtc_name) != 0)
+    {
+        remove(dtc_temp);
+        return -1;
+    }
+
+    return 0;
+}
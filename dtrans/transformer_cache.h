@@ -0,0 +1,54 @@
+#ifndef __DT_TRANSFORMER_CACHE_HEADER__
+#define __DT_TRANSFORMER_CACHE_HEADER__
+
+
+#include "transformer.h"
+#include "checksum.h"
+
+
+/* The coefficient matrix AtA and its factorization only depend on the
+   target reference model and the triangle correspondence, which are the
+   same for every job of a batch. They are saved to a cache directory
+   after being built for the first time, so later runs could load them rather
+   than build and factorize them all over again.
+
+   Each cache entry is made up with files named after the cache key:
+
+       <cache_dir>/<key>.dtc   AtA in binary form, followed by the
+                               fill-reducing permutation of the CHOLMOD
+                               factor if it's the solver
+       <cache_dir>/<key>.umf   numeric factorization saved by UMFPACK
+
+   CHOLMOD has no way to save a factor, its entries keep the permutation so
+   the costly ordering is skipped, the numeric factorization is redone.
+   That's why dtrans solves with UMFPACK by default when it's given a cache.
+*/
+
+
+/* Calculate the cache key from the content of the target reference model
+   file and the triangle correspondence file, as well as the maximum number
+   of correspondences per target triangle and the solver. It returns 0 on
+   success, or -1 to indicate that a file could not be read. */
+int __dt_TransformerCacheKey(
+    const char *target_ref_name, const char *tricorrs_name,
+    dt_size_type n_maxcorrs, int solver, __dt_Hash64 *key);
+
+/* Load trans->AtA from the cache entry of specified key, along with
+   trans->numeric_obj for UMFPACK, or the permutation of the factor for
+   CHOLMOD, which is malloc'ed and stored to *perm (NULL otherwise). It
+   returns 0 on success, or -1 if there's no usable cache entry, in which
+   case nothing is loaded. */
+int __dt_LoadTransformerCache(
+    const char *cache_dir, __dt_Hash64 key, dtTransformer *trans,
+    int **perm);
+
+/* Save trans->AtA and the factorization to the cache. Files are
+   written under temporary names and renamed into place, so concurrent jobs
+   never see a partially written entry. It returns 0 on success, or -1 to
+   indicate that the entry could not be written. */
+int __dt_SaveTransformerCache(
+    const char *cache_dir, __dt_Hash64 key, const dtTransformer *trans);
+
+
+
+#endif /* __DT_TRANSFORMER_CACHE_HEADER__ */
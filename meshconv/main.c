@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>   /* for getopt */
+#include <time.h>     /* for clock_gettime */
+
+#include "mesh_model.h"
+#include "pose_sequence.h"
+#include "triangle_corr.h"
+
+
+/* Convert model files between .obj and .dtm format, the format of each file
+   is determined by the extension of its name.
+
+   With a reference model specified, a .dtm output is a pose file sharing
+   topology with the reference model: only vertex coordinates are written,
+   which is what dtrans needs for the deformed source models. Pose files are
+   read with the reference model as well, so they could be turned back into
+   self-contained models.
+
+   Poses of a reference model could also be packed into a .dts pose sequence,
+   or unpacked from it into separate model files.
+
+   Triangle correspondence files are converted between the text format and
+   the binary format, the source and target reference models are needed for
+   the header of a binary file.
+
+   The time it takes to read model files could be measured as well, which is
+   how the throughput of the .obj parser is tracked.
+*/
+
+
+static void __crash_on_save_error(const char *filename)
+{
+    fprintf(stderr, "file: %s - ", filename);
+    perror("Saving model file error");
+    exit(-1);
+}
+
+/* the pose must be made up with the same triangles as the reference model */
+static void __check_topology(
+    const char *filename, const dtMeshModel *model,
+    const dtMeshModel *reference)
+{
+    if (model->n_vertex   != reference->n_vertex   ||
+        model->n_triangle != reference->n_triangle ||
+        memcmp(model->triangle, reference->triangle,
+               (size_t)model->n_triangle * sizeof(dtTriangle)) != 0)
+    {
+        fprintf(stderr, "file: %s - topology differs from the reference "
+                "model\n", filename);
+        exit(-1);
+    }
+}
+
+
+/* Convert a single model file, or a pose of the reference model if it is not
+   NULL */
+static void __convert(
+    const char *input_name, const char *output_name,
+    const dtMeshModel *reference)
+{
+    dtMeshModel model;
+    const char *ext = strrchr(output_name, '.');
+    int ret;
+
+    if (reference == NULL)
+    {
+        __dt_ReadMeshFile_commit_or_crash(input_name, &model);
+        ret = SaveMeshFile(output_name, &model);
+    }
+    else
+    {
+        __dt_ReadPoseFile_commit_or_crash(input_name, reference, &model);
+        __check_topology(input_name, &model, reference);
+
+        ret = (ext != NULL && strcmp(ext, ".dtm") == 0)?
+            SaveDtmFile_SharedTopology(output_name, &model):
+            SaveMeshFile(output_name, &model);
+    }
+
+    if (ret != 0) __crash_on_save_error(output_name);
+    DestroyMeshModel(&model);
+}
+
+
+/* Pack poses of the reference model into a pose sequence */
+static void __pack_sequence(
+    const char *sequence_name, const dtMeshModel *reference,
+    char **pose_name, int n_pose, int use_float)
+{
+    dtPoseSequence seq;
+    dtMeshModel model;
+    int i_pose;
+
+    if (CreatePoseSequence(sequence_name, reference, use_float, &seq) != 0) {
+        __crash_on_save_error(sequence_name);
+    }
+
+    for (i_pose = 0; i_pose < n_pose; i_pose++)
+    {
+        __dt_ReadPoseFile_commit_or_crash(pose_name[i_pose], reference, &model);
+        __check_topology(pose_name[i_pose], &model, reference);
+
+        if (AppendPoseSequenceFrame(&seq, model.vertex) != 0) {
+            __crash_on_save_error(sequence_name);
+        }
+        DestroyMeshModel(&model);
+    }
+
+    if (ClosePoseSequence(&seq) != 0) {
+        __crash_on_save_error(sequence_name);
+    }
+}
+
+/* Unpack every frame of a pose sequence to <prefix><frame index>.obj */
+static void __unpack_sequence(const char *sequence_name, const char *prefix)
+{
+    dtPoseSequence seq;
+    dtMeshModel model;
+    char model_name[FILENAME_MAX];
+    int ret;
+
+    if ((ret = OpenPoseSequence(sequence_name, &seq)) != 0)
+    {
+        fprintf(stderr, "file: %s - ", sequence_name);
+        if (ret == -1) perror("Reading pose sequence error");
+        else fprintf(stderr, "Corrupted or incompatible .dts file\n");
+        exit(-1);
+    }
+
+    /* frames share normal vectors and triangles of the reference model */
+    model = seq.reference;
+    model.vertex = (dtVertex*)__dt_malloc(
+        (size_t)model.n_vertex * sizeof(dtVertex));
+
+    while ((ret = ReadPoseSequenceFrame(&seq, model.vertex)) == 0)
+    {
+        snprintf(model_name, sizeof(model_name),
+                 "%s%d.obj", prefix, seq.i_frame - 1);
+        if (SaveObjFile(model_name, &model) != 0) {
+            __crash_on_save_error(model_name);
+        }
+    }
+
+    if (ret == -1) {
+        fprintf(stderr, "file: %s - ", sequence_name);
+        perror("Reading pose sequence error");
+        exit(-1);
+    }
+
+    free(model.vertex);
+    ClosePoseSequence(&seq);
+}
+
+
+/* Convert a .tricorrs file to binary, or to text if to_text is set */
+static void __convert_tricorrs(
+    const char *input_name, const char *output_name,
+    const char *source_name, const char *target_name, int to_text)
+{
+    __dt_TriangleCorrsList tclist;
+    dtMeshModel source, target;
+    int ret;
+
+    __dt_ReadMeshFile_commit_or_crash(source_name, &source);
+    __dt_ReadMeshFile_commit_or_crash(target_name, &target);
+
+    if ((ret = __dt_LoadTriangleCorrsList(input_name, &tclist)) != 0)
+    {
+        fprintf(stderr, "file: %s - ", input_name);
+        if (ret == -1) perror("Reading triangle correspondence error");
+        else fprintf(stderr, "Corrupted or incompatible .tricorrs file\n");
+        exit(-1);
+    }
+
+    ret = to_text?
+        __dt_SaveTriangleCorrsList(output_name, &tclist):
+        __dt_SaveTriangleCorrsList_Binary(
+            output_name, &source, &target, &tclist);
+
+    if (ret != 0)
+    {
+        fprintf(stderr, "file: %s - ", output_name);
+        if (ret == -1) perror("Saving triangle correspondence error");
+        else fprintf(stderr, "Triangle index out of range\n");
+        exit(-1);
+    }
+
+    __dt_DestroyTriangleCorrsList(&tclist);
+    DestroyMeshModel(&source);
+    DestroyMeshModel(&target);
+}
+
+
+/* wall clock time in seconds */
+static double __seconds(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+}
+
+/* Read each model file n_repeat times and print the best throughput */
+static void __benchmark_read(char **model_name, int n_model, int n_repeat)
+{
+    dtMeshModel model;
+    FILE *fp;
+    double t0, seconds;
+    long size;
+    int i_model, i_repeat;
+
+    for (i_model = 0; i_model < n_model; i_model++)
+    {
+        /* size of the file, read once to warm the page cache */
+        if ((fp = fopen(model_name[i_model], "rb")) == NULL ||
+            fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0)
+        {
+            fprintf(stderr, "file: %s - ", model_name[i_model]);
+            perror("Reading model file error");
+            exit(-1);
+        }
+        fclose(fp);
+
+        __dt_ReadMeshFile_commit_or_crash(model_name[i_model], &model);
+        DestroyMeshModel(&model);
+
+        for (seconds = -1, i_repeat = 0; i_repeat < n_repeat; i_repeat++)
+        {
+            t0 = __seconds();
+            __dt_ReadMeshFile_commit_or_crash(model_name[i_model], &model);
+            t0 = __seconds() - t0;
+            DestroyMeshModel(&model);
+
+            if (seconds < 0 || t0 < seconds) seconds = t0;
+        }
+
+        printf("%s  %.1f MB  %.1f MB/s, best of %d\n", model_name[i_model],
+            1e-6 * size, 1e-6 * size / seconds, n_repeat);
+    }
+}
+
+
+static void __print_usage(const char *program)
+{
+    printf(
+        "usage: %s [-r reference_model] input_model output_model\n"
+        "       %s -p out.dts [-f] reference_model <one or more poses>\n"
+        "       %s -u in.dts prefix\n"
+        "       %s -c [-t] source_ref target_ref in.tricorrs out.tricorrs\n"
+        "       %s -b n_repeat <one or more models>\n"
+        "  .obj and .dtm formats are chosen by file name extension,\n"
+        "  with -r a .dtm output is a vertex only pose file.\n"
+        "  -p  pack poses into a pose sequence, -f encodes frames in float32\n"
+        "  -u  unpack frames of a pose sequence to <prefix>##.obj\n"
+        "  -c  convert triangle correspondences to the binary format, or to\n"
+        "      text with -t\n"
+        "  -b  time reading model files, best of n_repeat reads\n",
+        program, program, program, program, program);
+}
+
+int main(int argc, char *argv[])
+{
+    dtMeshModel reference;
+
+    const char
+        *reference_name = NULL,   /* -r option */
+        *pack_name      = NULL,   /* -p option */
+        *unpack_name    = NULL;   /* -u option */
+
+    int use_float = 0, tricorrs = 0, to_text = 0, n_repeat = 0, opt, n_arg;
+
+    while ((opt = getopt(argc, argv, "r:p:u:fctb:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': reference_name = optarg; break;
+            case 'p': pack_name      = optarg; break;
+            case 'u': unpack_name    = optarg; break;
+            case 'f': use_float      = 1;      break;
+            case 'c': tricorrs       = 1;      break;
+            case 't': to_text        = 1;      break;
+            case 'b': n_repeat = atoi(optarg); break;
+            default:
+                __print_usage(argv[0]);
+                return 0;
+        }
+    }
+
+    n_arg = argc - optind;
+
+    if (n_repeat > 0 && n_arg >= 1)
+    {
+        __benchmark_read(&argv[optind], n_arg, n_repeat);
+    }
+    else if (n_repeat != 0) {
+        __print_usage(argv[0]);
+    }
+    else if (tricorrs && n_arg == 4)
+    {
+        __convert_tricorrs(argv[optind + 2], argv[optind + 3],
+            argv[optind], argv[optind + 1], to_text);
+    }
+    else if (tricorrs) {
+        __print_usage(argv[0]);
+    }
+    else if (unpack_name != NULL && n_arg == 1)
+    {
+        __unpack_sequence(unpack_name, argv[optind]);
+    }
+    else if (pack_name != NULL && n_arg >= 1)
+    {
+        __dt_ReadMeshFile_commit_or_crash(argv[optind], &reference);
+        __pack_sequence(
+            pack_name, &reference, &argv[optind + 1], n_arg - 1, use_float);
+        DestroyMeshModel(&reference);
+    }
+    else if (unpack_name == NULL && pack_name == NULL && n_arg == 2)
+    {
+        if (reference_name != NULL)
+        {
+            __dt_ReadMeshFile_commit_or_crash(reference_name, &reference);
+            __convert(argv[optind], argv[optind + 1], &reference);
+            DestroyMeshModel(&reference);
+        }
+        else {
+            __convert(argv[optind], argv[optind + 1], NULL);
+        }
+    }
+    else {
+        __print_usage(argv[0]);
+    }
+
+    return 0;
+}
@@ -13,12 +13,15 @@ int main(int argc, char *argv[])
     if (argc == 2)
     {
         model_filename = argv[1];
-        if ((ret = ReadObjFile(model_filename, &model)) == 0) {
+        if ((ret = ReadMeshFile(model_filename, &model)) == 0) {
             return ModelViz_Main(&argc, argv);
         }
         else if (ret == -1) {
             perror("Reading model file error");
         }
+        else if (ret == -2) {
+            fprintf(stderr, "Corrupted or incompatible .dtm file\n");
+        }
         else {
             fprintf(stderr, "Syntax error on line: %u\n", ret);
         }
@@ -26,7 +29,7 @@ int main(int argc, char *argv[])
     }
     else {
         printf(".OBJ model viewer\n"
-               "Usage: %s <.obj model filename>\n", *argv);
+               "Usage: %s <.obj or .dtm model filename>\n", *argv);
     }
 
     return 0;
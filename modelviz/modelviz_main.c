@@ -99,7 +99,7 @@ static void __callback_OnKeyDown(unsigned char key, int sx, int sy)
     {
         case 'r':   /* reload model */
             DestroyMeshModel(&model);
-            __dt_ReadObjFile_commit_or_crash(model_filename, &model);
+            __dt_ReadMeshFile_commit_or_crash(model_filename, &model);
             glutPostRedisplay();
             break;
     }